@@ -54,6 +54,19 @@ typedef NS_ENUM(NSInteger, CDTAttachmentError) {
                  inTransaction:(FMDatabase *)db
                          error:(NSError *__autoreleasing *)error;
 
+/**
+ Returns the attachments for a batch of document revisions, given by their sequence numbers.
+ The attachments and their blob filenames are fetched with one query per few hundred
+ revisions rather than a query per revision and another per attachment.
+
+ @return NSDictionary mapping each sequence, as an NSNumber, to an NSArray of CDTAttachment.
+         Revisions without attachments have no entry. nil if there was an error reading the
+         database.
+ */
+- (NSDictionary *)attachmentsForSequences:(NSArray *)sequences
+                            inTransaction:(FMDatabase *)db
+                                    error:(NSError *__autoreleasing *)error;
+
 /*
  Streams attachment data into a blob in the blob store.
  Returns nil if there was a problem, otherwise a dictionary
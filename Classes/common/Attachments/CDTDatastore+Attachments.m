@@ -37,13 +37,26 @@
 #pragma mark SQL statements
 
 const NSString *SQL_ATTACHMENTS_SELECT =
-    @"SELECT sequence, filename, key, type, encoding, length, encoded_length revpos "
+    @"SELECT sequence, filename, key, type, encoding, length, encoded_length, revpos "
     @"FROM attachments WHERE filename = :filename AND sequence = :sequence";
 
 const NSString *SQL_ATTACHMENTS_SELECT_ALL =
-    @"SELECT sequence, filename, key, type, encoding, length, encoded_length revpos "
+    @"SELECT sequence, filename, key, type, encoding, length, encoded_length, revpos "
     @"FROM attachments WHERE sequence = :sequence";
 
+// Selects the same columns as SQL_ATTACHMENTS_SELECT_ALL, plus the blob's filename, for a list
+// of sequences given as placeholders
+const NSString *SQL_ATTACHMENTS_SELECT_ALL_IN_SEQUENCES =
+    @"SELECT attachments.sequence AS sequence, attachments.filename AS filename, "
+    @"attachments.key AS key, type, encoding, length, encoded_length, revpos, "
+    @"attachments_key_filename.filename AS blob_filename "
+    @"FROM attachments LEFT OUTER JOIN attachments_key_filename "
+    @"ON attachments_key_filename.key = lower(hex(attachments.key)) "
+    @"WHERE attachments.sequence IN (%@)";
+
+// Sequences per query, well within SQLite's limit on the number of parameters
+static const NSUInteger kCDTAttachmentsBatchSize = 500;
+
 const NSString *SQL_DELETE_ATTACHMENT_ROW =
     @"DELETE FROM attachments WHERE filename = :filename AND sequence = :sequence";
 
@@ -109,9 +122,76 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
     return attachments;
 }
 
+- (NSDictionary *)attachmentsForSequences:(NSArray *)sequences
+                            inTransaction:(FMDatabase *)db
+                                    error:(NSError *__autoreleasing *)error
+{
+    NSMutableDictionary *attachmentsBySequence = [NSMutableDictionary dictionary];
+
+    for (NSUInteger start = 0; start < sequences.count; start += kCDTAttachmentsBatchSize) {
+        NSRange range =
+            NSMakeRange(start, MIN(kCDTAttachmentsBatchSize, sequences.count - start));
+        NSArray *batch = [sequences subarrayWithRange:range];
+
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:batch.count];
+        for (NSUInteger i = 0; i < batch.count; i++) {
+            [placeholders addObject:@"?"];
+        }
+        NSString *sql = [NSString stringWithFormat:[SQL_ATTACHMENTS_SELECT_ALL_IN_SEQUENCES copy],
+                                                   [placeholders componentsJoinedByString:@","]];
+
+        FMResultSet *r = [db executeQuery:sql withArgumentsInArray:batch];
+        if (!r) {
+            if (error) {
+                *error = [db lastError];
+            }
+            return nil;
+        }
+
+        @try {
+            while ([r next]) {
+                NSString *filename = [r stringForColumn:@"blob_filename"];
+                CDTSavedAttachment *attachment =
+                    [self attachmentFromDbRow:r blob:[self.database blobWithFilename:filename]];
+
+                if (attachment != nil) {
+                    NSNumber *sequence = @([r longLongIntForColumn:@"sequence"]);
+                    NSMutableArray *attachments = attachmentsBySequence[sequence];
+                    if (!attachments) {
+                        attachments = [NSMutableArray array];
+                        attachmentsBySequence[sequence] = attachments;
+                    }
+                    [attachments addObject:attachment];
+                } else {
+                    CDTLogInfo(CDTDATASTORE_LOG_CONTEXT,
+                               @"Error reading an attachment row for sequence %lld. "
+                               @"Closed connection during read?",
+                               [r longLongIntForColumn:@"sequence"]);
+                }
+            }
+        }
+        @finally { [r close]; }
+    }
+
+    return attachmentsBySequence;
+}
+
 - (CDTSavedAttachment *)attachmentFromDbRow:(FMResultSet *)r inDatabase:(FMDatabase *)db
 {
-    // SELECT sequence, filename, key, type, encoding, length, encoded_length revpos ...
+    // Validate key data (required to get to the file) before looking up the file.
+    NSData *keyData = [r dataNoCopyForColumn:@"key"];
+    if (keyData.length != sizeof(TDBlobKey)) {
+        return [self attachmentFromDbRow:r blob:nil];
+    }
+
+    id<CDTBlobReader> blob = [self.database blobForKey:*(TDBlobKey *)keyData.bytes withDatabase:db];
+
+    return [self attachmentFromDbRow:r blob:blob];
+}
+
+- (CDTSavedAttachment *)attachmentFromDbRow:(FMResultSet *)r blob:(id<CDTBlobReader>)blob
+{
+    // SELECT sequence, filename, key, type, encoding, length, encoded_length, revpos ...
     SequenceNumber sequence = [r longForColumn:@"sequence"];
     NSString *name = [r stringForColumn:@"filename"];
 
@@ -125,8 +205,6 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
         return nil;
     }
 
-    id<CDTBlobReader> blob = [self.database blobForKey:*(TDBlobKey *)keyData.bytes withDatabase:db];
-
     NSString *type = [r stringForColumn:@"type"];
     NSInteger size = [r longForColumn:@"length"];
     NSInteger revpos = [r longForColumn:@"revpos"];
@@ -35,31 +35,29 @@
 
     NSMutableArray *results = [NSMutableArray array];
 
+    NSMutableArray *sequences = [NSMutableArray array];
     for (TD_Revision *tdRev in revs) {
-        [self.database loadRevisionBody:tdRev options:0 database:db];
-
-        CDTDocumentRevision *ob = [[CDTDocumentRevision alloc] initWithDocId:tdRev.docID
-                                                                  revisionId:tdRev.revID
-                                                                        body:tdRev.body.properties
-                                                                     deleted:tdRev.deleted
-                                                                 attachments:@{}
-                                                                    sequence:tdRev.sequence];
+        [sequences addObject:@(tdRev.sequence)];
+    }
+    NSDictionary *attachmentsBySequence =
+        [self attachmentsForSequences:sequences inTransaction:db error:nil];
 
-        //[[CDTDocumentRevision alloc] initWithTDRevision:tdRev];
+    for (TD_Revision *tdRev in revs) {
+        [self.database loadRevisionBody:tdRev options:0 database:db];
 
-        NSArray *attachmentArray = [self attachmentsForRev:ob inTransaction:db error:nil];
+        NSArray *attachmentArray = attachmentsBySequence[@(tdRev.sequence)];
         NSMutableDictionary *attachments = [NSMutableDictionary dictionary];
 
         for (CDTAttachment *attachment in attachmentArray) {
             [attachments setObject:attachment forKey:attachment.name];
         }
 
-        ob = [[CDTDocumentRevision alloc] initWithDocId:tdRev.docID
-                                             revisionId:tdRev.revID
-                                                   body:tdRev.body.properties
-                                                deleted:tdRev.deleted
-                                            attachments:attachments
-                                               sequence:tdRev.sequence];
+        CDTDocumentRevision *ob = [[CDTDocumentRevision alloc] initWithDocId:tdRev.docID
+                                                                  revisionId:tdRev.revID
+                                                                        body:tdRev.body.properties
+                                                                     deleted:tdRev.deleted
+                                                                 attachments:attachments
+                                                                    sequence:tdRev.sequence];
 
         [results addObject:ob];
     }
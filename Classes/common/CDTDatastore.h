@@ -135,6 +135,20 @@ extern NSString *const CDTDatastoreChangeNotification;
  */
 - (NSArray *)getAllDocuments;
 
+/**
+ * Enumerates the current winning revision of every document in the
+ * datastore, in document ID order.
+ *
+ * Documents are read from the database a page at a time, so memory use
+ * doesn't grow with the size of the datastore. Documents created or
+ * deleted during the enumeration may or may not be seen.
+ *
+ * @param block called with each document revision; set `*stop` to YES to
+ *              end the enumeration.
+ */
+- (void)enumerateAllDocumentsUsingBlock:(void (^)(CDTDocumentRevision *revision,
+                                                  BOOL *stop))block;
+
 /**
  * Enumerates the current winning revision for all documents in the
  * datastore and return a list of their document identifiers.
@@ -37,6 +37,9 @@
 
 NSString *const CDTDatastoreChangeNotification = @"CDTDatastoreChangeNotification";
 
+// Number of rows read from the database at a time when going through all documents
+static const unsigned kCDTAllDocumentsPageSize = 1000;
+
 @interface CDTDatastore ()
 
 @property (nonatomic, strong, readonly) id<CDTEncryptionKeyProvider> keyProvider;
@@ -223,69 +226,59 @@ NSString *const CDTDatastoreChangeNotification = @"CDTDatastoreChangeNotificatio
 
 - (NSArray *)getAllDocuments
 {
-    NSError *error;
     if (![self ensureDatabaseOpen]) {
         return nil;
     }
 
-    NSArray *result = [NSArray array];
+    NSMutableArray *result = [NSMutableArray array];
+    [self enumerateAllDocumentsUsingBlock:^(CDTDocumentRevision *revision, BOOL *stop) {
+        [result addObject:revision];
+    }];
+
+    return [NSArray arrayWithArray:result];
+}
+
+- (void)enumerateAllDocumentsUsingBlock:(void (^)(CDTDocumentRevision *revision,
+                                                  BOOL *stop))block
+{
+    if (![self ensureDatabaseOpen]) {
+        return;
+    }
+
     TDContentOptions contentOptions = kTDIncludeLocalSeq;
-    struct TDQueryOptions query = {.limit = UINT_MAX,
+    struct TDQueryOptions query = {.limit = kCDTAllDocumentsPageSize,
                                    .inclusiveEnd = YES,
-                                   .skip = 0,
+                                   .exclusiveStart = YES,
                                    .descending = NO,
                                    .includeDocs = YES,
                                    .content = contentOptions};
 
-    // This method must loop to get around the fact that conflicted documents
-    // contribute more than one row in the query -getDocsWithIDs:options: uses,
-    // so in the face of conflicted documents, the initial query above will
-    // only return the winning revisions of a subset of the documents.
-    BOOL done = NO;
-    do {
-        NSMutableArray *batch = [NSMutableArray array];
-
-        NSDictionary *dictResults = [self.database getDocsWithIDs:nil options:&query];
-
-        for (NSDictionary *row in dictResults[@"rows"]) {
-            NSString *docId = row[@"id"];
-            NSString *revId = row[@"value"][@"rev"];
-
-            TD_Revision *revision =
-                [[TD_Revision alloc] initWithDocID:docId revID:revId deleted:NO];
-            revision.body = [[TD_Body alloc] initWithProperties:row[@"doc"]];
-            revision.sequence = [row[@"doc"][@"_local_seq"] longLongValue];
-
-            CDTDocumentRevision *ob =
-                [[CDTDocumentRevision alloc] initWithDocId:revision.docID
-                                                revisionId:revision.revID
-                                                      body:revision.body.properties
-                                                   deleted:revision.deleted
-                                               attachments:@{}
-                                                  sequence:revision.sequence];
-
-            NSArray *attachments = [self attachmentsForRev:ob error:&error];
-            NSMutableDictionary *dict = [NSMutableDictionary dictionary];
-            for (CDTAttachment *attachment in attachments) {
-                [dict setObject:attachment forKey:attachment.name];
+    // Each page starts after the last document ID seen, rather than skipping rows, so that
+    // SQLite seeks straight to it. Conflicted documents contribute more than one row to the
+    // query -getDocsWithIDs:options: uses, so a page may hold fewer than `limit` documents,
+    // but the winning revision always comes first, so the remainder of a document cut off
+    // at the end of a page can safely be skipped.
+    NSString *lastDocId = nil;
+    BOOL stop = NO;
+    while (!stop) {
+        @autoreleasepool
+        {
+            query.startKey = lastDocId;
+            NSArray *batch = [self revisionsForDocsWithIds:nil options:&query];
+            if (batch.count == 0) {
+                break;
             }
-            [batch addObject:[[CDTDocumentRevision alloc] initWithDocId:revision.docID
-                                                             revisionId:revision.revID
-                                                                   body:revision.body.properties
-                                                                deleted:revision.deleted
-                                                            attachments:dict
-                                                               sequence:revision.sequence]];
-        }
-
-        result = [result arrayByAddingObjectsFromArray:batch];
-
-        done = ((NSArray *)dictResults[@"rows"]).count == 0;
-
-        query.skip = query.skip + query.limit;
 
-    } while (!done);
+            for (CDTDocumentRevision *revision in batch) {
+                block(revision, &stop);
+                if (stop) {
+                    break;
+                }
+            }
 
-    return result;
+            lastDocId = ((CDTDocumentRevision *)batch.lastObject).docId;
+        }
+    }
 }
 
 - (NSArray *)getAllDocumentIds
@@ -295,21 +288,26 @@ NSString *const CDTDatastoreChangeNotification = @"CDTDatastoreChangeNotificatio
     }
     
     NSMutableArray *result = [NSMutableArray array];
-    struct TDQueryOptions query = {.limit = UINT_MAX,
+    struct TDQueryOptions query = {.limit = kCDTAllDocumentsPageSize,
                                    .inclusiveEnd = YES,
-                                   .skip = 0,
+                                   .exclusiveStart = YES,
                                    .descending = NO,
                                    .includeDocs = NO};
     
-    NSDictionary *dictResults;
+    // Pages by document ID in the same way as -enumerateAllDocumentsUsingBlock:
+    NSString *lastDocId = nil;
+    NSArray *rows;
     do {
-        dictResults = [self.database getDocsWithIDs:nil options:&query];
-        for (NSDictionary *row in dictResults[@"rows"]) {
-            [result addObject:row[@"id"]];
+        @autoreleasepool
+        {
+            query.startKey = lastDocId;
+            rows = [self.database getDocsWithIDs:nil options:&query][@"rows"];
+            for (NSDictionary *row in rows) {
+                [result addObject:row[@"id"]];
+            }
+            lastDocId = result.lastObject;
         }
-        
-        query.skip = query.skip + query.limit;
-    } while (((NSArray *)dictResults[@"rows"]).count > 0);
+    } while (rows.count > 0);
     
     return [NSArray arrayWithArray:result];
     
@@ -338,16 +336,39 @@ NSString *const CDTDatastoreChangeNotification = @"CDTDatastoreChangeNotificatio
 /* docIds can be null for getting all documents */
 - (NSArray *)allDocsQuery:(NSArray *)docIds options:(TDQueryOptions *)queryOptions
 {
-    NSError *error;
     if (![self ensureDatabaseOpen]) {
         return nil;
     }
 
-    NSMutableArray *result = [NSMutableArray array];
+    return [self revisionsForDocsWithIds:docIds options:queryOptions];
+}
+
+/*
+ Runs an all docs query and returns a CDTDocumentRevision for each row. The documents and
+ their attachments are read in one transaction, with the attachments for the whole page
+ fetched together.
+ */
+- (NSArray *)revisionsForDocsWithIds:(NSArray *)docIds options:(TDQueryOptions *)queryOptions
+{
+    __block NSArray *rows;
+    __block NSDictionary *attachmentsBySequence;
+
+    [self.database.fmdbQueue inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        rows = [self.database getDocsWithIDs:docIds options:queryOptions database:db][@"rows"];
+
+        NSMutableArray *sequences = [NSMutableArray arrayWithCapacity:rows.count];
+        for (NSDictionary *row in rows) {
+            SequenceNumber sequence = [row[@"doc"][@"_local_seq"] longLongValue];
+            if (sequence > 0) {
+                [sequences addObject:@(sequence)];
+            }
+        }
+        attachmentsBySequence = [self attachmentsForSequences:sequences inTransaction:db error:nil];
+    }];
 
-    NSDictionary *dictResults = [self.database getDocsWithIDs:docIds options:queryOptions];
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:rows.count];
 
-    for (NSDictionary *row in dictResults[@"rows"]) {
+    for (NSDictionary *row in rows) {
         NSString *docId = row[@"id"];
         
         NSString *revId = row[@"value"][@"rev"];
@@ -365,14 +386,7 @@ NSString *const CDTDatastoreChangeNotification = @"CDTDatastoreChangeNotificatio
             revision.body = [[TD_Body alloc] initWithProperties:row[@"doc"]];
         }
 
-        CDTDocumentRevision *ob =
-            [[CDTDocumentRevision alloc] initWithDocId:revision.docID
-                                            revisionId:revision.revID
-                                                  body:revision.body.properties
-                                               deleted:revision.deleted
-                                           attachments:@{}
-                                              sequence:revision.sequence];
-        NSArray *attachments = [self attachmentsForRev:ob error:&error];
+        NSArray *attachments = attachmentsBySequence[@(revision.sequence)];
         NSMutableDictionary *dict = [NSMutableDictionary dictionary];
         for (CDTAttachment *attachment in attachments) {
             [dict setObject:attachment forKey:attachment.name];
@@ -128,6 +128,13 @@ typedef NS_ENUM(NSInteger, CDTReplicationErrors) {
 */
 @property (nonatomic, copy) NSDictionary* optionalHeaders;
 
+/**
+ Relative priority of this replication when it competes with other replications created by the
+ same CDTReplicatorFactory for connections and datastore writes. Higher values are served
+ first. Default is 0.
+ */
+@property (nonatomic) NSInteger priority;
+
 NS_ASSUME_NONNULL_BEGIN
 
 @property (nonnull, nonatomic, readonly, strong) NSArray* httpInterceptors;
@@ -36,6 +36,7 @@ NS_ASSUME_NONNULL_END
     CDTAbstractReplication *copy = [[[self class] allocWithZone:zone] init];
     if (copy) {
         copy.optionalHeaders = self.optionalHeaders;
+        copy.priority = self.priority;
         copy.httpInterceptors = [self.httpInterceptors copyWithZone:zone];
     }
 
@@ -211,6 +211,8 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
         }
     }
 
+    self.tdReplicator.priority = self.cdtReplication.priority;
+
     // create TD_FilterBlock that wraps the CDTFilterBlock and set the TDPusher.filter property.
     if ([self.cdtReplication isKindOfClass:[CDTPushReplication class]]) {
         CDTPushReplication *pushRep = (CDTPushReplication *)self.cdtReplication;
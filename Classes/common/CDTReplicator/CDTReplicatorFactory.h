@@ -61,6 +61,29 @@
  */
 - (id)initWithDatastoreManager:(CDTDatastoreManager *)dsManager;
 
+/**---------------------------------------------------------------------------------------
+ * @name Sharing resources between replications
+ *  --------------------------------------------------------------------------------------
+ */
+
+/**
+ All the replicators created by a factory run on a small shared set of threads, and share the
+ budgets below. When a budget is used up, replications with a higher
+ CDTAbstractReplication.priority are served first; replications of the same priority take
+ turns.
+ */
+
+/** Maximum number of HTTP connections used at once to fetch or upload documents. Default is
+ 16. */
+@property (nonatomic) NSUInteger maxConcurrentConnections;
+
+/** Maximum number of replications writing to their local datastores at once. Default is 2. */
+@property (nonatomic) NSUInteger maxConcurrentDatastoreWriters;
+
+/** Approximate limit on the number of bytes per second received by all the replications.
+ Default is 0, meaning no limit. */
+@property (nonatomic) NSUInteger maxBytesPerSecond;
+
 
 /**---------------------------------------------------------------------------------------
  * @name Creating replication jobs
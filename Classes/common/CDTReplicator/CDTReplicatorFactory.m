@@ -25,6 +25,7 @@
 #import "CDTLogging.h"
 
 #import "TDReplicatorManager.h"
+#import "TDReplicationScheduler.h"
 
 static NSString *const CDTReplicatorFactoryErrorDomain = @"CDTReplicatorFactoryErrorDomain";
 
@@ -59,6 +60,35 @@ static NSString *const CDTReplicatorFactoryErrorDomain = @"CDTReplicatorFactoryE
 }
 
 
+#pragma mark Shared resource budgets
+
+- (NSUInteger)maxConcurrentConnections
+{
+    return self.replicatorManager.scheduler.maxConnections;
+}
+
+- (void)setMaxConcurrentConnections:(NSUInteger)maxConcurrentConnections
+{
+    self.replicatorManager.scheduler.maxConnections = maxConcurrentConnections;
+}
+
+- (NSUInteger)maxConcurrentDatastoreWriters
+{
+    return self.replicatorManager.scheduler.maxDatabaseWriters;
+}
+
+- (void)setMaxConcurrentDatastoreWriters:(NSUInteger)maxConcurrentDatastoreWriters
+{
+    self.replicatorManager.scheduler.maxDatabaseWriters = maxConcurrentDatastoreWriters;
+}
+
+- (NSUInteger)maxBytesPerSecond { return self.replicatorManager.scheduler.maxBytesPerSecond; }
+
+- (void)setMaxBytesPerSecond:(NSUInteger)maxBytesPerSecond
+{
+    self.replicatorManager.scheduler.maxBytesPerSecond = maxBytesPerSecond;
+}
+
 #pragma mark CDTReplicatorFactory interface methods
 
 - (CDTReplicator *)onewaySourceDatastore:(CDTDatastore *)source targetURI:(NSURL *)target
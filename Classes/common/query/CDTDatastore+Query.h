@@ -33,6 +33,27 @@
  */
 @property (nonatomic, readonly, getter = isTextSearchEnabled) BOOL textSearchEnabled;
 
+/**
+ Whether queries projecting fields which are all in one index build their results from the
+ index without loading documents. See -[CDTQIndexManager indexOnlyProjection] for the
+ caveats. Default is NO.
+ */
+@property (nonatomic) BOOL indexOnlyProjection;
+
+/**
+ Whether indexes are kept up to date in the background as the datastore changes, so that
+ queries allowing stale results needn't wait for them. See
+ -[CDTQIndexManager backgroundIndexingEnabled]. Default is NO.
+ */
+@property (nonatomic, getter=isBackgroundIndexingEnabled) BOOL backgroundIndexingEnabled;
+
+/**
+ Maximum number of document IDs held by the query result cache, which answers repeated
+ queries without running them again until the datastore or its indexes change. See
+ -[CDTQIndexManager queryCacheLimit]. Default is 0, disabling the cache.
+ */
+@property (nonatomic) NSUInteger queryCacheLimit;
+
 /**
  Return a list of the indexes defined.
  
@@ -79,7 +100,8 @@
  Create a new index based on an index type with specific index 
  settings over a set of fields.
  
- Index settings currenly only apply to a TEXT index.
+ Index settings apply to a TEXT index, and a JSON index may have
+ a partial filter selector.
  
  An example:
  
@@ -93,6 +115,19 @@
  This will create a TEXT index named text_idx and override the
  default tokenizer used to construct the TEXT index with the
  "porter" algorithm tokenizer.
+
+ A JSON index accepts a "partial_filter_selector" setting. Only
+ documents matching the selector are indexed, and the index is
+ only used by queries whose selector includes the filter's
+ clauses:
+
+ [ds ensureIndexed: @[ @"name" ]
+          withName: @"people_by_name"
+              type: @"json"
+          settings: @{ @"partial_filter_selector": @{ @"type": @"person" } }]
+
+ A query such as { "type": "person", "name": "mike" } can use
+ this index, whereas { "name": "mike" } cannot.
  */
 - (NSString *)ensureIndexed:(NSArray * /* NSString */)fieldNames
                    withName:(NSString *)indexName
@@ -143,4 +178,22 @@
                  fields:(NSArray *)fields
                    sort:(NSArray *)sortDocument;
 
+/**
+ Find documents matching a query, optionally without waiting for
+ indexes to be brought up to date.
+ 
+ With `allowStale` YES, the query uses the indexes as they are,
+ so recent changes may be missing from the results. This is
+ intended for use with backgroundIndexingEnabled, which keeps
+ the indexes close to up to date without blocking queries.
+ 
+ @return Set of documents, or `nil` if there was an error.
+ */
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+             allowStale:(BOOL)allowStale;
+
 @end
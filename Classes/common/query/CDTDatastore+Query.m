@@ -24,7 +24,7 @@
         @synchronized(self)
         {
             if (objc_getAssociatedObject(self, @selector(CDTQManager)) == nil) {
-                CDTQIndexManager *m = [CDTQIndexManager managerUsingDatastore:self error:nil];
+                CDTQIndexManager *m = [CDTQIndexManager lazyManagerUsingDatastore:self];
                 objc_setAssociatedObject(self, @selector(CDTQManager), m,
                                          OBJC_ASSOCIATION_RETAIN_NONATOMIC);
             }
@@ -39,6 +39,36 @@
     return [self.CDTQManager isTextSearchEnabled];
 }
 
+- (BOOL)indexOnlyProjection
+{
+    return self.CDTQManager.indexOnlyProjection;
+}
+
+- (void)setIndexOnlyProjection:(BOOL)indexOnlyProjection
+{
+    self.CDTQManager.indexOnlyProjection = indexOnlyProjection;
+}
+
+- (BOOL)isBackgroundIndexingEnabled
+{
+    return self.CDTQManager.backgroundIndexingEnabled;
+}
+
+- (void)setBackgroundIndexingEnabled:(BOOL)backgroundIndexingEnabled
+{
+    self.CDTQManager.backgroundIndexingEnabled = backgroundIndexingEnabled;
+}
+
+- (NSUInteger)queryCacheLimit
+{
+    return self.CDTQManager.queryCacheLimit;
+}
+
+- (void)setQueryCacheLimit:(NSUInteger)queryCacheLimit
+{
+    self.CDTQManager.queryCacheLimit = queryCacheLimit;
+}
+
 - (NSDictionary *)listIndexes
 {
     return [self.CDTQManager listIndexes];
@@ -81,6 +111,21 @@
     return [self.CDTQManager find:query skip:skip limit:limit fields:fields sort:sortDocument];
 }
 
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+             allowStale:(BOOL)allowStale
+{
+    return [self.CDTQManager find:query
+                             skip:skip
+                            limit:limit
+                           fields:fields
+                             sort:sortDocument
+                       allowStale:allowStale];
+}
+
 - (BOOL)deleteIndexNamed:(NSString *)indexName
 {
     return [self.CDTQManager deleteIndexNamed:indexName];
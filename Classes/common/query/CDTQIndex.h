@@ -17,6 +17,29 @@
 extern NSString *const kCDTQJsonType;
 extern NSString *const kCDTQTextType;
 
+/**
+ * Index setting for json indexes holding a selector. Only documents matching the selector
+ * are indexed, and the index is only used for queries whose selector implies it.
+ */
+extern NSString *const kCDTQPartialFilterSelector;
+
+/**
+ * Index setting for text indexes choosing the SQLite full text search module, kCDTQTextFTS4
+ * (the default) or kCDTQTextFTS5. FTS5 indexes can rank results with bm25(): sort a query
+ * with a text clause by `@{ @"$text" : @"desc" }` to get the best matches first. FTS5 has
+ * its own query syntax, and lacks the "simple" tokenizer; "ascii" is its equivalent.
+ */
+extern NSString *const kCDTQTextFTS;
+extern NSString *const kCDTQTextFTS4;
+extern NSString *const kCDTQTextFTS5;
+
+/**
+ * Index setting for text indexes holding an array of prefix lengths, such as `@[ @2, @3 ]`,
+ * for which SQLite keeps extra index entries so that prefix queries like `liv*` needn't
+ * scan every term with the prefix.
+ */
+extern NSString *const kCDTQTextPrefix;
+
 /**
  * This class provides functionality to manage an index
  */
@@ -48,7 +71,8 @@ extern NSString *const kCDTQTextType;
  * @param fieldNames the field names in the index
  * @param indexType the index type (json or text)
  * @param indexSettings the optional settings used to configure the index.
- *                      Only supported parameter is 'tokenize' for text indexes only.
+ *                      Supported parameters are 'tokenize', 'fts' and 'prefix' for text
+ *                      indexes and 'partial_filter_selector' for json indexes.
  * @return the Index object or nil if arguments passed in were invalid.
  */
 + (instancetype)index:(NSString *)indexName
@@ -72,4 +96,21 @@ extern NSString *const kCDTQTextType;
  */
 - (NSString *)settingsAsJSON;
 
+/**
+ * Returns the normalised partial filter selector from an index's settings as stored in the
+ * index metadata, or nil if the index isn't partial.
+ *
+ * @param indexSettings the index settings as a JSON string
+ * @return the normalised selector, or nil
+ */
++ (NSDictionary *)partialFilterSelectorFromSettings:(NSString *)indexSettings;
+
+/**
+ * Returns whether an index's settings, as stored in the index metadata, choose FTS5.
+ *
+ * @param indexSettings the index settings as a JSON string
+ * @return YES for an FTS5 text index
+ */
++ (BOOL)isFTS5TextIndexWithSettings:(NSString *)indexSettings;
+
 @end
@@ -15,9 +15,17 @@
 #import "CDTQIndex.h"
 
 #import "CDTQLogging.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQueryValidator.h"
 
 NSString *const kCDTQJsonType = @"json";
 NSString *const kCDTQTextType = @"text";
+NSString *const kCDTQPartialFilterSelector = @"partial_filter_selector";
+
+NSString *const kCDTQTextFTS = @"fts";
+NSString *const kCDTQTextFTS4 = @"fts4";
+NSString *const kCDTQTextFTS5 = @"fts5";
+NSString *const kCDTQTextPrefix = @"prefix";
 
 static NSString *const kCDTQTextTokenize = @"tokenize";
 static NSString *const kCDTQTextDefaultTokenizer = @"simple";
@@ -45,7 +53,7 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
     static NSArray *validSettingsArray = nil;
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
-        validSettingsArray = @[ kCDTQTextTokenize ];
+        validSettingsArray = @[ kCDTQTextTokenize, kCDTQTextFTS, kCDTQTextPrefix ];
     });
     return validSettingsArray;
 }
@@ -103,8 +111,20 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
     }
     
     if ([indexType.lowercaseString isEqualToString:kCDTQJsonType] && indexSettings) {
-        LogWarn(@"Index type is %@, index settings %@ ignored.", indexType, indexSettings);
-        indexSettings = nil;
+        // json indexes only support a partial filter selector; other settings are ignored.
+        NSDictionary *filter = indexSettings[kCDTQPartialFilterSelector];
+        if (indexSettings.count > (filter ? 1 : 0)) {
+            LogWarn(@"Index type is %@, index settings %@ ignored.", indexType, indexSettings);
+        }
+        if (filter) {
+            if (![CDTQIndex validPartialFilterSelector:filter]) {
+                LogError(@"Invalid partial filter selector %@.", filter);
+                return nil;
+            }
+            indexSettings = @{ kCDTQPartialFilterSelector : filter };
+        } else {
+            indexSettings = nil;
+        }
     } else if ([indexType.lowercaseString isEqualToString:kCDTQTextType]) {
         if (!indexSettings) {
             indexSettings = @{ kCDTQTextTokenize: kCDTQTextDefaultTokenizer };
@@ -117,6 +137,9 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
                     return nil;
                 }
             }
+            if (![CDTQIndex validTextSettings:indexSettings]) {
+                return nil;
+            }
         }
     }
     
@@ -126,6 +149,98 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
                                   indexSettings:indexSettings];
 }
 
++ (BOOL)validTextSettings:(NSDictionary *)indexSettings
+{
+    NSObject *fts = indexSettings[kCDTQTextFTS];
+    if (fts && ![@[ kCDTQTextFTS4, kCDTQTextFTS5 ] containsObject:fts]) {
+        LogError(@"Invalid %@ setting %@, use %@ or %@.", kCDTQTextFTS, fts, kCDTQTextFTS4,
+                 kCDTQTextFTS5);
+        return NO;
+    }
+
+    NSObject *prefix = indexSettings[kCDTQTextPrefix];
+    if (prefix && ![CDTQIndex validPrefixLengths:prefix]) {
+        LogError(@"Invalid %@ setting %@, use an array of prefix lengths such as [2, 3].",
+                 kCDTQTextPrefix, prefix);
+        return NO;
+    }
+
+    return YES;
+}
+
++ (BOOL)validPrefixLengths:(NSObject *)prefix
+{
+    if (![prefix isKindOfClass:[NSArray class]] || ((NSArray *)prefix).count == 0) {
+        return NO;
+    }
+
+    for (NSNumber *length in (NSArray *)prefix) {
+        if (![length isKindOfClass:[NSNumber class]] || length.integerValue <= 0 ||
+            length.doubleValue != length.integerValue) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
++ (BOOL)validPartialFilterSelector:(NSObject *)filter
+{
+    if (![filter isKindOfClass:[NSDictionary class]] || ((NSDictionary *)filter).count == 0) {
+        return NO;
+    }
+
+    // Text searches can't be evaluated against a single document while indexing
+    NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:(NSDictionary *)filter];
+    return selector && ![CDTQIndex selectorContainsTextSearch:selector];
+}
+
++ (BOOL)selectorContainsTextSearch:(NSDictionary *)selector
+{
+    NSArray *clauses = selector[AND] ?: selector[OR];
+    for (NSDictionary *clause in clauses) {
+        if (clause[TEXT] ||
+            ((clause[AND] || clause[OR]) && [CDTQIndex selectorContainsTextSearch:clause])) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
++ (NSDictionary *)partialFilterSelectorFromSettings:(NSString *)indexSettings
+{
+    if (indexSettings.length == 0) {
+        return nil;
+    }
+
+    NSData *settingsData = [indexSettings dataUsingEncoding:NSUTF8StringEncoding];
+    NSDictionary *settingsDict =
+        [NSJSONSerialization JSONObjectWithData:settingsData options:kNilOptions error:nil];
+    if (![settingsDict isKindOfClass:[NSDictionary class]]) {
+        LogError(@"Error processing index settings %@", indexSettings);
+        return nil;
+    }
+
+    NSDictionary *filter = settingsDict[kCDTQPartialFilterSelector];
+    return filter ? [CDTQQueryValidator normaliseAndValidateQuery:filter] : nil;
+}
+
++ (BOOL)isFTS5TextIndexWithSettings:(NSString *)indexSettings
+{
+    if (indexSettings.length == 0) {
+        return NO;
+    }
+
+    NSData *settingsData = [indexSettings dataUsingEncoding:NSUTF8StringEncoding];
+    NSDictionary *settingsDict =
+        [NSJSONSerialization JSONObjectWithData:settingsData options:kNilOptions error:nil];
+    if (![settingsDict isKindOfClass:[NSDictionary class]]) {
+        LogError(@"Error processing index settings %@", indexSettings);
+        return NO;
+    }
+
+    return [settingsDict[kCDTQTextFTS] isEqual:kCDTQTextFTS5];
+}
+
 -(BOOL) compareIndexTypeTo:(NSString *)indexType withIndexSettings:(NSString *)indexSettings
 {
     if (![self.indexType.lowercaseString isEqualToString:indexType.lowercaseString]) {
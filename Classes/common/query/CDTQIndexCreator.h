@@ -45,9 +45,13 @@
 + (CDTQSqlParts *)createIndexTableStatementForIndexName:(NSString *)indexName
                                              fieldNames:(NSArray /*NSString*/ *)fieldNames;
 
++ (NSArray /*NSString*/ *)indexColumnsForFieldNames:(NSArray /*NSString*/ *)fieldNames;
+
 + (CDTQSqlParts *)createIndexIndexStatementForIndexName:(NSString *)indexName
                                              fieldNames:(NSArray /*NSString*/ *)fieldNames;
 
++ (CDTQSqlParts *)createIdIndexStatementForIndexName:(NSString *)indexName;
+
 + (CDTQSqlParts *)createVirtualTableStatementForIndexName:(NSString *)indexName
                                                fieldNames:(NSArray /*NSString*/ *)fieldNames
                                                  settings:(NSDictionary *)indexSettings;
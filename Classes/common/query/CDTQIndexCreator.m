@@ -73,6 +73,12 @@
                      @"search, enable FTS compile options in SQLite.");
             return nil;
         }
+        if ([index.indexSettings[kCDTQTextFTS] isEqual:kCDTQTextFTS5] &&
+            ![CDTQIndexManager fts5AvailableInDatabase:self.database]) {
+            LogError(@"FTS5 text indexes not supported.  To add support for them, "
+                     @"enable the FTS5 compile option in SQLite.");
+            return nil;
+        }
     }
 
     NSArray *fieldNames = [CDTQIndexCreator removeDirectionsFromFields:index.fieldNames];
@@ -103,92 +109,242 @@
         fieldNames = [NSArray arrayWithArray:tmp];
     }
 
-    // Check the index limit.  Limit is 1 for "text" indexes and unlimited for "json" indexes.
-    // Then check whether the index already exists; return success if it does and is same,
-    // else fail.
+    // Index managers for the same datastore each have their own queue, so creation is
+    // serialised across the process. Wait for any build of this index to be published, so an
+    // index table without metadata is always left over from a build which didn't finish.
+    NSString *buildKey = [CDTQIndexCreator buildKeyForIndexName:index.indexName
+                                                     inDatabase:_database];
+    NSCondition *lock = [CDTQIndexCreator creationLock];
+    [lock lock];
+    while ([[CDTQIndexCreator indexesBeingBuilt] containsObject:buildKey]) {
+        [lock wait];
+    }
+
+    // Check the index limit.  Limit is 1 for "text" indexes and unlimited for "json"
+    // indexes. Then check whether the index already exists; return success if it does
+    // and is same, else fail.
+    BOOL ready = YES;
     NSDictionary *existingIndexes = [CDTQIndexManager listIndexesInDatabaseQueue:self.database];
     if ([CDTQIndexCreator indexLimitReached:index basedOnIndexes:existingIndexes]) {
         LogError(@"Index limit reached.  Cannot create index %@.", index.indexName);
-        return nil;
-    }
-    if (existingIndexes[index.indexName] != nil) {
+        ready = NO;
+    } else if (existingIndexes[index.indexName] != nil) {
         NSDictionary *existingIndex = existingIndexes[index.indexName];
         NSString *existingType = existingIndex[@"type"];
         NSString *existingSettings = existingIndex[@"settings"];
         NSSet *existingFields = [NSSet setWithArray:existingIndex[@"fields"]];
         NSSet *newFields = [NSSet setWithArray:fieldNames];
 
-        if ([existingFields isEqualToSet:newFields] &&
-            [index compareIndexTypeTo:existingType withIndexSettings:existingSettings]) {
-            BOOL success = [CDTQIndexUpdater updateIndex:index.indexName
-                                              withFields:fieldNames
-                                              inDatabase:_database
-                                           fromDatastore:_datastore
-                                                   error:nil];
-            return success ? index.indexName : nil;
-        } else {
-            return nil;
-        }
+        ready = [existingFields isEqualToSet:newFields] &&
+                [index compareIndexTypeTo:existingType withIndexSettings:existingSettings];
+    } else if ([index.indexType.lowercaseString isEqualToString:kCDTQTextType]) {
+        ready = [self createTextIndex:index withFields:fieldNames];
+    } else {
+        ready = [self createJsonIndex:index withFields:fieldNames holdingLock:lock];
     }
+    [lock unlock];
+
+    if (!ready) {
+        return nil;
+    }
+
+    // Bring the index up to date, catching up with any changes made while a new index was
+    // built
+    BOOL success = [CDTQIndexUpdater updateIndex:index.indexName
+                                      withFields:fieldNames
+                                      inDatabase:_database
+                                   fromDatastore:_datastore
+                                           error:nil];
+
+    return success ? index.indexName : nil;
+}
 
+/**
+ Creates the SQLite virtual table for a text index along with its metadata, leaving it empty.
+ */
+- (BOOL)createTextIndex:(CDTQIndex *)index withFields:(NSArray /*NSString*/ *)fieldNames
+{
     __block BOOL success = YES;
 
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        success = [CDTQIndexCreator dropLeftoverTableForIndexName:index.indexName inDatabase:db];
 
-        // Insert metadata table entries
-        NSArray *inserts = [CDTQIndexCreator
-                            insertMetadataStatementsForIndexName:index.indexName
-                                                            type:index.indexType
-                                                        settings:index.settingsAsJSON
-                                                      fieldNames:fieldNames];
-        for (CDTQSqlParts *sql in inserts) {
-            success = success && [db executeUpdate:sql.sqlWithPlaceholders
-                                     withArgumentsInArray:sql.placeholderValues];
-        }
-
-        // Create SQLite data structures to support the index
-        // For JSON index type create a SQLite table and a SQLite index
-        // For TEXT index type create a SQLite virtual table
-        if ([index.indexType.lowercaseString isEqualToString:kCDTQTextType]) {
-            // Create the virtual table for the TEXT index
-            CDTQSqlParts *createVirtualTable =
+        CDTQSqlParts *createVirtualTable =
             [CDTQIndexCreator createVirtualTableStatementForIndexName:index.indexName
                                                            fieldNames:fieldNames
                                                              settings:index.indexSettings];
-            success = success && [db executeUpdate:createVirtualTable.sqlWithPlaceholders
-                              withArgumentsInArray:createVirtualTable.placeholderValues];
-        } else {
-            // Create the table for the index
-            CDTQSqlParts *createTable =
+        success = success && [db executeUpdate:createVirtualTable.sqlWithPlaceholders
+                          withArgumentsInArray:createVirtualTable.placeholderValues];
+
+        success = success && [CDTQIndexCreator insertMetadataForIndex:index
+                                                           fieldNames:fieldNames
+                                                         lastSequence:0
+                                                           inDatabase:db];
+
+        if (!success) {
+            *rollback = YES;
+        }
+    }];
+
+    return success;
+}
+
+/**
+ Creates and builds the table for a json index, then its SQLite indexes and its metadata.
+
+ The index is only added to the metadata once it's built, so updates of all indexes don't
+ find it half built, and a build which fails or doesn't finish leaves no index behind to be
+ taken for a complete one. The creation lock is released while the table is built, with the
+ index marked as being built so that no other creator drops its table.
+ */
+- (BOOL)createJsonIndex:(CDTQIndex *)index
+             withFields:(NSArray /*NSString*/ *)fieldNames
+            holdingLock:(NSCondition *)lock
+{
+    __block BOOL success = YES;
+
+    [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        success = [CDTQIndexCreator dropLeftoverTableForIndexName:index.indexName inDatabase:db];
+
+        CDTQSqlParts *createTable =
             [CDTQIndexCreator createIndexTableStatementForIndexName:index.indexName
                                                          fieldNames:fieldNames];
-            success = success && [db executeUpdate:createTable.sqlWithPlaceholders
-                              withArgumentsInArray:createTable.placeholderValues];
-            
-            // Create the SQLite index on the index table
-            
-            CDTQSqlParts *createIndex =
+        success = success && [db executeUpdate:createTable.sqlWithPlaceholders
+                          withArgumentsInArray:createTable.placeholderValues];
+
+        if (!success) {
+            *rollback = YES;
+        }
+    }];
+
+    if (!success) {
+        return NO;
+    }
+
+    NSString *buildKey = [CDTQIndexCreator buildKeyForIndexName:index.indexName
+                                                     inDatabase:_database];
+    [[CDTQIndexCreator indexesBeingBuilt] addObject:buildKey];
+    [lock unlock];
+
+    // Load the existing documents in parallel, then create the SQLite indexes on the index
+    // table, which is much quicker than maintaining them row by row: one led by the indexed
+    // fields for queries and sorting, one on _id for index maintenance. If the build fails
+    // the index is recorded as up to date with nothing, so the update indexes everything.
+    NSError *buildError = nil;
+    SequenceNumber lastSequence = 0;
+    if (![CDTQIndexUpdater buildIndex:index.indexName
+                           withFields:fieldNames
+                           inDatabase:_database
+                        fromDatastore:_datastore
+                         upToSequence:&lastSequence
+                                error:&buildError]) {
+        LogWarn(@"Building index %@ in parallel failed, indexing serially: %@",
+                index.indexName, buildError);
+        lastSequence = 0;
+    }
+
+    [lock lock];
+    [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        CDTQSqlParts *createIndex =
             [CDTQIndexCreator createIndexIndexStatementForIndexName:index.indexName
                                                          fieldNames:fieldNames];
-            success = success && [db executeUpdate:createIndex.sqlWithPlaceholders
-                              withArgumentsInArray:createIndex.placeholderValues];
-        }
-        
+        success = success && [db executeUpdate:createIndex.sqlWithPlaceholders
+                          withArgumentsInArray:createIndex.placeholderValues];
+
+        CDTQSqlParts *createIdIndex =
+            [CDTQIndexCreator createIdIndexStatementForIndexName:index.indexName];
+        success = success && [db executeUpdate:createIdIndex.sqlWithPlaceholders
+                          withArgumentsInArray:createIdIndex.placeholderValues];
+
+        success = success && [CDTQIndexCreator insertMetadataForIndex:index
+                                                           fieldNames:fieldNames
+                                                         lastSequence:lastSequence
+                                                           inDatabase:db];
+
         if (!success) {
             *rollback = YES;
         }
     }];
+    [[CDTQIndexCreator indexesBeingBuilt] removeObject:buildKey];
+    [lock broadcast];
+
+    return success;
+}
+
+/**
+ The lock held while index tables are created or published, shared by every index manager
+ in the process.
+ */
++ (NSCondition *)creationLock
+{
+    static NSCondition *lock;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        lock = [[NSCondition alloc] init];
+    });
+    return lock;
+}
+
+/**
+ Keys of the indexes whose tables are being built, see +buildKeyForIndexName:inDatabase:.
+ Only use it while holding the creation lock.
+ */
++ (NSMutableSet /*NSString*/ *)indexesBeingBuilt
+{
+    static NSMutableSet *indexesBeingBuilt;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        indexesBeingBuilt = [NSMutableSet set];
+    });
+    return indexesBeingBuilt;
+}
 
-    // Update the new index if it's been created
-    if (success) {
-        success = success && [CDTQIndexUpdater updateIndex:index.indexName
-                                                withFields:fieldNames
-                                                inDatabase:_database
-                                             fromDatastore:_datastore
-                                                     error:nil];
+/**
+ Identifies an index across all the queues open on its database, by the database's path.
+ */
++ (NSString *)buildKeyForIndexName:(NSString *)indexName inDatabase:(FMDatabaseQueue *)database
+{
+    NSString *path = database.path.stringByStandardizingPath;
+    if (path.length == 0) {
+        // An in-memory database is only reachable through its queue
+        path = [NSString stringWithFormat:@"%p", database];
     }
+    return [NSString stringWithFormat:@"%@\n%@", path, indexName];
+}
 
-    return success ? index.indexName : nil;
+/**
+ Drops the table of an index which has no metadata and isn't being built, left by a build
+ which didn't finish.
+ */
++ (BOOL)dropLeftoverTableForIndexName:(NSString *)indexName inDatabase:(FMDatabase *)db
+{
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    return [db executeUpdate:[NSString stringWithFormat:@"DROP TABLE IF EXISTS \"%@\";",
+                                                        tableName]];
+}
+
++ (BOOL)insertMetadataForIndex:(CDTQIndex *)index
+                    fieldNames:(NSArray /*NSString*/ *)fieldNames
+                  lastSequence:(SequenceNumber)lastSequence
+                    inDatabase:(FMDatabase *)db
+{
+    BOOL success = YES;
+    NSArray *inserts = [CDTQIndexCreator insertMetadataStatementsForIndexName:index.indexName
+                                                                         type:index.indexType
+                                                                     settings:index.settingsAsJSON
+                                                                   fieldNames:fieldNames];
+    for (CDTQSqlParts *sql in inserts) {
+        success = success && [db executeUpdate:sql.sqlWithPlaceholders
+                          withArgumentsInArray:sql.placeholderValues];
+    }
+
+    if (lastSequence > 0) {
+        NSString *sql = [NSString
+            stringWithFormat:@"UPDATE %@ SET last_sequence = ? WHERE index_name = ?;",
+                             kCDTQIndexMetadataTableName];
+        success = success && [db executeUpdate:sql, @(lastSequence), index.indexName];
+    }
+    return success;
 }
 
 /**
@@ -314,12 +470,39 @@
         NSString *clause = [NSString stringWithFormat:@"\"%@\" NONE", fieldName];
         [clauses addObject:clause];
     }
+    [clauses addObject:[NSString stringWithFormat:@"\"%@\" NONE",
+                                                  kCDTQIndexProjectableColumnName]];
 
     NSString *sql = [NSString stringWithFormat:@"CREATE TABLE %@ ( %@ );", tableName,
                                                [clauses componentsJoinedByString:@", "]];
     return [CDTQSqlParts partsForSql:sql parameters:@[]];
 }
 
+/**
+ The column order of the SQLite index for a Cloudant Query index: the indexed fields in the
+ order they were given, followed by _id and _rev.
+
+ SQLite can only seek on a leading column, so putting the fields first lets range queries
+ and ORDER BY clauses on them use the index. Having _id and _rev last means queries which
+ only need those columns are answered from the index alone.
+ */
++ (NSArray /*NSString*/ *)indexColumnsForFieldNames:(NSArray /*NSString*/ *)fieldNames
+{
+    NSMutableArray *columns = [NSMutableArray array];
+    for (NSString *fieldName in fieldNames) {
+        if (![fieldName isEqualToString:@"_id"] && ![fieldName isEqualToString:@"_rev"]) {
+            [columns addObject:fieldName];
+        }
+    }
+    if ([fieldNames containsObject:@"_id"]) {
+        [columns addObject:@"_id"];
+    }
+    if ([fieldNames containsObject:@"_rev"]) {
+        [columns addObject:@"_rev"];
+    }
+    return [NSArray arrayWithArray:columns];
+}
+
 + (CDTQSqlParts *)createIndexIndexStatementForIndexName:(NSString *)indexName
                                              fieldNames:(NSArray /*NSString*/ *)fieldNames
 {
@@ -335,7 +518,7 @@
     NSString *sqlIndexName = [tableName stringByAppendingString:@"_index"];
 
     NSMutableArray *clauses = [NSMutableArray array];
-    for (NSString *fieldName in fieldNames) {
+    for (NSString *fieldName in [CDTQIndexCreator indexColumnsForFieldNames:fieldNames]) {
         [clauses addObject:[NSString stringWithFormat:@"\"%@\"", fieldName]];
     }
 
@@ -344,6 +527,23 @@
     return [CDTQSqlParts partsForSql:sql parameters:@[]];
 }
 
+/**
+ The index on _id used when the rows for a document are deleted as the index is updated.
+ */
++ (CDTQSqlParts *)createIdIndexStatementForIndexName:(NSString *)indexName
+{
+    if (!indexName) {
+        return nil;
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *sqlIndexName = [tableName stringByAppendingString:@"_id_index"];
+
+    NSString *sql = [NSString
+        stringWithFormat:@"CREATE INDEX %@ ON %@ ( \"_id\" );", sqlIndexName, tableName];
+    return [CDTQSqlParts partsForSql:sql parameters:@[]];
+}
+
 /**
  * This function generates the virtual table create SQL for the specified index.
  * Note:  Any column that contains an '=' will cause the statement to fail
@@ -352,7 +552,7 @@
  * @param indexName the index name to be used when creating the SQLite virtual table
  * @param fieldNames the columns in the table
  * @param indexSettings the special settings to apply to the virtual table -
- *                      (only 'tokenize' is current supported)
+ *                      'tokenize', 'prefix' and 'fts', which chooses FTS4 or FTS5
  * @return the SQL to create the SQLite virtual table
  */
 + (CDTQSqlParts *)createVirtualTableStatementForIndexName:(NSString *)indexName
@@ -373,17 +573,26 @@
         [clauses addObject:[NSString stringWithFormat:@"\"%@\"", fieldName]];
     }
     
-    NSMutableArray *settingsClauses = [NSMutableArray array];
+    BOOL fts5 = [indexSettings[kCDTQTextFTS] isEqual:kCDTQTextFTS5];
     for (NSString *parameter in indexSettings.allKeys) {
-        [settingsClauses addObject:[NSString stringWithFormat:@"%@=%@",
-                                    parameter,
-                                    indexSettings[parameter]]];
+        if ([parameter.lowercaseString isEqualToString:kCDTQTextFTS]) {
+            continue;
+        } else if ([parameter.lowercaseString isEqualToString:kCDTQTextPrefix]) {
+            // FTS4 wants a comma separated list, FTS5 a space separated one
+            NSString *lengths =
+                [indexSettings[parameter] componentsJoinedByString:fts5 ? @" " : @","];
+            [clauses addObject:[NSString stringWithFormat:@"%@='%@'", parameter, lengths]];
+        } else {
+            [clauses addObject:[NSString stringWithFormat:@"%@=%@",
+                                parameter,
+                                indexSettings[parameter]]];
+        }
     }
     
-    NSString *sql = [NSString stringWithFormat:@"CREATE VIRTUAL TABLE %@ USING FTS4 ( %@, %@ );",
+    NSString *sql = [NSString stringWithFormat:@"CREATE VIRTUAL TABLE %@ USING %@ ( %@ );",
                      tableName,
-                     [clauses componentsJoinedByString:@", "],
-                     [settingsClauses componentsJoinedByString:@", "]];
+                     fts5 ? @"FTS5" : @"FTS4",
+                     [clauses componentsJoinedByString:@", "]];
     return [CDTQSqlParts partsForSql:sql parameters:@[]];
 }
 
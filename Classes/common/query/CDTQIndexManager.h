@@ -17,6 +17,9 @@
 extern NSString *const CDTQIndexManagerErrorDomain;
 extern NSString *const kCDTQIndexTablePrefix;
 extern NSString *const kCDTQIndexMetadataTableName;
+/** Column of a json index's table which is 1 when a row holds the document's values for every
+    indexed field as they are, so a projection can be read from it. */
+extern NSString *const kCDTQIndexProjectableColumnName;
 
 @class CDTDatastore;
 @class CDTQResultSet;
@@ -69,9 +72,54 @@ typedef NS_ENUM(NSInteger, CDTQQueryError) {
 @interface CDTQIndexManager : NSObject
 
 @property (nonatomic, strong) CDTDatastore *datastore;
+/** The index database, opened by the first use of a manager made by +lazyManagerUsingDatastore:. */
 @property (nonatomic, strong) FMDatabaseQueue *database;
 @property (nonatomic, readonly, getter = isTextSearchEnabled) BOOL textSearchEnabled;
 
+/** YES for a manager made by +managerColocatedWithDatastore:error:. */
+@property (nonatomic, readonly, getter=isColocated) BOOL colocated;
+
+/**
+ When YES, a query passing `fields` whose fields are all in a single json index returns
+ projected revisions built from the index's rows, without loading documents from the
+ datastore.
+
+ Values come back as they are stored in the index, so only enable this when the projected
+ fields hold strings and numbers: booleans come back as numbers and a single-valued array
+ comes back as its value. Documents where a projected field is missing, null, an object or an
+ array of other than one value, or a string starting with { or (, are loaded as usual.
+ Revisions projected from an index have no attachments and a sequence of 0.
+
+ Default is NO.
+ */
+@property (nonatomic) BOOL indexOnlyProjection;
+
+/**
+ When YES, indexes are brought up to date on a low-priority background queue, in small
+ batches, whenever the datastore posts a CDTDatastoreChangeNotification. Queries passing
+ `allowStale:YES` then return straight away using the indexes as they are, rather than first
+ waiting for them to catch up with the datastore.
+
+ Default is NO, where indexes are only updated when queried or by -updateAllIndexes.
+ */
+@property (nonatomic, getter=isBackgroundIndexingEnabled) BOOL backgroundIndexingEnabled;
+
+/**
+ Maximum number of document IDs held by the query result cache. When non-zero, the results
+ of -find: calls are kept, least recently used first out, keyed by their normalised selector,
+ sort, fields, skip and limit. A cached result is reused until the datastore or any index
+ changes. Enumerating a cached result set still loads its documents from the datastore.
+
+ Default is 0, which disables the cache. Setting a lower limit evicts results to fit.
+ */
+@property (nonatomic) NSUInteger queryCacheLimit;
+
+/** Number of -find: calls answered from the query result cache. */
+@property (nonatomic, readonly) NSUInteger queryCacheHits;
+
+/** Number of -find: calls, made with the query result cache enabled, which missed it. */
+@property (nonatomic, readonly) NSUInteger queryCacheMisses;
+
 /**
  Constructs a new CDTQIndexManager which indexes documents in `datastore`
  */
@@ -81,6 +129,30 @@ typedef NS_ENUM(NSInteger, CDTQQueryError) {
 - (instancetype)initUsingDatastore:(CDTDatastore *)datastore
                              error:(NSError *__autoreleasing *)error;
 
+/**
+ Constructs a new CDTQIndexManager which indexes documents in `datastore`, leaving its index
+ database to be opened when it's first used. This makes creating a manager for each of many
+ datastores at launch cheap, but a database which can't be opened, for example because of a
+ wrong encryption key, is only reported by the log and by the failure of each call.
+ */
++ (CDTQIndexManager *)lazyManagerUsingDatastore:(CDTDatastore *)datastore;
+
+/**
+ Constructs a new CDTQIndexManager which keeps its indexes in `datastore`'s own database,
+ using the datastore's connection, rather than in a separate index database.
+
+ Index updates then read changes and write index rows on one connection, sharing its page
+ cache and WAL, and the index tables can be joined with the datastore's tables in SQL. The
+ updates still commit in transactions of their own, which hold up the datastore's writes
+ while they run.
+
+ Colocated indexes are separate from those of a manager made by +managerUsingDatastore:error:,
+ which are kept in the index database until it's deleted. They're deleted along with the
+ datastore, and the manager can't be used once the datastore is closed.
+ */
++ (CDTQIndexManager *)managerColocatedWithDatastore:(CDTDatastore *)datastore
+                                              error:(NSError *__autoreleasing *)error;
+
 - (NSDictionary * /* NSString -> NSArray[NSString]*/)listIndexes;
 
 /** Internal */
@@ -102,6 +174,20 @@ typedef NS_ENUM(NSInteger, CDTQQueryError) {
 
 - (BOOL)deleteIndexNamed:(NSString *)indexName;
 
+/**
+ Merges the segments of a text index into one, which makes searching it faster until
+ documents are indexed again. This can take a while for a large index, and it's best done
+ after indexing many documents at once.
+ */
+- (BOOL)optimizeTextIndexNamed:(NSString *)indexName;
+
+/**
+ Sets how many segments of the same size a text index accumulates before SQLite merges them
+ as documents are indexed, between 2 and 16, or 0 to only merge on -optimizeTextIndexNamed:.
+ Fewer segments make searches faster and indexing slower. The setting is kept in the index.
+ */
+- (BOOL)setAutomergeSegments:(NSUInteger)segments forTextIndexNamed:(NSString *)indexName;
+
 - (BOOL)updateAllIndexes;
 
 - (CDTQResultSet *)find:(NSDictionary *)query;
@@ -112,10 +198,25 @@ typedef NS_ENUM(NSInteger, CDTQQueryError) {
                  fields:(NSArray *)fields
                    sort:(NSArray *)sortDocument;
 
+/**
+ As -find:skip:limit:fields:sort:, but when `allowStale` is YES the indexes aren't brought up
+ to date first, so changes the background indexer hasn't reached yet may be missing from the
+ results. Each query still sees the indexes at a single point between update batches.
+ */
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+             allowStale:(BOOL)allowStale;
+
 /** Internal */
 + (NSString *)tableNameForIndex:(NSString *)indexName;
 
 /** Internal */
 + (BOOL)ftsAvailableInDatabase:(FMDatabaseQueue *)db;
 
+/** Internal */
++ (BOOL)fts5AvailableInDatabase:(FMDatabaseQueue *)db;
+
 @end
@@ -31,7 +31,9 @@
 //     johna     |  3-blob     |  John        |  Appleseed
 //     joeb      |  2-blip     |  Joe         |  Bloggs
 //
-// There is a single SQLite index created on all columns of this table.
+// Two SQLite indexes are created on this table: one over the indexed fields followed by
+// _id and _rev, used for queries and sorting, and one over _id, used to remove a document's
+// rows when the index is updated.
 //
 // N.b.: _id and _rev are automatically added to all indexes to allow them to be used to
 // project CDTDocumentRevisions without the need to load a document from the datastore.
@@ -44,6 +46,7 @@
 #import "CDTQIndexUpdater.h"
 #import "CDTQQueryExecutor.h"
 #import "CDTQIndexCreator.h"
+#import "CDTQQueryValidator.h"
 #import "CDTQLogging.h"
 
 #import "CDTEncryptionKeyProvider.h"
@@ -51,6 +54,7 @@
 
 #import "TD_Database.h"
 #import "TD_Body.h"
+#import "TDCanonicalJSON.h"
 
 #import "FMDatabase+EncryptionKey.h"
 
@@ -61,16 +65,47 @@ NSString *const CDTQIndexManagerErrorDomain = @"CDTIndexManagerErrorDomain";
 
 NSString *const kCDTQIndexTablePrefix = @"_t_cloudant_sync_query_index_";
 NSString *const kCDTQIndexMetadataTableName = @"_t_cloudant_sync_query_metadata";
+NSString *const kCDTQIndexProjectableColumnName = @"_projectable";
 
 static NSString *const kCDTQExtensionName = @"com.cloudant.sync.query";
 static NSString *const kCDTQIndexFieldNamePattern = @"^[a-zA-Z][a-zA-Z0-9_]*$";
 
-static const int VERSION = 2;
+static const int VERSION = 4;
 
-@interface CDTQIndexManager ()
+// A colocated index's tables share the datastore's file, whose user_version is the
+// datastore's schema version, so their schema version is kept in a table instead.
+static NSString *const kCDTQSchemaVersionTableName = @"_t_cloudant_sync_query_schema_version";
+
+// Background updates use small transactions so that queries aren't held up behind them
+static const NSUInteger kCDTQBackgroundBatchSize = 100;
+
+// Number of query shapes whose plans are remembered
+static const NSUInteger kCDTQPlanCacheCapacity = 100;
+
+/** A query result held by the query result cache, with the state it was found in. */
+@interface CDTQCachedResult : NSObject
+@property (nonatomic, strong) CDTQResultSet *resultSet;
+@property (nonatomic) SequenceNumber datastoreSequence;
+@property (nonatomic, strong) NSDictionary *indexSequences;  // index name -> last_sequence
+@property (nonatomic) BOOL indexesWereUpToDate;
+@end
+
+@implementation CDTQCachedResult
+@end
+
+@interface CDTQIndexManager () {
+    dispatch_queue_t _indexingQueue;  // serialises index updates
+    BOOL _backgroundUpdateScheduled;  // guarded by @synchronized(self)
+
+    // Query result cache, guarded by @synchronized(_queryCache)
+    NSMutableDictionary *_queryCache;       // key -> CDTQCachedResult
+    NSMutableOrderedSet *_queryCacheOrder;  // keys, least recently used first
+    NSUInteger _queryCacheSize;        // document IDs held
+
+    CDTQQueryPlanCache *_planCache;
+}
 
 @property (nonatomic, strong) NSRegularExpression *validFieldName;
-@property (readwrite) BOOL textSearchEnabled;
 
 @end
 
@@ -100,18 +135,54 @@ static const int VERSION = 2;
     return [[CDTQIndexManager alloc] initUsingDatastore:datastore error:error];
 }
 
++ (CDTQIndexManager *)lazyManagerUsingDatastore:(CDTDatastore *)datastore
+{
+    return [[CDTQIndexManager alloc] initUsingDatastore:datastore
+                                              colocated:NO
+                                             openLazily:YES
+                                                  error:nil];
+}
+
++ (CDTQIndexManager *)managerColocatedWithDatastore:(CDTDatastore *)datastore
+                                              error:(NSError *__autoreleasing *)error
+{
+    return [[CDTQIndexManager alloc] initUsingDatastore:datastore
+                                              colocated:YES
+                                             openLazily:NO
+                                                  error:error];
+}
+
 - (instancetype)initUsingDatastore:(CDTDatastore *)datastore error:(NSError *__autoreleasing *)error
+{
+    return [self initUsingDatastore:datastore colocated:NO openLazily:NO error:error];
+}
+
+- (instancetype)initUsingDatastore:(CDTDatastore *)datastore
+                         colocated:(BOOL)colocated
+                        openLazily:(BOOL)openLazily
+                             error:(NSError *__autoreleasing *)error
 {
     self = [super init];
     if (self) {
-        _database = [CDTQIndexManager databaseQueueWithDatastore:datastore error:error];
-        if (_database) {
+        _colocated = colocated;
+        if (!openLazily) {
+            _database = [CDTQIndexManager databaseQueueWithDatastore:datastore
+                                                           colocated:colocated
+                                                               error:error];
+        }
+        if (_database || openLazily) {
             _datastore = datastore;
             _validFieldName =
                 [[NSRegularExpression alloc] initWithPattern:kCDTQIndexFieldNamePattern
                                                      options:0
                                                        error:error];
-            _textSearchEnabled = [CDTQIndexManager ftsAvailableInDatabase:_database];
+            _queryCache = [NSMutableDictionary dictionary];
+            _queryCacheOrder = [NSMutableOrderedSet orderedSet];
+            _planCache = [[CDTQQueryPlanCache alloc] initWithCapacity:kCDTQPlanCacheCapacity];
+            _indexingQueue =
+                dispatch_queue_create("com.cloudant.sync.query.indexing", DISPATCH_QUEUE_SERIAL);
+            dispatch_set_target_queue(_indexingQueue,
+                                      dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
         } else {
             self = nil;
         }
@@ -120,6 +191,90 @@ static const int VERSION = 2;
     return self;
 }
 
+- (FMDatabaseQueue *)database
+{
+    @synchronized(self)
+    {
+        if (!_database && _datastore) {
+            NSError *error = nil;
+            _database = [CDTQIndexManager databaseQueueWithDatastore:_datastore
+                                                           colocated:_colocated
+                                                               error:&error];
+            if (!_database) {
+                LogError(@"Failed to open the index database for %@: %@", _datastore, error);
+            }
+        }
+        return _database;
+    }
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+#pragma mark Background indexing
+
+- (void)setBackgroundIndexingEnabled:(BOOL)backgroundIndexingEnabled
+{
+    @synchronized(self)
+    {
+        if (_backgroundIndexingEnabled == backgroundIndexingEnabled) {
+            return;
+        }
+        _backgroundIndexingEnabled = backgroundIndexingEnabled;
+    }
+
+    NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+    if (backgroundIndexingEnabled) {
+        [center addObserver:self
+                   selector:@selector(datastoreChanged:)
+                       name:CDTDatastoreChangeNotification
+                     object:_datastore];
+        [self scheduleBackgroundUpdate];  // catch up with changes made before now
+    } else {
+        [center removeObserver:self name:CDTDatastoreChangeNotification object:_datastore];
+    }
+}
+
+- (void)datastoreChanged:(NSNotification *)notification { [self scheduleBackgroundUpdate]; }
+
+/**
+ Queues an update of all indexes, unless one is already queued and not yet started. A burst
+ of changes, such as a pull replication writing documents, results in few updates.
+ */
+- (void)scheduleBackgroundUpdate
+{
+    @synchronized(self)
+    {
+        if (_backgroundUpdateScheduled) {
+            return;
+        }
+        _backgroundUpdateScheduled = YES;
+    }
+
+    __weak CDTQIndexManager *weakSelf = self;
+    dispatch_async(_indexingQueue, ^{
+        CDTQIndexManager *self = weakSelf;
+        if (!self) {
+            return;
+        }
+        @synchronized(self)
+        {
+            // Changes from now on need another update, including once background indexing
+            // is enabled again
+            self->_backgroundUpdateScheduled = NO;
+        }
+        if (!self.backgroundIndexingEnabled) {
+            return;
+        }
+        if (![self updateAllIndexesWithBatchSize:kCDTQBackgroundBatchSize]) {
+            LogWarn(@"Background update of indexes failed; they will be updated by the next "
+                    @"query which doesn't allow stale results");
+        }
+    });
+}
+
 #pragma mark List indexes
 
 /**
@@ -132,7 +287,7 @@ static const int VERSION = 2;
  */
 - (NSDictionary * /* NSString -> NSArray[NSString]*/)listIndexes
 {
-    return [CDTQIndexManager listIndexesInDatabaseQueue:_database];
+    return [CDTQIndexManager listIndexesInDatabaseQueue:self.database];
 }
 
 + (NSDictionary /* NSString -> NSArray[NSString]*/ *)listIndexesInDatabaseQueue:
@@ -228,7 +383,7 @@ static const int VERSION = 2;
 - (NSString *)ensureIndexed:(NSArray * /* NSString */)fieldNames withName:(NSString *)indexName
 {
     return [CDTQIndexCreator ensureIndexed:[CDTQIndex index:indexName withFields:fieldNames]
-                                inDatabase:_database
+                                inDatabase:self.database
                              fromDatastore:_datastore];
 }
 
@@ -254,7 +409,11 @@ static const int VERSION = 2;
  @param indexName Name of index to create.
  @param type The type of index (json or text currently supported)
  @param indexSettings The optional settings to be applied to an index
- *                    Only text indexes support settings - Ex. { "tokenize" : "simple" }
+ *                    Text indexes support tokenize - Ex. { "tokenize" : "simple" },
+ *                    the FTS module - Ex. { "fts" : "fts5" } and prefix lengths
+ *                    to index - Ex. { "prefix" : [ 2, 3 ] }
+ *                    Json indexes support a partial filter selector, indexing only
+ *                    matching documents - Ex. { "partial_filter_selector" : { "type" : "x" } }
  @returns name of created index
  */
 - (NSString *)ensureIndexed:(NSArray * /* NSString */)fieldNames
@@ -266,7 +425,7 @@ static const int VERSION = 2;
                                                  withFields:fieldNames
                                                      ofType:type
                                                withSettings:indexSettings]
-                                inDatabase:_database
+                                inDatabase:self.database
                              fromDatastore:_datastore];
 }
 
@@ -276,7 +435,7 @@ static const int VERSION = 2;
 {
     __block BOOL success = YES;
 
-    [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+    [self.database inTransaction:^(FMDatabase *db, BOOL *rollback) {
 
         NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
         NSString *sql;
@@ -299,17 +458,93 @@ static const int VERSION = 2;
     return success;
 }
 
+#pragma mark Text index maintenance
+
+- (BOOL)optimizeTextIndexNamed:(NSString *)indexName
+{
+    if (![self isTextIndexNamed:indexName]) {
+        return NO;
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *sql =
+        [NSString stringWithFormat:@"INSERT INTO %@ (%@) VALUES ('optimize');", tableName,
+                                   tableName];
+    __block BOOL success;
+    [self.database inDatabase:^(FMDatabase *db) {
+        success = [db executeUpdate:sql withArgumentsInArray:@[]];
+    }];
+    if (!success) {
+        LogError(@"Failed to optimize text index: %@", indexName);
+    }
+    return success;
+}
+
+- (BOOL)setAutomergeSegments:(NSUInteger)segments forTextIndexNamed:(NSString *)indexName
+{
+    if (segments > 16) {
+        LogError(@"Automerge segments must be between 0 and 16, not %lu.",
+                 (unsigned long)segments);
+        return NO;
+    }
+    if (![self isTextIndexNamed:indexName]) {
+        return NO;
+    }
+
+    // FTS5 keeps its configuration in a rank column; FTS4 parses it from the command.
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *settings = [self listIndexes][indexName][@"settings"];
+    NSString *sql;
+    if ([CDTQIndex isFTS5TextIndexWithSettings:settings]) {
+        sql = [NSString stringWithFormat:@"INSERT INTO %@ (%@, rank) VALUES ('automerge', %lu);",
+                                         tableName, tableName, (unsigned long)segments];
+    } else {
+        sql = [NSString stringWithFormat:@"INSERT INTO %@ (%@) VALUES ('automerge=%lu');",
+                                         tableName, tableName, (unsigned long)segments];
+    }
+    __block BOOL success;
+    [self.database inDatabase:^(FMDatabase *db) {
+        success = [db executeUpdate:sql withArgumentsInArray:@[]];
+    }];
+    if (!success) {
+        LogError(@"Failed to set automerge for text index: %@", indexName);
+    }
+    return success;
+}
+
+- (BOOL)isTextIndexNamed:(NSString *)indexName
+{
+    NSDictionary *index = [self listIndexes][indexName];
+    if (![[index[@"type"] lowercaseString] isEqualToString:kCDTQTextType]) {
+        LogError(@"No text index named %@.", indexName);
+        return NO;
+    }
+    return YES;
+}
+
 #pragma mark Update indexes
 
 - (BOOL)updateAllIndexes
+{
+    // Updates are serialised on the indexing queue, so this waits for any background update
+    // in progress and then processes whatever it didn't.
+    __block BOOL success;
+    dispatch_sync(_indexingQueue, ^{ success = [self updateAllIndexesWithBatchSize:500]; });
+    return success;
+}
+
+/** Must be called on the indexing queue. */
+- (BOOL)updateAllIndexesWithBatchSize:(NSUInteger)batchSize
 {
     // TODO
 
     // To start with, assume top-level fields only
 
     NSDictionary *indexes = [self listIndexes];
-    return
-        [CDTQIndexUpdater updateAllIndexes:indexes inDatabase:_database fromDatastore:_datastore];
+    CDTQIndexUpdater *updater =
+        [[CDTQIndexUpdater alloc] initWithDatabase:self.database datastore:_datastore];
+    updater.batchSize = batchSize;
+    return [updater updateAllIndexes:indexes];
 }
 
 #pragma mark Query indexes
@@ -324,24 +559,189 @@ static const int VERSION = 2;
                   limit:(NSUInteger)limit
                  fields:(NSArray *)fields
                    sort:(NSArray *)sortDocument
+{
+    return [self find:query skip:skip limit:limit fields:fields sort:sortDocument allowStale:NO];
+}
+
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+             allowStale:(BOOL)allowStale
 {
     if (!query) {
         LogError(@"-find called with nil selector; bailing.");
         return nil;
     }
 
-    if (![self updateAllIndexes]) {
+    // Results are cached against the datastore's and the indexes' sequence numbers, read
+    // before any update so that a change made while querying always causes a miss later.
+    NSString *cacheKey = nil;
+    SequenceNumber datastoreSequence = 0;
+    NSDictionary *indexSequences = nil;
+    if (self.queryCacheLimit > 0) {
+        NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:query];
+        if (selector) {  // invalid queries are reported by the executor
+            // Keyed by canonical JSON, with sorted keys, which hashes and compares quickly
+            cacheKey = [TDCanonicalJSON canonicalString:@[
+                selector, sortDocument ?: [NSNull null], fields ?: [NSNull null], @(skip),
+                @(limit)
+            ]];
+            datastoreSequence = _datastore.database.lastSequence;
+            CDTQResultSet *cached = [self cachedResultForKey:cacheKey
+                                           datastoreSequence:datastoreSequence
+                                              indexSequences:&indexSequences
+                                                  allowStale:allowStale];
+            if (cached) {
+                return cached;
+            }
+            // A stale result is cached against the indexes as they were before querying
+            if (allowStale && !indexSequences) {
+                indexSequences = [self indexSequences];
+            }
+        }
+    }
+
+    if (!allowStale && ![self updateAllIndexes]) {
         return nil;
     }
 
+    // SQLite's schema version changes whenever an index is created or deleted, by this or any
+    // other manager, so it identifies the set of indexes to the plan cache. It's read in the
+    // same transaction as the indexes so that the two agree.
+    __block NSDictionary *indexes;
+    __block NSInteger indexGeneration;
+    [self.database inDeferredTransaction:^(FMDatabase *db, BOOL *rollback) {
+        indexGeneration = [db intForQuery:@"PRAGMA schema_version;"];
+        indexes = [CDTQIndexManager listIndexesInDatabase:db];
+    }];
+
     CDTQQueryExecutor *queryExecutor =
-        [[CDTQQueryExecutor alloc] initWithDatabase:_database datastore:_datastore];
-    return [queryExecutor find:query
-                  usingIndexes:[self listIndexes]
-                          skip:skip
-                         limit:limit
-                        fields:fields
-                          sort:sortDocument];
+        [[CDTQQueryExecutor alloc] initWithDatabase:self.database datastore:_datastore];
+    queryExecutor.indexOnlyProjection = self.indexOnlyProjection;
+    queryExecutor.planCache = _planCache;
+    queryExecutor.indexGeneration = indexGeneration;
+    CDTQResultSet *resultSet = [queryExecutor find:query
+                                      usingIndexes:indexes
+                                              skip:skip
+                                             limit:limit
+                                            fields:fields
+                                              sort:sortDocument];
+
+    if (cacheKey && resultSet) {
+        CDTQCachedResult *result = [[CDTQCachedResult alloc] init];
+        result.resultSet = resultSet;
+        result.datastoreSequence = datastoreSequence;
+        // After an update the indexes are up to date with at least datastoreSequence
+        result.indexSequences = allowStale ? indexSequences : [self indexSequences];
+        result.indexesWereUpToDate = !allowStale;
+        [self cacheResult:result forKey:cacheKey];
+    }
+
+    return resultSet;
+}
+
+#pragma mark Query result cache
+
+- (void)setQueryCacheLimit:(NSUInteger)queryCacheLimit
+{
+    @synchronized(_queryCache)
+    {
+        _queryCacheLimit = queryCacheLimit;
+        [self evictQueryCacheEntriesToFit:0];
+    }
+}
+
+/**
+ Returns the sequence each index is up to date with, keyed by index name.
+ */
+- (NSDictionary /* NSString -> NSNumber */ *)indexSequences
+{
+    NSMutableDictionary *sequences = [NSMutableDictionary dictionary];
+    [self.database inDatabase:^(FMDatabase *db) {
+        NSString *sql = @"SELECT index_name, MAX(last_sequence) FROM %@ GROUP BY index_name;";
+        sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+        FMResultSet *rs = [db executeQuery:sql];
+        while ([rs next]) {
+            sequences[[rs stringForColumnIndex:0]] = @([rs longLongIntForColumnIndex:1]);
+        }
+        [rs close];
+    }];
+    return sequences;
+}
+
+/**
+ Returns a new result set over the cached result for the key if it was found with the
+ datastore and indexes as they are now. Unless `allowStale`, the indexes must also have been
+ up to date then. The indexes' sequences are only read, into `indexSequences`, when there's a
+ cached result for the datastore's sequence.
+ */
+- (CDTQResultSet *)cachedResultForKey:(NSString *)key
+                    datastoreSequence:(SequenceNumber)datastoreSequence
+                       indexSequences:(NSDictionary **)indexSequences
+                           allowStale:(BOOL)allowStale
+{
+    CDTQCachedResult *result;
+    @synchronized(_queryCache)
+    {
+        result = _queryCache[key];
+    }
+    if (result && result.datastoreSequence == datastoreSequence &&
+        (allowStale || result.indexesWereUpToDate)) {
+        *indexSequences = [self indexSequences];
+        if ([result.indexSequences isEqualToDictionary:*indexSequences]) {
+            @synchronized(_queryCache)
+            {
+                if (_queryCache[key] == result) {
+                    [_queryCacheOrder removeObject:key];
+                    [_queryCacheOrder addObject:key];
+                }
+                _queryCacheHits++;
+            }
+            return [CDTQResultSet resultSetWithResultSet:result.resultSet];
+        }
+    }
+    @synchronized(_queryCache)
+    {
+        _queryCacheMisses++;
+    }
+    return nil;
+}
+
+- (void)cacheResult:(CDTQCachedResult *)result forKey:(NSString *)key
+{
+    NSUInteger size = result.resultSet.originalDocumentIds.count;
+
+    @synchronized(_queryCache)
+    {
+        CDTQCachedResult *previous = _queryCache[key];
+        if (previous) {
+            _queryCacheSize -= previous.resultSet.originalDocumentIds.count;
+            [_queryCache removeObjectForKey:key];
+            [_queryCacheOrder removeObject:key];
+        }
+        if (size > _queryCacheLimit) {
+            return;  // would evict everything else and still not fit
+        }
+
+        [self evictQueryCacheEntriesToFit:size];
+        _queryCache[key] = result;
+        [_queryCacheOrder addObject:key];
+        _queryCacheSize += size;
+    }
+}
+
+/** Must be called while synchronized on _queryCache. */
+- (void)evictQueryCacheEntriesToFit:(NSUInteger)size
+{
+    while (_queryCacheOrder.count > 0 && _queryCacheSize + size > _queryCacheLimit) {
+        NSString *key = _queryCacheOrder[0];
+        CDTQCachedResult *evicted = _queryCache[key];
+        _queryCacheSize -= evicted.resultSet.originalDocumentIds.count;
+        [_queryCache removeObjectForKey:key];
+        [_queryCacheOrder removeObjectAtIndex:0];
+    }
 }
 
 #pragma mark Utilities
@@ -353,41 +753,80 @@ static const int VERSION = 2;
 
 + (BOOL)ftsAvailableInDatabase:(FMDatabaseQueue *)db
 {
-    __block BOOL ftsOptionsExist = NO;
+    return [CDTQIndexManager compileOptions:@[ @"ENABLE_FTS3" ] availableInDatabase:db];
+}
+
++ (BOOL)fts5AvailableInDatabase:(FMDatabaseQueue *)db
+{
+    return [CDTQIndexManager compileOptions:@[ @"ENABLE_FTS5" ] availableInDatabase:db];
+}
+
+/**
+ Returns whether SQLite was compiled with all of `options`. They're the same for every
+ database, so each answer is remembered.
+ */
++ (BOOL)compileOptions:(NSArray *)options availableInDatabase:(FMDatabaseQueue *)db
+{
+    static NSMutableDictionary *availableByOptions;  // options -> @YES or @NO
+    @synchronized([CDTQIndexManager class])
+    {
+        if (availableByOptions[options]) {
+            return [availableByOptions[options] boolValue];
+        }
+    }
+    if (!db) {
+        return NO;
+    }
+
+    __block BOOL optionsExist = NO;
     
     [db inDatabase:^(FMDatabase *db) {
-        NSMutableArray *ftsCompileOptions = [NSMutableArray arrayWithArray:@[ @"ENABLE_FTS3" ] ];
+        NSMutableArray *missingOptions = [NSMutableArray arrayWithArray:options];
         FMResultSet *rs = [db executeQuery:@"PRAGMA compile_options;"];
         while ([rs next]) {
             NSString *compileOption = [rs stringForColumnIndex:0];
-            [ftsCompileOptions removeObject:compileOption];
-            if (ftsCompileOptions.count == 0) {
-                ftsOptionsExist = YES;
+            [missingOptions removeObject:compileOption];
+            if (missingOptions.count == 0) {
+                optionsExist = YES;
                 break;
             }
         }
         [rs close];
     }];
+
+    @synchronized([CDTQIndexManager class])
+    {
+        if (!availableByOptions) {
+            availableByOptions = [NSMutableDictionary dictionary];
+        }
+        availableByOptions[options] = @(optionsExist);
+    }
     
-    return ftsOptionsExist;
+    return optionsExist;
 }
 
 - (BOOL)isTextSearchEnabled
 {
-    if (!_textSearchEnabled) {
+    BOOL textSearchEnabled = [CDTQIndexManager ftsAvailableInDatabase:self.database];
+    if (!textSearchEnabled) {
         LogInfo(@"Based on SQLite compile options, "
                 @"text search is currently not supported.  "
                 @"To enable text search recompile SQLite with "
                 @"the full text saerch compile options turned on.");
     }
-    return _textSearchEnabled;
+    return textSearchEnabled;
 }
 
 #pragma mark Setup methods
 
 + (FMDatabaseQueue *)databaseQueueWithDatastore:(CDTDatastore *)datastore
+                                      colocated:(BOOL)colocated
                                           error:(NSError *__autoreleasing *)error
 {
+    if (colocated) {
+        return [CDTQIndexManager colocatedDatabaseQueueWithDatastore:datastore error:error];
+    }
+
     NSString *dir = [datastore extensionDataFolder:kCDTQExtensionName];
     [[NSFileManager defaultManager] createDirectoryAtPath:dir
                               withIntermediateDirectories:TRUE
@@ -422,7 +861,7 @@ static const int VERSION = 2;
     }
 
     if (success) {
-        success = [CDTQIndexManager updateSchema:VERSION inDatabase:database];
+        success = [CDTQIndexManager updateSchema:VERSION inDatabase:database colocated:NO];
 
         if (!success) {
             NSDictionary *userInfo = @{
@@ -446,6 +885,32 @@ static const int VERSION = 2;
     return database;
 }
 
+/**
+ Returns the datastore's own queue, with the index tables created in the datastore's database.
+ The datastore has already keyed and configured its connection.
+ */
++ (FMDatabaseQueue *)colocatedDatabaseQueueWithDatastore:(CDTDatastore *)datastore
+                                                   error:(NSError *__autoreleasing *)error
+{
+    TD_Database *source = datastore.database;
+    FMDatabaseQueue *database = [source isOpen] ? source.fmdbQueue : nil;
+
+    if (!database || ![CDTQIndexManager updateSchema:VERSION inDatabase:database colocated:YES]) {
+        if (error) {
+            NSDictionary *userInfo = @{
+                NSLocalizedDescriptionKey :
+                    NSLocalizedString(@"Problem creating indexes in the datastore's database.", nil)
+            };
+            *error = [NSError errorWithDomain:CDTQIndexManagerErrorDomain
+                                         code:CDTQIndexErrorSqlError
+                                     userInfo:userInfo];
+        }
+        return nil;
+    }
+
+    return database;
+}
+
 + (BOOL)configureDatabase:(FMDatabaseQueue *)database
     withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
                         error:(NSError **)error
@@ -474,20 +939,25 @@ static const int VERSION = 2;
     return success;
 }
 
-+ (BOOL)updateSchema:(int)currentVersion inDatabase:(FMDatabaseQueue *)database
++ (BOOL)updateSchema:(int)currentVersion
+          inDatabase:(FMDatabaseQueue *)database
+           colocated:(BOOL)colocated
 {
     __block BOOL success = YES;
 
+    // Most of the time the schema is up to date, which reading the version is enough to tell,
+    // without writing it back inside a transaction.
+    __block int knownVersion = 0;
+    [database inDatabase:^(FMDatabase *db) {
+        knownVersion = [CDTQIndexManager schemaVersionInDatabase:db colocated:colocated];
+    }];
+    if (knownVersion == currentVersion) {
+        return YES;
+    }
+
     // get current version
     [database inTransaction:^(FMDatabase *db, BOOL *rollback) {
-        int version = 0;
-
-        FMResultSet *rs = [db executeQuery:@"pragma user_version;"];
-        while ([rs next]) {
-            version = [rs intForColumnIndex:0];
-            break;  // should only be a single result, so may as well break
-        }
-        [rs close];
+        int version = [CDTQIndexManager schemaVersionInDatabase:db colocated:colocated];
 
         if (version < 1) {
             success = [CDTQIndexManager migrate_0_1:db];
@@ -497,9 +967,18 @@ static const int VERSION = 2;
             success = success && [CDTQIndexManager migrate_1_2:db];
         }
 
-        // Set user_version unconditionally
-        NSString *sql = [NSString stringWithFormat:@"pragma user_version = %d", currentVersion];
-        success = success && [db executeUpdate:sql];
+        if (version < 3) {
+            success = success && [CDTQIndexManager migrate_2_3:db];
+        }
+
+        if (version < 4) {
+            success = success && [CDTQIndexManager migrate_3_4:db];
+        }
+
+        // Set the version unconditionally
+        success = success && [CDTQIndexManager setSchemaVersion:currentVersion
+                                                     inDatabase:db
+                                                      colocated:colocated];
 
         if (!success) {
             LogError(@"Failed to update schema");
@@ -510,6 +989,37 @@ static const int VERSION = 2;
     return success;
 }
 
++ (int)schemaVersionInDatabase:(FMDatabase *)db colocated:(BOOL)colocated
+{
+    if (!colocated) {
+        return [db intForQuery:@"pragma user_version;"];
+    }
+
+    NSString *sql = @"SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = ?;";
+    if ([db intForQuery:sql, kCDTQSchemaVersionTableName] == 0) {
+        return 0;
+    }
+    sql = [NSString stringWithFormat:@"SELECT version FROM %@;", kCDTQSchemaVersionTableName];
+    return [db intForQuery:sql];
+}
+
++ (BOOL)setSchemaVersion:(int)version inDatabase:(FMDatabase *)db colocated:(BOOL)colocated
+{
+    if (!colocated) {
+        NSString *sql = [NSString stringWithFormat:@"pragma user_version = %d", version];
+        return [db executeUpdate:sql];
+    }
+
+    NSString *table = kCDTQSchemaVersionTableName;
+    NSString *create =
+        [NSString stringWithFormat:@"CREATE TABLE IF NOT EXISTS %@ ( version INTEGER NOT NULL );",
+                                   table];
+    return [db executeUpdate:create] &&
+           [db executeUpdate:[NSString stringWithFormat:@"DELETE FROM %@;", table]] &&
+           [db executeUpdate:[NSString stringWithFormat:@"INSERT INTO %@ (version) VALUES (?);",
+                                                        table], @(version)];
+}
+
 + (BOOL)migrate_0_1:(FMDatabase *)db
 {
     NSString *SCHEMA_INDEX = @"CREATE TABLE _t_cloudant_sync_query_metadata ( "
@@ -525,4 +1035,61 @@ static const int VERSION = 2;
     return [db executeUpdate:SCHEMA_INDEX];
 }
 
+/**
+ Replaces the SQLite index of each json index, which had _id as its leading column, with
+ one led by the indexed fields plus a separate index on _id.
+ */
++ (BOOL)migrate_2_3:(FMDatabase *)db
+{
+    BOOL success = YES;
+    NSDictionary *indexes = [CDTQIndexManager listIndexesInDatabase:db];
+    for (NSString *indexName in indexes) {
+        NSString *indexType = indexes[indexName][@"type"];
+        if ([indexType.lowercaseString isEqualToString:kCDTQTextType]) {
+            continue;  // text indexes are FTS virtual tables, with no SQLite index
+        }
+
+        NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+        NSString *sql = [NSString stringWithFormat:@"DROP INDEX IF EXISTS %@_index;", tableName];
+        success = success && [db executeUpdate:sql];
+
+        CDTQSqlParts *createIndex =
+            [CDTQIndexCreator createIndexIndexStatementForIndexName:indexName
+                                                         fieldNames:indexes[indexName][@"fields"]];
+        success = success && [db executeUpdate:createIndex.sqlWithPlaceholders
+                          withArgumentsInArray:createIndex.placeholderValues];
+
+        CDTQSqlParts *createIdIndex =
+            [CDTQIndexCreator createIdIndexStatementForIndexName:indexName];
+        success = success && [db executeUpdate:createIdIndex.sqlWithPlaceholders
+                          withArgumentsInArray:createIdIndex.placeholderValues];
+    }
+    return success;
+}
+
+/**
+ Adds the projectable marker column to each json index. Existing rows are left NULL, so
+ projections load their documents until the rows are next rewritten.
+ */
++ (BOOL)migrate_3_4:(FMDatabase *)db
+{
+    BOOL success = YES;
+    NSDictionary *indexes = [CDTQIndexManager listIndexesInDatabase:db];
+    for (NSString *indexName in indexes) {
+        NSString *indexType = indexes[indexName][@"type"];
+        if ([indexType.lowercaseString isEqualToString:kCDTQTextType]) {
+            continue;  // text indexes aren't used for projections
+        }
+
+        NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+        if ([db columnExists:kCDTQIndexProjectableColumnName inTableWithName:tableName]) {
+            continue;
+        }
+        NSString *sql = [NSString stringWithFormat:@"ALTER TABLE %@ ADD COLUMN \"%@\" NONE;",
+                                                   tableName, kCDTQIndexProjectableColumnName];
+        success = success && [db executeUpdate:sql];
+    }
+    return success;
+}
+
 @end
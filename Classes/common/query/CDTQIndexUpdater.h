@@ -47,12 +47,30 @@
       fromDatastore:(CDTDatastore *)datastore
               error:(NSError *__autoreleasing *)error;
 
+/**
+ Load the documents in a datastore into a new, empty index using several threads.
+
+ See -buildIndex:withFields:upToSequence:error:.
+ */
++ (BOOL)buildIndex:(NSString *)indexName
+        withFields:(NSArray /* NSString */ *)fieldNames
+        inDatabase:(FMDatabaseQueue *)database
+     fromDatastore:(CDTDatastore *)datastore
+      upToSequence:(SequenceNumber *)lastSequence
+             error:(NSError *__autoreleasing *)error;
+
 /**
  Constructs a new CDTQQueryExecutor using the indexes in `database` to index documents from
  `datastore`.
  */
 - (instancetype)initWithDatabase:(FMDatabaseQueue *)database datastore:(CDTDatastore *)datastore;
 
+/**
+ Number of changed documents written to an index in each transaction. Smaller batches let
+ queries run in between. Default is 500.
+ */
+@property (nonatomic) NSUInteger batchSize;
+
 /**
  Update all the indexes in a set.
 
@@ -69,6 +87,23 @@
          withFields:(NSArray /* NSString */ *)fieldNames
               error:(NSError *__autoreleasing *)error;
 
+/**
+ Load the documents in the datastore into a new, empty json index using several threads.
+
+ The datastore's sequence range is split between worker threads, each reading its slice on
+ its own read-only connection and extracting index rows, while the rows are written through
+ the index database's queue. The index table should have no SQLite indexes yet; create them
+ afterwards, then call -updateIndex:withFields:error: to pick up changes made during the build.
+
+ The rows are inserted without checking for existing ones, so the index mustn't be in the
+ metadata table yet, where other updates would find it. On success `lastSequence` is set to
+ the sequence the index was built to, for its metadata. On failure the index is left empty.
+ */
+- (BOOL)buildIndex:(NSString *)indexName
+        withFields:(NSArray /* NSString */ *)fieldNames
+      upToSequence:(SequenceNumber *)lastSequence
+             error:(NSError *__autoreleasing *)error;
+
 /**
  Generate the DELETE statement to remove a documents entries from an index.
  */
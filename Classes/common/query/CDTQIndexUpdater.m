@@ -14,17 +14,36 @@
 
 #import "CDTQIndexUpdater.h"
 
+#import "CDTQIndex.h"
 #import "CDTQIndexManager.h"
 #import "CDTQResultSet.h"
+#import "CDTQUnindexedMatcher.h"
 #import "CDTQValueExtractor.h"
 #import "CDTFetchChanges.h"
 #import "CDTQLogging.h"
 #import "CDTLogging.h"
+#import "TDJSON.h"
 
 #import "CloudantSync.h"
 
 #import <FMDB/FMDB.h>
 
+// Keeps statements well within SQLite's default limit of 999 parameters
+static const NSUInteger kCDTQMaxRowsPerStatement = 200;
+
+// Beyond this, extra build workers mostly contend for the single writer
+static const NSUInteger kCDTQMaxBuildWorkers = 4;
+
+/** A row of an index as it's stored in the database. */
+@interface CDTQIndexRow : NSObject
+@property (nonatomic) long long rowId;
+@property (nonatomic, strong) NSString *revId;
+@property (nonatomic, strong) NSArray *values;  // of the row columns other than _id and _rev
+@end
+
+@implementation CDTQIndexRow
+@end
+
 @interface CDTQIndexUpdater ()
 
 @property (nonatomic, strong) FMDatabaseQueue *database;
@@ -40,6 +59,7 @@
     if (self) {
         _database = database;
         _datastore = datastore;
+        _batchSize = 500;
     }
     return self;
 }
@@ -78,6 +98,25 @@
     return success;
 }
 
+/**
+ Load the documents in a datastore into a new, empty index using several threads.
+ */
++ (BOOL)buildIndex:(NSString *)indexName
+        withFields:(NSArray /* NSString */ *)fieldNames
+        inDatabase:(FMDatabaseQueue *)database
+     fromDatastore:(CDTDatastore *)datastore
+      upToSequence:(SequenceNumber *)lastSequence
+             error:(NSError *__autoreleasing *)error
+{
+    CDTQIndexUpdater *updater =
+        [[CDTQIndexUpdater alloc] initWithDatabase:database datastore:datastore];
+    BOOL success = [updater buildIndex:indexName
+                            withFields:fieldNames
+                          upToSequence:lastSequence
+                                 error:error];
+    return success;
+}
+
 #pragma mark Instance methods
 
 - (BOOL)updateAllIndexes:(NSDictionary /*NSString -> NSArray[NSString]*/ *)indexes
@@ -122,6 +161,11 @@
 {
     __block bool success = YES;
 
+    // Documents not matching a partial index's filter have their rows removed but not re-added
+    CDTQUnindexedMatcher *filter = [self partialFilterMatcherForIndex:indexName];
+
+    NSUInteger batchSize = MAX(self.batchSize, (NSUInteger)1);
+
     NSString *lastSeqString = [[NSNumber numberWithLongLong:lastSequence] stringValue];
     CDTFetchChanges *fetcher =
         [[CDTFetchChanges alloc] initWithDatastore:_datastore startSequenceValue:lastSeqString];
@@ -138,12 +182,13 @@
 
         [updateBatch addObject:revision];
 
-        if (updateBatch.count > 500) {
+        if (updateBatch.count >= batchSize) {
             CDTQIndexUpdater *self = weakSelf;
             if (self) {
-                success =
-                    success &&
-                    [self processUpdateBatch:updateBatch forIndex:indexName fieldNames:fieldNames];
+                success = success && [self processUpdateBatch:updateBatch
+                                                      forIndex:indexName
+                                                    fieldNames:fieldNames
+                                                        filter:filter];
                 [updateBatch removeAllObjects];
             }
         }
@@ -157,7 +202,7 @@
 
         [deleteBatch addObject:docId];
 
-        if (deleteBatch.count > 500) {
+        if (deleteBatch.count >= batchSize) {
             CDTQIndexUpdater *self = weakSelf;
             if (self) {
                 success = success && [self processDeleteBatch:deleteBatch forIndex:indexName];
@@ -176,9 +221,10 @@
         CDTQIndexUpdater *self = weakSelf;
         if (self) {
             // Process any remaining updates and deletes
-            success =
-                success &&
-                [self processUpdateBatch:updateBatch forIndex:indexName fieldNames:fieldNames];
+            success = success && [self processUpdateBatch:updateBatch
+                                                  forIndex:indexName
+                                                fieldNames:fieldNames
+                                                    filter:filter];
             [updateBatch removeAllObjects];
             success = success && [self processDeleteBatch:deleteBatch forIndex:indexName];
             [deleteBatch removeAllObjects];
@@ -195,49 +241,296 @@
     return success;
 }
 
+#pragma mark Initial build
+
+- (BOOL)buildIndex:(NSString *)indexName
+        withFields:(NSArray /* NSString */ *)fieldNames
+      upToSequence:(SequenceNumber *)builtSequence
+             error:(NSError *__autoreleasing *)error
+{
+    TD_Database *source = _datastore.database;
+    // Changes after this sequence are left for -updateIndex:withFields:error: to pick up
+    SequenceNumber lastSequence = source.lastSequence;
+
+    NSUInteger workerCount = [NSProcessInfo processInfo].activeProcessorCount;
+    workerCount = MAX(MIN(workerCount, kCDTQMaxBuildWorkers), (NSUInteger)1);
+
+    NSMutableArray *readers = [NSMutableArray arrayWithCapacity:workerCount];
+    for (NSUInteger i = 0; i < workerCount; i++) {
+        FMDatabaseQueue *reader = [source openReadOnlyQueue];
+        if (!reader) {
+            break;
+        }
+        [readers addObject:reader];
+    }
+
+    __block BOOL success = (readers.count > 0);
+
+    if (success) {
+        CDTQUnindexedMatcher *filter = [self partialFilterMatcherForIndex:indexName];
+        NSArray *valueFields = [CDTQIndexUpdater valueFieldsForFieldNames:fieldNames];
+        NSUInteger batchSize = MAX(self.batchSize, (NSUInteger)1);
+
+        // Each worker reads the documents whose winning revision's sequence is in its slice,
+        // so every document is read by exactly one worker.
+        size_t count = readers.count;
+        SequenceNumber sliceSize = lastSequence / (SequenceNumber)count + 1;
+        BOOL *loaded = calloc(count, sizeof(BOOL));
+        dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                       ^(size_t i) {
+                           SequenceNumber after = (SequenceNumber)i * sliceSize;
+                           loaded[i] = [self loadIndex:indexName
+                                           valueFields:valueFields
+                                                filter:filter
+                                        sequencesAfter:after
+                                                  upTo:MIN(after + sliceSize, lastSequence)
+                                             batchSize:batchSize
+                                            fromReader:readers[i]];
+                       });
+        for (size_t i = 0; i < count; i++) {
+            success = success && loaded[i];
+        }
+        free(loaded);
+    }
+
+    for (FMDatabaseQueue *reader in readers) {
+        [reader close];
+    }
+
+    if (success && builtSequence) {
+        *builtSequence = lastSequence;
+    }
+
+    if (!success) {
+        NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+        [_database inDatabase:^(FMDatabase *db) {
+            [db executeUpdate:[NSString stringWithFormat:@"DELETE FROM %@;", tableName]];
+        }];
+
+        if (error) {
+            NSDictionary *userInfo = @{
+                NSLocalizedDescriptionKey : NSLocalizedString(@"Problem building index.", nil)
+            };
+            *error = [NSError errorWithDomain:CDTQIndexManagerErrorDomain
+                                         code:CDTQIndexErrorSqlError
+                                     userInfo:userInfo];
+        }
+        LogError(@"Problem building index %@", indexName);
+    }
+
+    return success;
+}
+
+/**
+ Indexes the documents whose winning revisions have sequences in (after, upTo], reading them
+ with `reader` a batch at a time. Run by the build workers.
+ */
+- (BOOL)loadIndex:(NSString *)indexName
+       valueFields:(NSArray *)valueFields
+            filter:(CDTQUnindexedMatcher *)filter
+    sequencesAfter:(SequenceNumber)after
+              upTo:(SequenceNumber)upTo
+         batchSize:(NSUInteger)batchSize
+        fromReader:(FMDatabaseQueue *)reader
+{
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSMutableArray *columns = [NSMutableArray arrayWithObjects:@"_id", @"_rev", nil];
+    [columns addObjectsFromArray:[CDTQIndexUpdater rowColumnsForValueFields:valueFields]];
+
+    // The winning revision is the current, non-deleted one with the highest revid
+    NSString *sql =
+        @"SELECT docs.docid, revs.revid, revs.sequence, revs.json FROM revs, docs "
+        @"WHERE revs.sequence > ? AND revs.sequence <= ? AND revs.current = 1 "
+        @"AND revs.deleted = 0 AND docs.doc_id = revs.doc_id AND NOT EXISTS ("
+        @"SELECT 1 FROM revs AS other WHERE other.doc_id = revs.doc_id AND other.current = 1 "
+        @"AND other.deleted = 0 AND other.revid > revs.revid) "
+        @"ORDER BY revs.sequence LIMIT ?;";
+
+    while (after < upTo) {
+        @autoreleasepool {
+            __block BOOL success = YES;
+            __block SequenceNumber lastRead = after;
+            NSMutableArray *rows = [NSMutableArray array];
+
+            [reader inDatabase:^(FMDatabase *db) {
+                FMResultSet *rs =
+                    [db executeQuery:sql withArgumentsInArray:@[ @(after), @(upTo), @(batchSize) ]];
+                if (!rs) {
+                    success = NO;
+                    return;
+                }
+                while ([rs next]) {
+                    NSString *docId = [rs stringForColumnIndex:0];
+                    NSString *revId = [rs stringForColumnIndex:1];
+                    lastRead = [rs longLongIntForColumnIndex:2];
+                    NSData *json = [rs dataNoCopyForColumnIndex:3];
+
+                    NSDictionary *body = nil;
+                    if (json.length > 0) {
+                        body = [TDJSON JSONObjectWithData:json options:0 error:nil];
+                    }
+                    CDTDocumentRevision *revision = [[CDTDocumentRevision alloc]
+                        initWithDocId:docId
+                           revisionId:revId
+                                 body:([body isKindOfClass:[NSDictionary class]] ? body : @{})
+                              deleted:NO
+                          attachments:nil
+                             sequence:lastRead];
+
+                    if (filter && ![filter matches:revision]) {
+                        continue;
+                    }
+                    NSArray *revisionRows = [CDTQIndexUpdater rowsToIndexRevision:revision
+                                                                          inIndex:indexName
+                                                                   withFieldNames:valueFields];
+                    for (NSArray *values in revisionRows) {
+                        NSMutableArray *args = [NSMutableArray arrayWithObjects:docId, revId, nil];
+                        [args addObjectsFromArray:values];
+                        [rows addObject:args];
+                    }
+                }
+                [rs close];
+            }];
+
+            if (!success) {
+                LogError(@"Building index %@ failed reading documents", indexName);
+                return NO;
+            }
+            if (lastRead == after) {
+                break;  // no more winning revisions in this slice
+            }
+            after = lastRead;
+
+            // The index database's queue serialises the workers' writes
+            [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+                for (CDTQSqlParts *insert in [CDTQIndexUpdater partsToInsertRows:rows
+                                                                     withColumns:columns
+                                                                         inTable:tableName]) {
+                    success = success && [db executeUpdate:insert.sqlWithPlaceholders
+                                             withArgumentsInArray:insert.placeholderValues];
+                }
+                if (!success) {
+                    *rollback = YES;
+                }
+            }];
+
+            if (!success) {
+                LogError(@"Building index %@ failed writing rows", indexName);
+                return NO;
+            }
+        }
+    }
+
+    return YES;
+}
+
 - (BOOL)processUpdateBatch:(NSArray *)updateBatch
                   forIndex:(NSString *)indexName
                 fieldNames:(NSArray /* NSString */ *)fieldNames
+                    filter:(CDTQUnindexedMatcher *)filter
 {
+    // Only the latest revision of each document matters
+    NSMutableDictionary *revisions = [NSMutableDictionary dictionary];
+    for (CDTDocumentRevision *revision in updateBatch) {
+        revisions[revision.docId] = revision;
+    }
+    if (revisions.count == 0) {
+        return YES;
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSArray *valueFields = [CDTQIndexUpdater valueFieldsForFieldNames:fieldNames];
+
     __block BOOL success = YES;
 
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
 
-        for (CDTDocumentRevision *revision in updateBatch) {
-            // Delete existing values
-            CDTQSqlParts *parts = [CDTQIndexUpdater partsToDeleteIndexEntriesForDocId:revision.docId
-                                                                            fromIndex:indexName];
-            [db executeUpdate:parts.sqlWithPlaceholders
-                withArgumentsInArray:parts.placeholderValues];
-
-            // Insert new values as the rev isn't deleted
-
-            // If we are indexing a document where one field is an array, we
-            // have multiple rows to insert into the index.
-            NSArray *insertStatements = [CDTQIndexUpdater partsToIndexRevision:revision
-                                                                       inIndex:indexName
-                                                                withFieldNames:fieldNames];
-
-            for (CDTQSqlParts *insert in insertStatements) {
-                // partsToIndexRevision:... returns nil if there are no applicable fields to
-                // index
-                if (insert) {
-                    success = success && [db executeUpdate:insert.sqlWithPlaceholders
-                                             withArgumentsInArray:insert.placeholderValues];
-                }
+        NSDictionary *existingRows =
+            [CDTQIndexUpdater rowsForDocIds:revisions.allKeys
+                                    inTable:tableName
+                                 rowColumns:[CDTQIndexUpdater rowColumnsForValueFields:valueFields]
+                                   database:db];
+        if (!existingRows) {
+            LogError(@"Updating index %@ failed reading existing rows", indexName);
+            success = NO;
+            *rollback = YES;
+            return;
+        }
 
-                if (!success) {
-                    LogError(@"Updating index %@ failed, CDTSqlParts: %@", indexName, insert);
-                    break;
+        // Work out which rows have changed. Most updates don't touch indexed fields, so
+        // the existing rows only need their _rev updating.
+        NSMutableArray *rowIdsToDelete = [NSMutableArray array];
+        NSMutableArray *revisionsToUpdate = [NSMutableArray array];
+        NSMutableArray *rowsToInsert = [NSMutableArray array];
+
+        for (CDTDocumentRevision *revision in revisions.allValues) {
+            NSArray *newRows = @[];
+            // A partial index only has rows for documents matching its filter
+            if (!filter || [filter matches:revision]) {
+                newRows = [CDTQIndexUpdater rowsToIndexRevision:revision
+                                                        inIndex:indexName
+                                                 withFieldNames:valueFields] ?: @[];
+            }
+
+            NSMutableArray *unmatched = [existingRows[revision.docId] mutableCopy];
+            BOOL revisionChanged = NO;
+            for (NSArray *values in newRows) {
+                NSUInteger i = [unmatched indexOfObjectPassingTest:^BOOL(
+                                              CDTQIndexRow *row, NSUInteger idx, BOOL *stop) {
+                    return [row.values isEqualToArray:values];
+                }];
+                if (i == NSNotFound) {
+                    NSMutableArray *args = [NSMutableArray arrayWithObjects:revision.docId,
+                                                                           revision.revId, nil];
+                    [args addObjectsFromArray:values];
+                    [rowsToInsert addObject:args];
+                } else {
+                    CDTQIndexRow *row = unmatched[i];
+                    revisionChanged = revisionChanged || ![row.revId isEqual:revision.revId];
+                    [unmatched removeObjectAtIndex:i];
                 }
             }
 
+            for (CDTQIndexRow *row in unmatched) {
+                [rowIdsToDelete addObject:@(row.rowId)];
+            }
+            if (revisionChanged) {
+                [revisionsToUpdate addObject:revision];
+            }
+        }
+
+        // Write the differences, deleting first so that updated _revs apply to kept rows only
+
+        for (CDTQSqlParts *parts in [CDTQIndexUpdater partsToDeleteRowIds:rowIdsToDelete
+                                                                fromTable:tableName]) {
+            success = success && [db executeUpdate:parts.sqlWithPlaceholders
+                                     withArgumentsInArray:parts.placeholderValues];
+        }
+
+        NSString *updateRev =
+            [NSString stringWithFormat:@"UPDATE %@ SET \"_rev\" = ? WHERE \"_id\" = ?;", tableName];
+        for (CDTDocumentRevision *revision in revisionsToUpdate) {
+            success = success && [db executeUpdate:updateRev
+                                     withArgumentsInArray:@[ revision.revId, revision.docId ]];
+        }
+
+        NSMutableArray *columns = [NSMutableArray arrayWithObjects:@"_id", @"_rev", nil];
+        [columns addObjectsFromArray:[CDTQIndexUpdater rowColumnsForValueFields:valueFields]];
+        for (CDTQSqlParts *insert in [CDTQIndexUpdater partsToInsertRows:rowsToInsert
+                                                             withColumns:columns
+                                                                 inTable:tableName]) {
+            success = success && [db executeUpdate:insert.sqlWithPlaceholders
+                                     withArgumentsInArray:insert.placeholderValues];
             if (!success) {
-                // TODO fill in error
-                *rollback = YES;
+                LogError(@"Updating index %@ failed, CDTSqlParts: %@", indexName, insert);
                 break;
             }
         }
+
+        if (!success) {
+            // TODO fill in error
+            *rollback = YES;
+        }
     }];
 
     return success;
@@ -247,14 +540,18 @@
 {
     __block BOOL success = YES;
 
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
 
-        for (NSString *docId in deleteBatch) {
-            // Delete existing values
-            CDTQSqlParts *parts =
-                [CDTQIndexUpdater partsToDeleteIndexEntriesForDocId:docId fromIndex:indexName];
-            [db executeUpdate:parts.sqlWithPlaceholders
-                withArgumentsInArray:parts.placeholderValues];
+        for (NSUInteger i = 0; i < deleteBatch.count; i += kCDTQMaxRowsPerStatement) {
+            NSRange range =
+                NSMakeRange(i, MIN(kCDTQMaxRowsPerStatement, deleteBatch.count - i));
+            NSArray *docIds = [deleteBatch subarrayWithRange:range];
+            NSString *placeholders = [CDTQIndexUpdater placeholders:docIds.count];
+            NSString *sql = [NSString stringWithFormat:@"DELETE FROM %@ WHERE \"_id\" IN (%@);",
+                                                       tableName, placeholders];
+            [db executeUpdate:sql withArgumentsInArray:docIds];
         }
 
     }];
@@ -262,6 +559,201 @@
     return success;
 }
 
+#pragma mark Index rows
+
+/**
+ The indexed fields, other than _id and _rev, in the order their values appear in rows.
+ */
++ (NSArray *)valueFieldsForFieldNames:(NSArray *)fieldNames
+{
+    NSMutableArray *valueFields = [NSMutableArray arrayWithCapacity:fieldNames.count];
+    for (NSString *fieldName in fieldNames) {
+        if (![fieldName isEqualToString:@"_id"] && ![fieldName isEqualToString:@"_rev"]) {
+            [valueFields addObject:fieldName];
+        }
+    }
+    return valueFields;
+}
+
+/**
+ The columns of a row after _id and _rev, in the order rows from -rowsToIndexRevision:... hold
+ them: the indexed fields, then the projectable marker.
+ */
++ (NSArray *)rowColumnsForValueFields:(NSArray *)valueFields
+{
+    return [valueFields arrayByAddingObject:kCDTQIndexProjectableColumnName];
+}
+
++ (NSString *)placeholders:(NSUInteger)count
+{
+    NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [placeholders addObject:@"?"];
+    }
+    return [placeholders componentsJoinedByString:@", "];
+}
+
+/**
+ Returns the rows currently in the index for the documents, keyed by document ID, or nil on
+ error.
+ */
++ (NSDictionary /* NSString -> NSArray[CDTQIndexRow] */ *)rowsForDocIds:(NSArray *)docIds
+                                                                 inTable:(NSString *)tableName
+                                                              rowColumns:(NSArray *)rowColumns
+                                                                database:(FMDatabase *)db
+{
+    NSMutableArray *columns =
+        [NSMutableArray arrayWithObjects:@"rowid", @"\"_id\"", @"\"_rev\"", nil];
+    for (NSString *column in rowColumns) {
+        [columns addObject:[NSString stringWithFormat:@"\"%@\"", column]];
+    }
+
+    NSMutableDictionary *rows = [NSMutableDictionary dictionaryWithCapacity:docIds.count];
+    for (NSUInteger i = 0; i < docIds.count; i += kCDTQMaxRowsPerStatement) {
+        NSRange range = NSMakeRange(i, MIN(kCDTQMaxRowsPerStatement, docIds.count - i));
+        NSArray *chunk = [docIds subarrayWithRange:range];
+        NSString *sql = [NSString stringWithFormat:@"SELECT %@ FROM %@ WHERE \"_id\" IN (%@);",
+                                                   [columns componentsJoinedByString:@", "],
+                                                   tableName,
+                                                   [CDTQIndexUpdater placeholders:chunk.count]];
+        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:chunk];
+        if (!rs) {
+            return nil;
+        }
+        while ([rs next]) {
+            CDTQIndexRow *row = [[CDTQIndexRow alloc] init];
+            row.rowId = [rs longLongIntForColumnIndex:0];
+            row.revId = [rs stringForColumnIndex:2];
+            NSMutableArray *values = [NSMutableArray arrayWithCapacity:rowColumns.count];
+            for (int column = 3; column < (int)columns.count; column++) {
+                [values addObject:[rs objectForColumnIndex:column]];
+            }
+            row.values = values;
+
+            NSString *docId = [rs stringForColumnIndex:1];
+            if (!rows[docId]) {
+                rows[docId] = [NSMutableArray array];
+            }
+            [rows[docId] addObject:row];
+        }
+        [rs close];
+    }
+    return rows;
+}
+
+/**
+ Returns the values of `valueFields` for each row a revision should have in an index, with
+ NSNull for a field the revision doesn't have, followed by the row's projectable marker. A
+ revision has one row per value of its array field, if it has one. Returns nil if it has more
+ than one array field.
+
+ A row is marked projectable when each of its values is a string or a number, as found in the
+ document, so a projection of the indexed fields can be read from it instead of the document.
+ Rows for missing fields, nulls, booleans, objects and array elements aren't, since the index
+ columns can't tell them apart from other values.
+ */
++ (NSArray /* NSArray */ *)rowsToIndexRevision:(CDTDocumentRevision *)rev
+                                       inIndex:(NSString *)indexName
+                                withFieldNames:(NSArray *)valueFields
+{
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:valueFields.count];
+    NSInteger arrayFieldIndex = -1;
+    for (NSString *fieldName in valueFields) {
+        NSObject *value =
+            [CDTQValueExtractor extractValueForFieldName:fieldName fromDictionary:rev.body];
+        if ([value isKindOfClass:[NSArray class]]) {
+            if (arrayFieldIndex >= 0) {
+                LogError(@"Indexing %@ in index %@ includes >1 array field; only array field "
+                         @"per index allowed",
+                         rev.docId, indexName);
+                return nil;
+            }
+            arrayFieldIndex = values.count;
+        }
+        // As with -partsToIndexRevision:..., missing fields and empty arrays are NULL
+        if (!value || ([value isKindOfClass:[NSArray class]] && ((NSArray *)value).count == 0)) {
+            value = [NSNull null];
+        }
+        [values addObject:value];
+    }
+
+    if (arrayFieldIndex < 0 || ![values[arrayFieldIndex] isKindOfClass:[NSArray class]]) {
+        BOOL projectable = arrayFieldIndex < 0;
+        for (NSObject *value in values) {
+            projectable = projectable && [CDTQIndexUpdater isProjectableValue:value];
+        }
+        [values addObject:@(projectable)];
+        return @[ values ];
+    }
+
+    NSMutableArray *rows = [NSMutableArray array];
+    for (NSObject *value in (NSArray *)values[arrayFieldIndex]) {
+        NSMutableArray *row = [values mutableCopy];
+        row[arrayFieldIndex] = value;
+        [row addObject:@NO];
+        [rows addObject:row];
+    }
+    return rows;
+}
+
++ (BOOL)isProjectableValue:(NSObject *)value
+{
+    if ([value isKindOfClass:[NSString class]]) {
+        return YES;
+    }
+    return [value isKindOfClass:[NSNumber class]] &&
+           CFGetTypeID((__bridge CFTypeRef)value) != CFBooleanGetTypeID();
+}
+
++ (NSArray /* CDTQSqlParts */ *)partsToDeleteRowIds:(NSArray *)rowIds
+                                          fromTable:(NSString *)tableName
+{
+    NSMutableArray *statements = [NSMutableArray array];
+    for (NSUInteger i = 0; i < rowIds.count; i += kCDTQMaxRowsPerStatement) {
+        NSRange range = NSMakeRange(i, MIN(kCDTQMaxRowsPerStatement, rowIds.count - i));
+        NSArray *chunk = [rowIds subarrayWithRange:range];
+        NSString *sql = [NSString stringWithFormat:@"DELETE FROM %@ WHERE rowid IN (%@);",
+                                                   tableName,
+                                                   [CDTQIndexUpdater placeholders:chunk.count]];
+        [statements addObject:[CDTQSqlParts partsForSql:sql parameters:chunk]];
+    }
+    return statements;
+}
+
+/**
+ Returns multi-row INSERT statements for the rows, each an array of values for `columns`,
+ keeping within SQLite's default limit of 999 parameters per statement.
+ */
++ (NSArray /* CDTQSqlParts */ *)partsToInsertRows:(NSArray /* NSArray */ *)rows
+                                      withColumns:(NSArray *)columns
+                                          inTable:(NSString *)tableName
+{
+    NSMutableArray *sqlSafeColumns = [NSMutableArray arrayWithCapacity:columns.count];
+    for (NSString *column in columns) {
+        [sqlSafeColumns addObject:[NSString stringWithFormat:@"\"%@\"", column]];
+    }
+    NSString *rowPlaceholders =
+        [NSString stringWithFormat:@"( %@ )", [CDTQIndexUpdater placeholders:columns.count]];
+    NSUInteger rowsPerStatement = MIN(kCDTQMaxRowsPerStatement, 999 / columns.count);
+    rowsPerStatement = MAX(rowsPerStatement, (NSUInteger)1);
+
+    NSMutableArray *statements = [NSMutableArray array];
+    for (NSUInteger i = 0; i < rows.count; i += rowsPerStatement) {
+        NSUInteger n = MIN(rowsPerStatement, rows.count - i);
+        NSMutableArray *values = [NSMutableArray arrayWithCapacity:n];
+        NSMutableArray *args = [NSMutableArray arrayWithCapacity:n * columns.count];
+        for (NSArray *row in [rows subarrayWithRange:NSMakeRange(i, n)]) {
+            [values addObject:rowPlaceholders];
+            [args addObjectsFromArray:row];
+        }
+        NSString *sql = [NSString stringWithFormat:@"INSERT INTO %@ ( %@ ) VALUES %@;", tableName,
+                                                   [sqlSafeColumns componentsJoinedByString:@", "],
+                                                   [values componentsJoinedByString:@", "]];
+        [statements addObject:[CDTQSqlParts partsForSql:sql parameters:args]];
+    }
+    return statements;
+}
+
 + (CDTQSqlParts *)partsToDeleteIndexEntriesForDocId:(NSString *)docId
                                           fromIndex:(NSString *)indexName
 {
@@ -416,6 +908,24 @@
     return [CDTQSqlParts partsForSql:sql parameters:args];
 }
 
+- (CDTQUnindexedMatcher *)partialFilterMatcherForIndex:(NSString *)indexName
+{
+    __block NSString *settings = nil;
+
+    [_database inDatabase:^(FMDatabase *db) {
+        NSString *sql = @"SELECT index_settings FROM %@ WHERE index_name = ? LIMIT 1";
+        sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:@[ indexName ]];
+        if ([rs next]) {
+            settings = [rs stringForColumnIndex:0];
+        }
+        [rs close];
+    }];
+
+    NSDictionary *selector = [CDTQIndex partialFilterSelectorFromSettings:settings];
+    return selector ? [CDTQUnindexedMatcher matcherWithSelector:selector] : nil;
+}
+
 - (SequenceNumber)sequenceNumberForIndex:(NSString *)indexName
 {
     __block SequenceNumber result = 0;
@@ -15,6 +15,7 @@
 #import <Foundation/Foundation.h>
 
 @class CDTDatastore;
+@class CDTQQueryPlanCache;
 @class CDTQResultSet;
 @class CDTQSqlParts;
 @class FMDatabaseQueue;
@@ -30,6 +31,24 @@
  */
 - (instancetype)initWithDatabase:(FMDatabaseQueue *)database datastore:(CDTDatastore *)datastore;
 
+/**
+ Whether projections may be built from index rows; see CDTQIndexManager.
+ */
+@property (nonatomic) BOOL indexOnlyProjection;
+
+/**
+ If set, query plans are looked up in and added to this cache, so that queries with the same
+ shape as an earlier one only need their values binding into its SQL.
+ */
+@property (nonatomic, strong) CDTQQueryPlanCache *planCache;
+
+/**
+ Identifies the set of indexes passed to -find:usingIndexes:skip:limit:fields:sort: to the
+ plan cache, which only reuses plans made for the same generation. It must change whenever
+ the indexes do.
+ */
+@property (nonatomic) NSInteger indexGeneration;
+
 /**
  Execute the query passed using the selection of index definition provided.
 
@@ -61,4 +80,19 @@
                     usingOrder:(NSArray /*NSDictionary*/ *)sortDocument
                        indexes:(NSDictionary *)indexes;
 
+/**
+ Return the name of a json index containing all the projected fields, or nil.
+ */
++ (NSString *)chooseIndexForProjection:(NSArray /*NSString*/ *)fields
+                           fromIndexes:(NSDictionary *)indexes;
+
+/**
+ Return the indexes which may be used to answer the normalised `selector`: every index
+ without a partial filter selector, and the partial indexes whose filter the selector implies.
+
+ A selector implies a filter when each of the filter's clauses appears in the selector's
+ top-level `$and`, or in every branch of its `$or`.
+ */
++ (NSDictionary *)indexes:(NSDictionary *)indexes usableForSelector:(NSDictionary *)selector;
+
 @end
@@ -14,7 +14,9 @@
 
 #import "CDTQQueryExecutor.h"
 
+#import "CDTQIndex.h"
 #import "CDTQIndexManager.h"
+#import "CDTQIndexCreator.h"
 #import "CDTQResultSet.h"
 #import "CDTQQuerySqlTranslator.h"
 #import "CDTQLogging.h"
@@ -22,6 +24,8 @@
 #import "CDTDatastore.h"
 #import "CDTDocumentRevision.h"
 #import "CDTQQueryValidator.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQueryPlanCache.h"
 
 #import <FMDB/FMDB.h>
 
@@ -31,6 +35,7 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
 
 @property (nonatomic, strong) FMDatabaseQueue *database;
 @property (nonatomic, strong) CDTDatastore *datastore;
+@property (nonatomic, strong) NSArray *allDocumentIds;  // for query nodes without SQL
 
 @end
 
@@ -69,35 +74,91 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         return nil;  // validate logs error message
     }
 
-    // normailse and validate query by passing into the executors
-
-    query = [CDTQQueryValidator normaliseAndValidateQuery:query];
+    // Queries differing only in the values they compare fields with share a plan, which
+    // just needs binding to this query's values. Whether a partial index can be used depends
+    // on the values in the selector, so those queries are always planned afresh.
+    CDTQQueryShape *shape = nil;
+    if (self.planCache && ![CDTQQueryExecutor hasPartialIndexes:indexes]) {
+        shape = [CDTQQueryShape shapeOfSelector:query];
+    }
 
-    if (!query) {
-        return nil;
+    CDTQQueryPlan *plan = [self.planCache planForShape:shape
+                                       indexGeneration:self.indexGeneration];
+    if (!plan) {
+        plan = [self planForSelector:(shape ? shape.selector : query) indexes:indexes];
+        if (!plan) {
+            return nil;
+        }
+        [self.planCache addPlan:plan forShape:shape indexGeneration:self.indexGeneration];
     }
 
-    //
-    // Execute the query
-    //
+    indexes = plan.indexes;
 
     // YES if we need to run posthoc matcher
-    BOOL indexesCoverQuery;
+    BOOL indexesCoverQuery = plan.indexesCoverQuery;
 
-    CDTQChildrenQueryNode *root;
-    root = [self translateQuery:query indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+    CDTQChildrenQueryNode *root = shape ? [shape bindQueryTree:plan.root] : plan.root;
 
-    if (!root) {
-        return nil;
+    // The matcher needs the selector's values; it's not used when indexes cover the query
+    query = plan.selector;
+    if (shape && !indexesCoverQuery) {
+        query = [shape bind:query];
     }
 
+    // Text clauses aren't parameterised, so the plan's selector holds the search itself
+    NSDictionary *textClause = [CDTQQuerySqlTranslator textClauseInSelector:plan.selector];
+    NSString *textIndex =
+        textClause ? [CDTQQuerySqlTranslator getTextIndexFromIndexes:indexes] : nil;
+
+    NSString *rankOrder = [CDTQQueryExecutor rankOrderInSortDocument:sortDocument];
+    if (rankOrder && ![CDTQQueryExecutor canSortByRank:sortDocument
+                                          usingTextIndex:textIndex
+                                                 indexes:indexes]) {
+        return nil;  // logs the reason
+    }
+
+    // When the text search is the whole query SQLite can apply the limit, so only the top
+    // results are read from the index rather than every hit. Sorting by anything but rank
+    // needs every hit, so it's left to -sortIds:.
+    NSArray *andClauses = plan.selector[AND];
+    BOOL pushLimitToText = textIndex && indexesCoverQuery && limit > 0 &&
+                           andClauses.count == 1 && andClauses[0][TEXT] != nil &&
+                           (sortDocument.count == 0 || rankOrder != nil);
+
+    //
+    // Execute the query
+    //
+
     __block NSArray *docIds;
 
+    // A colocated index database is the datastore's own queue, which can't be used from
+    // within the transaction below, so any document IDs needed from the datastore are
+    // read first.
+    if (!pushLimitToText && [CDTQQueryExecutor queryTreeNeedsAllDocumentIds:root]) {
+        self.allDocumentIds = [self.datastore getAllDocumentIds] ?: @[];
+    }
+
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        if (pushLimitToText) {
+            CDTQSqlParts *select =
+                [CDTQQuerySqlTranslator selectStatementForTextClause:textClause
+                                                          usingIndex:textIndex
+                                                           rankOrder:rankOrder
+                                                               limit:skip + limit];
+            docIds = [CDTQQueryExecutor idsForQuery:select inDatabase:db];
+            return;
+        }
+
         NSSet *docIdSet = [self executeQueryTree:root inDatabase:db];
 
         // sorting
-        if (sortDocument != nil && sortDocument.count > 0) {
+        if (rankOrder) {
+            docIds = [CDTQQueryExecutor rankIds:docIdSet
+                                  byTextClause:textClause
+                                    usingIndex:textIndex
+                                         order:rankOrder
+                                    inDatabase:db];
+        } else if (sortDocument != nil && sortDocument.count > 0) {
             docIds = [CDTQQueryExecutor sortIds:docIdSet
                                       usingSort:sortDocument
                                         indexes:indexes
@@ -116,11 +177,20 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
 
     if (matcher) {
         LogWarn(@"Query could not be executed using indexes alone; falling back to filtering "
-                @"documents themselves. This will be VERY SLOW as each candidate document is "
-                @"loaded from the datastore and matched against the query selector.");
+                @"documents themselves. Where SQLite can match the selector against the stored "
+                @"JSON this is done in the datastore; otherwise it will be VERY SLOW as each "
+                @"candidate document is loaded and matched against the query selector.");
+    }
+
+    // When every projected field is in an index, the results can be read from the index rather
+    // than loading each document, as long as we don't need the documents to match against.
+    NSString *projectionIndex = nil;
+    if (self.indexOnlyProjection && fields && !matcher) {
+        projectionIndex = [CDTQQueryExecutor chooseIndexForProjection:fields fromIndexes:indexes];
     }
 
     CDTDatastore *ds = self.datastore;
+    FMDatabaseQueue *database = self.database;
     return [CDTQResultSet resultSetWithBlock:^(CDTQResultSetBuilder *b) {
         b.docIds = docIds;
         b.datastore = ds;
@@ -128,9 +198,48 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         b.skip = skip;
         b.limit = limit;
         b.matcher = matcher;
+        if (projectionIndex) {
+            b.projectionIndex = projectionIndex;
+            b.database = database;
+        }
     }];
 }
 
+/**
+ Normalises and validates the selector, then translates it to use the indexes. Returns nil
+ if the selector is invalid or can't be translated.
+ */
+- (CDTQQueryPlan *)planForSelector:(NSDictionary *)selector indexes:(NSDictionary *)indexes
+{
+    // normailse and validate query by passing into the executors
+
+    selector = [CDTQQueryValidator normaliseAndValidateQuery:selector];
+
+    if (!selector) {
+        return nil;
+    }
+
+    // Partial indexes don't hold every document, so they can only be used when the query
+    // can't match anything outside them.
+    indexes = [CDTQQueryExecutor indexes:indexes usableForSelector:selector];
+
+    BOOL indexesCoverQuery;
+
+    CDTQChildrenQueryNode *root;
+    root = [self translateQuery:selector indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+
+    if (!root) {
+        return nil;
+    }
+
+    CDTQQueryPlan *plan = [[CDTQQueryPlan alloc] init];
+    plan.selector = selector;
+    plan.indexes = indexes;
+    plan.root = root;
+    plan.indexesCoverQuery = indexesCoverQuery;
+    return plan;
+}
+
 // Method exists so we can override it in testing (to force indexesCoverQuery to false)
 - (CDTQChildrenQueryNode *)translateQuery:(NSDictionary *)query
                                   indexes:(NSDictionary *)indexes
@@ -150,6 +259,66 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
     return indexesCoverQuery ? nil : [CDTQUnindexedMatcher matcherWithSelector:selector];
 }
 
+#pragma mark Partial indexes
+
++ (NSDictionary *)indexes:(NSDictionary *)indexes usableForSelector:(NSDictionary *)selector
+{
+    NSMutableDictionary *usable = [NSMutableDictionary dictionaryWithCapacity:indexes.count];
+    for (NSString *indexName in indexes) {
+        NSDictionary *filter =
+            [CDTQIndex partialFilterSelectorFromSettings:indexes[indexName][@"settings"]];
+        if (!filter || [CDTQQueryExecutor selector:selector impliesFilter:filter]) {
+            usable[indexName] = indexes[indexName];
+        }
+    }
+    return usable;
+}
+
++ (BOOL)hasPartialIndexes:(NSDictionary *)indexes
+{
+    for (NSString *indexName in indexes) {
+        if ([CDTQIndex partialFilterSelectorFromSettings:indexes[indexName][@"settings"]]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
++ (BOOL)selector:(NSDictionary *)selector impliesFilter:(NSDictionary *)filter
+{
+    // Normalised filters are an $and or $or of clauses; an $or filter is only implied when
+    // it appears whole in the selector.
+    NSArray *filterClauses = filter[AND] ?: @[ filter ];
+    for (NSDictionary *filterClause in filterClauses) {
+        if (![CDTQQueryExecutor selector:selector impliesClause:filterClause]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
++ (BOOL)selector:(NSDictionary *)selector impliesClause:(NSDictionary *)clause
+{
+    BOOL isOr = (selector[OR] != nil);
+    NSArray *clauses = selector[AND] ?: selector[OR];
+    if (clauses.count == 0) {
+        return NO;
+    }
+
+    for (NSDictionary *subClause in clauses) {
+        BOOL implied =
+            [subClause isEqual:clause] ||
+            ((subClause[AND] || subClause[OR]) &&
+             [CDTQQueryExecutor selector:subClause impliesClause:clause]);
+        if (implied && !isOr) {
+            return YES;  // one clause of an $and is enough
+        } else if (!implied && isOr) {
+            return NO;  // every branch of an $or must imply it
+        }
+    }
+    return isOr;
+}
+
 #pragma mark Validation helpers
 
 + (BOOL)validateSortDocument:(NSArray /*NSDictionary*/ *)sortDocument
@@ -267,7 +436,7 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         } else {
             // No SQL exists so we are now forced to go directly to the
             // document datastore to retrieve the list of document ids.
-            docIds = [NSMutableArray arrayWithArray:[self.datastore getAllDocumentIds]];
+            docIds = [NSMutableArray arrayWithArray:self.allDocumentIds];
         }
 
         return [NSSet setWithArray:docIds];
@@ -276,8 +445,95 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
     }
 }
 
+/** Returns YES if any SQL node in the tree has no SQL, so matches every document. */
++ (BOOL)queryTreeNeedsAllDocumentIds:(CDTQQueryNode *)node
+{
+    if ([node isKindOfClass:[CDTQChildrenQueryNode class]]) {
+        for (CDTQQueryNode *child in ((CDTQChildrenQueryNode *)node).children) {
+            if ([CDTQQueryExecutor queryTreeNeedsAllDocumentIds:child]) {
+                return YES;
+            }
+        }
+        return NO;
+    }
+    return [node isKindOfClass:[CDTQSqlQueryNode class]] && !((CDTQSqlQueryNode *)node).sql;
+}
+
 #pragma mark Sorting
 
+/**
+ Returns the direction of a sort by text search rank, `@{ @"$text" : @"desc" }`, or nil if
+ `sortDocument` isn't sorting by rank.
+ */
++ (NSString *)rankOrderInSortDocument:(NSArray /*NSDictionary*/ *)sortDocument
+{
+    for (NSDictionary *orderClause in sortDocument) {
+        if (orderClause[TEXT]) {
+            return orderClause[TEXT];
+        }
+    }
+    return nil;
+}
+
++ (BOOL)canSortByRank:(NSArray /*NSDictionary*/ *)sortDocument
+       usingTextIndex:(NSString *)textIndex
+              indexes:(NSDictionary *)indexes
+{
+    if (sortDocument.count > 1) {
+        LogError(@"Sorting by text search rank can't be combined with other fields, %@",
+                 sortDocument);
+        return NO;
+    }
+    if (!textIndex) {
+        LogError(@"Sorting by text search rank needs a text search clause and a text index.");
+        return NO;
+    }
+    if (![CDTQIndex isFTS5TextIndexWithSettings:indexes[textIndex][@"settings"]]) {
+        LogError(@"Sorting by text search rank needs an FTS5 text index, %@ is FTS4.",
+                 textIndex);
+        return NO;
+    }
+    return YES;
+}
+
+/**
+ Return the document IDs in `docIdSet` ordered by how well they match a text clause. Any not
+ matching the text clause, from another branch of an $or, come after those which do.
+ */
++ (NSArray *)rankIds:(NSSet /*NSString*/ *)docIdSet
+        byTextClause:(NSDictionary *)textClause
+          usingIndex:(NSString *)textIndex
+               order:(NSString *)direction
+          inDatabase:(FMDatabase *)db
+{
+    CDTQSqlParts *select = [CDTQQuerySqlTranslator selectStatementForTextClause:textClause
+                                                                     usingIndex:textIndex
+                                                                      rankOrder:direction
+                                                                          limit:0];
+    NSMutableArray *rankedIds = [NSMutableArray arrayWithCapacity:docIdSet.count];
+    NSMutableSet *unrankedIds = [NSMutableSet setWithSet:docIdSet];
+    for (NSString *candidateId in [CDTQQueryExecutor idsForQuery:select inDatabase:db]) {
+        if ([unrankedIds containsObject:candidateId]) {
+            [rankedIds addObject:candidateId];
+            [unrankedIds removeObject:candidateId];
+        }
+    }
+    [rankedIds addObjectsFromArray:[unrankedIds allObjects]];
+    return rankedIds;
+}
+
++ (NSArray *)idsForQuery:(CDTQSqlParts *)select inDatabase:(FMDatabase *)db
+{
+    NSMutableArray *docIds = [NSMutableArray array];
+    FMResultSet *rs =
+        [db executeQuery:select.sqlWithPlaceholders withArgumentsInArray:select.placeholderValues];
+    while ([rs next]) {
+        [docIds addObject:[rs stringForColumnIndex:0]];
+    }
+    [rs close];
+    return docIds;
+}
+
 /**
  Return ordered list of document IDs using provided indexes.
 
@@ -405,16 +661,57 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         return nil;  // no point in querying empty set of fields
     }
 
+    NSMutableArray *orderedFields = [NSMutableArray array];
+    for (NSDictionary *orderSpecifier in sortDocument) {
+        [orderedFields addObject:[orderSpecifier allKeys][0]];
+    }
+
+    // Prefer an index whose leading columns are the sort fields in order, so SQLite
+    // can read rows in index order rather than sorting them.
     NSString *chosenIndex = nil;
     for (NSString *indexName in indexes) {
-        NSSet *providedFields = [NSSet setWithArray:indexes[indexName][@"fields"]];
+        NSArray *fields = indexes[indexName][@"fields"];
+        NSSet *providedFields = [NSSet setWithArray:fields];
         if ([neededFields isSubsetOfSet:providedFields]) {
-            chosenIndex = indexName;
-            break;
+            NSArray *columns = [CDTQIndexCreator indexColumnsForFieldNames:fields];
+            if (columns.count >= orderedFields.count &&
+                [[columns subarrayWithRange:NSMakeRange(0, orderedFields.count)]
+                    isEqualToArray:orderedFields]) {
+                chosenIndex = indexName;
+                break;
+            } else if (!chosenIndex) {
+                chosenIndex = indexName;
+            }
         }
     }
 
     return chosenIndex;
 }
 
++ (NSString *)chooseIndexForProjection:(NSArray /*NSString*/ *)fields
+                           fromIndexes:(NSDictionary *)indexes
+{
+    // _id and _rev aren't body fields, so a projection containing them isn't read from the
+    // index columns of the same name.
+    NSSet *neededFields = [NSSet setWithArray:fields];
+    if (neededFields.count == 0 || [neededFields containsObject:@"_id"] ||
+        [neededFields containsObject:@"_rev"]) {
+        return nil;
+    }
+
+    for (NSString *indexName in indexes) {
+        NSString *indexType = indexes[indexName][@"type"];
+        if ([indexType.lowercaseString isEqualToString:@"text"]) {
+            continue;
+        }
+
+        NSSet *providedFields = [NSSet setWithArray:indexes[indexName][@"fields"]];
+        if ([neededFields isSubsetOfSet:providedFields]) {
+            return indexName;
+        }
+    }
+
+    return nil;
+}
+
 @end
@@ -0,0 +1,87 @@
+//
+//  CDTQQueryPlanCache.h
+//
+//  Copyright (c) 2015 Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class CDTQChildrenQueryNode;
+
+/**
+ A selector with its literal values taken out, so that queries differing only in the values
+ they compare fields with share a shape.
+
+ The values of fields and of the $eq, $ne, $lt, $lte, $gt, $gte, $in and $nin operators are
+ replaced by parameters: strings and numbers which stand for the values and are mapped back
+ to them by -bind:. Booleans, nulls and the arguments of other operators, which change the
+ SQL a selector translates to, are left in the shape.
+ */
+@interface CDTQQueryShape : NSObject
+
+/**
+ Returns the shape of a selector as passed to -find:, or nil if a literal in it could be
+ mistaken for a parameter.
+ */
++ (instancetype)shapeOfSelector:(NSDictionary *)selector;
+
+/** The selector with its values replaced by parameters. */
+@property (nonatomic, strong, readonly) NSDictionary *selector;
+
+/** The values taken out of the selector, in the order of their parameters. */
+@property (nonatomic, strong, readonly) NSArray *values;
+
+/** The shape's selector as canonical JSON, which is the same for selectors of the same shape. */
+@property (nonatomic, strong, readonly) NSString *canonicalSelector;
+
+/**
+ Returns a copy of `object`, which may be a dictionary, an array or a single value, with
+ any of this shape's parameters within it replaced by their values.
+ */
+- (id)bind:(id)object;
+
+/** Returns a copy of a query tree with the parameters in its SQL replaced by their values. */
+- (CDTQChildrenQueryNode *)bindQueryTree:(CDTQChildrenQueryNode *)root;
+
+@end
+
+/**
+ A normalised selector translated to a query tree, ready to be bound to the values of a
+ particular query.
+ */
+@interface CDTQQueryPlan : NSObject
+
+@property (nonatomic, strong) NSDictionary *selector;
+@property (nonatomic, strong) NSDictionary *indexes;
+@property (nonatomic, strong) CDTQChildrenQueryNode *root;
+@property (nonatomic) BOOL indexesCoverQuery;
+
+@end
+
+/**
+ Remembers the plans for the most recently used query shapes, so that repeated queries
+ needn't be normalised and translated again. Thread-safe.
+ */
+@interface CDTQQueryPlanCache : NSObject
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ Returns the plan for the shape over a set of indexes, or nil. The set is identified by a
+ generation number, which must change whenever the indexes do.
+ */
+- (CDTQQueryPlan *)planForShape:(CDTQQueryShape *)shape indexGeneration:(NSInteger)generation;
+
+/** Remembers the plan, evicting the least recently used if the cache is full. */
+- (void)addPlan:(CDTQQueryPlan *)plan
+           forShape:(CDTQQueryShape *)shape
+    indexGeneration:(NSInteger)generation;
+
+@end
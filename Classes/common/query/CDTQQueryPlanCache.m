@@ -0,0 +1,323 @@
+//
+//  CDTQQueryPlanCache.m
+//
+//  Copyright (c) 2015 Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQQueryPlanCache.h"
+
+#import "CDTQIndexManager.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQuerySqlTranslator.h"
+
+#import "TDCanonicalJSON.h"
+
+// String parameters are this prefix followed by the parameter's number. U+FFFF is a
+// noncharacter, so it won't turn up in real values.
+static NSString *const kCDTQParameterPrefix = @"\uFFFFcdtq-parameter-";
+
+// Number parameters are multiples of this, far beyond any value a query compares with.
+static const double kCDTQNumberParameterBase = -1.0e300;
+
+@interface CDTQQueryShape ()
+
+@property (nonatomic, strong, readwrite) NSDictionary *selector;
+@property (nonatomic, strong, readwrite) NSArray *values;
+@property (nonatomic, strong, readwrite) NSString *canonicalSelector;
+@property (nonatomic, strong) NSDictionary *valuesByParameter;
+@property (nonatomic, strong) NSMutableArray *parameterList;
+@property (nonatomic, strong) NSMutableArray *valueList;
+
+@end
+
+@implementation CDTQQueryShape
+
++ (instancetype)shapeOfSelector:(NSDictionary *)selector
+{
+    if (![selector isKindOfClass:[NSDictionary class]]) {
+        return nil;
+    }
+
+    CDTQQueryShape *shape = [[CDTQQueryShape alloc] init];
+    shape.parameterList = [NSMutableArray array];
+    shape.valueList = [NSMutableArray array];
+    shape.selector = [shape parameteriseSelector:selector];
+    if (!shape.selector) {
+        return nil;
+    }
+    shape.values = [shape.valueList copy];
+    shape.canonicalSelector = [TDCanonicalJSON canonicalString:shape.selector];
+    shape.valuesByParameter = [NSDictionary dictionaryWithObjects:shape.valueList
+                                                          forKeys:shape.parameterList];
+    shape.parameterList = nil;
+    shape.valueList = nil;
+    return shape;
+}
+
+/**
+ Returns YES for a string or a number other than a boolean: the values which are compared
+ with fields.
+ */
++ (BOOL)isParameterisableValue:(NSObject *)value
+{
+    if ([value isKindOfClass:[NSString class]]) {
+        return YES;
+    }
+    return [value isKindOfClass:[NSNumber class]] &&
+           CFGetTypeID((__bridge CFTypeRef)value) != CFBooleanGetTypeID();
+}
+
+/** Returns YES if a value left in the shape would be taken for a parameter when binding. */
++ (BOOL)looksLikeParameter:(NSObject *)value
+{
+    if ([value isKindOfClass:[NSString class]]) {
+        return [(NSString *)value hasPrefix:kCDTQParameterPrefix];
+    }
+    return [CDTQQueryShape isParameterisableValue:value] &&
+           [(NSNumber *)value doubleValue] <= kCDTQNumberParameterBase;
+}
+
+- (NSObject *)parameterForValue:(NSObject *)value
+{
+    NSUInteger i = self.parameterList.count;
+    NSObject *parameter;
+    if ([value isKindOfClass:[NSString class]]) {
+        parameter = [NSString stringWithFormat:@"%@%lu", kCDTQParameterPrefix, (unsigned long)i];
+    } else {
+        parameter = @(kCDTQNumberParameterBase * (double)(i + 1));
+    }
+    [self.parameterList addObject:parameter];
+    [self.valueList addObject:value];
+    return parameter;
+}
+
+/**
+ Copies a dictionary of field names, $and, $or and $not, replacing the values of fields
+ with parameters.
+ */
+- (NSDictionary *)parameteriseSelector:(NSDictionary *)selector
+{
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithCapacity:selector.count];
+    for (NSString *key in selector) {
+        NSObject *value = selector[key];
+        NSObject *shaped;
+        if (![key isKindOfClass:[NSString class]]) {
+            shaped = [self literal:value];
+        } else if ([key isEqualToString:AND] || [key isEqualToString:OR]) {
+            shaped = [self parameteriseClauses:value];
+        } else if ([key hasPrefix:@"$"]) {
+            shaped = [self literal:value];
+        } else if ([value isKindOfClass:[NSDictionary class]]) {
+            shaped = [self parameterisePredicate:(NSDictionary *)value];
+        } else if ([CDTQQueryShape isParameterisableValue:value]) {
+            shaped = [self parameterForValue:value];
+        } else {
+            shaped = [self literal:value];
+        }
+        if (!shaped) {
+            return nil;
+        }
+        result[key] = shaped;
+    }
+    return result;
+}
+
+- (NSArray *)parameteriseClauses:(NSObject *)clauses
+{
+    if (![clauses isKindOfClass:[NSArray class]]) {
+        return [self literal:clauses];
+    }
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:((NSArray *)clauses).count];
+    for (NSObject *clause in (NSArray *)clauses) {
+        NSObject *shaped = [clause isKindOfClass:[NSDictionary class]]
+                               ? [self parameteriseSelector:(NSDictionary *)clause]
+                               : [self literal:clause];
+        if (!shaped) {
+            return nil;
+        }
+        [result addObject:shaped];
+    }
+    return result;
+}
+
+/** Copies the operators applied to a field, replacing the values compared with parameters. */
+- (NSDictionary *)parameterisePredicate:(NSDictionary *)predicate
+{
+    NSArray *comparisons = @[ EQ, NE, LT, LTE, GT, GTE ];
+
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithCapacity:predicate.count];
+    for (NSString *operator in predicate) {
+        NSObject *value = predicate[operator];
+        NSObject *shaped;
+        if ([operator isEqual:NOT] && [value isKindOfClass:[NSDictionary class]]) {
+            shaped = [self parameterisePredicate:(NSDictionary *)value];
+        } else if ([comparisons containsObject:operator] &&
+                   [CDTQQueryShape isParameterisableValue:value]) {
+            shaped = [self parameterForValue:value];
+        } else if (([operator isEqual:IN] || [operator isEqual:NIN]) &&
+                   [value isKindOfClass:[NSArray class]]) {
+            NSMutableArray *list = [NSMutableArray arrayWithCapacity:((NSArray *)value).count];
+            for (NSObject *item in (NSArray *)value) {
+                NSObject *shapedItem = [CDTQQueryShape isParameterisableValue:item]
+                                           ? [self parameterForValue:item]
+                                           : [self literal:item];
+                if (!shapedItem) {
+                    return nil;
+                }
+                [list addObject:shapedItem];
+            }
+            shaped = list;
+        } else {
+            shaped = [self literal:value];
+        }
+        if (!shaped) {
+            return nil;
+        }
+        result[operator] = shaped;
+    }
+    return result;
+}
+
+/** Returns a value which stays in the shape, or nil if it could be taken for a parameter. */
+- (NSObject *)literal:(NSObject *)value
+{
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        for (NSObject *key in (NSDictionary *)value) {
+            if (![self literal:key] || ![self literal:((NSDictionary *)value)[key]]) {
+                return nil;
+            }
+        }
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        for (NSObject *item in (NSArray *)value) {
+            if (![self literal:item]) {
+                return nil;
+            }
+        }
+    } else if ([CDTQQueryShape looksLikeParameter:value]) {
+        return nil;
+    }
+    return value;
+}
+
+- (id)bind:(id)object
+{
+    if ([object isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *dictionary = (NSDictionary *)object;
+        NSMutableDictionary *bound = [NSMutableDictionary dictionaryWithCapacity:dictionary.count];
+        for (id key in dictionary) {
+            bound[key] = [self bind:dictionary[key]];
+        }
+        return bound;
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        NSMutableArray *bound = [NSMutableArray arrayWithCapacity:((NSArray *)object).count];
+        for (id item in (NSArray *)object) {
+            [bound addObject:[self bind:item]];
+        }
+        return bound;
+    } else if (object) {
+        return self.valuesByParameter[object] ?: object;
+    }
+    return nil;
+}
+
+- (CDTQChildrenQueryNode *)bindQueryTree:(CDTQChildrenQueryNode *)root
+{
+    return (CDTQChildrenQueryNode *)[self bindQueryNode:root];
+}
+
+- (CDTQQueryNode *)bindQueryNode:(CDTQQueryNode *)node
+{
+    if ([node isKindOfClass:[CDTQChildrenQueryNode class]]) {
+        CDTQChildrenQueryNode *bound = [[[node class] alloc] init];
+        for (CDTQQueryNode *child in ((CDTQChildrenQueryNode *)node).children) {
+            [bound.children addObject:[self bindQueryNode:child]];
+        }
+        return bound;
+    } else if ([node isKindOfClass:[CDTQSqlQueryNode class]]) {
+        CDTQSqlParts *sql = ((CDTQSqlQueryNode *)node).sql;
+        CDTQSqlQueryNode *bound = [[CDTQSqlQueryNode alloc] init];
+        if (sql) {
+            bound.sql = [CDTQSqlParts partsForSql:sql.sqlWithPlaceholders
+                                       parameters:[self bind:sql.placeholderValues]];
+        }
+        return bound;
+    }
+    return node;
+}
+
+@end
+
+@implementation CDTQQueryPlan
+
+@end
+
+@implementation CDTQQueryPlanCache {
+    NSUInteger _capacity;
+    NSMutableDictionary *_plans;  // "generation:canonical selector" -> CDTQQueryPlan
+    NSMutableOrderedSet *_keys;    // least recently used first
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        _capacity = MAX(capacity, (NSUInteger)1);
+        _plans = [NSMutableDictionary dictionaryWithCapacity:_capacity];
+        _keys = [NSMutableOrderedSet orderedSetWithCapacity:_capacity];
+    }
+    return self;
+}
+
++ (NSString *)keyForShape:(CDTQQueryShape *)shape indexGeneration:(NSInteger)generation
+{
+    return [NSString stringWithFormat:@"%ld:%@", (long)generation, shape.canonicalSelector];
+}
+
+- (CDTQQueryPlan *)planForShape:(CDTQQueryShape *)shape indexGeneration:(NSInteger)generation
+{
+    if (!shape) {
+        return nil;
+    }
+
+    NSString *key = [CDTQQueryPlanCache keyForShape:shape indexGeneration:generation];
+    @synchronized(self)
+    {
+        CDTQQueryPlan *plan = _plans[key];
+        if (plan) {
+            [_keys removeObject:key];
+            [_keys addObject:key];
+        }
+        return plan;
+    }
+}
+
+- (void)addPlan:(CDTQQueryPlan *)plan
+           forShape:(CDTQQueryShape *)shape
+    indexGeneration:(NSInteger)generation
+{
+    if (!plan || !shape) {
+        return;
+    }
+
+    NSString *key = [CDTQQueryPlanCache keyForShape:shape indexGeneration:generation];
+    @synchronized(self)
+    {
+        if (_plans[key]) {
+            [_keys removeObject:key];
+        } else if (_keys.count >= _capacity) {
+            [_plans removeObjectForKey:_keys[0]];
+            [_keys removeObjectAtIndex:0];
+        }
+        _plans[key] = plan;
+        [_keys addObject:key];
+    }
+}
+
+@end
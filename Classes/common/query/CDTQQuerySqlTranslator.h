@@ -164,4 +164,41 @@
  */
 + (CDTQSqlParts *)selectStatementForAndClause:(NSArray *)clause usingIndex:(NSString *)indexName;
 
+/**
+ Returns the name of the text index in `indexes`, or nil if there isn't one.
+ */
++ (NSString *)getTextIndexFromIndexes:(NSDictionary *)indexes;
+
+/**
+ Returns the text clause, `@{ @"$text" : @{ @"$search" : ... } }`, in a normalised selector,
+ or nil if it doesn't have one.
+ */
++ (NSDictionary *)textClauseInSelector:(NSDictionary *)selector;
+
+/**
+ Returns the SQL statement to find document IDs matching a text clause, ordered by their
+ bm25() rank when `direction` isn't nil, `desc` putting the best matches first, and returning
+ at most `limit` IDs when it isn't 0. Ranking needs an FTS5 index.
+
+ @param textClause the text clause being executed.
+ @param indexName the text index to search
+ @param direction `asc`, `desc` or nil
+ @param limit the maximum number of IDs, or 0 for all of them
+ */
++ (CDTQSqlParts *)selectStatementForTextClause:(NSDictionary *)textClause
+                                    usingIndex:(NSString *)indexName
+                                     rankOrder:(NSString *)direction
+                                         limit:(NSUInteger)limit;
+
+/**
+ Returns an SQL expression which is true when a document matches the normalised `selector`,
+ evaluated over the `docs` and `revs` tables of a datastore using SQLite's JSON functions on
+ the revision's stored JSON, or nil if the selector uses something which can't be expressed
+ this way.
+
+ Values are compared as CDTQUnindexedMatcher compares them: an array matches if any of its
+ values does, except for $size and $mod which look at the value itself.
+ */
++ (CDTQSqlParts *)jsonWherePartsForSelector:(NSDictionary *)selector;
+
 @end
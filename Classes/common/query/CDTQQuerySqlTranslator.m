@@ -17,6 +17,7 @@
 
 #import "CDTQQueryExecutor.h"
 #import "CDTQIndexManager.h"
+#import "CDTQIndexCreator.h"
 #import "CDTQLogging.h"
 #import "CDTQQueryValidator.h"
 
@@ -30,6 +31,10 @@
 
 @end
 
+// The JSON of the revision in the datastore's revs table, which the JSON functions won't
+// accept as a BLOB.
+static NSString *const kCDTQRevisionJSON = @"CAST(revs.json AS TEXT)";
+
 @implementation CDTQQueryNode
 
 @end
@@ -333,6 +338,8 @@
 
 + (NSString *)chooseIndexForFields:(NSSet *)neededFields fromIndexes:(NSDictionary *)indexes
 {
+    // Prefer an index whose leading column is one of the needed fields, as SQLite
+    // can seek on that rather than scanning the whole index.
     NSString *chosenIndex = nil;
     for (NSString *indexName in indexes) {
         
@@ -342,10 +349,16 @@
             continue;
         }
         
-        NSSet *providedFields = [NSSet setWithArray:indexes[indexName][@"fields"]];
+        NSArray *fields = indexes[indexName][@"fields"];
+        NSSet *providedFields = [NSSet setWithArray:fields];
         if ([neededFields isSubsetOfSet:providedFields]) {
-            chosenIndex = indexName;
-            break;
+            NSArray *columns = [CDTQIndexCreator indexColumnsForFieldNames:fields];
+            if ([neededFields containsObject:columns.firstObject]) {
+                chosenIndex = indexName;
+                break;
+            } else if (!chosenIndex) {
+                chosenIndex = indexName;
+            }
         }
     }
 
@@ -579,6 +592,17 @@
 
 + (CDTQSqlParts *)selectStatementForTextClause:(NSDictionary *)textClause
                                     usingIndex:(NSString *)indexName
+{
+    return [CDTQQuerySqlTranslator selectStatementForTextClause:textClause
+                                                     usingIndex:indexName
+                                                      rankOrder:nil
+                                                          limit:0];
+}
+
++ (CDTQSqlParts *)selectStatementForTextClause:(NSDictionary *)textClause
+                                    usingIndex:(NSString *)indexName
+                                     rankOrder:(NSString *)direction
+                                         limit:(NSUInteger)limit
 {
     if (textClause.count == 0) {
         return nil;  // no query here
@@ -591,11 +615,276 @@
     NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
     NSString *search = textClause[TEXT][SEARCH];
     
-    NSString *sql = @"SELECT _id FROM %@ WHERE %@ MATCH ?;";
+    NSString *sql = @"SELECT _id FROM %@ WHERE %@ MATCH ?";
     sql = [NSString stringWithFormat:sql, tableName, tableName];
+
+    // bm25() is lower for better matches, so the most relevant come first in descending
+    // order of relevance.
+    if (direction) {
+        BOOL bestFirst = [direction.uppercaseString isEqualToString:@"DESC"];
+        sql = [sql stringByAppendingFormat:@" ORDER BY bm25(%@)%@", tableName,
+                                           bestFirst ? @"" : @" DESC"];
+    }
+    if (limit > 0) {
+        sql = [sql stringByAppendingFormat:@" LIMIT %lu", (unsigned long)limit];
+    }
+    sql = [sql stringByAppendingString:@";"];
     
     CDTQSqlParts *parts = [CDTQSqlParts partsForSql:sql parameters:@[ search ]];
     return parts;
 }
 
++ (NSDictionary *)textClauseInSelector:(NSDictionary *)selector
+{
+    for (NSDictionary *clause in selector[AND] ?: selector[OR]) {
+        NSDictionary *textClause = clause[TEXT] ? clause : nil;
+        if (!textClause && (clause[AND] || clause[OR])) {
+            textClause = [CDTQQuerySqlTranslator textClauseInSelector:clause];
+        }
+        if (textClause) {
+            return textClause;
+        }
+    }
+    return nil;
+}
+
+#pragma mark Matching stored JSON
+
++ (CDTQSqlParts *)jsonWherePartsForSelector:(NSDictionary *)selector
+{
+    // At this point we will have a root compound predicate, AND or OR, as for
+    // +translateQuery:toUseIndexes:indexesCoverQuery:.
+    NSString *joiner;
+    NSArray *clauses;
+    if (selector[AND]) {
+        joiner = @" AND ";
+        clauses = selector[AND];
+    } else if (selector[OR]) {
+        joiner = @" OR ";
+        clauses = selector[OR];
+    }
+
+    if (clauses.count == 0) {
+        return nil;
+    }
+
+    NSMutableArray *sqlClauses = [NSMutableArray array];
+    NSMutableArray *sqlParameters = [NSMutableArray array];
+    for (NSDictionary *clause in clauses) {
+        if (![clause isKindOfClass:[NSDictionary class]] || clause.count != 1) {
+            return nil;
+        }
+
+        NSString *field = clause.allKeys[0];
+        CDTQSqlParts *parts;
+        if ([field isEqualToString:AND] || [field isEqualToString:OR]) {
+            parts = [CDTQQuerySqlTranslator jsonWherePartsForSelector:clause];
+        } else if ([field hasPrefix:@"$"]) {
+            parts = nil;  // e.g., $text, which needs a text index
+        } else {
+            parts = [CDTQQuerySqlTranslator jsonWherePartsForField:field predicate:clause[field]];
+        }
+
+        if (!parts) {
+            return nil;
+        }
+        [sqlClauses addObject:parts.sqlWithPlaceholders];
+        [sqlParameters addObjectsFromArray:parts.placeholderValues];
+    }
+
+    NSString *sql =
+        [NSString stringWithFormat:@"(%@)", [sqlClauses componentsJoinedByString:joiner]];
+    return [CDTQSqlParts partsForSql:sql parameters:sqlParameters];
+}
+
+/**
+ The JSON path for a dotted field name as an SQL string literal. Each segment is quoted so
+ field names don't need escaping; returns nil if a segment can't be quoted.
+ */
++ (NSString *)jsonPathLiteralForField:(NSString *)fieldName
+{
+    NSMutableString *path = [NSMutableString stringWithString:@"'$"];
+    for (NSString *segment in [fieldName componentsSeparatedByString:@"."]) {
+        if ([segment rangeOfString:@"\""].location != NSNotFound) {
+            return nil;
+        }
+        [path appendFormat:@".\"%@\"",
+                           [segment stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    }
+    [path appendString:@"'"];
+    return path;
+}
+
++ (CDTQSqlParts *)jsonWherePartsForField:(NSString *)fieldName predicate:(NSDictionary *)predicate
+{
+    // Here we could have:
+    //   { fieldName: { operator: value } }
+    // or
+    //   { fieldName: { $not: { operator: value } } }
+    if (![predicate isKindOfClass:[NSDictionary class]] || predicate.count != 1) {
+        return nil;
+    }
+
+    NSString *operator= predicate.allKeys[0];
+    BOOL invertResult = [operator isEqualToString:NOT];
+    if (invertResult) {
+        predicate = predicate[NOT];
+        if (![predicate isKindOfClass:[NSDictionary class]] || predicate.count != 1) {
+            return nil;
+        }
+        operator= predicate.allKeys[0];
+    }
+    NSObject *expected = predicate[operator];
+
+    // _id and _rev aren't in the JSON, they're columns of the docs and revs tables.
+    NSString *value, *type, *path = nil;
+    if ([fieldName isEqualToString:@"_id"]) {
+        value = @"docs.docid";
+        type = @"'text'";
+    } else if ([fieldName isEqualToString:@"_rev"]) {
+        value = @"revs.revid";
+        type = @"'text'";
+    } else {
+        path = [CDTQQuerySqlTranslator jsonPathLiteralForField:fieldName];
+        if (!path) {
+            return nil;
+        }
+        value = [NSString stringWithFormat:@"json_extract(%@, %@)", kCDTQRevisionJSON, path];
+        type = [NSString stringWithFormat:@"json_type(%@, %@)", kCDTQRevisionJSON, path];
+    }
+
+    NSMutableArray *parameters = [NSMutableArray array];
+    NSString *sql;
+
+    if ([operator isEqualToString:SIZE]) {
+        // $size looks at the value itself rather than at its elements
+        if (!path || ![expected isKindOfClass:[NSNumber class]]) {
+            sql = @"0";
+        } else {
+            [parameters addObject:expected];
+            sql = [NSString stringWithFormat:@"COALESCE(%@ = 'array' AND "
+                                             @"json_array_length(%@, %@) = ?, 0)",
+                                             type, kCDTQRevisionJSON, path];
+        }
+
+    } else if ([operator isEqualToString:MOD]) {
+        // So does $mod, where the ObjC matcher doesn't look inside arrays either
+        NSString *condition = [CDTQQuerySqlTranslator jsonConditionForOperator:operator
+                                                                 expectedValue:expected
+                                                                         value:value
+                                                                          type:type
+                                                                    parameters:parameters];
+        if (!condition) {
+            return nil;
+        }
+        sql = [NSString stringWithFormat:@"COALESCE(%@, 0)", condition];
+
+    } else if (path) {
+        // Other operators match if the value does or, for an array, if any of its elements does.
+        // Parameters are added in the order their placeholders appear.
+        NSString *elementCondition =
+            [CDTQQuerySqlTranslator jsonConditionForOperator:operator
+                                               expectedValue:expected
+                                                       value:@"value"
+                                                        type:@"type"
+                                                  parameters:parameters];
+        NSString *valueCondition =
+            [CDTQQuerySqlTranslator jsonConditionForOperator:operator
+                                               expectedValue:expected
+                                                       value:value
+                                                        type:type
+                                                  parameters:parameters];
+        if (!elementCondition || !valueCondition) {
+            return nil;
+        }
+        sql = [NSString stringWithFormat:@"CASE %@ WHEN 'array' "
+                                         @"THEN EXISTS (SELECT 1 FROM json_each(%@, %@) WHERE %@) "
+                                         @"ELSE COALESCE(%@, 0) END",
+                                         type, kCDTQRevisionJSON, path, elementCondition,
+                                         valueCondition];
+
+    } else {
+        NSString *condition = [CDTQQuerySqlTranslator jsonConditionForOperator:operator
+                                                                 expectedValue:expected
+                                                                         value:value
+                                                                          type:type
+                                                                    parameters:parameters];
+        if (!condition) {
+            return nil;
+        }
+        sql = [NSString stringWithFormat:@"COALESCE(%@, 0)", condition];
+    }
+
+    if (invertResult) {
+        sql = [NSString stringWithFormat:@"NOT (%@)", sql];
+    }
+    return [CDTQSqlParts partsForSql:sql parameters:parameters];
+}
+
+/**
+ The SQL condition comparing a single value, with its JSON type as named by json_type(), to
+ the expected value. Returns nil if the operator or expected value can't be handled.
+ */
++ (NSString *)jsonConditionForOperator:(NSString *)operator
+                         expectedValue:(NSObject *)expected
+                                 value:(NSString *)value
+                                  type:(NSString *)type
+                            parameters:(NSMutableArray *)parameters
+{
+    BOOL scalarExpected =
+        [expected isKindOfClass:[NSString class]] || [expected isKindOfClass:[NSNumber class]];
+    NSDictionary *operatorMap = @{ LT : @"<", LTE : @"<=", GT : @">", GTE : @">=" };
+
+    if ([operator isEqualToString:EQ]) {
+        if ([expected isKindOfClass:[NSNull class]]) {
+            return [NSString stringWithFormat:@"(%@ IS NULL)", value];
+        } else if (scalarExpected) {
+            [parameters addObject:expected];
+            return [NSString
+                stringWithFormat:@"(%@ NOT IN ('object', 'array') AND %@ = ?)", type, value];
+        }
+
+    } else if ([operator isEqualToString:IN]) {
+        NSArray *expectedValues = (NSArray *)expected;
+        if (![expectedValues isKindOfClass:[NSArray class]] || expectedValues.count == 0) {
+            return nil;
+        }
+        for (NSObject *expectedValue in expectedValues) {
+            if (!([expectedValue isKindOfClass:[NSString class]] ||
+                  [expectedValue isKindOfClass:[NSNumber class]])) {
+                return nil;
+            }
+        }
+        NSString *placeholders = [CDTQQuerySqlTranslator placeholdersForList:expectedValues
+                                                     updatingParameterValues:parameters];
+        return [NSString stringWithFormat:@"(%@ NOT IN ('object', 'array') AND %@ IN %@)", type,
+                                          value, placeholders];
+
+    } else if ([operator isEqualToString:EXISTS]) {
+        // A missing field and a null are both treated as not existing
+        BOOL exists = [(NSNumber *)expected boolValue];
+        return [NSString stringWithFormat:(exists ? @"(%@ IS NOT NULL)" : @"(%@ IS NULL)"), value];
+
+    } else if (operatorMap[operator]) {
+        // SQLite orders numbers before strings, as CDTQUnindexedMatcher does
+        if (scalarExpected) {
+            [parameters addObject:expected];
+            return [NSString
+                stringWithFormat:@"(%@ IN ('integer', 'real', 'true', 'false', 'text') AND %@ %@ ?)",
+                                 type, value, operatorMap[operator]];
+        }
+
+    } else if ([operator isEqualToString:MOD]) {
+        // Validation has made sure these are two integers and the divisor isn't 0
+        NSArray *modulus = (NSArray *)expected;
+        [parameters addObjectsFromArray:@[ modulus[0], modulus[1] ]];
+        return [NSString
+            stringWithFormat:@"(%@ IN ('integer', 'real', 'true', 'false') AND (%@ %% ?) = ?)",
+                             type, value];
+
+    }
+
+    return nil;
+}
+
 @end
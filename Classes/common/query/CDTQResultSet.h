@@ -18,6 +18,7 @@
 @class CDTQResultSetBuilder;
 @class CDTDocumentRevision;
 @class CDTQUnindexedMatcher;
+@class FMDatabaseQueue;
 
 typedef void (^CDTQResultSetBuilderBlock)(CDTQResultSetBuilder *configuration);
 
@@ -33,6 +34,11 @@ typedef void (^CDTQResultSetBuilderBlock)(CDTQResultSetBuilder *configuration);
 @property (nonatomic) NSUInteger limit;
 @property (nonatomic, strong) CDTQUnindexedMatcher *matcher;
 
+/** If set, `fields` are projected from the rows of this index in `database` rather than
+    from documents loaded from the datastore. */
+@property (nonatomic, strong) NSString *projectionIndex;
+@property (nonatomic, strong) FMDatabaseQueue *database;
+
 @end
 
 /**
@@ -53,6 +59,9 @@ typedef void (^CDTQResultSetBuilderBlock)(CDTQResultSetBuilder *configuration);
 
 + (instancetype)resultSetWithBlock:(CDTQResultSetBuilderBlock)block;
 
+/** Internal. Returns a new result set over the same document IDs, with the same options. */
++ (instancetype)resultSetWithResultSet:(CDTQResultSet *)resultSet;
+
 - (instancetype)initWithBuilder:(CDTQResultSetBuilder *)builder;
 
 - (void)enumerateObjectsUsingBlock:(void (^)(CDTDocumentRevision *rev, NSUInteger idx,
@@ -60,4 +69,7 @@ typedef void (^CDTQResultSetBuilderBlock)(CDTQResultSetBuilder *configuration);
 
 @property (nonatomic, strong, readonly) NSArray *documentIds;  // of type NSString*
 
+/** Internal. The document IDs found by the query, before post-hoc matching, skip and limit. */
+@property (nonatomic, strong, readonly) NSArray *originalDocumentIds;
+
 @end
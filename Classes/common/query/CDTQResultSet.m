@@ -13,17 +13,21 @@
 //  and limitations under the License.
 
 #import "CDTQResultSet.h"
+#import "CDTQIndexManager.h"
 #import "CDTQLogging.h"
 #import "CDTQProjectedDocumentRevision.h"
 #import "CDTQUnindexedMatcher.h"
 
 #import <CloudantSync.h>
+#import <FMDB/FMDB.h>
 
 @interface CDTQResultSet ()
 @property (nonatomic, strong, readwrite) NSArray *fields;
 @property (nonatomic) NSUInteger skip;
 @property (nonatomic) NSUInteger limit;
 @property (nonatomic, strong) CDTQUnindexedMatcher *matcher;
+@property (nonatomic, strong) NSString *projectionIndex;
+@property (nonatomic, strong) FMDatabaseQueue *database;
 @end
 
 @implementation CDTQResultSetBuilder
@@ -47,6 +51,8 @@
         _skip = builder.skip;
         _limit = builder.limit;
         _matcher = builder.matcher;
+        _projectionIndex = builder.projectionIndex;
+        _database = builder.database;
     }
     return self;
 }
@@ -60,6 +66,20 @@
     return [builder build];
 }
 
++ (instancetype)resultSetWithResultSet:(CDTQResultSet *)resultSet
+{
+    return [CDTQResultSet resultSetWithBlock:^(CDTQResultSetBuilder *b) {
+        b.docIds = resultSet.originalDocumentIds;
+        b.datastore = resultSet->_datastore;
+        b.fields = resultSet.fields;
+        b.skip = resultSet.skip;
+        b.limit = resultSet.limit;
+        b.matcher = resultSet.matcher;
+        b.projectionIndex = resultSet.projectionIndex;
+        b.database = resultSet.database;
+    }];
+}
+
 - (NSArray /* NSString */ *)documentIds
 {
     // This is implemented using -enumerateObjectsUsingBlock so that when we're using
@@ -84,6 +104,7 @@
     NSUInteger limit = self.limit;
     CDTQUnindexedMatcher *matcher = self.matcher;
     NSArray *fields = self.fields;
+    BOOL projectFromIndex = (self.projectionIndex != nil);
 
     BOOL stop = NO;  // user stopped, or we returned `limit` results
     NSUInteger batchSize = 50;
@@ -92,13 +113,35 @@
         range.length = MIN(batchSize, _originalDocumentIds.count - range.location);
         NSArray *batch = [_originalDocumentIds subarrayWithRange:range];
 
-        NSArray *docs = [_datastore getDocumentsWithIds:batch];
+        // Where SQLite can match the selector against the stored JSON, only the documents
+        // which match need loading.
+        BOOL matchedInSql = NO;
+        if (matcher) {
+            NSSet *matchingIds = [matcher documentIdsMatching:batch inDatastore:_datastore];
+            if (matchingIds) {
+                batch = [batch objectsAtIndexes:[batch indexesOfObjectsPassingTest:^BOOL(
+                                                           NSString *docId, NSUInteger i,
+                                                           BOOL *stopTest) {
+                    return [matchingIds containsObject:docId];
+                }]];
+                matchedInSql = YES;
+            }
+        }
+
+        NSArray *docs;
+        if (batch.count == 0) {
+            docs = @[];
+        } else if (projectFromIndex) {
+            docs = [self projectedRevisionsFromIndexForIds:batch];
+        } else {
+            docs = [_datastore getDocumentsWithIds:batch];
+        }
 
         for (CDTDocumentRevision *rev in docs) {
             CDTDocumentRevision *innerRev = rev;  // allows us to replace later if projecting
 
             // Apply post-hoc matcher
-            if (matcher && ![matcher matches:innerRev]) {
+            if (matcher && !matchedInSql && ![matcher matches:innerRev]) {
                 continue;
             }
 
@@ -109,7 +152,7 @@
             }
 
             // Apply projection if result matches
-            if (fields) {
+            if (fields && !projectFromIndex) {
                 innerRev =
                     [CDTQResultSet projectFields:self.fields fromRevision:rev datastore:_datastore];
             }
@@ -137,6 +180,75 @@
     }
 }
 
+/**
+ Returns projected revisions for the document IDs, in the same order, built from the rows of
+ the projection index. A document is loaded from the datastore and projected from its body
+ instead when its row can't stand in for it: when the row wasn't marked projectable as it was
+ indexed, such as for one of the rows of an array field or a field holding an object.
+ */
+- (NSArray /* CDTDocumentRevision */ *)projectedRevisionsFromIndexForIds:(NSArray *)docIds
+{
+    NSArray *fields = self.fields;
+    NSMutableDictionary *rowsById = [NSMutableDictionary dictionaryWithCapacity:docIds.count];
+
+    NSMutableArray *columns = [NSMutableArray
+        arrayWithObjects:@"\"_id\"", @"\"_rev\"",
+                         [NSString stringWithFormat:@"\"%@\"", kCDTQIndexProjectableColumnName],
+                         nil];
+    for (NSString *field in fields) {
+        [columns addObject:[NSString stringWithFormat:@"\"%@\"", field]];
+    }
+    NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:docIds.count];
+    for (NSUInteger i = 0; i < docIds.count; i++) {
+        [placeholders addObject:@"?"];
+    }
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:self.projectionIndex];
+    NSString *sql = [NSString stringWithFormat:@"SELECT %@ FROM %@ WHERE _id IN (%@);",
+                                               [columns componentsJoinedByString:@", "], tableName,
+                                               [placeholders componentsJoinedByString:@", "]];
+
+    [self.database inDatabase:^(FMDatabase *db) {
+        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:docIds];
+        while ([rs next]) {
+            NSString *docId = [rs stringForColumnIndex:0];
+            NSMutableArray *rows = rowsById[docId];
+            if (!rows) {
+                rows = [NSMutableArray arrayWithCapacity:1];
+                rowsById[docId] = rows;
+            }
+            [rows addObject:[rs resultDictionary]];
+        }
+        [rs close];
+    }];
+
+    NSMutableArray *revisions = [NSMutableArray arrayWithCapacity:docIds.count];
+    for (NSString *docId in docIds) {
+        NSArray *rows = rowsById[docId];
+        if (rows.count == 1 && [rows[0][kCDTQIndexProjectableColumnName] isEqual:@1]) {
+            NSDictionary *row = rows[0];
+            NSMutableDictionary *body = [NSMutableDictionary dictionaryWithCapacity:fields.count];
+            for (NSString *field in fields) {
+                body[field] = row[field];
+            }
+            [revisions addObject:[[CDTQProjectedDocumentRevision alloc] initWithDocId:docId
+                                                                           revisionId:row[@"_rev"]
+                                                                                 body:body
+                                                                              deleted:NO
+                                                                          attachments:nil
+                                                                             sequence:0
+                                                                            datastore:_datastore]];
+        } else if (rows.count > 0) {
+            CDTDocumentRevision *rev = [_datastore getDocumentWithId:docId error:nil];
+            if (rev) {
+                [revisions addObject:[CDTQResultSet projectFields:fields
+                                                     fromRevision:rev
+                                                        datastore:_datastore]];
+            }
+        }
+    }
+    return revisions;
+}
+
 + (CDTDocumentRevision *)projectFields:(NSArray *)fields
                           fromRevision:(CDTDocumentRevision *)rev
                              datastore:(CDTDatastore *)datastore
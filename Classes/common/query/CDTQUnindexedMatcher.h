@@ -18,6 +18,7 @@
 #import "CDTQQuerySqlTranslator.h"
 
 @class CDTDocumentRevision;
+@class CDTDatastore;
 
 @interface CDTQOperatorExpressionNode : CDTQQueryNode
 
@@ -97,4 +98,13 @@
  */
 - (BOOL)matches:(CDTDocumentRevision *)rev;
 
+/**
+ Returns the IDs from `docIds` whose current revisions in `datastore` match this matcher's
+ selector, evaluated by SQLite against the stored JSON so the documents needn't be loaded.
+
+ Returns nil if the selector can't be matched this way or SQLite lacks the JSON functions, in
+ which case the caller should use -matches: on each document instead.
+ */
+- (NSSet *)documentIdsMatching:(NSArray *)docIds inDatastore:(CDTDatastore *)datastore;
+
 @end
@@ -22,14 +22,114 @@
 #import "CDTQQueryValidator.h"
 
 #import "CDTDocumentRevision.h"
+#import "CDTDatastore.h"
+#import "TD_Database.h"
+
+#import <FMDB/FMDB.h>
+
+/**
+ The operators an expression node can be compiled to. $in is compiled to $eq over
+ several expected values.
+ */
+typedef NS_ENUM(NSInteger, CDTQMatcherOperator) {
+    CDTQMatcherOperatorUnknown = 0,
+    CDTQMatcherOperatorEq,
+    CDTQMatcherOperatorLt,
+    CDTQMatcherOperatorLte,
+    CDTQMatcherOperatorGt,
+    CDTQMatcherOperatorGte,
+    CDTQMatcherOperatorExists,
+    CDTQMatcherOperatorMod,
+    CDTQMatcherOperatorSize
+};
+
+@interface CDTQOperatorExpressionNode () {
+   @public
+    // Compiled from `expression` by -compile, so matching doesn't have to pick the
+    // selector apart again for every document.
+    NSArray *_keyPath;
+    CDTQMatcherOperator _operator;
+    BOOL _invertResult;
+    NSArray *_expectedValues;  // the expected value(s), always as an array
+    BOOL _expectedBool;        // $exists
+    NSInteger _divisor;        // $mod
+    NSInteger _remainder;      // $mod
+    NSNumber *_expectedSize;   // $size, nil if the expected value isn't a number
+}
+
+- (void)compile;
+
+@end
 
 @implementation CDTQOperatorExpressionNode
 
+- (void)compile
+{
+    // Here we could have:
+    //   { fieldName: { operator: value } }
+    // or
+    //   { fieldName: { $not: { operator: value } } }
+
+    NSString *fieldName = self.expression.allKeys[0];
+    NSDictionary *operatorExpression = self.expression[fieldName];
+    NSString *operator= operatorExpression.allKeys[0];
+
+    _keyPath = [CDTQValueExtractor keyPathForFieldName:fieldName];
+
+    // First work out whether we need to invert the result when done
+    _invertResult = [operator isEqualToString:NOT];
+    if (_invertResult) {
+        operatorExpression = operatorExpression[NOT];
+        operator= operatorExpression.allKeys[0];
+    }
+
+    NSObject *expected = operatorExpression[operator];
+    NSDictionary *operators = @{
+        EQ : @(CDTQMatcherOperatorEq),
+        IN : @(CDTQMatcherOperatorEq),
+        LT : @(CDTQMatcherOperatorLt),
+        LTE : @(CDTQMatcherOperatorLte),
+        GT : @(CDTQMatcherOperatorGt),
+        GTE : @(CDTQMatcherOperatorGte),
+        EXISTS : @(CDTQMatcherOperatorExists),
+        MOD : @(CDTQMatcherOperatorMod),
+        SIZE : @(CDTQMatcherOperatorSize)
+    };
+    _operator = [operators[operator] integerValue];
+
+    switch (_operator) {
+        case CDTQMatcherOperatorMod:
+            // The expected value is an NSArray containing two numbers.  These two numbers are
+            // assured to be integers and the divisor is assured to not be 0.  This would have
+            // been handled during normalization and validation.
+            _divisor = [((NSArray *)expected)[0] integerValue];
+            _remainder = [((NSArray *)expected)[1] integerValue];
+            break;
+        case CDTQMatcherOperatorSize:
+            _expectedSize = [expected isKindOfClass:[NSNumber class]] ? (NSNumber *)expected : nil;
+            break;
+        case CDTQMatcherOperatorUnknown:
+            LogWarn(@"Found unexpected operator in selector: %@", operator);
+            break;
+        case CDTQMatcherOperatorExists:
+            _expectedBool = [((NSNumber *)expected)boolValue];
+            _expectedValues = @[ expected ];
+            break;
+        default:
+            // Since $in is the same as a series of $eq comparisons, both are matched
+            // against an array of expected values.
+            _expectedValues =
+                [expected isKindOfClass:[NSArray class]] ? (NSArray *)expected : @[ expected ];
+            break;
+    }
+}
+
 @end
 
 @interface CDTQUnindexedMatcher ()
 
 @property (nonatomic, strong) CDTQChildrenQueryNode *root;
+@property (nonatomic, strong) CDTQSqlParts *jsonWhereParts;  // nil if not expressible in SQL
 
 @end
 
@@ -47,6 +147,7 @@
 
     CDTQUnindexedMatcher *matcher = [[CDTQUnindexedMatcher alloc] init];
     matcher.root = root;
+    matcher.jsonWhereParts = [CDTQQuerySqlTranslator jsonWherePartsForSelector:selector];
     return matcher;
 }
 
@@ -86,6 +187,7 @@
     for (NSDictionary *expression in basicClauses) {
         CDTQOperatorExpressionNode *node = [[CDTQOperatorExpressionNode alloc] init];
         node.expression = expression;
+        [node compile];
         [root.children addObject:node];
     }
 
@@ -127,98 +229,102 @@
     return [self executeSelectorTree:self.root onRevision:rev];
 }
 
-#pragma mark Tree walking
-
-- (BOOL)executeSelectorTree:(CDTQQueryNode *)node onRevision:(CDTDocumentRevision *)rev
+- (NSSet *)documentIdsMatching:(NSArray *)docIds inDatastore:(CDTDatastore *)datastore
 {
-    if ([node isKindOfClass:[CDTQAndQueryNode class]]) {
-        BOOL passed = YES;
-
-        CDTQAndQueryNode *andNode = (CDTQAndQueryNode *)node;
-
-//        if ([andNode.children count] == 0) {
-//            // well this isn't right, something has gone wrong
-//            return NO;
-//        }
-
-        for (CDTQQueryNode *child in andNode.children) {
-            passed = passed && [self executeSelectorTree:child onRevision:rev];
-        }
-
-        return passed;
+    CDTQSqlParts *where = self.jsonWhereParts;
+    if (!where || docIds.count == 0) {
+        return nil;
     }
-    if ([node isKindOfClass:[CDTQOrQueryNode class]]) {
-        BOOL passed = NO;
 
-        CDTQOrQueryNode *orNode = (CDTQOrQueryNode *)node;
-        for (CDTQQueryNode *child in orNode.children) {
-            passed = passed || [self executeSelectorTree:child onRevision:rev];
+    NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:docIds.count];
+    for (NSUInteger i = 0; i < docIds.count; i++) {
+        [placeholders addObject:@"?"];
+    }
+    NSMutableArray *parameters = [NSMutableArray arrayWithArray:docIds];
+    [parameters addObjectsFromArray:where.placeholderValues];
+
+    // Match against the winning revision, as -[CDTDatastore getDocumentsWithIds:] loads it
+    NSString *sql = [NSString
+        stringWithFormat:@"SELECT docs.docid FROM docs, revs "
+                         @"WHERE docs.docid IN (%@) AND revs.doc_id = docs.doc_id "
+                         @"AND revs.revid = (SELECT revid FROM revs AS winner "
+                         @"WHERE winner.doc_id = docs.doc_id AND winner.current = 1 "
+                         @"AND winner.deleted = 0 ORDER BY winner.revid DESC LIMIT 1) "
+                         @"AND %@;",
+                         [placeholders componentsJoinedByString:@", "],
+                         where.sqlWithPlaceholders];
+
+    __block NSMutableSet *matching = nil;
+    [datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        if (![CDTQUnindexedMatcher sqliteHasJSONFunctions]) {
+            return;
         }
 
-        return passed;
+        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:parameters];
+        if (!rs) {
+            LogWarn(@"Matching documents in SQL failed, will match them one by one: %@",
+                    [db lastErrorMessage]);
+            return;
+        }
+        matching = [NSMutableSet setWithCapacity:docIds.count];
+        while ([rs next]) {
+            [matching addObject:[rs stringForColumnIndex:0]];
+        }
+        // A revision whose body isn't valid JSON stops the statement part way through, so
+        // the documents matched so far aren't all of them; fall back to loading documents
+        if ([db hadError]) {
+            LogWarn(@"Matching documents in SQL failed, will match them one by one: %@",
+                    [db lastErrorMessage]);
+            matching = nil;
+        }
+        [rs close];
+    }];
 
-    } else if ([node isKindOfClass:[CDTQOperatorExpressionNode class]]) {
-        NSDictionary *expression = ((CDTQOperatorExpressionNode *)node).expression;
+    return matching;
+}
 
-        // Here we could have:
-        //   { fieldName: { operator: value } }
-        // or
-        //   { fieldName: { $not: { operator: value } } }
++ (BOOL)sqliteHasJSONFunctions
+{
+    // The functions are built into SQLite or not, so this is checked once. Asking SQLite how
+    // it was compiled, rather than calling a function which may not exist, avoids an error,
+    // which aborts debug builds of the datastore. JSON1 is part of SQLite from 3.38 unless
+    // left out, and before that an extension which has to be compiled in.
+    static BOOL available = NO;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        available = sqlite3_compileoption_used("ENABLE_JSON1") ||
+                    (sqlite3_libversion_number() >= 3038000 &&
+                     !sqlite3_compileoption_used("OMIT_JSON"));
+        if (!available) {
+            LogInfo(@"SQLite JSON functions unavailable, documents will be matched one by one");
+        }
+    });
+    return available;
+}
 
-        // Next evaluate the result
-        NSString *fieldName = expression.allKeys[0];
-        NSDictionary *operatorExpression = expression[fieldName];
+#pragma mark Tree walking
 
-        NSString *operator= operatorExpression.allKeys[0];
+- (BOOL)executeSelectorTree:(CDTQQueryNode *)node onRevision:(CDTDocumentRevision *)rev
+{
+    if ([node isKindOfClass:[CDTQOperatorExpressionNode class]]) {
+        return [self executeExpression:(CDTQOperatorExpressionNode *)node onRevision:rev];
 
-        // First work out whether we need to invert the result when done
-        BOOL invertResult = [operator isEqualToString:NOT];
-        if (invertResult) {
-            operatorExpression = operatorExpression[NOT];
-            operator = operatorExpression.allKeys[0];
+    } else if ([node isKindOfClass:[CDTQAndQueryNode class]]) {
+        for (CDTQQueryNode *child in ((CDTQAndQueryNode *)node).children) {
+            if (![self executeSelectorTree:child onRevision:rev]) {
+                return NO;
+            }
         }
+        return YES;
 
-        NSObject *expected = operatorExpression[operator];
-        NSObject *actual = [CDTQValueExtractor extractValueForFieldName:fieldName fromRevision:rev];
-        
-        BOOL passed = NO;
-        NSArray *specialCaseOperators = @[ MOD, SIZE ];
-        if ([specialCaseOperators containsObject:operator]) {
-            // If an operator like $mod or $size is found we need to treat the
-            // comparison as a special case.
-            //
-            // $mod: perform modulo arithmetic on the actual value using the first
-            //       element in the expected array as the divisor before comparing
-            //       the result to the second element in the expected array.
-            //
-            // $size: check whether the actual value is an array, then compare the
-            //        actual array size with the expected value.
-            passed = [self actualValue:actual matchesOperator:operator andExpectedValue:expected];
-        } else {
-            // Since $in is the same as a series of $eq comparisons -
-            // Treat them the same by:
-            // - Ensuring that both expected and actual are NSArrays.
-            // - Convert the $in operator to the $eq operator.
-            if (![expected isKindOfClass:[NSArray class]]) {
-                expected = @[ expected ];
-            }
-            if (![actual isKindOfClass:[NSArray class]]) {
-                actual = actual ? @[ actual ] : @[ [NSNull null] ];
-            }
-            if ([operator isEqualToString:IN]) {
-                operator = EQ;
-            }
-            
-            for (NSObject *expectedItem in (NSArray *)expected) {
-                for (NSObject *actualItem in (NSArray *)actual) {
-                    // OR since any actual item can match any value in the expected NSArray
-                    passed = passed || [self actualValue:actualItem
-                                         matchesOperator:operator
-                                        andExpectedValue:expectedItem];
-                }
+    } else if ([node isKindOfClass:[CDTQOrQueryNode class]]) {
+        for (CDTQQueryNode *child in ((CDTQOrQueryNode *)node).children) {
+            if ([self executeSelectorTree:child onRevision:rev]) {
+                return YES;
             }
         }
-        return invertResult ? !passed : passed;
+        return NO;
+
     } else {
         // We constructed the tree, so shouldn't end up here; error if we do.
         LogError(@"Found unexpected selector execution tree: %@", node);
@@ -226,44 +332,80 @@
     }
 }
 
-- (BOOL)actualValue:(NSObject *)actual
-     matchesOperator:(NSString *) operator
-    andExpectedValue:(NSObject *)expected
+- (BOOL)executeExpression:(CDTQOperatorExpressionNode *)node onRevision:(CDTDocumentRevision *)rev
 {
-    BOOL passed = NO;
+    NSObject *actual = [CDTQValueExtractor extractValueForKeyPath:node->_keyPath fromRevision:rev];
 
-    if ([operator isEqualToString:EQ]) {
-        passed = [self eqL:actual R:expected];
-
-    } else if ([operator isEqualToString:LT]) {
-        passed = [self ltL:actual R:expected];
-
-    } else if ([operator isEqualToString:LTE]) {
-        passed = [self lteL:actual R:expected];
-
-    } else if ([operator isEqualToString:GT]) {
-        passed = [self gtL:actual R:expected];
+    BOOL passed = NO;
+    switch (node->_operator) {
+        case CDTQMatcherOperatorMod:
+            // $mod: perform modulo arithmetic on the actual value using the divisor
+            //       before comparing the result to the expected remainder.
+            passed = [self modL:actual divisor:node->_divisor remainder:node->_remainder];
+            break;
+
+        case CDTQMatcherOperatorSize:
+            // $size: check whether the actual value is an array, then compare the
+            //        actual array size with the expected value.
+            passed = [self sizeL:actual R:node->_expectedSize];
+            break;
+
+        case CDTQMatcherOperatorUnknown:
+            passed = NO;  // didn't understand
+            break;
+
+        default: {
+            // Any actual item can match any expected value, so treat a single actual value
+            // like an array of one.
+            NSArray *actualValues;
+            if ([actual isKindOfClass:[NSArray class]]) {
+                actualValues = (NSArray *)actual;
+            } else {
+                actualValues = actual ? @[ actual ] : @[ [NSNull null] ];
+            }
 
-    } else if ([operator isEqualToString:GTE]) {
-        passed = [self gteL:actual R:expected];
+            for (NSObject *expectedItem in node->_expectedValues) {
+                for (NSObject *actualItem in actualValues) {
+                    if ([self actualValue:actualItem
+                             matchesOperator:node->_operator
+                            andExpectedValue:expectedItem
+                                expectedBool:node->_expectedBool]) {
+                        passed = YES;
+                        break;
+                    }
+                }
+                if (passed) {
+                    break;
+                }
+            }
+            break;
+        }
+    }
 
-    } else if ([operator isEqualToString:MOD]) {
-        passed = [self modL:actual R:expected];
-        
-    } else if ([operator isEqualToString:SIZE]) {
-        passed = [self sizeL:actual R:expected];
-        
-    } else if ([operator isEqualToString:EXISTS]) {
-        BOOL expectedBool = [((NSNumber *)expected)boolValue];
-        BOOL exists = (![actual isEqual:[NSNull null]]);
-        passed = (exists == expectedBool);
+    return node->_invertResult ? !passed : passed;
+}
 
-    } else {
-        LogWarn(@"Found unexpected operator in selector: %@", operator);
-        passed = NO;  // didn't understand
+- (BOOL)actualValue:(NSObject *)actual
+     matchesOperator:(CDTQMatcherOperator) operator
+    andExpectedValue:(NSObject *)expected
+        expectedBool:(BOOL)expectedBool
+{
+    switch (operator) {
+        case CDTQMatcherOperatorEq:
+            return [self eqL:actual R:expected];
+        case CDTQMatcherOperatorLt:
+            return [self ltL:actual R:expected];
+        case CDTQMatcherOperatorLte:
+            return [self lteL:actual R:expected];
+        case CDTQMatcherOperatorGt:
+            return [self gtL:actual R:expected];
+        case CDTQMatcherOperatorGte:
+            return [self gteL:actual R:expected];
+        case CDTQMatcherOperatorExists:
+            return (![actual isEqual:[NSNull null]]) == expectedBool;
+        default:
+            return NO;
     }
-
-    return passed;
 }
 
 #pragma mark matchers
@@ -354,18 +496,12 @@
     return ![self ltL:l R:r];
 }
 
-- (BOOL)modL:(NSObject *)l R:(NSObject *)r
+- (BOOL)modL:(NSObject *)l divisor:(NSInteger)divisor remainder:(NSInteger)expectedRemainder
 {
     if (![l isKindOfClass:[NSNumber class]]) {
         return NO;
     }
 
-    // r should be an NSArray containing two numbers.  These two numbers are assured
-    // to be integers and the divisor is assured to not be 0.  This would have been
-    // handled during normalization and validation.
-    NSInteger divisor = [((NSArray *)r)[0] integerValue];
-    NSInteger expectedRemainder = [((NSArray *)r)[1] integerValue];
-    
     // Calculate the actual remainder based on the truncated whole
     // number value of l which is the actual number from the document.
     // This is the desired behavior to relicate the SQL engine.
@@ -374,16 +510,15 @@
     return actualRemainder == expectedRemainder;
 }
 
-- (BOOL)sizeL:(NSObject *)l R:(NSObject *)r
+- (BOOL)sizeL:(NSObject *)l R:(NSNumber *)expectedSize
 {
     // The actual value must be an array and the expected value must be a number in
     // order to perform a size comparison.
-    if (![l isKindOfClass:[NSArray class]] || ![r isKindOfClass:[NSNumber class]]) {
+    if (![l isKindOfClass:[NSArray class]] || !expectedSize) {
         return NO;
     }
     
     NSNumber *actualSize = [NSNumber numberWithInteger:((NSArray *) l).count];
-    NSNumber *expectedSize = (NSNumber *)r;
     
     return [actualSize isEqualToNumber:expectedSize];
 }
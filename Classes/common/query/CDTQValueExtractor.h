@@ -26,4 +26,16 @@
 
 + (NSObject *)extractValueForFieldName:(NSString *)fieldName fromDictionary:(NSDictionary *)body;
 
+/**
+ Splits a possibly dotted field name into the key path used by the methods below, so
+ callers extracting the same field from many documents only split it once.
+ */
++ (NSArray /* NSString */ *)keyPathForFieldName:(NSString *)possiblyDottedField;
+
++ (NSObject *)extractValueForKeyPath:(NSArray /* NSString */ *)keyPath
+                        fromRevision:(CDTDocumentRevision *)rev;
+
++ (NSObject *)extractValueForKeyPath:(NSArray /* NSString */ *)keyPath
+                      fromDictionary:(NSDictionary *)body;
+
 @end
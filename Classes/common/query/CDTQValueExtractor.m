@@ -22,46 +22,66 @@
 + (NSObject *)extractValueForFieldName:(NSString *)possiblyDottedField
                           fromRevision:(CDTDocumentRevision *)rev
 {
-    // _id and _rev are special fields which come from attributes
-    // of the revision and not its body.
-    if ([possiblyDottedField isEqualToString:@"_id"]) {
-        return rev.docId;
-    } else if ([possiblyDottedField isEqualToString:@"_rev"]) {
-        return rev.revId;
-    } else {
-        return [CDTQValueExtractor extractValueForFieldName:possiblyDottedField
-                                             fromDictionary:rev.body];
-    }
+    return [CDTQValueExtractor
+        extractValueForKeyPath:[CDTQValueExtractor keyPathForFieldName:possiblyDottedField]
+                  fromRevision:rev];
 }
 
 + (NSObject *)extractValueForFieldName:(NSString *)possiblyDottedField
                         fromDictionary:(NSDictionary *)body
 {
-    // The algorithm here is to split the fields into a "path" and a "lastSegment".
-    // The path leads us to the final sub-document. We know that if we have either
-    // nil or a non-dictionary object while traversing path that the body doesn't
-    // have the right fields for this field selector -- it allows us to make sure
-    // that each level of the `path` results in a document rather than a value,
-    // because if it's a value, we can't continue the selection process.
+    return [CDTQValueExtractor
+        extractValueForKeyPath:[CDTQValueExtractor keyPathForFieldName:possiblyDottedField]
+                fromDictionary:body];
+}
+
++ (NSArray /* NSString */ *)keyPathForFieldName:(NSString *)possiblyDottedField
+{
+    return [possiblyDottedField componentsSeparatedByString:@"."];
+}
+
++ (NSObject *)extractValueForKeyPath:(NSArray /* NSString */ *)keyPath
+                        fromRevision:(CDTDocumentRevision *)rev
+{
+    // _id and _rev are special fields which come from attributes
+    // of the revision and not its body.
+    if (keyPath.count == 1) {
+        NSString *field = keyPath[0];
+        if ([field isEqualToString:@"_id"]) {
+            return rev.docId;
+        } else if ([field isEqualToString:@"_rev"]) {
+            return rev.revId;
+        }
+    }
+    return [CDTQValueExtractor extractValueForKeyPath:keyPath fromDictionary:rev.body];
+}
 
-    NSArray *fields = [possiblyDottedField componentsSeparatedByString:@"."];
++ (NSObject *)extractValueForKeyPath:(NSArray /* NSString */ *)keyPath
+                      fromDictionary:(NSDictionary *)body
+{
+    // The algorithm here is to walk the key path up to its last segment. The path leads us
+    // to the final sub-document. We know that if we have either nil or a non-dictionary
+    // object while traversing path that the body doesn't have the right fields for this
+    // field selector -- it allows us to make sure that each level of the path results in
+    // a document rather than a value, because if it's a value, we can't continue the
+    // selection process.
 
-    NSRange pathLen;
-    pathLen.location = 0;
-    pathLen.length = fields.count - 1;
-    NSArray *path = [fields subarrayWithRange:pathLen];
-    NSString *lastSegment = [fields lastObject];
+    if (keyPath.count == 0) {
+        return nil;
+    }
 
+    NSUInteger pathLength = keyPath.count - 1;
     NSDictionary *currentLevel = body;
-    for (NSString *field in path) {
-        currentLevel = currentLevel[field];
+    for (NSUInteger i = 0; i < pathLength; i++) {
+        currentLevel = currentLevel[keyPath[i]];
         if (currentLevel == nil || ![currentLevel isKindOfClass:[NSDictionary class]]) {
-            LogVerbose(@"Could not extract field %@ from document %@", possiblyDottedField, body);
+            LogVerbose(@"Could not extract field %@ from document %@",
+                       [keyPath componentsJoinedByString:@"."], body);
             return nil;  // we ran out of stuff before we reached the full path length
         }
     }
 
-    return currentLevel[lastSegment];
+    return currentLevel[keyPath[pathLength]];
 }
 
 @end
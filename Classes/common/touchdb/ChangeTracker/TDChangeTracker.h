@@ -44,6 +44,8 @@ typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTr
     NSDictionary* _requestHeaders;
     id<TDAuthorizer> _authorizer;
     unsigned _retryCount;
+    BOOL _paused;
+    BOOL _pollPending;
 }
 
 - (id)initWithDatabaseURL:(NSURL*)databaseURL
@@ -69,6 +71,11 @@ typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTr
 @property (nonatomic) NSTimeInterval heartbeat;
 @property (nonatomic) NSArray* docIDs;
 
+/** While YES the tracker won't start another poll of the feed; a poll that comes due meanwhile is
+    started as soon as it's set back to NO. The client uses this to stop reading changes while
+    it has too large a backlog of revisions to fetch or insert. */
+@property (nonatomic) BOOL paused;
+
 - (BOOL)start;
 - (void)stop;
 
@@ -84,6 +91,7 @@ typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTr
 - (NSInteger)receivedPollResponse:(NSData*)body errorMessage:(NSString**)errorMessage;
 - (BOOL)receivedChanges:(NSArray*)changes errorMessage:(NSString**)errorMessage;
 - (BOOL)receivedChange:(NSDictionary*)change;
+- (void)startNextPoll;  // call instead of -start to begin a follow-up poll; honours .paused
 - (void)stopped;  // override this
 
 @end
@@ -41,7 +41,7 @@
 @synthesize limit = _limit, heartbeat = _heartbeat, error = _error;
 @synthesize client = _client, filterName = _filterName, filterParameters = _filterParameters;
 @synthesize requestHeaders = _requestHeaders, authorizer = _authorizer;
-@synthesize docIDs = _docIDs;
+@synthesize docIDs = _docIDs, paused = _paused;
 
 - (id)initWithDatabaseURL:(NSURL*)databaseURL
                      mode:(TDChangeTrackerMode)mode
@@ -154,8 +154,28 @@
     return NO;
 }
 
+- (void)setPaused:(BOOL)paused
+{
+    if (paused == _paused) return;
+    _paused = paused;
+    CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@: %@", self, paused ? @"Paused" : @"Resumed");
+    if (!paused && _pollPending) {
+        _pollPending = NO;
+        [self start];
+    }
+}
+
+- (void)startNextPoll
+{
+    if (_paused)
+        _pollPending = YES;
+    else
+        [self start];
+}
+
 - (void)stop
 {
+    _pollPending = NO;
     [NSObject cancelPreviousPerformRequestsWithTarget:self
                                              selector:@selector(retry)
                                                object:nil];  // cancel pending retries
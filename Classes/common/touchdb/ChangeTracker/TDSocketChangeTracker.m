@@ -295,7 +295,7 @@
     [self clearConnection];
 
     if (restart)
-        [self start];  // Next poll...
+        [self startNextPoll];  // Next poll (deferred while paused)...
     else
         [self stopped];
 }
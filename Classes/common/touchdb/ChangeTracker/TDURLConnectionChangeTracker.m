@@ -290,7 +290,7 @@ didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge
     [self clearConnection];
     
     if (restart){
-        [self start];  // Next poll...
+        [self startNextPoll];  // Next poll (deferred while paused)...
     } else {
         [self stopped];
     }
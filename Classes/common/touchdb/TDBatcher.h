@@ -11,22 +11,44 @@
 #import <Foundation/Foundation.h>
 
 /** Utility that queues up objects until the queue fills up or a time interval elapses,
-    then passes objects, in groups of its capacity, to a client-supplied processor block. */
+    then passes objects, in groups of its capacity, to a client-supplied processor block.
+
+    Objects may be queued from any thread. The processor block, the backpressure handler and the
+    flush methods always run on the thread that created the batcher, which must have a run loop. */
 @interface TDBatcher : NSObject {
     NSUInteger _capacity;
     NSTimeInterval _delay;
-    NSMutableArray* _inbox;
+    NSMutableArray* _inbox;  // guarded by @synchronized(self)
+    bool _wakeupPending;     // guarded by @synchronized(self)
     bool _scheduled;
     NSTimeInterval _scheduledDelay;
     void (^_processor)(NSArray*);
+    NSThread* _thread;
+    NSUInteger _highWaterMark;
+    bool _backedUp;
+    void (^_backpressureHandler)(BOOL);
 }
 
 - (id)initWithCapacity:(NSUInteger)capacity
                  delay:(NSTimeInterval)delay
              processor:(void (^)(NSArray*))block;
 
+/** Number of objects waiting to be processed. Safe to call from any thread. */
 @property (readonly) NSUInteger count;
 
+/** When the number of queued objects reaches this value the batcher reports that it is backed
+    up; it stops being backed up once the queue drains to half this value. Zero (the default)
+    disables backpressure. */
+@property (nonatomic) NSUInteger highWaterMark;
+
+/** YES while the queue is above the high-water mark (see above). */
+@property (readonly, nonatomic) BOOL backedUp;
+
+/** Called on the batcher's thread whenever .backedUp changes. Producers should stop adding
+    objects while it's YES. */
+@property (copy, nonatomic) void (^backpressureHandler)(BOOL backedUp);
+
+/** Adds objects to the queue. These may be called on any thread. */
 - (void)queueObject:(id)object;
 - (void)queueObjects:(NSArray*)objects;
 
@@ -19,6 +19,9 @@
 
 @implementation TDBatcher
 
+@synthesize highWaterMark = _highWaterMark, backedUp = _backedUp,
+            backpressureHandler = _backpressureHandler;
+
 - (id)initWithCapacity:(NSUInteger)capacity
                  delay:(NSTimeInterval)delay
              processor:(void (^)(NSArray*))block
@@ -28,6 +31,7 @@
         _capacity = capacity;
         _delay = delay;
         _processor = [block copy];
+        _thread = [NSThread currentThread];
     }
     return self;
 }
@@ -50,32 +54,66 @@
     }
 }
 
+// Removes up to 'limit' objects from the head of the inbox, returning them and setting
+// *outRemaining to the number left behind.
+- (NSArray*)dequeueUpTo:(NSUInteger)limit remaining:(NSUInteger*)outRemaining
+{
+    @synchronized(self)
+    {
+        NSArray* objects;
+        NSUInteger count = _inbox.count;
+        if (count <= limit) {
+            objects = _inbox;
+            _inbox = nil;
+            *outRemaining = 0;
+        } else {
+            NSRange range = NSMakeRange(0, limit);
+            objects = [_inbox subarrayWithRange:range];
+            [_inbox removeObjectsInRange:range];
+            *outRemaining = count - limit;
+        }
+        return objects;
+    }
+}
+
+// Flips .backedUp when the queue crosses the high-water mark, or drains to half of it.
+- (void)updateBackpressure:(NSUInteger)count
+{
+    if (_highWaterMark == 0) return;
+    BOOL backedUp = _backedUp ? (count > _highWaterMark / 2) : (count >= _highWaterMark);
+    if (backedUp != _backedUp) {
+        _backedUp = backedUp;
+        if (_backpressureHandler) _backpressureHandler(backedUp);
+    }
+}
+
 - (void)processNow
 {
     _scheduled = false;
-    NSArray* toProcess;
-    NSUInteger count = _inbox.count;
-    if (count == 0) {
-        return;
-    } else if (count <= _capacity) {
-        toProcess = _inbox;
-        _inbox = nil;
-    } else {
-        toProcess = [_inbox subarrayWithRange:NSMakeRange(0, _capacity)];
-        [_inbox removeObjectsInRange:NSMakeRange(0, _capacity)];
+    NSUInteger remaining;
+    NSArray* toProcess = [self dequeueUpTo:_capacity remaining:&remaining];
+    if (toProcess.count == 0) return;
+    if (remaining > 0) {
         // There are more objects left, so schedule them Real Soon:
         [self scheduleWithDelay:0.0];
     }
+    [self updateBackpressure:remaining];
     _processor(toProcess);
 }
 
-- (void)queueObjects:(NSArray*)objects
+// Runs on _thread after objects have been added to the inbox.
+- (void)inboxChanged
 {
-    if (objects.count == 0) return;
-    if (!_inbox) _inbox = [[NSMutableArray alloc] init];
-    [_inbox addObjectsFromArray:objects];
+    NSUInteger count;
+    @synchronized(self)
+    {
+        _wakeupPending = false;
+        count = _inbox.count;
+    }
+    if (count == 0) return;
+    [self updateBackpressure:count];
 
-    if (_inbox.count < _capacity)
+    if (count < _capacity)
         [self scheduleWithDelay:_delay];
     else {
         [self unschedule];
@@ -83,6 +121,28 @@
     }
 }
 
+- (void)queueObjects:(NSArray*)objects
+{
+    if (objects.count == 0) return;
+    BOOL wakeUp;
+    @synchronized(self)
+    {
+        if (!_inbox) _inbox = [[NSMutableArray alloc] init];
+        [_inbox addObjectsFromArray:objects];
+        // Only one wake-up needs to be in flight at a time; it'll see everything queued so far.
+        wakeUp = !_wakeupPending;
+        _wakeupPending = true;
+    }
+
+    if ([NSThread currentThread] == _thread)
+        [self inboxChanged];
+    else if (wakeUp)
+        [self performSelector:@selector(inboxChanged)
+                     onThread:_thread
+                   withObject:nil
+                waitUntilDone:NO];
+}
+
 - (void)queueObject:(id)object { [self queueObjects:@[ object ]]; }
 
 - (void)flush
@@ -93,14 +153,18 @@
 
 - (void)flushAll
 {
-    if (_inbox.count > 0) {
+    NSUInteger remaining;
+    NSArray* toProcess = [self dequeueUpTo:NSUIntegerMax remaining:&remaining];
+    if (toProcess.count > 0) {
         [self unschedule];
-        NSArray* toProcess = _inbox;
-        _inbox = nil;
+        [self updateBackpressure:0];
         _processor(toProcess);
     }
 }
 
-- (NSUInteger)count { return _inbox.count; }
+- (NSUInteger)count
+{
+    @synchronized(self) { return _inbox.count; }
+}
 
 @end
@@ -64,6 +64,18 @@ typedef struct TDBlobKey
  */
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db;
 
+/**
+ Return a reader for an attachment whose filename has already been looked up in the database,
+ e.g. by joining with the table that relates keys and filenames.
+
+ @param filename Filename of the attachment, as returned by the database
+
+ @return A reader
+
+ @see CDTBlobReader
+ */
+- (id<CDTBlobReader>)blobWithFilename:(NSString *)filename;
+
 /**
  Save to disk the data passed a parameter and also returns the key for the new attachment.
  
@@ -102,6 +102,12 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db
 {
     NSString *filename = [TD_Database filenameForKey:key inBlobFilenamesTableInDatabase:db];
+
+    return [self blobWithFilename:filename];
+}
+
+- (id<CDTBlobReader>)blobWithFilename:(NSString *)filename
+{
     NSString *blobPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
 
     id<CDTBlobReader> reader = [_blobHandleFactory readerWithPath:blobPath];
@@ -20,6 +20,15 @@ int TDCollateJSON(void *context, int len1, const void *chars1, int len2, const v
 int TDCollateJSONLimited(void *context, int len1, const void *chars1, int len2, const void *chars2,
                          unsigned arrayLimit);
 
+/** Returns a binary key for JSON-formatted data, such that comparing two keys with memcmp orders
+    them the same way TDCollateJSON orders the JSON, in the collation mode given by 'context'.
+    This lets SQLite sort and seek on the keys with its BINARY collation.
+    Unicode string collation can't be reproduced byte-wise, so in kTDCollateJSON_Unicode mode the
+    key stops at the first string in the JSON and *outExact is set to NO. Two such keys can then
+    only be ordered by memcmp if they differ; if they're equal the JSON has to be compared.
+    The same restrictions on the JSON apply as for TDCollateJSON. */
+NSData *TDCollationKeyForJSON(void *context, int len, const void *chars, BOOL *outExact);
+
 // CouchDB's default collation rules, including Unicode collation for strings
 #define kTDCollateJSON_Unicode ((void *)0)
 
@@ -306,3 +306,119 @@ int TDCollateJSON(void* context, int len1, const void* chars1, int len2, const v
 {
     return TDCollateJSONLimited(context, len1, chars1, len2, chars2, UINT_MAX);
 }
+
+#pragma mark - COLLATION KEYS:
+
+// Each token in a collation key starts with a byte giving its type, numbered in collation order
+// from 1, so that the 0 terminating a string sorts before any token.
+static uint8_t collationKeyTag(ValueType type, void* context)
+{
+    if (context != kTDCollateJSON_Raw)
+        return (uint8_t)(type + 1);
+    else
+        return (uint8_t)(kRawOrderOfValueType[type] + 5);
+}
+
+// Numbers are 8 big-endian bytes, with the bits of the double flipped so that they sort as
+// unsigned integers: all of them for negative numbers, just the sign bit for positive ones.
+static void appendCollationKeyNumber(NSMutableData* key, double n)
+{
+    if (n == 0.0) n = 0.0;  // -0.0 collates equal to 0.0
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    bits = (bits & 0x8000000000000000ULL) ? ~bits : (bits | 0x8000000000000000ULL);
+    bits = CFSwapInt64HostToBig(bits);
+    [key appendBytes:&bits length:sizeof(bits)];
+}
+
+// Strings are their characters, compared as chars by compareStringsASCII, shifted so that they
+// sort as unsigned bytes, then a 0. Bytes 0 and 1 are escaped as 1 1 and 1 2 to keep them above
+// the terminator.
+static void appendCollationKeyStringASCII(NSMutableData* key, const char** in)
+{
+    const char* str = *in;
+    uint8_t escape = 1;
+    while (true) {
+        char c = *++str;
+        if (c == '"') break;
+        if (c == '\\') c = convertEscape(&str);
+        uint8_t b = (uint8_t)((int)c - CHAR_MIN);
+        if (b <= 1) {
+            [key appendBytes:&escape length:1];
+            b += 1;
+        }
+        [key appendBytes:&b length:1];
+    }
+    uint8_t terminator = 0;
+    [key appendBytes:&terminator length:1];
+    *in = str + 1;
+}
+
+NSData* TDCollationKeyForJSON(void* context, int len, const void* chars, BOOL* outExact)
+{
+    NSMutableData* key = [NSMutableData dataWithCapacity:len + 8];
+    const char* str = chars;
+    BOOL exact = YES;
+    int depth = 0;
+
+    // Walks the tokens just as TDCollateJSONLimited does:
+    do {
+        ValueType type = valueTypeOf(*str);
+        if (type == kIllegal) {
+            exact = NO;
+            break;
+        }
+        uint8_t tag = collationKeyTag(type, context);
+        [key appendBytes:&tag length:1];
+
+        if (type == kString && context == kTDCollateJSON_Unicode) {
+            exact = NO;
+            break;
+        }
+
+        switch (type) {
+            case kNull:
+            case kTrue:
+                str += 4;
+                break;
+            case kFalse:
+                str += 5;
+                break;
+            case kNumber: {
+                char* next;
+                double n;
+                if (depth == 0) {
+                    // Don't read past the end of the input; see TDCollateJSONLimited
+                    n = readNumber(str, (const char*)chars + len, &next);
+                } else {
+                    n = strtod(str, &next);
+                }
+                appendCollationKeyNumber(key, n);
+                str = next;
+                break;
+            }
+            case kString:
+                appendCollationKeyStringASCII(key, &str);
+                break;
+            case kArray:
+            case kObject:
+                ++str;
+                ++depth;
+                break;
+            case kEndArray:
+            case kEndObject:
+                ++str;
+                --depth;
+                break;
+            case kComma:
+            case kColon:
+                ++str;
+                break;
+            case kIllegal:
+                break;
+        }
+    } while (depth > 0);
+
+    if (outExact) *outExact = exact;
+    return key;
+}
@@ -50,6 +50,18 @@
 /** Must be called from within a queue -inDatabase: or -inTransaction: **/
 - (TDStatus)deleteViewNamed:(NSString*)name;
 
+/** Must be called from within a queue -inDatabase: or -inTransaction: **/
+- (NSDictionary*)extraPropertiesForRevision:(TD_Revision*)rev
+                                    options:(TDContentOptions)options
+                                 inDatabase:(FMDatabase*)db;
+
+/** Decodes a revision's JSON body and adds the extra properties to it. Doesn't touch the
+    database, so can be called on any thread. */
++ (NSDictionary*)documentPropertiesFromJSON:(NSData*)json
+                            extraProperties:(NSDictionary*)extra
+                                      docID:(NSString*)docID
+                                      revID:(NSString*)revID;
+
 - (NSMutableDictionary*)documentPropertiesFromJSON:(NSData*)json
                                              docID:(NSString*)docID
                                              revID:(NSString*)revID
@@ -78,6 +90,7 @@
 - (NSUInteger)blobCount;
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key;
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db;
+- (id<CDTBlobReader>)blobWithFilename:(NSString *)filename;
 - (BOOL)storeBlob:(NSData *)blob creatingKey:(TDBlobKey *)outKey;
 - (BOOL)storeBlob:(NSData *)blob creatingKey:(TDBlobKey *)outKey withDatabase:(FMDatabase *)db;
 - (BOOL)storeBlob:(NSData *)blob
@@ -111,6 +124,11 @@
 @interface TD_View ()
 - (id)initWithDatabase:(TD_Database*)db name:(NSString*)name;
 @property (readonly) int viewID;
++ (NSString*)mapTableForViewID:(int)viewID;
++ (BOOL)createMapTableForViewID:(int)viewID
+                      collation:(TDViewCollation)collation
+                     inDatabase:(FMDatabase*)db;
++ (NSString*)reduceTableForViewID:(int)viewID;
 - (NSArray*)dump;
 - (void)databaseClosing;
 @end
@@ -135,10 +153,19 @@
                                     path:(NSString*)relativePath
                                     body:(id)body
                             onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+/** Like -sendAsyncRequest:... but the completion block gets the unparsed response body (NSData). */
+- (TDRemoteJSONRequest*)sendAsyncRawRequest:(NSString*)method
+                                       path:(NSString*)relativePath
+                                       body:(id)body
+                               onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
 - (void)addRemoteRequest:(TDRemoteRequest*)request;
 - (void)removeRemoteRequest:(TDRemoteRequest*)request;
 - (void)asyncTaskStarted;
 - (void)asyncTasksFinished:(NSUInteger)numTasks;
+/** Runs the block (on the replicator thread) once the scheduler grants a unit of the resource;
+    immediately if there's no scheduler. Balance with -releaseResource:. */
+- (void)acquireResource:(TDReplicationResource)resource then:(void (^)())block;
+- (void)releaseResource:(TDReplicationResource)resource;
 - (void)stopped;
 - (void)databaseClosing;
 - (void)revisionFailed;  // subclasses call this if a transfer fails
@@ -0,0 +1,53 @@
+//
+//  TDJSONScanner.h
+//  CloudantSync
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+/** Reads a document's JSON as received from a remote server in a single pass, without building
+    an object tree. The special properties the replicator needs (_id, _rev, _deleted, _revisions
+    and the presence of _attachments) are picked out as they go by, and the rest of the body is
+    re-emitted in canonical form (see TDCanonicalJSON) ready to be stored in the revs table.
+
+    Anything unusual -- malformed JSON, duplicate keys, lone surrogates, very deep nesting --
+    makes -scan fail, and the caller should fall back to parsing the document normally. */
+@interface TDJSONScanner : NSObject
+
+- (id)initWithData:(NSData*)json;
+
+/** Scans the document. Returns NO if the JSON isn't an object the scanner can handle, or if it
+    contains an invalid top-level "_"-prefixed key. */
+- (BOOL)scan;
+
+@property (readonly) NSData* json;
+@property (readonly) NSString* docID;
+@property (readonly) NSString* revID;
+@property (readonly) BOOL deleted;
+
+/** Revision IDs from the _revisions property, newest first, or nil if there wasn't one. */
+@property (readonly) NSArray* revisionHistory;
+
+/** YES if the document has a non-empty _attachments property. The scanner doesn't look inside
+    it; such documents need to go through the regular attachment handling. */
+@property (readonly) BOOL hasAttachments;
+
+/** Canonical JSON of the body with all special keys removed, as -encodeDocumentJSON: would
+    produce it. Numbers are kept in the form in which they were received. */
+@property (readonly) NSData* canonicalBody;
+
+/** Locates the "doc" values of the rows in an _all_docs?include_docs=true response without
+    parsing them. Returns one NSData per row (NSNull for rows without a doc object), or nil if the
+    response isn't well-formed. */
++ (NSArray*)documentsInAllDocsResponse:(NSData*)json;
+
+@end
@@ -0,0 +1,719 @@
+//
+//  TDJSONScanner.m
+//  CloudantSync
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDJSONScanner.h"
+#import "CDTLogging.h"
+
+// Objects and arrays nested deeper than this make the scan fail (and the caller fall back to the
+// regular parser) rather than risk running out of stack on the replicator thread.
+#define kMaxNestingDepth 128
+
+#pragma mark - LOW-LEVEL SCANNING:
+
+typedef struct {
+    const uint8_t* pos;
+    const uint8_t* end;
+    unsigned depth;
+} TDJSONCursor;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} TDJSONBuffer;
+
+/** A member of a JSON object, waiting to be written out in canonical key order. */
+typedef struct {
+    const uint8_t* key;  // decoded UTF-8 key
+    size_t keyLength;
+    uint8_t* ownedKey;   // non-NULL if the key had escapes and had to be decoded into a copy
+    const uint8_t* value;
+    const uint8_t* valueEnd;
+} TDJSONMember;
+
+typedef struct {
+    TDJSONMember* members;
+    size_t count;
+    size_t capacity;
+} TDJSONMemberList;
+
+static bool bufferAppend(TDJSONBuffer* buf, const void* bytes, size_t length)
+{
+    if (buf->length + length > buf->capacity) {
+        size_t capacity = MAX(buf->capacity * 2, buf->length + length + 256);
+        uint8_t* bytes = realloc(buf->bytes, capacity);
+        if (!bytes) return false;
+        buf->bytes = bytes;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->bytes + buf->length, bytes, length);
+    buf->length += length;
+    return true;
+}
+
+static inline bool bufferAppendByte(TDJSONBuffer* buf, uint8_t byte)
+{
+    return bufferAppend(buf, &byte, 1);
+}
+
+static void memberListFree(TDJSONMemberList* list)
+{
+    for (size_t i = 0; i < list->count; i++) free(list->members[i].ownedKey);
+    free(list->members);
+    list->members = NULL;
+    list->count = list->capacity = 0;
+}
+
+static TDJSONMember* memberListAdd(TDJSONMemberList* list)
+{
+    if (list->count == list->capacity) {
+        size_t capacity = MAX(list->capacity * 2, (size_t)8);
+        TDJSONMember* members = realloc(list->members, capacity * sizeof(TDJSONMember));
+        if (!members) return NULL;
+        list->members = members;
+        list->capacity = capacity;
+    }
+    TDJSONMember* member = &list->members[list->count++];
+    memset(member, 0, sizeof(*member));
+    return member;
+}
+
+static inline void skipWhitespace(TDJSONCursor* c)
+{
+    while (c->pos < c->end &&
+           (*c->pos == ' ' || *c->pos == '\n' || *c->pos == '\r' || *c->pos == '\t'))
+        c->pos++;
+}
+
+static inline bool scanByte(TDJSONCursor* c, uint8_t byte)
+{
+    skipWhitespace(c);
+    if (c->pos >= c->end || *c->pos != byte) return false;
+    c->pos++;
+    return true;
+}
+
+/** Scans a string token. On return start/end delimit the raw (still escaped) contents. */
+static bool scanString(TDJSONCursor* c, const uint8_t** start, const uint8_t** end, bool* escaped)
+{
+    if (!scanByte(c, '"')) return false;
+    *start = c->pos;
+    *escaped = false;
+    while (c->pos < c->end) {
+        uint8_t ch = *c->pos;
+        if (ch == '"') {
+            *end = c->pos++;
+            return true;
+        } else if (ch == '\\') {
+            *escaped = true;
+            c->pos += 2;
+        } else if (ch < 0x20) {
+            return false;
+        } else {
+            c->pos++;
+        }
+    }
+    return false;
+}
+
+static int hexValue(uint8_t ch)
+{
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+static bool scanHex4(const uint8_t** pos, const uint8_t* end, uint32_t* outValue)
+{
+    if (end - *pos < 4) return false;
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hexValue((*pos)[i]);
+        if (digit < 0) return false;
+        value = (value << 4) | (uint32_t)digit;
+    }
+    *pos += 4;
+    *outValue = value;
+    return true;
+}
+
+static bool appendUTF8(TDJSONBuffer* buf, uint32_t cp)
+{
+    uint8_t bytes[4];
+    size_t n;
+    if (cp < 0x80) {
+        bytes[0] = (uint8_t)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        bytes[0] = (uint8_t)(0xC0 | (cp >> 6));
+        bytes[1] = (uint8_t)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        bytes[0] = (uint8_t)(0xE0 | (cp >> 12));
+        bytes[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        bytes[2] = (uint8_t)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        bytes[0] = (uint8_t)(0xF0 | (cp >> 18));
+        bytes[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+        bytes[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        bytes[3] = (uint8_t)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    return bufferAppend(buf, bytes, n);
+}
+
+/** Decodes the escapes in a raw string token, appending the resulting UTF-8 to buf. */
+static bool decodeString(const uint8_t* pos, const uint8_t* end, TDJSONBuffer* buf)
+{
+    while (pos < end) {
+        const uint8_t* run = pos;
+        while (pos < end && *pos != '\\') pos++;
+        if (pos > run && !bufferAppend(buf, run, pos - run)) return false;
+        if (pos >= end) break;
+
+        if (end - pos < 2) return false;
+        uint8_t esc = pos[1];
+        pos += 2;
+        uint8_t ch;
+        switch (esc) {
+            case '"':
+            case '\\':
+            case '/':
+                ch = esc;
+                break;
+            case 'b':
+                ch = '\b';
+                break;
+            case 'f':
+                ch = '\f';
+                break;
+            case 'n':
+                ch = '\n';
+                break;
+            case 'r':
+                ch = '\r';
+                break;
+            case 't':
+                ch = '\t';
+                break;
+            case 'u': {
+                uint32_t cp;
+                if (!scanHex4(&pos, end, &cp)) return false;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    // High surrogate; must be followed by an escaped low surrogate:
+                    uint32_t low;
+                    if (end - pos < 2 || pos[0] != '\\' || pos[1] != 'u') return false;
+                    pos += 2;
+                    if (!scanHex4(&pos, end, &low) || low < 0xDC00 || low > 0xDFFF) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;  // lone low surrogate
+                }
+                if (!appendUTF8(buf, cp)) return false;
+                continue;
+            }
+            default:
+                return false;
+        }
+        if (!bufferAppendByte(buf, ch)) return false;
+    }
+    return true;
+}
+
+/** Writes decoded UTF-8 as a quoted string, escaped the same way as TDCanonicalJSON does it. */
+static bool writeCanonicalString(TDJSONBuffer* out, const uint8_t* pos, size_t length)
+{
+    const uint8_t* end = pos + length;
+    if (!bufferAppendByte(out, '"')) return false;
+    while (pos < end) {
+        const uint8_t* run = pos;
+        while (pos < end && *pos >= 0x20 && *pos != '"' && *pos != '\\') pos++;
+        if (pos > run && !bufferAppend(out, run, pos - run)) return false;
+        if (pos >= end) break;
+
+        uint8_t ch = *pos++;
+        char escaped[8];
+        switch (ch) {
+            case '"':
+                strcpy(escaped, "\\\"");
+                break;
+            case '\\':
+                strcpy(escaped, "\\\\");
+                break;
+            case '\r':
+                strcpy(escaped, "\\r");
+                break;
+            case '\n':
+                strcpy(escaped, "\\n");
+                break;
+            default:
+                snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                break;
+        }
+        if (!bufferAppend(out, escaped, strlen(escaped))) return false;
+    }
+    return bufferAppendByte(out, '"');
+}
+
+static bool scanNumber(TDJSONCursor* c)
+{
+    skipWhitespace(c);
+    const uint8_t* p = c->pos;
+    const uint8_t* end = c->end;
+    if (p < end && *p == '-') p++;
+    if (p >= end || !isdigit(*p)) return false;
+    if (*p == '0')
+        p++;
+    else
+        while (p < end && isdigit(*p)) p++;
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || !isdigit(*p)) return false;
+        while (p < end && isdigit(*p)) p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p >= end || !isdigit(*p)) return false;
+        while (p < end && isdigit(*p)) p++;
+    }
+    c->pos = p;
+    return true;
+}
+
+static bool scanLiteral(TDJSONCursor* c, const char* literal)
+{
+    skipWhitespace(c);
+    size_t length = strlen(literal);
+    if ((size_t)(c->end - c->pos) < length || memcmp(c->pos, literal, length) != 0) return false;
+    c->pos += length;
+    return true;
+}
+
+static bool skipValue(TDJSONCursor* c);
+
+static bool skipContainer(TDJSONCursor* c, uint8_t open, uint8_t close)
+{
+    if (!scanByte(c, open) || ++c->depth > kMaxNestingDepth) return false;
+    if (!scanByte(c, close)) {
+        do {
+            if (open == '{') {
+                const uint8_t* start, *end;
+                bool escaped;
+                if (!scanString(c, &start, &end, &escaped) || !scanByte(c, ':')) return false;
+            }
+            if (!skipValue(c)) return false;
+        } while (scanByte(c, ','));
+        if (!scanByte(c, close)) return false;
+    }
+    c->depth--;
+    return true;
+}
+
+static bool skipValue(TDJSONCursor* c)
+{
+    skipWhitespace(c);
+    if (c->pos >= c->end) return false;
+    switch (*c->pos) {
+        case '{':
+            return skipContainer(c, '{', '}');
+        case '[':
+            return skipContainer(c, '[', ']');
+        case '"': {
+            const uint8_t* start, *end;
+            bool escaped;
+            return scanString(c, &start, &end, &escaped);
+        }
+        case 't':
+            return scanLiteral(c, "true");
+        case 'f':
+            return scanLiteral(c, "false");
+        case 'n':
+            return scanLiteral(c, "null");
+        default:
+            return scanNumber(c);
+    }
+}
+
+/** Scans an object key, decoding it if it contains escapes, into the member's key fields. */
+static bool scanKey(TDJSONCursor* c, TDJSONMember* member)
+{
+    const uint8_t* start, *end;
+    bool escaped;
+    if (!scanString(c, &start, &end, &escaped)) return false;
+    if (!escaped) {
+        member->key = start;
+        member->keyLength = end - start;
+        return true;
+    }
+    TDJSONBuffer decoded = {NULL, 0, 0};
+    if (!decodeString(start, end, &decoded)) {
+        free(decoded.bytes);
+        return false;
+    }
+    member->ownedKey = decoded.bytes;
+    member->key = decoded.bytes;
+    member->keyLength = decoded.length;
+    return true;
+}
+
+/** Orders object keys the way TDCanonicalJSON does (NSLiteralSearch, i.e. by UTF-16 code unit).
+    UTF-8 byte order matches that, except that characters U+E000..U+FFFF sort after those outside
+    the BMP in UTF-8 but before them in UTF-16. */
+static int compareMembers(const void* a, const void* b)
+{
+    const TDJSONMember* m1 = a, *m2 = b;
+    size_t minLength = MIN(m1->keyLength, m2->keyLength);
+    size_t i = 0;
+    while (i < minLength && m1->key[i] == m2->key[i]) i++;
+    if (i == minLength) {
+        return (m1->keyLength > m2->keyLength) - (m1->keyLength < m2->keyLength);
+    }
+    // Back up to the lead byte of the differing character:
+    while (i > 0 && (m1->key[i] & 0xC0) == 0x80) i--;
+    uint8_t lead1 = m1->key[i], lead2 = m2->key[i];
+    bool high1 = (lead1 == 0xEE || lead1 == 0xEF), high2 = (lead2 == 0xEE || lead2 == 0xEF);
+    bool supp1 = lead1 >= 0xF0, supp2 = lead2 >= 0xF0;
+    if (high1 && supp2) return 1;
+    if (supp1 && high2) return -1;
+
+    // Compare from the first differing byte itself:
+    while (m1->key[i] == m2->key[i]) i++;
+    return (int)m1->key[i] - (int)m2->key[i];
+}
+
+static bool writeCanonicalValue(TDJSONCursor* c, TDJSONBuffer* out);
+
+/** Sorts the collected members and writes them out as a canonical JSON object. */
+static bool writeCanonicalMembers(TDJSONMemberList* list, unsigned depth, TDJSONBuffer* out)
+{
+    qsort(list->members, list->count, sizeof(TDJSONMember), compareMembers);
+    if (!bufferAppendByte(out, '{')) return false;
+    for (size_t i = 0; i < list->count; i++) {
+        TDJSONMember* member = &list->members[i];
+        if (i > 0) {
+            if (compareMembers(member, member - 1) == 0) return false;  // duplicate key
+            if (!bufferAppendByte(out, ',')) return false;
+        }
+        if (!writeCanonicalString(out, member->key, member->keyLength) ||
+            !bufferAppendByte(out, ':'))
+            return false;
+        TDJSONCursor valueCursor = {member->value, member->valueEnd, depth};
+        if (!writeCanonicalValue(&valueCursor, out)) return false;
+    }
+    return bufferAppendByte(out, '}');
+}
+
+static bool writeCanonicalObject(TDJSONCursor* c, TDJSONBuffer* out)
+{
+    if (!scanByte(c, '{') || ++c->depth > kMaxNestingDepth) return false;
+    TDJSONMemberList list = {NULL, 0, 0};
+    bool ok = true;
+    if (!scanByte(c, '}')) {
+        do {
+            TDJSONMember* member = memberListAdd(&list);
+            ok = member && scanKey(c, member) && scanByte(c, ':');
+            if (ok) {
+                skipWhitespace(c);
+                member->value = c->pos;
+                ok = skipValue(c);
+                member->valueEnd = c->pos;
+            }
+        } while (ok && scanByte(c, ','));
+        ok = ok && scanByte(c, '}');
+    }
+    ok = ok && writeCanonicalMembers(&list, c->depth, out);
+    memberListFree(&list);
+    c->depth--;
+    return ok;
+}
+
+static bool writeCanonicalArray(TDJSONCursor* c, TDJSONBuffer* out)
+{
+    if (!scanByte(c, '[') || ++c->depth > kMaxNestingDepth) return false;
+    if (!bufferAppendByte(out, '[')) return false;
+    if (!scanByte(c, ']')) {
+        bool first = true;
+        do {
+            if (!first && !bufferAppendByte(out, ',')) return false;
+            first = false;
+            if (!writeCanonicalValue(c, out)) return false;
+        } while (scanByte(c, ','));
+        if (!scanByte(c, ']')) return false;
+    }
+    c->depth--;
+    return bufferAppendByte(out, ']');
+}
+
+static bool writeCanonicalValue(TDJSONCursor* c, TDJSONBuffer* out)
+{
+    skipWhitespace(c);
+    if (c->pos >= c->end) return false;
+    switch (*c->pos) {
+        case '{':
+            return writeCanonicalObject(c, out);
+        case '[':
+            return writeCanonicalArray(c, out);
+        case '"': {
+            const uint8_t* start, *end;
+            bool escaped;
+            if (!scanString(c, &start, &end, &escaped)) return false;
+            if (!escaped) return writeCanonicalString(out, start, end - start);
+            TDJSONBuffer decoded = {NULL, 0, 0};
+            bool ok = decodeString(start, end, &decoded) &&
+                      writeCanonicalString(out, decoded.bytes, decoded.length);
+            free(decoded.bytes);
+            return ok;
+        }
+        default: {
+            // Literals and numbers are copied through as received:
+            const uint8_t* start = c->pos;
+            if (!skipValue(c)) return false;
+            return bufferAppend(out, start, c->pos - start);
+        }
+    }
+}
+
+static bool keyEquals(const TDJSONMember* member, const char* key)
+{
+    size_t length = strlen(key);
+    return member->keyLength == length && memcmp(member->key, key, length) == 0;
+}
+
+static NSString* scanNSString(TDJSONCursor* c)
+{
+    const uint8_t* start, *end;
+    bool escaped;
+    if (!scanString(c, &start, &end, &escaped)) return nil;
+    if (!escaped) {
+        return [[NSString alloc] initWithBytes:start length:end - start encoding:NSUTF8StringEncoding];
+    }
+    TDJSONBuffer decoded = {NULL, 0, 0};
+    NSString* result = nil;
+    if (decodeString(start, end, &decoded)) {
+        result = [[NSString alloc] initWithBytes:decoded.bytes
+                                          length:decoded.length
+                                        encoding:NSUTF8StringEncoding];
+    }
+    free(decoded.bytes);
+    return result;
+}
+
+#pragma mark - TDJSONScanner:
+
+@implementation TDJSONScanner
+
+@synthesize json = _json, docID = _docID, revID = _revID, deleted = _deleted,
+            revisionHistory = _revisionHistory, hasAttachments = _hasAttachments,
+            canonicalBody = _canonicalBody;
+
+- (id)initWithData:(NSData*)json
+{
+    NSParameterAssert(json);
+    self = [super init];
+    if (self) {
+        _json = [json copy];
+    }
+    return self;
+}
+
+// Parses {"start": N, "ids": ["suffix", ...]} into full revision IDs, newest first.
+- (BOOL)scanRevisions:(TDJSONCursor*)c
+{
+    if (!scanByte(c, '{')) return NO;
+    long start = 0;
+    NSMutableArray* suffixes = nil;
+    if (!scanByte(c, '}')) {
+        do {
+            TDJSONMember key = {0};
+            if (!scanKey(c, &key) || !scanByte(c, ':')) {
+                free(key.ownedKey);
+                return NO;
+            }
+            BOOL isStart = keyEquals(&key, "start"), isIDs = keyEquals(&key, "ids");
+            free(key.ownedKey);
+            if (isStart) {
+                skipWhitespace(c);
+                const uint8_t* number = c->pos;
+                if (!scanNumber(c)) return NO;
+                char digits[24];
+                size_t length = MIN((size_t)(c->pos - number), sizeof(digits) - 1);
+                memcpy(digits, number, length);
+                digits[length] = 0;
+                start = strtol(digits, NULL, 10);
+            } else if (isIDs) {
+                if (!scanByte(c, '[')) return NO;
+                suffixes = [[NSMutableArray alloc] init];
+                if (!scanByte(c, ']')) {
+                    do {
+                        NSString* suffix = scanNSString(c);
+                        if (!suffix) return NO;
+                        [suffixes addObject:suffix];
+                    } while (scanByte(c, ','));
+                    if (!scanByte(c, ']')) return NO;
+                }
+            } else if (!skipValue(c)) {
+                return NO;
+            }
+        } while (scanByte(c, ','));
+        if (!scanByte(c, '}')) return NO;
+    }
+
+    // Same expansion of the numeric prefixes as +[TD_Database parseCouchDBRevisionHistory:]:
+    if (start && suffixes) {
+        NSMutableArray* history = [[NSMutableArray alloc] initWithCapacity:suffixes.count];
+        for (NSString* suffix in suffixes) {
+            [history addObject:[NSString stringWithFormat:@"%ld-%@", start--, suffix]];
+        }
+        _revisionHistory = history;
+    } else {
+        _revisionHistory = suffixes;
+    }
+    return YES;
+}
+
+- (BOOL)scan
+{
+    TDJSONCursor c = {_json.bytes, (const uint8_t*)_json.bytes + _json.length, 0};
+    TDJSONMemberList body = {NULL, 0, 0};
+    TDJSONBuffer out = {NULL, 0, 0};
+    BOOL ok = NO;
+
+    if (!scanByte(&c, '{')) goto done;
+    c.depth = 1;
+    if (!scanByte(&c, '}')) {
+        do {
+            TDJSONMember* member = memberListAdd(&body);
+            if (!member || !scanKey(&c, member) || !scanByte(&c, ':')) goto done;
+            skipWhitespace(&c);
+
+            if (member->keyLength == 0 || member->key[0] != '_' ||
+                keyEquals(member, "_replication_id") || keyEquals(member, "_replication_state") ||
+                keyEquals(member, "_replication_state_time") ||
+                keyEquals(member, "_replication_stats")) {
+                // An ordinary property; it'll be written to the canonical body later:
+                member->value = c.pos;
+                if (!skipValue(&c)) goto done;
+                member->valueEnd = c.pos;
+                continue;
+            }
+
+            // A special property; consume it here and drop it from the body:
+            if (keyEquals(member, "_id")) {
+                _docID = scanNSString(&c);
+                if (!_docID) goto done;
+            } else if (keyEquals(member, "_rev")) {
+                _revID = scanNSString(&c);
+                if (!_revID) goto done;
+            } else if (keyEquals(member, "_deleted")) {
+                const uint8_t* value = c.pos;
+                if (!skipValue(&c)) goto done;
+                _deleted = (c.pos - value == 4 && memcmp(value, "true", 4) == 0);
+            } else if (keyEquals(member, "_revisions")) {
+                if (![self scanRevisions:&c]) goto done;
+            } else if (keyEquals(member, "_attachments")) {
+                const uint8_t* value = c.pos;
+                if (!skipValue(&c)) goto done;
+                // Only an empty object means there are no attachments to deal with:
+                TDJSONCursor attachments = {value, c.pos, 1};
+                _hasAttachments = !(scanByte(&attachments, '{') && scanByte(&attachments, '}'));
+            } else if (keyEquals(member, "_revs_info") || keyEquals(member, "_conflicts") ||
+                       keyEquals(member, "_deleted_conflicts") ||
+                       keyEquals(member, "_local_seq")) {
+                if (!skipValue(&c)) goto done;
+            } else {
+                CDTLogInfo(CDTDATASTORE_LOG_CONTEXT,
+                           @"TDJSONScanner: Invalid top-level key '%.*s' in document",
+                           (int)member->keyLength, member->key);
+                goto done;
+            }
+            free(member->ownedKey);
+            body.count--;
+        } while (scanByte(&c, ','));
+        if (!scanByte(&c, '}')) goto done;
+    }
+    skipWhitespace(&c);
+    if (c.pos != c.end) goto done;  // trailing garbage
+
+    if (!writeCanonicalMembers(&body, 1, &out)) goto done;
+    _canonicalBody = [[NSData alloc] initWithBytesNoCopy:out.bytes length:out.length freeWhenDone:YES];
+    out.bytes = NULL;
+    ok = YES;
+
+done:
+    memberListFree(&body);
+    free(out.bytes);
+    return ok;
+}
+
++ (NSArray*)documentsInAllDocsResponse:(NSData*)json
+{
+    TDJSONCursor c = {json.bytes, (const uint8_t*)json.bytes + json.length, 0};
+    NSMutableArray* docs = nil;
+
+    if (!scanByte(&c, '{')) return nil;
+    if (!scanByte(&c, '}')) {
+        do {
+            TDJSONMember key = {0};
+            if (!scanKey(&c, &key) || !scanByte(&c, ':')) {
+                free(key.ownedKey);
+                return nil;
+            }
+            BOOL isRows = keyEquals(&key, "rows");
+            free(key.ownedKey);
+            if (!isRows) {
+                if (!skipValue(&c)) return nil;
+                continue;
+            }
+
+            // Walk the rows, noting where each one's "doc" object is:
+            if (!scanByte(&c, '[')) return nil;
+            docs = [[NSMutableArray alloc] init];
+            if (scanByte(&c, ']')) continue;
+            do {
+                if (!scanByte(&c, '{')) return nil;
+                id doc = [NSNull null];
+                if (!scanByte(&c, '}')) {
+                    do {
+                        TDJSONMember rowKey = {0};
+                        if (!scanKey(&c, &rowKey) || !scanByte(&c, ':')) {
+                            free(rowKey.ownedKey);
+                            return nil;
+                        }
+                        BOOL isDoc = keyEquals(&rowKey, "doc");
+                        free(rowKey.ownedKey);
+                        skipWhitespace(&c);
+                        const uint8_t* value = c.pos;
+                        if (!skipValue(&c)) return nil;
+                        if (isDoc && *value == '{') {
+                            doc = [json subdataWithRange:NSMakeRange(value - (const uint8_t*)json.bytes,
+                                                                     c.pos - value)];
+                        }
+                    } while (scanByte(&c, ','));
+                    if (!scanByte(&c, '}')) return nil;
+                }
+                [docs addObject:doc];
+            } while (scanByte(&c, ','));
+            if (!scanByte(&c, ']')) return nil;
+        } while (scanByte(&c, ','));
+        if (!scanByte(&c, '}')) return nil;
+    }
+    skipWhitespace(&c);
+    if (c.pos != c.end) return nil;
+    return docs ?: @[];
+}
+
+@end
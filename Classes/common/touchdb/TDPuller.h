@@ -22,7 +22,10 @@
     NSMutableArray* _deletedRevsToPull;  // Separate lower-priority of deleted TDPulledRevisions
     NSMutableArray* _bulkRevsToPull;     // TDPulledRevisions that can be fetched in bulk
     NSUInteger _httpConnectionCount;     // Number of active NSURLConnections
+    NSUInteger _connectionsRequested;    // Connections asked of the scheduler but not granted yet
     TDBatcher* _downloadsToInsert;       // Queue of TDPulledRevisions, with bodies, to insert in DB
+    dispatch_queue_t _insertQueue;       // Serial queue on which downloads are written to the DB
+    NSUInteger _insertingCount;          // Number of revs handed to _insertQueue but not yet done
 }
 
 @end
@@ -32,9 +35,13 @@
    @private
     id _remoteSequenceID;
     bool _conflicted;
+    NSArray* _revisionHistory;
 }
 
 @property (copy) id remoteSequenceID;
 @property bool conflicted;
 
+/** For revisions read by a TDJSONScanner: the parsed _revisions history, newest first. */
+@property (copy) NSArray* revisionHistory;
+
 @end
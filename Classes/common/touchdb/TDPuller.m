@@ -19,6 +19,7 @@
 #import "TD_Database+Insertion.h"
 #import "TD_Database+Replication.h"
 #import "TD_Revision.h"
+#import "TD_Body.h"
 #import "TDChangeTracker.h"
 #import "TDAuthorizer.h"
 #import "TDBatcher.h"
@@ -27,7 +28,9 @@
 #import "TDInternal.h"
 #import "TDMisc.h"
 #import "ExceptionUtils.h"
+#import "MYBlockUtils.h"
 #import "TDJSON.h"
+#import "TDJSONScanner.h"
 #import "CDTLogging.h"
 
 // Maximum number of revisions to fetch simultaneously. (CFNetwork will only send about 5
@@ -46,6 +49,10 @@
 // Maximum number of revision IDs to pass in an "?atts_since=" query param
 #define kMaxNumberOfAttsSince 50u
 
+// Number of revisions waiting to be fetched, or waiting to be inserted, at which the _changes
+// feed is paused. It's resumed once the backlog drains to half this.
+#define kMaxBackloggedRevs 1000u
+
 @interface TDPuller () <TDChangeTrackerClient>
 @end
 
@@ -64,7 +71,13 @@ static NSString* joinQuotedEscaped(NSArray* strings);
             initWithCapacity:200
                        delay:1.0
                    processor:^(NSArray* downloads) { [self insertDownloads:downloads]; }];
+        _downloadsToInsert.highWaterMark = kMaxBackloggedRevs;
+        _downloadsToInsert.backpressureHandler = ^(BOOL backedUp) {
+            [self updateChangeTrackerPaused];
+        };
     }
+    if (!_insertQueue)
+        _insertQueue = dispatch_queue_create("com.cloudant.sync.replicator.inserts", NULL);
     if (!_pendingSequences) {
         _pendingSequences = [[TDSequenceMap alloc] init];
         if (_lastSequence != nil) {
@@ -215,6 +228,7 @@ static NSString* joinQuotedEscaped(NSArray* strings);
         }
     }
     self.changesTotal += changeCount;
+    [self updateChangeTrackerPaused];
 
     // We can tell we've caught up when the _changes feed returns less than we asked for:
     if (!_caughtUp && changes.count < kChangesFeedLimit) {
@@ -271,6 +285,8 @@ static NSString* joinQuotedEscaped(NSArray* strings);
         SequenceNumber seq = [_pendingSequences addValue:lastInboxSequence];
         [_pendingSequences removeSequence:seq];
         self.lastSequence = _pendingSequences.checkpointedValue;
+        // The inbox has left _batcher, which may let the changes feed resume:
+        [self updateChangeTrackerPaused];
         return;
     }
 
@@ -312,32 +328,75 @@ static NSString* joinQuotedEscaped(NSArray* strings);
     }
 }
 
-// Start up some HTTP GETs, within our limit on the maximum simultaneous number
+// Start up some HTTP GETs, within our limit on the maximum simultaneous number. Each one also
+// needs a connection from the scheduler's global budget, if there is a scheduler.
 - (void)pullRemoteRevisions
 {
-    while (_db && _httpConnectionCount < kMaxOpenHTTPConnections) {
-        NSUInteger nBulk = MIN(_bulkRevsToPull.count, kMaxRevsToGetInBulk);
-        if (nBulk == 1) {
-            // Rather than pulling a single revision in 'bulk', just pull it normally:
-            [self queueRemoteRevision:_bulkRevsToPull[0]];
-            [_bulkRevsToPull removeObjectAtIndex:0];
-            nBulk = 0;
-        }
-        if (nBulk > 0) {
-            // Prefer to pull bulk revisions:
-            NSRange r = NSMakeRange(0, nBulk);
-            [self pullBulkRevisions:[_bulkRevsToPull subarrayWithRange:r]];
-            [_bulkRevsToPull removeObjectsInRange:r];
-        } else {
-            // Prefer to pull an existing revision over a deleted one:
-            NSMutableArray* queue = _revsToPull;
-            if (queue.count == 0) {
-                queue = _deletedRevsToPull;
-                if (queue.count == 0) break;  // both queues are empty
-            }
-            [self pullRemoteRevision:queue[0]];
-            [queue removeObjectAtIndex:0];
+    while (_db && _httpConnectionCount + _connectionsRequested < kMaxOpenHTTPConnections &&
+           _connectionsRequested < self.numberOfFetchesQueued) {
+        ++_connectionsRequested;
+        [self acquireResource:kTDReplicationResourceConnection
+                         then:^{
+                             --_connectionsRequested;
+                             if (![self startNextFetch])
+                                 [self releaseResource:kTDReplicationResourceConnection];
+                         }];
+    }
+    [self updateChangeTrackerPaused];
+}
+
+// Number of HTTP requests it would take to fetch all the queued revisions.
+- (NSUInteger)numberOfFetchesQueued
+{
+    return (_bulkRevsToPull.count + kMaxRevsToGetInBulk - 1) / kMaxRevsToGetInBulk +
+           _revsToPull.count + _deletedRevsToPull.count;
+}
+
+// Starts fetching the next queued revision(s). Returns NO if there was nothing left to fetch.
+- (BOOL)startNextFetch
+{
+    if (!_db) return NO;
+    NSUInteger nBulk = MIN(_bulkRevsToPull.count, kMaxRevsToGetInBulk);
+    if (nBulk == 1) {
+        // Rather than pulling a single revision in 'bulk', just pull it normally:
+        [self queueRemoteRevision:_bulkRevsToPull[0]];
+        [_bulkRevsToPull removeObjectAtIndex:0];
+        nBulk = 0;
+    }
+    if (nBulk > 0) {
+        // Prefer to pull bulk revisions:
+        NSRange r = NSMakeRange(0, nBulk);
+        [self pullBulkRevisions:[_bulkRevsToPull subarrayWithRange:r]];
+        [_bulkRevsToPull removeObjectsInRange:r];
+    } else {
+        // Prefer to pull an existing revision over a deleted one:
+        NSMutableArray* queue = _revsToPull;
+        if (queue.count == 0) {
+            queue = _deletedRevsToPull;
+            if (queue.count == 0) return NO;  // both queues are empty
         }
+        [self pullRemoteRevision:queue[0]];
+        [queue removeObjectAtIndex:0];
+    }
+    return YES;
+}
+
+// Pauses the _changes feed while too many revisions are waiting to be fetched or inserted, so
+// that memory use stays bounded however far behind the remote database we are.
+- (void)updateChangeTrackerPaused
+{
+    if (!_changeTracker) return;
+    NSUInteger backlog = _batcher.count + _bulkRevsToPull.count + _revsToPull.count +
+                         _deletedRevsToPull.count;
+    BOOL paused = _changeTracker.paused;
+    NSUInteger toInsert = _downloadsToInsert.count + _insertingCount;
+    BOOL pause = _downloadsToInsert.backedUp ||
+                 (paused ? toInsert > kMaxBackloggedRevs / 2 : toInsert >= kMaxBackloggedRevs) ||
+                 (paused ? backlog > kMaxBackloggedRevs / 2 : backlog >= kMaxBackloggedRevs);
+    if (pause != paused) {
+        CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@: %@ changes feed (%u revs to fetch, %u to insert)",
+                self, pause ? @"Pausing" : @"Resuming", (unsigned)backlog, (unsigned)toInsert);
+        _changeTracker.paused = pause;
     }
 }
 
@@ -387,6 +446,8 @@ static NSString* joinQuotedEscaped(NSArray* strings);
                                                [strongSelf removeRemoteRequest:dl];
                                                [strongSelf asyncTasksFinished:1];
                                                --_httpConnectionCount;
+                                               [strongSelf releaseResource:
+                                                               kTDReplicationResourceConnection];
                                                // Start another task if there are still revisions
                                                // waiting to be pulled:
                                                [strongSelf pullRemoteRevisions];
@@ -408,118 +469,243 @@ static NSString* joinQuotedEscaped(NSArray* strings);
 
     [self asyncTaskStarted];
     ++_httpConnectionCount;
-    NSMutableArray* remainingRevs = [bulkRevs mutableCopy];
     NSArray* keys = [bulkRevs my_map:^(TD_Revision* rev) { return rev.docID; }];
-    [self sendAsyncRequest:@"POST"
-                      path:@"_all_docs?include_docs=true"
-                      body:$dict({ @"keys", keys })
-              onCompletion:^(id result, NSError* error) {
+    [self sendAsyncRawRequest:@"POST"
+                         path:@"_all_docs?include_docs=true"
+                         body:$dict({ @"keys", keys })
+                 onCompletion:^(id result, NSError* error) {
+                  // The connection's free now, so start another fetch while this one's response
+                  // is being decoded:
+                  --_httpConnectionCount;
+                  [self releaseResource:kTDReplicationResourceConnection];
+                  [self pullRemoteRevisions];
+
                   if (error) {
-                      self.error = error;
-                      [self revisionFailed];
-                      self.changesProcessed += bulkRevs.count;
-                  } else {
-                      // Process the resulting rows' documents.
-                      // We only add a document if it doesn't have attachments, and if its
-                      // revID matches the one we asked for.
-                      NSArray* rows = $castIf(NSArray, result[@"rows"]);
-                      CDTLogInfo(CDTREPLICATION_LOG_CONTEXT,
-                              @"%@ checking %u bulk-fetched remote revisions", self,
-                              (unsigned)rows.count);
-                      for (NSDictionary* row in rows) {
-                          NSDictionary* doc = $castIf(NSDictionary, row[@"doc"]);
-                          if (doc && !doc[@"_attachments"]) {
-                              TD_Revision* rev = [TD_Revision revisionWithProperties:doc];
-                              NSUInteger pos = [remainingRevs indexOfObject:rev];
-                              if (pos != NSNotFound) {
-                                  rev.sequence = [remainingRevs[pos] sequence];
-                                  [remainingRevs removeObjectAtIndex:pos];
-                                  [_downloadsToInsert queueObject:rev];
-                                  [self asyncTaskStarted];
-                              }
-                          }
-                      }
+                      [self bulkRevisions:bulkRevs fetched:nil error:error];
+                      return;
                   }
+                  // Decoding the documents is the expensive part, so it's done on the worker
+                  // pool; the results are matched up back on this thread.
+                  NSThread* replicatorThread = [NSThread currentThread];
+                  dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                      NSArray* fetched = [[self class] revisionsFromAllDocsResponse:result];
+                      MYOnThread(replicatorThread, ^{
+                          NSError* parseError = nil;
+                          if (!fetched) {
+                              CDTLogWarn(CDTREPLICATION_LOG_CONTEXT,
+                                      @"%@: _all_docs returned unparseable data", self);
+                              parseError = TDStatusToNSError(kTDStatusUpstreamError, nil);
+                          }
+                          [self bulkRevisions:bulkRevs fetched:fetched error:parseError];
+                      });
+                  });
+              }];
+}
 
-                  // Any leftover revisions that didn't get matched will be fetched individually:
-                  if (remainingRevs.count) {
-                      CDTLogInfo(CDTREPLICATION_LOG_CONTEXT,
-                              @"%@ bulk-fetch didn't work for %u of %u revs; getting individually",
-                              self, (unsigned)remainingRevs.count, (unsigned)nRevs);
-                      for (TD_Revision* rev in remainingRevs) [self queueRemoteRevision:rev];
-                      [self pullRemoteRevisions];
-                  }
+// Called on the replicator thread with the decoded result of a bulk fetch.
+- (void)bulkRevisions:(NSArray*)bulkRevs fetched:(NSArray*)fetched error:(NSError*)error
+{
+    NSUInteger nRevs = bulkRevs.count;
+    NSMutableArray* remainingRevs;
+    if (error) {
+        self.error = error;
+        [self revisionFailed];
+        self.changesProcessed += nRevs;
+        remainingRevs = [bulkRevs mutableCopy];
+    } else {
+        // Match up the returned documents with the revisions we asked for. We only add a
+        // document if its revID matches the one we asked for (TD_Revision equality and hashing
+        // are by docID and revID).
+        CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@ checking %u bulk-fetched remote revisions",
+                self, (unsigned)fetched.count);
+        NSMapTable* requested = [NSMapTable strongToStrongObjectsMapTable];
+        for (TD_Revision* rev in bulkRevs) [requested setObject:rev forKey:rev];
+        NSMutableArray* matched = [NSMutableArray arrayWithCapacity:fetched.count];
+        for (TD_Revision* rev in fetched) {
+            TD_Revision* requestedRev = [requested objectForKey:rev];
+            if (requestedRev) {
+                rev.sequence = requestedRev.sequence;
+                [requested removeObjectForKey:rev];
+                [matched addObject:rev];
+            }
+        }
+        if (matched.count > 0) {
+            // Queue them in the order they appeared in the _changes feed:
+            [matched sortUsingSelector:@selector(compareSequences:)];
+            for (NSUInteger i = 0; i < matched.count; ++i) [self asyncTaskStarted];
+            [_downloadsToInsert queueObjects:matched];
+        }
+        remainingRevs = [NSMutableArray arrayWithCapacity:requested.count];
+        for (TD_Revision* rev in bulkRevs) {
+            if ([requested objectForKey:rev]) [remainingRevs addObject:rev];
+        }
+    }
 
-                  // Note that we've finished this task:
-                  [self asyncTasksFinished:1];
-                  --_httpConnectionCount;
-                  // Start another task if there are still revisions waiting to be pulled:
-                  [self pullRemoteRevisions];
-              }];
+    // Any leftover revisions that didn't get matched will be fetched individually:
+    if (remainingRevs.count) {
+        CDTLogInfo(CDTREPLICATION_LOG_CONTEXT,
+                @"%@ bulk-fetch didn't work for %u of %u revs; getting individually", self,
+                (unsigned)remainingRevs.count, (unsigned)nRevs);
+        for (TD_Revision* rev in remainingRevs) [self queueRemoteRevision:rev];
+    }
+
+    // Note that we've finished this task:
+    [self asyncTasksFinished:1];
+    // Start another task if there are still revisions waiting to be pulled:
+    [self pullRemoteRevisions];
 }
 
-// This will be called when _downloadsToInsert fills up:
+// Decodes the documents in an _all_docs?include_docs=true response into revisions, spread
+// across the worker pool. Documents with attachments are left out. Returns nil if the response
+// is malformed. Thread-safe.
++ (NSArray*)revisionsFromAllDocsResponse:(NSData*)response
+{
+    // The response is tokenised rather than parsed; each row's doc is sliced out as raw JSON
+    // and only scanned once, by +revisionFromBulkDocument:.
+    NSArray* docs = [TDJSONScanner documentsInAllDocsResponse:response];
+    if (!docs) return nil;
+
+    size_t count = docs.count;
+    CFTypeRef* slots = calloc(count, sizeof(CFTypeRef));
+    if (!slots) return nil;
+    dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                   ^(size_t i) {
+                       @autoreleasepool
+                       {
+                           NSData* json = docs[i];
+                           if (![json isKindOfClass:[NSData class]]) return;
+                           TD_Revision* rev = [self revisionFromBulkDocument:json];
+                           if (rev) slots[i] = CFBridgingRetain(rev);
+                       }
+                   });
+    NSMutableArray* revs = [NSMutableArray arrayWithCapacity:count];
+    for (size_t i = 0; i < count; ++i) {
+        if (slots[i]) [revs addObject:CFBridgingRelease(slots[i])];
+    }
+    free(slots);
+    return revs;
+}
+
+// Turns a document from a bulk fetch into a revision ready to insert, or returns nil if it has
+// attachments (those have to be fetched individually).
++ (TD_Revision*)revisionFromBulkDocument:(NSData*)json
+{
+    TDJSONScanner* scanner = [[TDJSONScanner alloc] initWithData:json];
+    if ([scanner scan]) {
+        if (scanner.hasAttachments || !scanner.docID) return nil;
+        TDPulledRevision* rev = [[TDPulledRevision alloc] initWithDocID:scanner.docID
+                                                                  revID:scanner.revID
+                                                                deleted:scanner.deleted];
+        // Keep the raw JSON as the body, so it's only parsed if something (a validation
+        // function, a change notification) actually asks for the properties:
+        rev.body = [TD_Body bodyWithJSON:json];
+        rev.canonicalBody = scanner.canonicalBody;
+        rev.revisionHistory = scanner.revisionHistory;
+        return rev;
+    }
+
+    // The scanner gives up on anything unusual; parse those documents the regular way:
+    NSDictionary* doc =
+        $castIf(NSDictionary, [TDJSON JSONObjectWithData:json options:0 error:NULL]);
+    if (!doc || doc[@"_attachments"]) return nil;
+    return [TD_Revision revisionWithProperties:doc];
+}
+
+// This will be called when _downloadsToInsert fills up. The revisions are written to the
+// database on _insertQueue, so the replicator thread can carry on with network I/O meanwhile;
+// -finishedInsertingDownloads:... is called back on this thread once they're committed.
 - (void)insertDownloads:(NSArray*)downloads
 {
     CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@ inserting %u revisions...", self,
                (unsigned)downloads.count);
-    CFAbsoluteTime time = CFAbsoluteTimeGetCurrent();
-
-    //    [_db beginTransaction];
-    //    BOOL success = NO;
-    @try {
-        downloads = [downloads sortedArrayUsingSelector:@selector(compareSequences:)];
-        for (TD_Revision* rev in downloads) {
-            @autoreleasepool
-            {
-                SequenceNumber fakeSequence = rev.sequence;
-                NSArray* history = [TD_Database parseCouchDBRevisionHistory:rev.properties];
-                if (!history && rev.generation > 1) {
-                    CDTLogWarn(CDTREPLICATION_LOG_CONTEXT,
-                            @"%@: Missing revision history in response for %@", self, rev);
-                    self.error = TDStatusToNSError(kTDStatusUpstreamError, nil);
-                    [self revisionFailed];
-                    continue;
-                }
-                CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@ inserting %@ %@", self, rev.docID,
-                           [history my_compactDescription]);
-
-                // Insert the revision:
-                int status = [_db forceInsert:rev revisionHistory:history source:_remote];
-                if (TDStatusIsError(status)) {
-                    if (status == kTDStatusForbidden)
-                        CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@: Remote rev failed validation: %@",
-                                self, rev);
-                    else {
-                        CDTLogWarn(CDTREPLICATION_LOG_CONTEXT, @"%@ failed to write %@: status=%d", self,
-                                rev, status);
-                        [self revisionFailed];
-                        self.error = TDStatusToNSError(status, nil);
-                        continue;
+    downloads = [downloads sortedArrayUsingSelector:@selector(compareSequences:)];
+    NSThread* replicatorThread = [NSThread currentThread];
+    TD_Database* db = _db;
+    NSURL* remote = _remote;
+    _insertingCount += downloads.count;
+
+    // The write itself is budgeted by the scheduler, which limits how many replicators write to
+    // their databases at once.
+    [self acquireResource:kTDReplicationResourceDatabaseWriter then:^{
+        dispatch_async(_insertQueue, ^{
+            CFAbsoluteTime time = CFAbsoluteTimeGetCurrent();
+            NSMutableArray* insertedSequences = [NSMutableArray arrayWithCapacity:downloads.count];
+            NSError* error = nil;
+            NSUInteger failures = 0;
+            @try {
+                for (TD_Revision* rev in downloads) {
+                    @autoreleasepool
+                    {
+                        // (Inserting overwrites rev.sequence, so remember the fake one first.)
+                        SequenceNumber fakeSequence = rev.sequence;
+                        NSArray* history;
+                        if ([rev isKindOfClass:[TDPulledRevision class]])
+                            history = ((TDPulledRevision*)rev).revisionHistory;  // already scanned
+                        else
+                            history = [TD_Database parseCouchDBRevisionHistory:rev.properties];
+                        if (!history && rev.generation > 1) {
+                            CDTLogWarn(CDTREPLICATION_LOG_CONTEXT,
+                                    @"%@: Missing revision history in response for %@", self, rev);
+                            error = TDStatusToNSError(kTDStatusUpstreamError, nil);
+                            ++failures;
+                            continue;
+                        }
+                        CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@ inserting %@ %@", self,
+                                   rev.docID, [history my_compactDescription]);
+
+                        // Insert the revision:
+                        int status = [db forceInsert:rev revisionHistory:history source:remote];
+                        if (TDStatusIsError(status)) {
+                            if (status == kTDStatusForbidden)
+                                CDTLogInfo(CDTREPLICATION_LOG_CONTEXT,
+                                        @"%@: Remote rev failed validation: %@", self, rev);
+                            else {
+                                CDTLogWarn(CDTREPLICATION_LOG_CONTEXT,
+                                        @"%@ failed to write %@: status=%d", self, rev, status);
+                                error = TDStatusToNSError(status, nil);
+                                ++failures;
+                                continue;
+                            }
+                        }
+                        [insertedSequences addObject:@(fakeSequence)];
                     }
                 }
-
-                // Mark this revision's fake sequence as processed:
-                [_pendingSequences removeSequence:fakeSequence];
             }
-        }
+            @catch (NSException* x) {
+                MYReportException(x, @"%@: Exception inserting revisions", self);
+            }
 
-        CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@ finished inserting %u revisions", self,
-                   (unsigned)downloads.count);
+            time = CFAbsoluteTimeGetCurrent() - time;
+            CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@ inserted %u revs in %.3f sec (%.1f/sec)",
+                    self, (unsigned)downloads.count, time, downloads.count / time);
+
+            MYOnThread(replicatorThread, ^{
+                [self finishedInsertingDownloads:downloads
+                               insertedSequences:insertedSequences
+                                        failures:failures
+                                           error:error];
+            });
+        });
+    }];
+}
 
-        // Checkpoint:
-        self.lastSequence = _pendingSequences.checkpointedValue;
+// Called on the replicator thread when a batch handed to -insertDownloads: has been written.
+- (void)finishedInsertingDownloads:(NSArray*)downloads
+                 insertedSequences:(NSArray*)insertedSequences
+                          failures:(NSUInteger)failures
+                             error:(NSError*)error
+{
+    // Mark the written revisions' fake sequences as processed, and checkpoint:
+    for (NSNumber* fakeSequence in insertedSequences)
+        [_pendingSequences removeSequence:fakeSequence.longLongValue];
+    self.lastSequence = _pendingSequences.checkpointedValue;
 
-        //        success = YES;
-    }
-    @catch (NSException* x) { MYReportException(x, @"%@: Exception inserting revisions", self); }
-    //    @finally {
-    //        [_db endTransaction: success];
-    //    }
+    for (NSUInteger i = 0; i < failures; ++i) [self revisionFailed];
+    if (error) self.error = error;
+    [self releaseResource:kTDReplicationResourceDatabaseWriter];
 
-    time = CFAbsoluteTimeGetCurrent() - time;
-    CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@ inserted %u revs in %.3f sec (%.1f/sec)", self,
-            (unsigned)downloads.count, time, downloads.count / time);
+    _insertingCount -= downloads.count;
+    [self updateChangeTrackerPaused];
 
     self.changesProcessed += downloads.count;
     [self asyncTasksFinished:downloads.count];
@@ -531,7 +717,8 @@ static NSString* joinQuotedEscaped(NSArray* strings);
 
 @implementation TDPulledRevision
 
-@synthesize remoteSequenceID = _remoteSequenceID, conflicted = _conflicted;
+@synthesize remoteSequenceID = _remoteSequenceID, conflicted = _conflicted,
+            revisionHistory = _revisionHistory;
 
 @end
 
@@ -301,99 +301,102 @@
     CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@: Sending %@", self, changes.allRevisions);
     self.changesTotal += numDocsToSend;
     [self asyncTaskStarted];
-    [self sendAsyncRequest:@"POST"
-                      path:@"_bulk_docs"
-                      body:$dict({ @"docs", docsToSend }, { @"new_edits", $false })
-              onCompletion:^(NSDictionary* response, NSError* error) {
+    [self acquireResource:kTDReplicationResourceConnection then:^{
+        [self sendAsyncRequest:@"POST"
+                          path:@"_bulk_docs"
+                          body:$dict({ @"docs", docsToSend }, { @"new_edits", $false })
+                  onCompletion:^(NSDictionary* response, NSError* error) {
+                      [self releaseResource:kTDReplicationResourceConnection];
 
-                  TD_RevisionList* revisionsToRetry = [[TD_RevisionList alloc] init];
+                      TD_RevisionList* revisionsToRetry = [[TD_RevisionList alloc] init];
 
-                  if (!error) {
-                      NSMutableSet* failedIDs = [NSMutableSet set];
+                      if (!error) {
+                          NSMutableSet* failedIDs = [NSMutableSet set];
 
-                      // _bulk_docs response is really an array, not a dictionary
-                      for (NSDictionary* item in $castIf(NSArray, response)) {
-                          TDStatus status = statusFromBulkDocsResponseItem(item);
+                          // _bulk_docs response is really an array, not a dictionary
+                          for (NSDictionary* item in $castIf(NSArray, response)) {
+                              TDStatus status = statusFromBulkDocsResponseItem(item);
 
-                          if (!TDStatusIsError(status)) {
-                              continue;
-                          }
+                              if (!TDStatusIsError(status)) {
+                                  continue;
+                              }
 
-                          // This item (doc) failed to save correctly
-                          CDTLogWarn(CDTREPLICATION_LOG_CONTEXT, @"%@: _bulk_docs got an error: %@", self,
-                                  item);
-
-                          NSString* docID;
-                          NSURL* url;
-                          switch (status) {
-                              // 403/Forbidden means validation failed; don't treat it as an error
-                              // because I did my job in sending the revision. Other statuses are
-                              // actual replication errors.
-                              case kTDStatusForbidden:
-                              case kTDStatusUnauthorized:
-                                  break;
-
-                              // 412 is likely to mean that the attachment stubs we sent were
-                              // rejected by CouchDB. We need to resend the rev with all current
-                              // attachments using multipart/related. If this fails, we really
-                              // failed.
-                              case kTDStatusDuplicate:
-                                  docID = item[@"id"];
-                                  for (TD_Revision* rev in [changes revsWithDocID:docID]) {
-                                      [revisionsToRetry addRev:rev];
-                                  }
-                                  _sendAllDocumentsWithAttachmentsAsMultipart = YES;
+                              // This item (doc) failed to save correctly
+                              CDTLogWarn(CDTREPLICATION_LOG_CONTEXT,
+                                         @"%@: _bulk_docs got an error: %@", self, item);
+
+                              NSString* docID;
+                              NSURL* url;
+                              switch (status) {
+                                  // 403/Forbidden means validation failed; don't treat it as an
+                                  // error because I did my job in sending the revision. Other
+                                  // statuses are actual replication errors.
+                                  case kTDStatusForbidden:
+                                  case kTDStatusUnauthorized:
+                                      break;
+
+                                  // 412 is likely to mean that the attachment stubs we sent were
+                                  // rejected by CouchDB. We need to resend the rev with all current
+                                  // attachments using multipart/related. If this fails, we really
+                                  // failed.
+                                  case kTDStatusDuplicate:
+                                      docID = item[@"id"];
+                                      for (TD_Revision* rev in [changes revsWithDocID:docID]) {
+                                          [revisionsToRetry addRev:rev];
+                                      }
+                                      _sendAllDocumentsWithAttachmentsAsMultipart = YES;
 
-                                  // The rev also failed, so don't remove from pending
-                                  [failedIDs addObject:docID];
+                                      // The rev also failed, so don't remove from pending
+                                      [failedIDs addObject:docID];
 
-                                  break;
+                                      break;
 
-                              // Replication error
-                              default:
-                                  docID = item[@"id"];
-                                  [failedIDs addObject:docID];
-                                  url = nil;
-                                  if (docID) {
-                                      url = [_remote URLByAppendingPathComponent:docID];
-                                  }
-                                  error = TDStatusToNSError(status, url);
-                                  break;
+                                  // Replication error
+                                  default:
+                                      docID = item[@"id"];
+                                      [failedIDs addObject:docID];
+                                      url = nil;
+                                      if (docID) {
+                                          url = [_remote URLByAppendingPathComponent:docID];
+                                      }
+                                      error = TDStatusToNSError(status, url);
+                                      break;
+                              }
                           }
-                      }
 
-                      // Remove from the pending list all the revs that didn't fail
-                      for (TD_Revision* rev in changes.allRevisions) {
-                          if (![failedIDs containsObject:rev.docID]) {
-                              [self removePending:rev];
+                          // Remove from the pending list all the revs that didn't fail
+                          for (TD_Revision* rev in changes.allRevisions) {
+                              if (![failedIDs containsObject:rev.docID]) {
+                                  [self removePending:rev];
+                              }
                           }
-                      }
 
-                      CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@: Sent %@", self,
-                                 changes.allRevisions);
+                          CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@: Sent %@", self,
+                                     changes.allRevisions);
 
-                  } else if (error && error.code == kTDStatusDuplicate) {
-                      // A 412 for the whole batch means we don't know what caused the
-                      // failure. Therefore retry all, and be sure to send all attachment
-                      // data, as the 412 is caused by mismatched stubs.
-                      for (TD_Revision* rev in changes.allRevisions) {
-                          [revisionsToRetry addRev:rev];
+                      } else if (error && error.code == kTDStatusDuplicate) {
+                          // A 412 for the whole batch means we don't know what caused the
+                          // failure. Therefore retry all, and be sure to send all attachment
+                          // data, as the 412 is caused by mismatched stubs.
+                          for (TD_Revision* rev in changes.allRevisions) {
+                              [revisionsToRetry addRev:rev];
+                          }
+                          _sendAllDocumentsWithAttachmentsAsMultipart = YES;
+                      } else if (error) {
+                          // Another error in the request as a whole; fail replication.
+                          self.error = error;
+                          [self revisionFailed];
                       }
-                      _sendAllDocumentsWithAttachmentsAsMultipart = YES;
-                  } else if (error) {
-                      // Another error in the request as a whole; fail replication.
-                      self.error = error;
-                      [self revisionFailed];
-                  }
 
-                  self.changesProcessed += (numDocsToSend - revisionsToRetry.count);
+                      self.changesProcessed += (numDocsToSend - revisionsToRetry.count);
 
-                  if (revisionsToRetry.count > 0) {
-                      [self addRevsToInbox:revisionsToRetry];
-                  }
+                      if (revisionsToRetry.count > 0) {
+                          [self addRevsToInbox:revisionsToRetry];
+                      }
 
-                  [self asyncTasksFinished:1];
-              }];
+                      [self asyncTasksFinished:1];
+                  }];
+    }];
 }
 
 static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
@@ -460,6 +463,7 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
                                         streamer:bodyStream
                                   requestHeaders:self.requestHeaders
                                     onCompletion:^(TDMultipartUploader* uploader, NSError* error) {
+                                        [self releaseResource:kTDReplicationResourceConnection];
                                         if (error) {
                                             if ($equal(error.domain, TDHTTPErrorDomain) &&
                                                 error.code == kTDStatusUnsupportedType) {
@@ -507,20 +511,23 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
 
     [self asyncTaskStarted];
     NSString* path = $sprintf(@"%@?new_edits=false", TDEscapeID(rev.docID));
-    [self sendAsyncRequest:@"PUT"
-                      path:path
-                      body:rev.properties
-              onCompletion:^(id response, NSError* error) {
-                  if (error) {
-                      self.error = error;
-                      [self revisionFailed];
-                  } else {
-                      CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@: Sent %@ (JSON), response=%@", self,
-                                 rev, response);
-                      [self removePending:rev];
-                  }
-                  [self asyncTasksFinished:1];
-              }];
+    [self acquireResource:kTDReplicationResourceConnection then:^{
+        [self sendAsyncRequest:@"PUT"
+                          path:path
+                          body:rev.properties
+                  onCompletion:^(id response, NSError* error) {
+                      [self releaseResource:kTDReplicationResourceConnection];
+                      if (error) {
+                          self.error = error;
+                          [self revisionFailed];
+                      } else {
+                          CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT,
+                                        @"%@: Sent %@ (JSON), response=%@", self, rev, response);
+                          [self removePending:rev];
+                      }
+                      [self asyncTasksFinished:1];
+                  }];
+    }];
 }
 
 - (void)startNextUpload
@@ -528,9 +535,11 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
     if (!_uploading && _uploaderQueue.count > 0) {
         _uploading = YES;
         TDMultipartUploader* uploader = _uploaderQueue[0];
-        CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@: Starting %@", self, uploader);
-        [uploader start];
         [_uploaderQueue removeObjectAtIndex:0];
+        [self acquireResource:kTDReplicationResourceConnection then:^{
+            CDTLogVerbose(CDTREPLICATION_LOG_CONTEXT, @"%@: Starting %@", self, uploader);
+            [uploader start];
+        }];
     }
 }
 
@@ -27,6 +27,7 @@ typedef void (^TDRemoteRequestCompletionBlock)(id result, NSError* error);
     UInt8 _retryCount;
     bool _dontLog404;
     bool _challenged;
+    NSUInteger _bytesReceived;
 
 }
 
@@ -51,6 +52,9 @@ typedef void (^TDRemoteRequestCompletionBlock)(id result, NSError* error);
 /** Stops the request, calling the onCompletion block. */
 - (void)stop;
 
+/** Number of bytes of response body received so far. */
+@property (readonly) NSUInteger bytesReceived;
+
 /** JSON-compatible dictionary with status information, to be returned from _activity API */
 @property (readonly) NSMutableDictionary* statusInfo;
 
@@ -77,3 +81,8 @@ typedef void (^TDRemoteRequestCompletionBlock)(id result, NSError* error);
     NSMutableData* _jsonBuffer;
 }
 @end
+
+/** A JSON request whose response body is handed to the completion block unparsed, as NSData, for
+    callers that would rather tokenise it themselves (see TDJSONScanner). */
+@interface TDRemoteRawJSONRequest : TDRemoteJSONRequest
+@end
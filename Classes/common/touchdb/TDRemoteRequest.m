@@ -89,6 +89,8 @@
 
 - (id<TDAuthorizer>)authorizer { return _authorizer; }
 
+- (NSUInteger)bytesReceived { return _bytesReceived; }
+
 - (void)setAuthorizer:(id<TDAuthorizer>)authorizer
 {
     if (_authorizer != authorizer) {
@@ -245,6 +247,7 @@
 -(void) receivedData:(NSData *)data
 {
     CDTLogVerbose(CDTTD_REMOTE_REQUEST_CONTEXT, @"%@: Got %lu bytes", self, (unsigned long)data.length);
+    _bytesReceived += data.length;
 }
 
 - (void)requestDidError:(NSError *)error
@@ -318,3 +321,15 @@
 }
 
 @end
+
+@implementation TDRemoteRawJSONRequest
+
+- (void)receivedData:(NSData *)data
+{
+    CDTLogVerbose(CDTTD_REMOTE_REQUEST_CONTEXT, @"%@: Got %lu bytes", self, (unsigned long)data.length);
+    _bytesReceived += data.length;
+    [self clearSession];
+    [self respondWithResult:(data ?: [NSData data]) error:nil];
+}
+
+@end
@@ -0,0 +1,70 @@
+//
+//  TDReplicationScheduler.h
+//  CloudantSync
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+@class TDReplicator;
+
+/** Resources whose use is budgeted across all the replicators sharing a scheduler. */
+typedef NS_ENUM(NSUInteger, TDReplicationResource) {
+    /** An open HTTP connection fetching or uploading revisions. */
+    kTDReplicationResourceConnection = 0,
+    /** A batch of revisions being written to a local database. */
+    kTDReplicationResourceDatabaseWriter,
+};
+
+/** Shares a small, fixed set of run-loop threads and global resource budgets between many
+    replicators, so that syncing lots of databases at once doesn't mean lots of threads and
+    hundreds of sockets.
+
+    Replicators ask for a resource with -acquireResource:forReplicator:onGrant: and give it
+    back with -releaseResource:forReplicator:. When a budget is used up, waiting requests are
+    granted highest-priority first; among replicators of equal priority the one currently
+    holding the fewest of that resource goes first, then the one that has been waiting longest.
+
+    All methods are thread-safe. */
+@interface TDReplicationScheduler : NSObject
+
+- (instancetype)initWithThreadCount:(NSUInteger)threadCount;
+
+/** Maximum number of connections open at once across all replicators. Default is 16. */
+@property (nonatomic) NSUInteger maxConnections;
+
+/** Maximum number of batches being written to local databases at once. Default is 2. */
+@property (nonatomic) NSUInteger maxDatabaseWriters;
+
+/** Approximate limit on the number of bytes received per second across all replicators. Once
+    the limit has been reached no new connections are granted until the next second.
+    Default is 0, meaning no limit. */
+@property (nonatomic) NSUInteger maxBytesPerSecond;
+
+/** Returns the worker thread the replicator should run on, the one with fewest replicators. */
+- (NSThread*)threadForReplicator:(TDReplicator*)replicator;
+
+/** Called when a replicator stops. Its pending requests are dropped, any resources it still
+    holds are freed, and its thread becomes available for other replicators. */
+- (void)replicatorFinished:(TDReplicator*)replicator;
+
+/** Once a unit of the resource is available to the replicator, runs the block on the calling
+    thread, which must have a run loop. The block is never called before this returns. */
+- (void)acquireResource:(TDReplicationResource)resource
+          forReplicator:(TDReplicator*)replicator
+                onGrant:(void (^)())block;
+
+/** Returns a unit of the resource granted by -acquireResource:forReplicator:onGrant:. */
+- (void)releaseResource:(TDReplicationResource)resource forReplicator:(TDReplicator*)replicator;
+
+/** Counts received bytes towards the bandwidth limit. */
+- (void)replicator:(TDReplicator*)replicator receivedBytes:(NSUInteger)bytes;
+
+@end
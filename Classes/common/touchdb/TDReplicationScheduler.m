@@ -0,0 +1,324 @@
+//
+//  TDReplicationScheduler.m
+//  CloudantSync
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDReplicationScheduler.h"
+#import "TDReplicator.h"
+#import "MYBlockUtils.h"
+#import "CDTLogging.h"
+
+#define kDefaultMaxConnections 16
+#define kDefaultMaxDatabaseWriters 2
+#define kNumResources 2
+
+/** Scheduler-side state of one replicator. */
+@interface TDScheduledReplicator : NSObject {
+   @public
+    NSUInteger _threadIndex;
+    NSUInteger _held[kNumResources];
+}
+@end
+
+@implementation TDScheduledReplicator
+@end
+
+/** A waiting request for a resource. */
+@interface TDResourceRequest : NSObject {
+   @public
+    TDScheduledReplicator* _client;
+    TDReplicationResource _resource;
+    NSInteger _priority;
+    UInt64 _serial;
+    NSThread* _thread;
+    void (^_block)();
+}
+@end
+
+@implementation TDResourceRequest
+@end
+
+@implementation TDReplicationScheduler {
+    dispatch_queue_t _queue;  // everything below is only touched on this queue
+    NSUInteger _threadCount;
+    NSMutableArray* _threads;
+    NSUInteger* _threadLoads;
+    NSMapTable* _clients;        // TDReplicator -> TDScheduledReplicator
+    NSMutableArray* _waiting;    // TDResourceRequests
+    UInt64 _nextSerial;
+    NSUInteger _inUse[kNumResources];
+    NSUInteger _limits[kNumResources];
+    NSUInteger _maxBytesPerSecond;
+    NSUInteger _bytesThisSecond;
+    CFAbsoluteTime _secondStart;
+    BOOL _bandwidthWakeupScheduled;
+}
+
+- (instancetype)initWithThreadCount:(NSUInteger)threadCount
+{
+    NSParameterAssert(threadCount > 0);
+    self = [super init];
+    if (self) {
+        _queue = dispatch_queue_create("com.cloudant.sync.replication.scheduler", NULL);
+        _threadCount = threadCount;
+        _threads = [[NSMutableArray alloc] initWithCapacity:threadCount];
+        _threadLoads = calloc(threadCount, sizeof(NSUInteger));
+        _clients = [NSMapTable strongToStrongObjectsMapTable];
+        _waiting = [[NSMutableArray alloc] init];
+        _limits[kTDReplicationResourceConnection] = kDefaultMaxConnections;
+        _limits[kTDReplicationResourceDatabaseWriter] = kDefaultMaxDatabaseWriters;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // Replicators hold on to their scheduler, so by now none of them are using the threads.
+    [_threads makeObjectsPerformSelector:@selector(cancel)];
+    free(_threadLoads);
+}
+
+#pragma mark - Budgets
+
+- (NSUInteger)limitOf:(TDReplicationResource)resource
+{
+    __block NSUInteger limit;
+    dispatch_sync(_queue, ^{ limit = _limits[resource]; });
+    return limit;
+}
+
+- (void)setLimit:(NSUInteger)limit of:(TDReplicationResource)resource
+{
+    dispatch_async(_queue, ^{
+        _limits[resource] = MAX(limit, 1u);
+        [self grantWaiting];
+    });
+}
+
+- (NSUInteger)maxConnections { return [self limitOf:kTDReplicationResourceConnection]; }
+
+- (void)setMaxConnections:(NSUInteger)max
+{
+    [self setLimit:max of:kTDReplicationResourceConnection];
+}
+
+- (NSUInteger)maxDatabaseWriters { return [self limitOf:kTDReplicationResourceDatabaseWriter]; }
+
+- (void)setMaxDatabaseWriters:(NSUInteger)max
+{
+    [self setLimit:max of:kTDReplicationResourceDatabaseWriter];
+}
+
+- (NSUInteger)maxBytesPerSecond
+{
+    __block NSUInteger max;
+    dispatch_sync(_queue, ^{ max = _maxBytesPerSecond; });
+    return max;
+}
+
+- (void)setMaxBytesPerSecond:(NSUInteger)max
+{
+    dispatch_async(_queue, ^{
+        _maxBytesPerSecond = max;
+        [self grantWaiting];
+    });
+}
+
+#pragma mark - Threads
+
++ (void)runWorkerThread:(id)unused
+{
+    @autoreleasepool
+    {
+#ifndef GNUSTEP
+        // Add a no-op source so the runloop won't stop on its own:
+        CFRunLoopSourceContext context = {};  // all zeros
+        CFRunLoopSourceRef source = CFRunLoopSourceCreate(NULL, 0, &context);
+        CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopDefaultMode);
+        CFRelease(source);
+#endif
+    }
+    while (![[NSThread currentThread] isCancelled]) {
+        @autoreleasepool
+        {
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                     beforeDate:[NSDate dateWithTimeIntervalSinceNow:1.0]];
+        }
+    }
+}
+
+- (TDScheduledReplicator*)clientFor:(TDReplicator*)replicator
+{
+    TDScheduledReplicator* client = [_clients objectForKey:replicator];
+    if (!client) {
+        client = [[TDScheduledReplicator alloc] init];
+        client->_threadIndex = NSNotFound;
+        [_clients setObject:client forKey:replicator];
+    }
+    return client;
+}
+
+- (NSThread*)threadForReplicator:(TDReplicator*)replicator
+{
+    __block NSThread* thread;
+    dispatch_sync(_queue, ^{
+        TDScheduledReplicator* client = [self clientFor:replicator];
+        if (client->_threadIndex == NSNotFound) {
+            NSUInteger best = 0;
+            if (_threads.count < _threadCount) {
+                // Start another worker rather than doubling up on an existing one:
+                best = _threads.count;
+                NSThread* worker = [[NSThread alloc] initWithTarget:[self class]
+                                                           selector:@selector(runWorkerThread:)
+                                                             object:nil];
+                worker.name = [NSString stringWithFormat:@"TDReplicationScheduler %u",
+                                                         (unsigned)best];
+                [_threads addObject:worker];
+                [worker start];
+            } else {
+                for (NSUInteger i = 1; i < _threadCount; ++i) {
+                    if (_threadLoads[i] < _threadLoads[best]) best = i;
+                }
+            }
+            client->_threadIndex = best;
+            ++_threadLoads[best];
+        }
+        thread = _threads[client->_threadIndex];
+    });
+    return thread;
+}
+
+- (void)replicatorFinished:(TDReplicator*)replicator
+{
+    dispatch_async(_queue, ^{
+        TDScheduledReplicator* client = [_clients objectForKey:replicator];
+        if (!client) return;
+        [_waiting removeObjectsAtIndexes:[_waiting indexesOfObjectsPassingTest:^BOOL(
+                                                       TDResourceRequest* request, NSUInteger i,
+                                                       BOOL* stop) {
+            return request->_client == client;
+        }]];
+        for (NSUInteger r = 0; r < kNumResources; ++r) {
+            if (client->_held[r] > 0)
+                CDTLogInfo(CDTREPLICATION_LOG_CONTEXT,
+                           @"TDReplicationScheduler: %@ finished holding %u of resource %u",
+                           replicator, (unsigned)client->_held[r], (unsigned)r);
+            _inUse[r] -= client->_held[r];
+        }
+        if (client->_threadIndex != NSNotFound) --_threadLoads[client->_threadIndex];
+        [_clients removeObjectForKey:replicator];
+        [self grantWaiting];
+    });
+}
+
+#pragma mark - Granting resources
+
+- (void)acquireResource:(TDReplicationResource)resource
+          forReplicator:(TDReplicator*)replicator
+                onGrant:(void (^)())block
+{
+    NSThread* thread = [NSThread currentThread];
+    NSInteger priority = replicator.priority;
+    block = [block copy];
+    dispatch_async(_queue, ^{
+        TDResourceRequest* request = [[TDResourceRequest alloc] init];
+        request->_client = [self clientFor:replicator];
+        request->_resource = resource;
+        request->_priority = priority;
+        request->_serial = _nextSerial++;
+        request->_thread = thread;
+        request->_block = block;
+        [_waiting addObject:request];
+        [self grantWaiting];
+    });
+}
+
+- (void)releaseResource:(TDReplicationResource)resource forReplicator:(TDReplicator*)replicator
+{
+    dispatch_async(_queue, ^{
+        TDScheduledReplicator* client = [_clients objectForKey:replicator];
+        if (!client || client->_held[resource] == 0) return;  // already freed by -finished
+        --client->_held[resource];
+        --_inUse[resource];
+        [self grantWaiting];
+    });
+}
+
+- (void)replicator:(TDReplicator*)replicator receivedBytes:(NSUInteger)bytes
+{
+    dispatch_async(_queue, ^{
+        [self startNewSecondIfDue];
+        _bytesThisSecond += bytes;
+    });
+}
+
+- (void)startNewSecondIfDue
+{
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (now - _secondStart >= 1.0) {
+        _secondStart = now;
+        _bytesThisSecond = 0;
+    }
+}
+
+// Returns YES if the bandwidth budget allows a new connection. If not, arranges for the waiting
+// requests to be looked at again when the current second is up.
+- (BOOL)bandwidthAvailable
+{
+    if (_maxBytesPerSecond == 0) return YES;
+    [self startNewSecondIfDue];
+    if (_bytesThisSecond < _maxBytesPerSecond) return YES;
+    if (!_bandwidthWakeupScheduled) {
+        _bandwidthWakeupScheduled = YES;
+        double delay = MAX(1.0 - (CFAbsoluteTimeGetCurrent() - _secondStart), 0.0);
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), _queue,
+                       ^{
+                           _bandwidthWakeupScheduled = NO;
+                           [self grantWaiting];
+                       });
+    }
+    return NO;
+}
+
+// The waiting request for the resource that should be granted next: highest priority first,
+// then the replicator holding the fewest units, then the longest-waiting.
+- (TDResourceRequest*)nextRequestFor:(TDReplicationResource)resource
+{
+    TDResourceRequest* best = nil;
+    for (TDResourceRequest* request in _waiting) {
+        if (request->_resource != resource) continue;
+        if (!best || request->_priority > best->_priority ||
+            (request->_priority == best->_priority &&
+             (request->_client->_held[resource] < best->_client->_held[resource] ||
+              (request->_client->_held[resource] == best->_client->_held[resource] &&
+               request->_serial < best->_serial))))
+            best = request;
+    }
+    return best;
+}
+
+- (void)grantWaiting
+{
+    for (TDReplicationResource resource = 0; resource < kNumResources; ++resource) {
+        while (_inUse[resource] < _limits[resource]) {
+            TDResourceRequest* request = [self nextRequestFor:resource];
+            if (!request) break;
+            if (resource == kTDReplicationResourceConnection && ![self bandwidthAvailable]) break;
+            [_waiting removeObjectIdenticalTo:request];
+            ++_inUse[resource];
+            ++request->_client->_held[resource];
+            MYOnThread(request->_thread, request->_block);
+        }
+    }
+}
+
+@end
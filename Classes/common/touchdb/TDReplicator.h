@@ -10,6 +10,7 @@
 
 #import <Foundation/Foundation.h>
 #import "CDTURLSession.h"
+#import "TDReplicationScheduler.h"
 
 @class TD_Database, TD_RevisionList, TDBatcher, TDReachability;
 @protocol TDAuthorizer;
@@ -72,6 +73,13 @@ extern NSString* TDReplicatorStoppedNotification;
 @property (copy) NSDictionary* options;
 @property (nonatomic, strong,readonly) CDTURLSession *session;
 
+/** If set before -start, the replicator runs on one of the scheduler's shared threads instead of
+    its own, and takes its connections and database writes from the scheduler's budgets. */
+@property (strong) TDReplicationScheduler* scheduler;
+
+/** Replicators with a higher priority are granted scheduler resources first. Default is 0. */
+@property NSInteger priority;
+
 /** Access to the replicator's NSThread execution state.*/
 /** NSThread.executing*/
 -(BOOL) threadExecuting;
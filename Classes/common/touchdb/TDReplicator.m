@@ -55,6 +55,8 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 
 @property (nonatomic, strong) NSThread *replicatorThread;
 @property (nonatomic) BOOL replicatorStopped;
+//set by -stop; stands in for NSThread.isCancelled when running on a scheduler's shared thread.
+@property (nonatomic) BOOL stopRequested;
 @property (nonatomic, strong,readwrite) CDTURLSession *session;
 @property (nonatomic, strong) NSArray* interceptors;
 
@@ -136,6 +138,7 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 @synthesize remoteCheckpoint=_remoteCheckpoint;
 @synthesize authorizer=_authorizer;
 @synthesize requestHeaders = _requestHeaders;
+@synthesize scheduler = _scheduler, priority = _priority;
 
 - (BOOL)isPush
 {
@@ -223,11 +226,17 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     
     self.running = YES;
     
-    _replicatorThread = [[NSThread alloc] initWithTarget: self
-                                            selector: @selector(runReplicatorThread)
-                                              object: nil];
-    CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"Starting TDReplicator thread %@ ...", _replicatorThread);
-    [_replicatorThread start];
+    if (_scheduler) {
+        _replicatorThread = [_scheduler threadForReplicator:self];
+        CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"Starting TDReplicator on shared thread %@ ...",
+                   _replicatorThread);
+    } else {
+        _replicatorThread = [[NSThread alloc] initWithTarget: self
+                                                selector: @selector(runReplicatorThread)
+                                                  object: nil];
+        CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"Starting TDReplicator thread %@ ...", _replicatorThread);
+        [_replicatorThread start];
+    }
     
     [[NSNotificationCenter defaultCenter] addObserver: self selector: @selector(databaseWasDeleted:)
                                                  name: TD_DatabaseWillBeDeletedNotification
@@ -244,14 +253,35 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 {
     @synchronized(self) {
         if(self.cancelReplicator){
+            [self cancelledBeforeStart];
             return;
         }
         self.replicatorStarted = YES;
     }
     
+    if (!self.session) {
+        // Running on a scheduler's thread, so -runReplicatorThread didn't create the session:
+        self.session = [[CDTURLSession alloc] initWithDelegate:nil
+                                                callbackThread:_replicatorThread
+                                           requestInterceptors:self.interceptors];
+    }
     [self startReplicatorTasks];
 }
 
+// Tears down a replicator cancelled by -cancelIfNotStarted, which never reaches -stopped. Its
+// private thread can then exit, or a scheduler can give its place to another replicator.
+- (void)cancelledBeforeStart
+{
+    CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@ CANCELLED before starting", self);
+    self.running = NO;
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    _replicatorStopped = YES;
+    if (_scheduler) {
+        _db = nil;
+        [_scheduler replicatorFinished:self];
+    }
+}
+
 - (BOOL) cancelIfNotStarted
 {
     @synchronized(self) {
@@ -413,8 +443,10 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                                              selector: @selector(retryIfReady) object: nil];
 
     //this just sets the isCanceled BOOL on the object. It's
-    //our responsibility to actually stop the thread.
-    [_replicatorThread cancel];
+    //our responsibility to actually stop the thread. (A scheduler's shared thread
+    //carries on running other replicators.)
+    self.stopRequested = YES;
+    if (!_scheduler) [_replicatorThread cancel];
     
     if (_running && _asyncTaskCount == 0) {
         [self stopped];
@@ -440,18 +472,28 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"STOP %@", self);
     [[NSNotificationCenter defaultCenter] removeObserver: self];
     _replicatorStopped = YES;
+    if (_scheduler) {
+        // There's no private thread to exit and clear the reference to the db, so do it here
+        // or once the last async task finishes:
+        if (_asyncTaskCount == 0) _db = nil;
+        [_scheduler replicatorFinished:self];
+    }
 }
 
+// On a scheduler's shared thread these report this replicator's share of the thread.
 -(BOOL) threadExecuting
 {
+    if (_scheduler) return self.replicatorThread != nil && !self.replicatorStopped;
     return [self.replicatorThread isExecuting];
 }
 -(BOOL) threadFinished
 {
+    if (_scheduler) return self.replicatorStopped;
     return [self.replicatorThread isFinished];
 }
 -(BOOL) threadCanceled
 {
+    if (_scheduler) return self.stopRequested;
     return [self.replicatorThread isCancelled];
 }
 
@@ -559,7 +601,28 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     Assert(_asyncTaskCount >= 0);
     if (_asyncTaskCount == 0) {
         [self updateActive];
+        if (_scheduler && _replicatorStopped) _db = nil;
+    }
+}
+
+- (void)acquireResource:(TDReplicationResource)resource then:(void (^)())block
+{
+    if (!_scheduler) {
+        block();
+        return;
     }
+    [self asyncTaskStarted];  // waiting for the grant counts as activity
+    [_scheduler acquireResource:resource
+                  forReplicator:self
+                        onGrant:^{
+                            block();
+                            [self asyncTasksFinished:1];
+                        }];
+}
+
+- (void)releaseResource:(TDReplicationResource)resource
+{
+    [_scheduler releaseResource:resource forReplicator:self];
 }
 
 - (void)addToInbox:(TD_Revision*)rev
@@ -654,6 +717,31 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                                     path:(NSString*)path
                                     body:(id)body
                             onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    return [self sendAsyncRequest:method
+                             path:path
+                             body:body
+                     requestClass:[TDRemoteJSONRequest class]
+                     onCompletion:onCompletion];
+}
+
+- (TDRemoteJSONRequest*)sendAsyncRawRequest:(NSString*)method
+                                       path:(NSString*)path
+                                       body:(id)body
+                               onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    return [self sendAsyncRequest:method
+                             path:path
+                             body:body
+                     requestClass:[TDRemoteRawJSONRequest class]
+                     onCompletion:onCompletion];
+}
+
+- (TDRemoteJSONRequest*)sendAsyncRequest:(NSString*)method
+                                    path:(NSString*)path
+                                    body:(id)body
+                            requestClass:(Class)requestClass
+                            onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
 {
     CDTLogInfo(CDTREPLICATION_LOG_CONTEXT, @"%@: %@ %@", self, method, path);
     NSURL* url;
@@ -668,7 +756,7 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     // could have undefined value).
     __weak TDReplicator* weakSelf = self;
     __block TDRemoteJSONRequest* req = nil;
-    req = [[TDRemoteJSONRequest alloc] initWithSession:self.session method:method
+    req = [[requestClass alloc] initWithSession:self.session method:method
                                                   URL:url
                                                  body:body
                                        requestHeaders:self.requestHeaders
@@ -697,6 +785,8 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 
 - (void)removeRemoteRequest:(TDRemoteRequest*)request
 {
+    if (request.bytesReceived > 0)
+        [_scheduler replicator:self receivedBytes:request.bytesReceived];
     [_remoteRequests removeObjectIdenticalTo:request];
 }
 
@@ -11,9 +11,11 @@
 #import "TD_Database.h"
 @class TD_DatabaseManager;
 @class TDReplicator;
+@class TDReplicationScheduler;
 @protocol TDAuthorizer;
 
-/** Manages the creation of TDReplicator objects -- this is now just a factory for TDReplicators.
+/** Manages the creation of TDReplicator objects -- this is now just a factory for TDReplicators,
+    and the owner of the TDReplicationScheduler they share.
  */
 @interface TDReplicatorManager : NSObject
 {
@@ -21,6 +23,9 @@
 }
 @property (nonatomic, strong, readonly) NSMutableArray *replicators;
 
+/** Shared by all the replicators this manager creates. */
+@property (nonatomic, strong, readonly) TDReplicationScheduler *scheduler;
+
 - (id)initWithDatabaseManager:(TD_DatabaseManager*)dbManager;
 
 
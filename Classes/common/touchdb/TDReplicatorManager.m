@@ -30,6 +30,10 @@
 #import "MYBlockUtils.h"
 #import "CDTLogging.h"
 #import "TDStatus.h"
+#import "TDReplicationScheduler.h"
+
+// Number of threads the replicators created by a manager share.
+#define kReplicationThreadCount 2
 
 #if TARGET_OS_IPHONE
 #import <UIKit/UIApplication.h>
@@ -41,6 +45,7 @@
     self = [super init];
     if (self) {
         _dbManager = dbManager;
+        _scheduler = [[TDReplicationScheduler alloc] initWithThreadCount:kReplicationThreadCount];
     }
     return self;
 }
@@ -61,6 +66,7 @@
         return nil;
     }
     repl.sessionID = TDCreateUUID();
+    repl.scheduler = _scheduler;
         
     return repl;
 }
@@ -152,6 +152,11 @@
     return reader;
 }
 
+- (id<CDTBlobReader>)blobWithFilename:(NSString *)filename
+{
+    return [_attachments blobWithFilename:filename];
+}
+
 - (BOOL)storeBlob:(NSData*)blob creatingKey:(TDBlobKey*)outKey
 {
     NSError* error;
@@ -158,6 +158,10 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                                            @"_replication_state_time", @"_replication_stats", nil];
     }
 
+    // Revisions scanned straight off the wire already carry their stored form:
+    NSData* canonicalBody = rev.canonicalBody;
+    if (canonicalBody) return canonicalBody;
+
     NSDictionary* origProps = rev.properties;
     if (!origProps) return nil;
 
@@ -635,7 +639,9 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                     }
                     newRev.sequence = sequence;
 
-                    if (i == 0) {
+                    if (i == 0 && !rev.canonicalBody) {
+                        // (A pre-encoded canonicalBody means the rev has no attachments, and
+                        // looking for them would only force its JSON to be parsed.)
                         // Write any changed attachments for the new revision. As the parent
                         // sequence use
                         // the latest local revision (this is to copy attachments from):
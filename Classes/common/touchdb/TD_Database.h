@@ -128,6 +128,11 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
 
 @property (nonatomic, readonly) FMDatabaseQueue* fmdbQueue;
 
+/** Opens another, read-only connection to the open database, for reading alongside fmdbQueue
+    from other threads (the database is in WAL mode, so readers don't block the writer).
+    The caller owns the returned queue and must close it. Returns nil on failure. */
+- (FMDatabaseQueue*)openReadOnlyQueue;
+
 /** Replaces the database with a copy of another database.
     This is primarily used to install a canned database on first launch of an app, in which case you
    should first check .exists to avoid replacing the database if it exists already. The canned
@@ -226,6 +231,12 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
 
 - (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs options:(const struct TDQueryOptions*)options;
 
+/** As -getDocsWithIDs:options:, but within a transaction the caller already has open, so that
+    more can be read from the same snapshot of the database. */
+- (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs
+                        options:(const struct TDQueryOptions*)options
+                       database:(FMDatabase*)db;
+
 - (TD_View*)viewNamed:(NSString*)name;
 
 - (TD_View*)existingViewNamed:(NSString*)name;
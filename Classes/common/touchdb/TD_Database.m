@@ -220,35 +220,25 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
         result = (queue != nil);
     }
 
-    // Set key to cipher database (if available)
+    // Each connection needs the key, the collations and its settings; doing them all in one
+    // block saves dispatching to the queue for each.
     if (result) {
+        __weak TD_Database* weakSelf = self;
         [queue inDatabase:^(FMDatabase* db) {
+          TD_Database* strongSelf = weakSelf;
+
+          // Set key to cipher database (if available)
           NSError* error = nil;
           result = [db setKeyWithProvider:provider error:&error];
           if (!result) {
               CDTLogError(CDTDATASTORE_LOG_CONTEXT, @"Key not set for DB at %@: %@", _path, error);
+              return;
           }
-        }];
-    }
 
-    // Register CouchDB-compatible JSON collation functions:
-    if (result) {
-        [queue inDatabase:^(FMDatabase* db) {
-          sqlite3_create_collation(db.sqliteHandle, "JSON", SQLITE_UTF8, kTDCollateJSON_Unicode,
-                                   TDCollateJSON);
-          sqlite3_create_collation(db.sqliteHandle, "JSON_RAW", SQLITE_UTF8, kTDCollateJSON_Raw,
-                                   TDCollateJSON);
-          sqlite3_create_collation(db.sqliteHandle, "JSON_ASCII", SQLITE_UTF8, kTDCollateJSON_ASCII,
-                                   TDCollateJSON);
-          sqlite3_create_collation(db.sqliteHandle, "REVID", SQLITE_UTF8, NULL, TDCollateRevIDs);
-        }];
-    }
+          // Register CouchDB-compatible JSON collation functions:
+          [TD_Database registerCollationsInDatabase:db];
 
-    // Stuff we need to initialize every time the database opens:
-    if (result) {
-        __weak TD_Database* weakSelf = self;
-        [queue inDatabase:^(FMDatabase* db) {
-          TD_Database* strongSelf = weakSelf;
+          // Stuff we need to initialize every time the database opens:
           if (!strongSelf || ![strongSelf initialize:@"PRAGMA foreign_keys = ON;" inDatabase:db]) {
               result = NO;
           }
@@ -266,6 +256,43 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return result;
 }
 
++ (void)registerCollationsInDatabase:(FMDatabase*)db
+{
+    sqlite3_create_collation(db.sqliteHandle, "JSON", SQLITE_UTF8, kTDCollateJSON_Unicode,
+                             TDCollateJSON);
+    sqlite3_create_collation(db.sqliteHandle, "JSON_RAW", SQLITE_UTF8, kTDCollateJSON_Raw,
+                             TDCollateJSON);
+    sqlite3_create_collation(db.sqliteHandle, "JSON_ASCII", SQLITE_UTF8, kTDCollateJSON_ASCII,
+                             TDCollateJSON);
+    sqlite3_create_collation(db.sqliteHandle, "REVID", SQLITE_UTF8, NULL, TDCollateRevIDs);
+}
+
+// callers: CDTQIndexUpdater
+- (FMDatabaseQueue*)openReadOnlyQueue
+{
+    if (!_open) return nil;
+
+    FMDatabaseQueue* queue = [TD_Database queueForDatabaseAtPath:_path readOnly:YES];
+    if (!queue) return nil;
+
+    __block BOOL result = YES;
+    [queue inDatabase:^(FMDatabase* db) {
+      NSError* error = nil;
+      result = [db setKeyWithProvider:_keyProviderToOpenDB error:&error];
+      if (result) {
+          [TD_Database registerCollationsInDatabase:db];
+      } else {
+          CDTLogError(CDTDATASTORE_LOG_CONTEXT, @"Key not set for DB at %@: %@", _path, error);
+      }
+    }];
+
+    if (!result) {
+        [queue close];
+        return nil;
+    }
+    return queue;
+}
+
 // callers: many things
 - (BOOL)isOpen
 {
@@ -367,12 +394,6 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
                     version TEXT, \
                     lastsequence INTEGER DEFAULT 0); \
                 CREATE INDEX views_by_name ON views(name); \
-                CREATE TABLE maps ( \
-                    view_id INTEGER NOT NULL REFERENCES views(view_id) ON DELETE CASCADE, \
-                    sequence INTEGER NOT NULL REFERENCES revs(sequence) ON DELETE CASCADE, \
-                    key TEXT NOT NULL COLLATE JSON, \
-                    value TEXT); \
-                CREATE INDEX maps_keys on maps(view_id, key COLLATE JSON); \
                 CREATE TABLE attachments ( \
                     sequence INTEGER NOT NULL REFERENCES revs(sequence) ON DELETE CASCADE, \
                     filename TEXT NOT NULL, \
@@ -497,7 +518,76 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
                                 intoBlobFilenamesTableInDatabase:db];
             }
             
-            // dbVersion = 200;
+            dbVersion = 200;
+        }
+
+        // The shared maps table is only found in databases created before version 202, so
+        // new databases skip the steps converting it. Each step is a transaction, including its
+        // user_version update, so a step which fails or is interrupted is run again in full.
+        BOOL hasMapsTable = [db tableExists:@"maps"];
+
+        if (dbVersion < 201) {
+            // Version 201: binary collation keys for view rows. Existing rows don't have them,
+            // so views are re-indexed from scratch.
+            NSString* sql = nil;
+            if (hasMapsTable) {
+                sql = @"ALTER TABLE maps ADD COLUMN collation_key BLOB; \
+                        CREATE INDEX maps_collation_keys \
+                            ON maps(view_id, collation_key, key COLLATE JSON); \
+                        DELETE FROM maps; \
+                        UPDATE views SET lastsequence=0";
+            }
+            if (![db beginTransaction] ||
+                ![strongSelf migrateWithUpdates:sql queries:nil version:201 inDatabase:db] ||
+                ![db commit]) {
+                [db close];
+                result = NO;
+                return;
+            }
+            dbVersion = 201;
+        }
+
+        if (dbVersion < 202) {
+            // Version 202: each view's rows move to a table of their own, whose keys are indexed
+            // with the view's collation. Collations weren't recorded before, so rows go to
+            // Unicode-collated tables; views with another collation are re-indexed on next use.
+            if (![db beginTransaction] ||
+                ![db executeUpdate:@"ALTER TABLE views ADD COLUMN collation INTEGER"]) {
+                [db close];
+                result = NO;
+                return;
+            }
+            NSMutableArray* viewIDs = [NSMutableArray array];
+            if (hasMapsTable) {
+                FMResultSet* views = [db executeQuery:@"SELECT view_id FROM views"];
+                while ([views next]) [viewIDs addObject:@([views intForColumnIndex:0])];
+                [views close];
+            }
+
+            for (NSNumber* viewID in viewIDs) {
+                NSString* table = [TD_View mapTableForViewID:viewID.intValue];
+                NSString* copy = $sprintf(@"INSERT INTO %@ (sequence, key, value, collation_key) "
+                                           "SELECT sequence, key, value, collation_key "
+                                           "FROM maps WHERE view_id=?",
+                                          table);
+                if (![TD_View createMapTableForViewID:viewID.intValue
+                                            collation:kTDViewCollationUnicode
+                                           inDatabase:db] ||
+                    ![db executeUpdate:copy, viewID]) {
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+
+            NSString* sql = hasMapsTable ? @"DROP TABLE maps" : nil;
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:202 inDatabase:db] ||
+                ![db commit]) {
+                [db close];
+                result = NO;
+                return;
+            }
+            // dbVersion = 202;
         }
         
 #if DEBUG
@@ -743,6 +833,17 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     rev.sequence = sequence;
     rev.missing = (json == nil);
     NSDictionary* extra = [self extraPropertiesForRevision:rev options:options inDatabase:db];
+    return [TD_Database documentPropertiesFromJSON:json
+                                   extraProperties:extra
+                                             docID:docID
+                                             revID:revID];
+}
+
++ (NSDictionary*)documentPropertiesFromJSON:(NSData*)json
+                            extraProperties:(NSDictionary*)extra
+                                      docID:(NSString*)docID
+                                      revID:(NSString*)revID
+{
     if (json.length == 0 || (json.length == 2 && memcmp(json.bytes, "{}", 2) == 0))
         return extra;  // optimization, and workaround for issue #44
     NSMutableDictionary* docProperties =
@@ -1287,6 +1388,16 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
 {
     __block TDStatus result;
     [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        int viewID = [db intForQuery:@"SELECT view_id FROM views WHERE name=?", name];
+        if (viewID > 0) {
+            for (NSString* table in @[ [TD_View mapTableForViewID:viewID],
+                                       [TD_View reduceTableForViewID:viewID] ]) {
+                if (![db executeUpdate:$sprintf(@"DROP TABLE IF EXISTS %@", table)]) {
+                    result = kTDStatusDBError;
+                    return;
+                }
+            }
+        }
         if (![db executeUpdate:@"DELETE FROM views WHERE name=?", name]) {
             result = kTDStatusDBError;
             return;
@@ -1331,8 +1442,19 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
     return view;
 }
 
-// FIX: This has a lot of code in common with -[TD_View queryWithOptions:status:]. Unify the two!
 - (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs options:(const TDQueryOptions*)options
+{
+    __block NSDictionary* result;
+    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+        result = [self getDocsWithIDs:docIDs options:options database:db];
+    }];
+    return result;
+}
+
+// FIX: This has a lot of code in common with -[TD_View queryWithOptions:status:]. Unify the two!
+- (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs
+                        options:(const TDQueryOptions*)options
+                       database:(FMDatabase*)db
 {
     if (!options) options = &kDefaultTDQueryOptions;
 
@@ -1347,12 +1469,12 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
 
     NSMutableArray* args = $marray();
     id minKey = options->startKey, maxKey = options->endKey;
-    BOOL inclusiveMin = YES, inclusiveMax = options->inclusiveEnd;
+    BOOL inclusiveMin = !options->exclusiveStart, inclusiveMax = options->inclusiveEnd;
     if (options->descending) {
         minKey = maxKey;
         maxKey = options->startKey;
         inclusiveMin = inclusiveMax;
-        inclusiveMax = YES;
+        inclusiveMax = !options->exclusiveStart;
     }
     if (minKey) {
         Assert([minKey isKindOfClass:[NSString class]]);
@@ -1371,81 +1493,80 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
     [args addObject:@(options->limit)];
     [args addObject:@(options->skip)];
 
-    __block SequenceNumber update_seq = 0;
-    __block NSMutableArray* rows = $marray();
+    SequenceNumber update_seq = 0;
+    NSMutableArray* rows = $marray();
 
-    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
-        if (options->updateSeq)
-            update_seq = self.lastSequence;  // TODO: needs to be atomic with the following SELECT
-
-        // Now run the database query:
-        FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
-        if (!r) return;
-
-        int64_t lastDocID = 0;
-        NSMutableDictionary* docs = docIDs ? $mdict() : nil;
-        while ([r next]) {
-            @autoreleasepool
-            {
-                // Only count the first rev for a given doc (the rest will be losing conflicts):
-                int64_t docNumericID = [r longLongIntForColumnIndex:0];
-                if (docNumericID == lastDocID) continue;
-                lastDocID = docNumericID;
+    if (options->updateSeq) update_seq = [self lastSequenceInDatabase:db];
 
-                NSString* docID = [r stringForColumnIndex:1];
-                NSString* revID = [r stringForColumnIndex:2];
-                BOOL deleted = options->includeDeletedDocs && [r boolForColumn:@"deleted"];
-                NSDictionary* docContents = nil;
-                if (options->includeDocs) {
-                    // Fill in the document contents:
-                    NSData* json = [r dataNoCopyForColumnIndex:3];
-                    SequenceNumber sequence = [r longLongIntForColumnIndex:4];
-                    docContents = [self documentPropertiesFromJSON:json
-                                                             docID:docID
-                                                             revID:revID
-                                                           deleted:deleted
-                                                          sequence:sequence
-                                                           options:options->content
-                                                        inDatabase:db];
-                    Assert(docContents);
-                }
-                NSDictionary* change = $dict(
-                    { @"id", docID }, { @"key", docID },
-                    { @"value", $dict({ @"rev", revID }, { @"deleted", (deleted ? $true : nil) }) },
-                    { @"doc", docContents });
-                if (docIDs)
-                    [docs setObject:change forKey:docID];
-                else
-                    [rows addObject:change];
+    // Now run the database query:
+    FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+    if (!r) {
+        return $dict({ @"rows", rows }, { @"total_rows", @0 }, { @"offset", @(options->skip) });
+    }
+
+    int64_t lastDocID = 0;
+    NSMutableDictionary* docs = docIDs ? $mdict() : nil;
+    while ([r next]) {
+        @autoreleasepool
+        {
+            // Only count the first rev for a given doc (the rest will be losing conflicts):
+            int64_t docNumericID = [r longLongIntForColumnIndex:0];
+            if (docNumericID == lastDocID) continue;
+            lastDocID = docNumericID;
+
+            NSString* docID = [r stringForColumnIndex:1];
+            NSString* revID = [r stringForColumnIndex:2];
+            BOOL deleted = options->includeDeletedDocs && [r boolForColumn:@"deleted"];
+            NSDictionary* docContents = nil;
+            if (options->includeDocs) {
+                // Fill in the document contents:
+                NSData* json = [r dataNoCopyForColumnIndex:3];
+                SequenceNumber sequence = [r longLongIntForColumnIndex:4];
+                docContents = [self documentPropertiesFromJSON:json
+                                                         docID:docID
+                                                         revID:revID
+                                                       deleted:deleted
+                                                      sequence:sequence
+                                                       options:options->content
+                                                    inDatabase:db];
+                Assert(docContents);
             }
+            NSDictionary* change = $dict(
+                { @"id", docID }, { @"key", docID },
+                { @"value", $dict({ @"rev", revID }, { @"deleted", (deleted ? $true : nil) }) },
+                { @"doc", docContents });
+            if (docIDs)
+                [docs setObject:change forKey:docID];
+            else
+                [rows addObject:change];
         }
-        [r close];
+    }
+    [r close];
 
-        // If given doc IDs, sort the output into that order, and add entries for missing docs:
-        if (docIDs) {
-            for (NSString* docID in docIDs) {
-                NSDictionary* change = docs[docID];
-                if (!change) {
-                    NSString* revID = nil;
-                    SInt64 docNumericID = [self getDocNumericID:docID database:db];
-                    if (docNumericID > 0) {
-                        BOOL deleted;
-                        revID = [self winningRevIDOfDocNumericID:docNumericID
-                                                       isDeleted:&deleted
-                                                        database:db];
-                    }
-                    if (revID) {
-                        change =
-                            $dict({ @"id", docID }, { @"key", docID },
-                                  { @"value", $dict({ @"rev", revID }, { @"deleted", $true }) });
-                    } else {
-                        change = $dict({ @"key", docID }, { @"error", @"not_found" });
-                    }
+    // If given doc IDs, sort the output into that order, and add entries for missing docs:
+    if (docIDs) {
+        for (NSString* docID in docIDs) {
+            NSDictionary* change = docs[docID];
+            if (!change) {
+                NSString* revID = nil;
+                SInt64 docNumericID = [self getDocNumericID:docID database:db];
+                if (docNumericID > 0) {
+                    BOOL deleted;
+                    revID = [self winningRevIDOfDocNumericID:docNumericID
+                                                   isDeleted:&deleted
+                                                    database:db];
+                }
+                if (revID) {
+                    change =
+                        $dict({ @"id", docID }, { @"key", docID },
+                              { @"value", $dict({ @"rev", revID }, { @"deleted", $true }) });
+                } else {
+                    change = $dict({ @"key", docID }, { @"error", @"not_found" });
                 }
-                [rows addObject:change];
             }
+            [rows addObject:change];
         }
-    }];
+    }
 
     NSUInteger totalRows = rows.count;  //??? Is this true, or does it ignore limit/offset?
     return $dict({ @"rows", rows }, { @"total_rows", @(totalRows) },
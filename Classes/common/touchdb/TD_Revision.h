@@ -18,6 +18,7 @@ typedef SInt64 SequenceNumber;
    @private
     NSString* _docID, *_revID;
     TD_Body* _body;
+    NSData* _canonicalBody;
     SequenceNumber _sequence;
     bool _deleted;
     bool _missing;
@@ -38,6 +39,12 @@ typedef SInt64 SequenceNumber;
 @property (copy) NSDictionary* properties;
 @property (copy) NSData* asJSON;
 
+/** The body in the form it's stored in the revs table: canonical JSON with the special "_" keys
+    removed. Only set on attachment-free revisions scanned straight from a remote server's response
+    (see TDJSONScanner), to spare -encodeDocumentJSON: a round trip through NSDictionary.
+    Setting the body clears it. */
+@property (copy) NSData* canonicalBody;
+
 - (id)objectForKeyedSubscript:(NSString*)key;  // enables subscript access in Xcode 4.4+
 
 @property SequenceNumber sequence;
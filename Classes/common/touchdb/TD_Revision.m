@@ -60,8 +60,16 @@
     return [[self alloc] initWithProperties:properties];
 }
 
-@synthesize docID = _docID, revID = _revID, deleted = _deleted, missing = _missing, body = _body,
-            sequence = _sequence;
+@synthesize docID = _docID, revID = _revID, deleted = _deleted, missing = _missing,
+            canonicalBody = _canonicalBody, sequence = _sequence;
+
+- (TD_Body*)body { return _body; }
+
+- (void)setBody:(TD_Body*)body
+{
+    _body = body;
+    _canonicalBody = nil;  // no longer matches the body
+}
 
 - (unsigned)generation { return [[self class] generationFromRevID:_revID]; }
 
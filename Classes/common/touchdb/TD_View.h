@@ -22,7 +22,8 @@ typedef void (^TDMapBlock)(NSDictionary* doc, TDMapEmitBlock emit);
 /** A "reduce" function called to summarize the results of a view.
     @param keys  An array of keys to be reduced (or nil if this is a rereduce).
     @param values  A parallel array of values to be reduced, corresponding 1::1 with the keys.
-    @param rereduce  YES if the input values are the results of previous reductions.
+    @param rereduce  YES if the input values are the results of previous reductions. Stored
+   reductions are combined this way, so every reduce block must handle it.
     @return  The reduced value; almost always a scalar or small fixed-size object. */
 typedef id (^TDReduceBlock)(NSArray* keys, NSArray* values, BOOL rereduce);
 
@@ -43,6 +44,7 @@ typedef struct TDQueryOptions
     BOOL reduce;
     BOOL group;
     BOOL includeDeletedDocs;  // only works with _all_docs, not regular views
+    BOOL exclusiveStart;      // only works with _all_docs, not regular views
 } TDQueryOptions;
 
 extern const TDQueryOptions kDefaultTDQueryOptions;
@@ -69,6 +71,7 @@ typedef enum {
     TDReduceBlock _reduceBlock;
     TDViewCollation _collation;
     TDContentOptions _mapContentOptions;
+    BOOL _mapsConcurrently;
 }
 
 - (void)deleteView;
@@ -82,6 +85,10 @@ typedef enum {
 @property TDViewCollation collation;
 @property TDContentOptions mapContentOptions;
 
+/** If YES, -updateIndex calls the map block on several threads at once, so it must be safe to do
+    so. Defaults to NO; documents are decoded on several threads either way. */
+@property BOOL mapsConcurrently;
+
 - (BOOL)setMapBlock:(TDMapBlock)mapBlock
         reduceBlock:(TDReduceBlock)reduceBlock
             version:(NSString*)version;
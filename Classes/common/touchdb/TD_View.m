@@ -33,6 +33,12 @@
 
 #define kReduceBatchSize 100
 
+// Emitted rows are inserted this many at a time; each takes 4 of SQLite's 999 parameters.
+#define kMapInsertBatchSize 100
+
+// Documents are read this many at a time, then decoded and mapped on the worker pool.
+#define kMapBatchSize 64
+
 const TDQueryOptions kDefaultTDQueryOptions = {
     .limit = UINT_MAX,
     .inclusiveEnd = YES
@@ -41,6 +47,22 @@ const TDQueryOptions kDefaultTDQueryOptions = {
 
 static id<TDViewCompiler> sCompiler;
 
+/** A document read by -updateIndex, waiting to be decoded and passed to the map block. */
+@interface TDMapPendingDocument : NSObject {
+   @public
+    SequenceNumber _sequence;
+    NSString* _docID;
+    NSString* _revID;
+    NSData* _json;
+    NSDictionary* _extra;       // properties added by the database, like _id and _rev
+    NSArray* _conflicts;
+    NSDictionary* _properties;  // set by -decode
+    NSMutableArray* _emitted;   // key JSON, value JSON or NSNull, collation key, ...
+}
+- (void)decode;
+- (void)mapWithBlock:(TDMapBlock)mapBlock collation:(TDViewCollation)collation;
+@end
+
 @interface TD_View ()
 
 /** Must be called from within FMDatabaseQueue block */
@@ -64,7 +86,8 @@ static id<TDViewCompiler> sCompiler;
 }
 
 @synthesize database = _db, name = _name, mapBlock = _mapBlock, reduceBlock = _reduceBlock,
-            collation = _collation, mapContentOptions = _mapContentOptions;
+            collation = _collation, mapContentOptions = _mapContentOptions,
+            mapsConcurrently = _mapsConcurrently;
 
 - (int)viewID
 {
@@ -168,7 +191,10 @@ static id<TDViewCompiler> sCompiler;
 {
     if (self.viewID <= 0) return;
     [_db.fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
-        [db executeUpdate:@"DELETE FROM maps WHERE view_id=?", @(_viewID)];
+        NSString* table = [TD_View mapTableForViewID:_viewID];
+        if ([db tableExists:table]) [db executeUpdate:$sprintf(@"DELETE FROM %@", table)];
+        table = [TD_View reduceTableForViewID:_viewID];
+        [db executeUpdate:$sprintf(@"DROP TABLE IF EXISTS %@", table)];
         [db executeUpdate:@"UPDATE views SET lastsequence=0 WHERE view_id=?", @(_viewID)];
     }];
 }
@@ -185,11 +211,139 @@ static id<TDViewCompiler> sCompiler;
     _viewID = 0;
 }
 
+#pragma mark - MAP TABLES:
+
+static NSString* collationName(TDViewCollation collation)
+{
+    switch (collation) {
+        case kTDViewCollationRaw:
+            return @"JSON_RAW";
+        case kTDViewCollationASCII:
+            return @"JSON_ASCII";
+        default:
+            return @"JSON";
+    }
+}
+
++ (NSString*)mapTableForViewID:(int)viewID { return $sprintf(@"maps_%d", viewID); }
+
++ (BOOL)createMapTableForViewID:(int)viewID
+                      collation:(TDViewCollation)collation
+                     inDatabase:(FMDatabase*)db
+{
+    NSString* table = [self mapTableForViewID:viewID];
+    NSString* sql = $sprintf(@"CREATE TABLE %@ ( \
+                                   sequence INTEGER NOT NULL \
+                                       REFERENCES revs(sequence) ON DELETE CASCADE, \
+                                   key TEXT NOT NULL COLLATE %@, \
+                                   value TEXT, \
+                                   collation_key BLOB)",
+                             table, collationName(collation));
+    return [db executeUpdate:sql] &&
+           [db executeUpdate:$sprintf(@"CREATE INDEX %@_keys ON %@(collation_key, key)", table,
+                                      table)] &&
+           [db executeUpdate:$sprintf(@"CREATE INDEX %@_sequence ON %@(sequence)", table,
+                                      table)] &&
+           [db executeUpdate:@"UPDATE views SET collation=? WHERE view_id=?", @(collation),
+                             @(viewID)];
+}
+
++ (NSString*)reduceTableForViewID:(int)viewID { return $sprintf(@"reduces_%d", viewID); }
+
+/** Creates the table of a view's stored reductions: one row per distinct key in its map table,
+    holding the reduction of all the values emitted with that key. **/
++ (BOOL)createReduceTableForViewID:(int)viewID
+                         collation:(TDViewCollation)collation
+                        inDatabase:(FMDatabase*)db
+{
+    NSString* table = [self reduceTableForViewID:viewID];
+    NSString* sql = $sprintf(@"CREATE TABLE %@ ( \
+                                   key TEXT PRIMARY KEY COLLATE %@, \
+                                   value TEXT, \
+                                   collation_key BLOB)",
+                             table, collationName(collation));
+    return [db executeUpdate:sql] &&
+           [db executeUpdate:$sprintf(@"CREATE INDEX %@_keys ON %@(collation_key, key)", table,
+                                      table)];
+}
+
+/** Makes sure this view's map table exists and has the view's current collation, recreating it
+    empty (and so resetting the view's lastSequence) if not. Returns the table's name, or nil on
+    a database error. Must be called from within a FMDatabaseQueue block. **/
+- (NSString*)mapTableInDatabase:(FMDatabase*)db
+{
+    NSString* table = [TD_View mapTableForViewID:_viewID];
+    FMResultSet* r = [db executeQuery:@"SELECT collation FROM views WHERE view_id=?", @(_viewID)];
+    if (!r) return nil;
+    BOOL upToDate = [r next] && ![r columnIndexIsNull:0] && [r intForColumnIndex:0] == _collation;
+    [r close];
+    if (upToDate && [db tableExists:table]) return table;
+
+    CDTLogInfo(CDTTD_VIEW_CONTEXT, @"Creating map table %@ for view %@", table, _name);
+    NSString* reduceTable = [TD_View reduceTableForViewID:_viewID];
+    if (![db executeUpdate:$sprintf(@"DROP TABLE IF EXISTS %@", table)] ||
+        ![db executeUpdate:$sprintf(@"DROP TABLE IF EXISTS %@", reduceTable)] ||
+        ![TD_View createMapTableForViewID:_viewID collation:_collation inDatabase:db] ||
+        ![db executeUpdate:@"UPDATE views SET lastsequence=0 WHERE view_id=?", @(_viewID)])
+        return nil;
+    return table;
+}
+
 #pragma mark - INDEXING:
 
+// Appends the JSON of strings, numbers, booleans, nulls and arrays of them straight to `json`,
+// as keys usually are. Returns NO for anything else, such as dictionaries, which TDJSON handles.
+static BOOL appendScalarJSON(NSMutableString* json, id object)
+{
+    if ([object isKindOfClass:[NSString class]]) {
+        NSString* str = object;
+        NSUInteger length = str.length, start = 0;
+        [json appendString:@"\""];
+        for (NSUInteger i = 0; i < length; ++i) {
+            unichar c = [str characterAtIndex:i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            [json appendString:[str substringWithRange:NSMakeRange(start, i - start)]];
+            switch (c) {
+                case '"':  [json appendString:@"\\\""]; break;
+                case '\\': [json appendString:@"\\\\"]; break;
+                case '\n': [json appendString:@"\\n"]; break;
+                case '\r': [json appendString:@"\\r"]; break;
+                case '\t': [json appendString:@"\\t"]; break;
+                default:   [json appendFormat:@"\\u%04x", c]; break;
+            }
+            start = i + 1;
+        }
+        [json appendString:[str substringFromIndex:start]];
+        [json appendString:@"\""];
+    } else if ([object isKindOfClass:[NSNumber class]]) {
+        if (CFGetTypeID((__bridge CFTypeRef)object) == CFBooleanGetTypeID()) {
+            [json appendString:[object boolValue] ? @"true" : @"false"];
+        } else {
+            if (!isfinite([object doubleValue])) return NO;
+            [json appendString:[object stringValue]];
+        }
+    } else if (object == $null) {
+        [json appendString:@"null"];
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        [json appendString:@"["];
+        BOOL first = YES;
+        for (id item in object) {
+            if (!first) [json appendString:@","];
+            first = NO;
+            if (!appendScalarJSON(json, item)) return NO;
+        }
+        [json appendString:@"]"];
+    } else {
+        return NO;
+    }
+    return YES;
+}
+
 static NSString* toJSONString(id object)
 {
     if (!object) return nil;
+    NSMutableString* json = [NSMutableString string];
+    if (appendScalarJSON(json, object)) return json;
     return [TDJSON stringWithJSONObject:object options:TDJSONWritingAllowFragments error:NULL];
 }
 
@@ -199,6 +353,25 @@ static id fromJSON(NSData* json)
     return [TDJSON JSONObjectWithData:json options:TDJSONReadingAllowFragments error:NULL];
 }
 
+static void* collateContext(TDViewCollation collation)
+{
+    switch (collation) {
+        case kTDViewCollationRaw:
+            return kTDCollateJSON_Raw;
+        case kTDViewCollationASCII:
+            return kTDCollateJSON_ASCII;
+        default:
+            return kTDCollateJSON_Unicode;
+    }
+}
+
+// The binary collation key stored alongside a key in a map table; see TDCollationKeyForJSON.
+static NSData* collationKey(NSString* keyJSON, TDViewCollation collation, BOOL* outExact)
+{
+    const char* chars = keyJSON.UTF8String;
+    return TDCollationKeyForJSON(collateContext(collation), (int)strlen(chars), chars, outExact);
+}
+
 - (BOOL)stale { return self.lastSequenceIndexed < _db.lastSequence; }
 
 - (TDStatus)updateIndex
@@ -214,7 +387,16 @@ static id fromJSON(NSData* json)
     [_db.fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
         TD_View* strongSelf = weakSelf;
         FMResultSet* r = nil;
+        // The same few statements are run for every row, so keep them prepared:
+        BOOL cachedStatements = db.shouldCacheStatements;
+        db.shouldCacheStatements = YES;
         @try {
+            NSString* mapTable = [strongSelf mapTableInDatabase:db];
+            if (!mapTable) {
+                status = kTDStatusDBError;
+                return;
+            }
+
             // Check whether we need to update at all:
             const SequenceNumber lastSequence = [strongSelf lastSequenceIndexedInDatabase:db];
             const SequenceNumber dbMaxSequence = _db.lastSequence;
@@ -223,12 +405,35 @@ static id fromJSON(NSData* json)
                 return;
             }
 
-            __block BOOL emitFailed = NO;
             __block unsigned inserted = 0;
             FMDatabase* fmdb = db;
+            const TDViewCollation collation = _collation;
+
+            // Stored reductions are kept up to date along with the map table: rebuilt from it
+            // when it's been cleared, otherwise updated for just the keys this update touches.
+            NSString* reduceTable = nil;
+            BOOL rebuildReductions = (lastSequence == 0);
+            if (_reduceBlock) {
+                reduceTable = [TD_View reduceTableForViewID:viewID];
+                if (![fmdb tableExists:reduceTable]) {
+                    if (![TD_View createReduceTableForViewID:viewID
+                                                   collation:collation
+                                                  inDatabase:fmdb]) {
+                        status = kTDStatusDBError;
+                        return;
+                    }
+                    rebuildReductions = YES;
+                }
+            } else if (![fmdb executeUpdate:$sprintf(@"DROP TABLE IF EXISTS %@",
+                                                      [TD_View reduceTableForViewID:viewID])]) {
+                status = kTDStatusDBError;
+                return;
+            }
+            BOOL trackReductions = reduceTable && !rebuildReductions;
+            NSMutableDictionary* addedToReduce = [NSMutableDictionary dictionary];
+            NSMutableSet* removedFromReduce = [NSMutableSet set];
 
-            // First remove obsolete emitted results from the 'maps' table:
-            __block SequenceNumber sequence = lastSequence;
+            // First remove obsolete emitted results from the map table:
             if (lastSequence < 0) {
                 status = kTDStatusDBError;
                 return;
@@ -236,13 +441,20 @@ static id fromJSON(NSData* json)
             BOOL ok;
             if (lastSequence == 0) {
                 // If the lastSequence has been reset to 0, make sure to remove all map results:
-                ok = [fmdb executeUpdate:@"DELETE FROM maps WHERE view_id=?", @(_viewID)];
+                ok = [fmdb executeUpdate:$sprintf(@"DELETE FROM %@", mapTable)];
             } else {
                 // Delete all obsolete map results (ones from since-replaced revisions):
-                ok = [fmdb executeUpdate:@"DELETE FROM maps WHERE view_id=? AND sequence IN ("
-                                          "SELECT parent FROM revs WHERE sequence>? "
-                                          "AND parent>0 AND parent<=?)",
-                                         @(_viewID), @(lastSequence), @(lastSequence)];
+                NSString* obsolete = @"sequence IN (SELECT parent FROM revs WHERE sequence>? "
+                                      "AND parent>0 AND parent<=?)";
+                ok = !trackReductions ||
+                     [strongSelf addKeysFromMapTable:mapTable
+                                               where:obsolete
+                                           arguments:@[ @(lastSequence), @(lastSequence) ]
+                                               toSet:removedFromReduce
+                                          inDatabase:fmdb];
+                ok = ok && [fmdb executeUpdate:$sprintf(@"DELETE FROM %@ WHERE %@", mapTable,
+                                                        obsolete),
+                                               @(lastSequence), @(lastSequence)];
             }
             if (!ok) {
                 status = kTDStatusDBError;
@@ -252,19 +464,72 @@ static id fromJSON(NSData* json)
             unsigned deleted = fmdb.changes;
 #endif
 
-            // This is the emit() block, which gets called from within the user-defined map() block
-            // that's called down below.
-            TDMapEmitBlock emit = ^(id key, id value) {
-                if (!key) key = $null;
-                NSString* keyJSON = toJSONString(key);
-                NSString* valueJSON = toJSONString(value);
-                CDTLogInfo(CDTTD_VIEW_CONTEXT, @"    emit(%@, %@)", keyJSON, valueJSON);
-                if ([fmdb executeUpdate:@"INSERT INTO maps (view_id, sequence, key, value) VALUES "
-                                         "(?, ?, ?, ?)",
-                                        @(viewID), @(sequence), keyJSON, valueJSON])
+            // Emitted rows are collected and inserted a batch at a time, in one statement:
+            NSMutableArray* pendingRows = [NSMutableArray arrayWithCapacity:kMapInsertBatchSize * 4];
+            BOOL (^insertPendingRows)() = ^BOOL {
+                NSUInteger count = pendingRows.count / 4;
+                if (count == 0) return YES;
+                NSMutableString* sql = [NSMutableString
+                    stringWithFormat:@"INSERT INTO %@ (sequence, key, value, collation_key) "
+                                      "VALUES (?, ?, ?, ?)",
+                                     mapTable];
+                for (NSUInteger i = 1; i < count; ++i) [sql appendString:@", (?, ?, ?, ?)"];
+                BOOL batchInserted = [fmdb executeUpdate:sql withArgumentsInArray:pendingRows];
+                [pendingRows removeAllObjects];
+                return batchInserted;
+            };
+
+            // Adds the rows a document emitted to the batch to insert:
+            BOOL (^addEmittedRows)(TDMapPendingDocument*) = ^BOOL(TDMapPendingDocument* doc) {
+                NSArray* emitted = doc->_emitted;
+                for (NSUInteger i = 0; i < emitted.count; i += 3) {
+                    NSString* keyJSON = emitted[i];
+                    id valueJSON = emitted[i + 1];
+                    [pendingRows addObject:@(doc->_sequence)];
+                    [pendingRows addObject:keyJSON];
+                    [pendingRows addObject:valueJSON];
+                    [pendingRows addObject:emitted[i + 2]];
                     ++inserted;
-                else
-                    emitFailed = YES;
+                    if (pendingRows.count >= kMapInsertBatchSize * 4 && !insertPendingRows())
+                        return NO;
+                    if (trackReductions) {
+                        NSMutableArray* values = addedToReduce[keyJSON];
+                        if (!values) addedToReduce[keyJSON] = values = [NSMutableArray array];
+                        [values addObject:(valueJSON != $null)
+                                              ? [valueJSON dataUsingEncoding:NSUTF8StringEncoding]
+                                              : $null];
+                    }
+                }
+                return YES;
+            };
+
+            // Maps a batch of documents read below. Decoding the documents and calling the map
+            // block, which is the slow part, happens on the worker pool; the emitted rows are then
+            // inserted here, in the order the documents were read.
+            NSMutableArray* pendingDocs = [NSMutableArray arrayWithCapacity:kMapBatchSize];
+            TDMapBlock mapBlock = _mapBlock;
+            const BOOL mapConcurrently = _mapsConcurrently;
+            BOOL (^mapPendingDocs)() = ^BOOL {
+                NSArray* docs = [pendingDocs copy];
+                [pendingDocs removeAllObjects];
+                dispatch_queue_t workers =
+                    dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+                dispatch_apply(docs.count, workers, ^(size_t i) {
+                    @autoreleasepool
+                    {
+                        TDMapPendingDocument* doc = docs[i];
+                        [doc decode];
+                        if (mapConcurrently) [doc mapWithBlock:mapBlock collation:collation];
+                    }
+                });
+                for (TDMapPendingDocument* doc in docs) {
+                    @autoreleasepool
+                    {
+                        if (!mapConcurrently) [doc mapWithBlock:mapBlock collation:collation];
+                        if (!addEmittedRows(doc)) return NO;
+                    }
+                }
+                return YES;
             };
 
             // Now scan every revision added since the last time the view was indexed:
@@ -284,7 +549,7 @@ static id fromJSON(NSData* json)
                 @autoreleasepool
                 {
                     // Reconstitute the document as a dictionary:
-                    sequence = [r longLongIntForColumnIndex:1];
+                    SequenceNumber sequence = [r longLongIntForColumnIndex:1];
                     NSString* docID = [r stringForColumnIndex:2];
                     if ([docID hasPrefix:@"_design/"]) {  // design docs don't get indexed!
                         keepGoing = [r next];
@@ -320,9 +585,16 @@ static id fromJSON(NSData* json)
                                 // Remove its emitted rows:
                                 first = NO;
                                 SequenceNumber oldSequence = [r2 longLongIntForColumnIndex:1];
+                                if (trackReductions) {
+                                    [strongSelf addKeysFromMapTable:mapTable
+                                                              where:@"sequence=?"
+                                                          arguments:@[ @(oldSequence) ]
+                                                              toSet:removedFromReduce
+                                                         inDatabase:fmdb];
+                                }
                                 [fmdb executeUpdate:
-                                          @"DELETE FROM maps WHERE view_id=? AND sequence=?",
-                                          @(_viewID), @(oldSequence)];
+                                          $sprintf(@"DELETE FROM %@ WHERE sequence=?", mapTable),
+                                          @(oldSequence)];
                                 if (TDCompareRevIDs(oldRevID, revID) > 0) {
                                     // It still 'wins' the conflict, so it's the one that
                                     // should be mapped [again], not the current revision!
@@ -346,36 +618,54 @@ static id fromJSON(NSData* json)
                         }
                     }
 
-                    // Get the document properties, to pass to the map function:
-                    NSDictionary* properties = [_db documentPropertiesFromJSON:json
-                                                                         docID:docID
-                                                                         revID:revID
-                                                                       deleted:NO
-                                                                      sequence:sequence
-                                                                       options:_mapContentOptions
-                                                                    inDatabase:db];
-                    if (!properties) {
-                        CDTLogWarn(CDTTD_VIEW_CONTEXT, @"Failed to parse JSON of doc %@ rev %@", docID,
-                                revID);
-                        continue;
-                    }
-
-                    if (conflicts) {
-                        // Add a "_conflicts" property if there were conflicting revisions:
-                        NSMutableDictionary* mutableProps = [properties mutableCopy];
-                        mutableProps[@"_conflicts"] = conflicts;
-                        properties = mutableProps;
-                    }
-
-                    // Call the user-defined map() to emit new key/value pairs from this revision:
-                    CDTLogInfo(CDTTD_VIEW_CONTEXT, @"  call map for sequence=%lld...", sequence);
-                    _mapBlock(properties, emit);
-                    if (emitFailed) {
+                    // Collect the document to be decoded and mapped; only the properties the
+                    // database adds to its JSON are read here.
+                    TD_Revision* rev = [[TD_Revision alloc] initWithDocID:docID
+                                                                    revID:revID
+                                                                  deleted:NO];
+                    rev.sequence = sequence;
+                    rev.missing = (json == nil);
+                    TDMapPendingDocument* doc = [[TDMapPendingDocument alloc] init];
+                    doc->_sequence = sequence;
+                    doc->_docID = docID;
+                    doc->_revID = revID;
+                    doc->_json = json;
+                    doc->_extra = [_db extraPropertiesForRevision:rev
+                                                          options:_mapContentOptions
+                                                       inDatabase:db];
+                    doc->_conflicts = conflicts;
+                    [pendingDocs addObject:doc];
+                    if (pendingDocs.count >= kMapBatchSize && !mapPendingDocs()) {
                         status = kTDStatusCallbackError;
                         return;
                     }
                 }
             }
+            if (!mapPendingDocs()) {
+                status = kTDStatusCallbackError;
+                return;
+            }
+            if (!insertPendingRows()) {
+                status = kTDStatusCallbackError;
+                return;
+            }
+
+            // Bring the stored reductions up to date with the map table:
+            if (rebuildReductions && reduceTable) {
+                ok = [strongSelf rebuildReductionsInTable:reduceTable
+                                             fromMapTable:mapTable
+                                               inDatabase:fmdb];
+            } else if (trackReductions) {
+                ok = [strongSelf updateReductionsInTable:reduceTable
+                                            fromMapTable:mapTable
+                                             addedValues:addedToReduce
+                                             removedKeys:removedFromReduce
+                                              inDatabase:fmdb];
+            }
+            if (!ok) {
+                status = kTDStatusDBError;
+                return;
+            }
 
             // Finally, record the last revision sequence number that was indexed:
             if (![fmdb executeUpdate:@"UPDATE views SET lastSequence=? WHERE view_id=?",
@@ -392,10 +682,11 @@ static id fromJSON(NSData* json)
         @finally
         {
             [r close];
+            db.shouldCacheStatements = cachedStatements;
             if (status >= kTDStatusBadRequest)
                 CDTLogWarn(CDTTD_VIEW_CONTEXT, @"TouchDB: Failed to rebuild view '%@': %@", _name,
                         @(status));
-            *rollback = (status < kTDStatusBadRequest);
+            *rollback = TDStatusIsError(status);
         }
     }];
     return status;
@@ -403,6 +694,57 @@ static id fromJSON(NSData* json)
 
 #pragma mark - QUERYING:
 
+/** Adds a condition on the collation key to the query, so that SQLite can seek in its index.
+    Only if the bound's collation key is inexact, and so equal to those of keys either side of it,
+    is the JSON of rows with that collation key compared with the bound's. In a Unicode-collated
+    view that's every bound which is, or starts with, a string, so only bounds such as numbers
+    or arrays led by numbers gain from the collation key. **/
+- (void)appendBound:(id)bound
+     strictOperator:(NSString*)strictOp
+          inclusive:(BOOL)inclusive
+              toSql:(NSMutableString*)sql
+               args:(NSMutableArray*)args
+{
+    NSString* op = inclusive ? [strictOp stringByAppendingString:@"="] : strictOp;
+    NSString* boundJSON = toJSONString(bound);
+    BOOL exact;
+    NSData* boundCollation = collationKey(boundJSON, _collation, &exact);
+    if (exact) {
+        [sql appendFormat:@" AND collation_key %@ ?", op];
+        [args addObject:boundCollation];
+    } else {
+        [sql appendFormat:@" AND collation_key %@= ? AND (collation_key %@ ? OR key %@ ?)",
+                          strictOp, strictOp, op];
+        [args addObject:boundCollation];
+        [args addObject:boundCollation];
+        [args addObject:boundJSON];
+    }
+}
+
+/** Adds the conditions for the options' start and end keys to the query, and orders it. **/
+- (void)appendRangeOfOptions:(const TDQueryOptions*)options
+                       toSql:(NSMutableString*)sql
+                        args:(NSMutableArray*)args
+{
+    id minKey = options->startKey, maxKey = options->endKey;
+    BOOL inclusiveMin = YES, inclusiveMax = options->inclusiveEnd;
+    if (options->descending) {
+        minKey = maxKey;
+        maxKey = options->startKey;
+        inclusiveMin = inclusiveMax;
+        inclusiveMax = YES;
+    }
+    if (minKey) {
+        [self appendBound:minKey strictOperator:@">" inclusive:inclusiveMin toSql:sql args:args];
+    }
+    if (maxKey) {
+        [self appendBound:maxKey strictOperator:@"<" inclusive:inclusiveMax toSql:sql args:args];
+    }
+
+    [sql appendString:@" ORDER BY collation_key"];
+    [sql appendString:options->descending ? @" DESC, key DESC" : @", key"];
+}
+
 /** Must be called from within a FMDatabaseQueue block **/
 - (FMResultSet*)resultSetWithOptions:(const TDQueryOptions*)options
                               status:(TDStatus*)outStatus
@@ -410,18 +752,25 @@ static id fromJSON(NSData* json)
 {
     if (!options) options = &kDefaultTDQueryOptions;
 
-    // OPT: It would be faster to use separate tables for raw-or ascii-collated views so that
-    // they could be indexed with the right collation, instead of having to specify it here.
-    NSString* collationStr = @"";
-    if (_collation == kTDViewCollationASCII)
-        collationStr = @" COLLATE JSON_ASCII";
-    else if (_collation == kTDViewCollationRaw)
-        collationStr = @" COLLATE JSON_RAW";
+    if (_viewID <= 0) {
+        *outStatus = kTDStatusNotFound;
+        return nil;
+    }
+    NSString* mapTable = [self mapTableInDatabase:fmdb];
+    if (!mapTable) {
+        *outStatus = kTDStatusDBError;
+        return nil;
+    }
 
+    // Rows are sorted and range-limited by their binary collation keys, which SQLite compares
+    // with memcmp. In Unicode collation those keys stop at the first string, so rows whose keys
+    // are equal are then compared by their JSON, using the collation declared on the key column.
     NSMutableString* sql = [NSMutableString stringWithString:@"SELECT key, value, docid"];
     if (options->includeDocs) [sql appendString:@", revid, json, revs.sequence"];
-    [sql appendString:@" FROM maps, revs, docs WHERE maps.view_id=?"];
-    NSMutableArray* args = $marray(@(_viewID));
+    [sql appendFormat:@" FROM %@ AS maps, revs, docs WHERE revs.sequence = maps.sequence "
+                       "AND docs.doc_id = revs.doc_id",
+                      mapTable];
+    NSMutableArray* args = $marray();
 
     if (options->keys) {
         [sql appendString:@" AND key in ("];
@@ -434,29 +783,7 @@ static id fromJSON(NSData* json)
         [sql appendString:@")"];
     }
 
-    id minKey = options->startKey, maxKey = options->endKey;
-    BOOL inclusiveMin = YES, inclusiveMax = options->inclusiveEnd;
-    if (options->descending) {
-        minKey = maxKey;
-        maxKey = options->startKey;
-        inclusiveMin = inclusiveMax;
-        inclusiveMax = YES;
-    }
-    if (minKey) {
-        [sql appendString:(inclusiveMin ? @" AND key >= ?" : @" AND key > ?")];
-        [sql appendString:collationStr];
-        [args addObject:toJSONString(minKey)];
-    }
-    if (maxKey) {
-        [sql appendString:(inclusiveMax ? @" AND key <= ?" : @" AND key < ?")];
-        [sql appendString:collationStr];
-        [args addObject:toJSONString(maxKey)];
-    }
-
-    [sql appendString:@" AND revs.sequence = maps.sequence AND docs.doc_id = revs.doc_id "
-                       "ORDER BY key"];
-    [sql appendString:collationStr];
-    if (options->descending) [sql appendString:@" DESC"];
+    [self appendRangeOfOptions:options toSql:sql args:args];
     if (options->limit != kDefaultTDQueryOptions.limit) {
         [sql appendString:@" LIMIT ?"];
         [args addObject:@(options->limit)];
@@ -481,15 +808,28 @@ static id fromJSON(NSData* json)
     __weak TD_View* weakSelf = self;
     [_db.fmdbQueue inDatabase:^(FMDatabase* db) {
         TD_View* strongSelf = weakSelf;
+        unsigned groupLevel = options->groupLevel;
+        bool group = options->group || groupLevel > 0;
+        if ((options->reduce || group) && _reduceBlock) {
+            // Combine the stored reductions of the keys in range, if they can answer the query:
+            rows = [strongSelf storedReductionQuery:options
+                                              group:group
+                                         groupLevel:groupLevel
+                                           database:db];
+            if (rows) {
+                *outStatus = kTDStatusOK;
+                CDTLogInfo(CDTTD_VIEW_CONTEXT, @"Query %@: Returning %u stored reductions", _name,
+                           (unsigned)rows.count);
+                return;
+            }
+        }
+
         FMResultSet* r = [strongSelf resultSetWithOptions:options status:outStatus database:db];
         if (!r) {
             return;
         }
 
-        unsigned groupLevel = options->groupLevel;
-        bool group = options->group || groupLevel > 0;
         if (options->reduce || group) {
-            // Reduced or grouped query:
             // Reduced or grouped query:
             if (!_reduceBlock && !group) {
                 CDTLogWarn(CDTTD_VIEW_CONTEXT,
@@ -570,13 +910,14 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
         return key;
 }
 
-// Invokes the reduce function on the parallel arrays of keys and values
-- (id)reduceKeys:(NSMutableArray*)keys values:(NSMutableArray*)values
+// Invokes the reduce function on the parallel arrays of keys and values. When rereducing, keys
+// is nil and the values are the results of earlier reductions.
+- (id)reduceKeys:(NSMutableArray*)keys values:(NSMutableArray*)values rereduce:(BOOL)rereduce
 {
     if (!_reduceBlock) return nil;
-    TDLazyArrayOfJSON* lazyKeys = [[TDLazyArrayOfJSON alloc] initWithArray:keys];
+    TDLazyArrayOfJSON* lazyKeys = keys ? [[TDLazyArrayOfJSON alloc] initWithArray:keys] : nil;
     TDLazyArrayOfJSON* lazyVals = [[TDLazyArrayOfJSON alloc] initWithArray:values];
-    id result = _reduceBlock(lazyKeys, lazyVals, NO);
+    id result = _reduceBlock(lazyKeys, lazyVals, rereduce);
     return result ?: $null;
 }
 
@@ -599,7 +940,7 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
             if (group && !groupTogether(keyData, lastKeyData, groupLevel)) {
                 if (lastKeyData) {
                     // This pair starts a new group, so reduce & record the last one:
-                    id reduced = [self reduceKeys:keysToReduce values:valuesToReduce];
+                    id reduced = [self reduceKeys:keysToReduce values:valuesToReduce rereduce:NO];
                     [rows addObject:$dict({ @"key", groupKey(lastKeyData, groupLevel) },
                                           { @"value", reduced })];
                     [keysToReduce removeAllObjects];
@@ -617,7 +958,7 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
     if (keysToReduce.count > 0) {
         // Finish the last group (or the entire list, if no grouping):
         id key = group ? groupKey(lastKeyData, groupLevel) : $null;
-        id reduced = [self reduceKeys:keysToReduce values:valuesToReduce];
+        id reduced = [self reduceKeys:keysToReduce values:valuesToReduce rereduce:NO];
         CDTLogVerbose(CDTTD_VIEW_CONTEXT, @"Query %@: Reduced to key=%@, value=%@", _name,
                    toJSONString(key), toJSONString(reduced));
         [rows addObject:$dict({ @"key", key }, { @"value", reduced })];
@@ -625,6 +966,214 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
     return rows;
 }
 
+#pragma mark - STORED REDUCTIONS:
+
+// Each view with a reduce block stores the reduction of the values emitted with each distinct
+// key. updateIndex keeps them up to date, and reduced or grouped queries over a range of keys
+// rereduce them rather than reducing every row in the range.
+
+/** Adds the keys of the map table's rows matching the condition to the set. **/
+- (BOOL)addKeysFromMapTable:(NSString*)mapTable
+                      where:(NSString*)condition
+                  arguments:(NSArray*)arguments
+                      toSet:(NSMutableSet*)keys
+                 inDatabase:(FMDatabase*)db
+{
+    FMResultSet* r =
+        [db executeQuery:$sprintf(@"SELECT DISTINCT key FROM %@ WHERE %@", mapTable, condition)
+            withArgumentsInArray:arguments];
+    if (!r) return NO;
+    while ([r next]) [keys addObject:[r stringForColumnIndex:0]];
+    [r close];
+    return YES;
+}
+
+- (BOOL)storeReduction:(id)reduced
+                 ofKey:(NSString*)keyJSON
+               inTable:(NSString*)reduceTable
+            inDatabase:(FMDatabase*)db
+{
+    NSString* sql = $sprintf(@"INSERT OR REPLACE INTO %@ (key, value, collation_key) "
+                              "VALUES (?, ?, ?)",
+                             reduceTable);
+    return [db executeUpdate:sql, keyJSON, toJSONString(reduced),
+                             collationKey(keyJSON, _collation, NULL)];
+}
+
+/** Reduces the rows of the map table with keys equal to the given one, all of which have been
+    fetched by `r`, and stores the result, or deletes the stored reduction if there are none. **/
+- (BOOL)storeReductionOfRows:(FMResultSet*)r
+                       ofKey:(NSString*)keyJSON
+                     inTable:(NSString*)reduceTable
+                  inDatabase:(FMDatabase*)db
+{
+    NSMutableArray* keys = [NSMutableArray array], *values = [NSMutableArray array];
+    while ([r next]) {
+        [keys addObject:[r dataForColumnIndex:0]];
+        [values addObject:[r dataForColumnIndex:1] ?: $null];
+    }
+    [r close];
+    if (keys.count == 0) {
+        return [db executeUpdate:$sprintf(@"DELETE FROM %@ WHERE key=?", reduceTable), keyJSON];
+    }
+    id reduced = [self reduceKeys:keys values:values rereduce:NO];
+    return [self storeReduction:reduced ofKey:keyJSON inTable:reduceTable inDatabase:db];
+}
+
+/** Replaces all the stored reductions with ones computed from the map table. **/
+- (BOOL)rebuildReductionsInTable:(NSString*)reduceTable
+                    fromMapTable:(NSString*)mapTable
+                      inDatabase:(FMDatabase*)db
+{
+    if (![db executeUpdate:$sprintf(@"DELETE FROM %@", reduceTable)]) return NO;
+    FMResultSet* r = [db executeQuery:$sprintf(@"SELECT key, value FROM %@ "
+                                                "ORDER BY collation_key, key",
+                                               mapTable)];
+    if (!r) return NO;
+
+    void* context = collateContext(_collation);
+    NSMutableArray* keys = [NSMutableArray array], *values = [NSMutableArray array];
+    NSData* lastKey = nil;
+    BOOL ok = YES;
+    while (ok && [r next]) {
+        @autoreleasepool
+        {
+            NSData* key = [r dataForColumnIndex:0];
+            if (lastKey && TDCollateJSON(context, (int)lastKey.length, lastKey.bytes,
+                                         (int)key.length, key.bytes) != 0) {
+                // This row starts a new key, so reduce & store the last one's rows:
+                id reduced = [self reduceKeys:keys values:values rereduce:NO];
+                ok = [self storeReduction:reduced
+                                    ofKey:[lastKey my_UTF8ToString]
+                                  inTable:reduceTable
+                               inDatabase:db];
+                [keys removeAllObjects];
+                [values removeAllObjects];
+            }
+            lastKey = key;
+            [keys addObject:key];
+            [values addObject:[r dataForColumnIndex:1] ?: $null];
+        }
+    }
+    [r close];
+    if (ok && keys.count > 0) {
+        id reduced = [self reduceKeys:keys values:values rereduce:NO];
+        ok = [self storeReduction:reduced
+                            ofKey:[lastKey my_UTF8ToString]
+                          inTable:reduceTable
+                       inDatabase:db];
+    }
+    return ok;
+}
+
+/** Updates the stored reductions of the keys an index update touched. `added` maps keys to the
+    JSON of the values emitted with them; keys in `removed` had rows deleted. **/
+- (BOOL)updateReductionsInTable:(NSString*)reduceTable
+                   fromMapTable:(NSString*)mapTable
+                    addedValues:(NSDictionary*)added
+                    removedKeys:(NSSet*)removed
+                     inDatabase:(FMDatabase*)db
+{
+    // Keys which only gained rows: rereduce their stored reduction with that of the new values.
+    NSString* selectStored = $sprintf(@"SELECT value FROM %@ WHERE key=?", reduceTable);
+    for (NSString* keyJSON in added) {
+        if ([removed containsObject:keyJSON]) continue;
+        @autoreleasepool
+        {
+            NSMutableArray* values = [added[keyJSON] mutableCopy];
+            NSData* keyData = [keyJSON dataUsingEncoding:NSUTF8StringEncoding];
+            NSMutableArray* keys = [NSMutableArray arrayWithCapacity:values.count];
+            for (NSUInteger i = 0; i < values.count; ++i) [keys addObject:keyData];
+            id reduced = [self reduceKeys:keys values:values rereduce:NO];
+
+            NSData* stored = [db dataForQuery:selectStored, keyJSON];
+            if (stored) {
+                reduced = [self reduceKeys:nil values:$marray(stored, reduced) rereduce:YES];
+            }
+            if (![self storeReduction:reduced ofKey:keyJSON inTable:reduceTable inDatabase:db])
+                return NO;
+        }
+    }
+
+    // Keys which lost rows: reductions can't be undone, so reduce all their rows again.
+    NSString* selectRows = $sprintf(@"SELECT key, value FROM %@ "
+                                     "WHERE collation_key=? AND key=?",
+                                    mapTable);
+    for (NSString* keyJSON in removed) {
+        @autoreleasepool
+        {
+            FMResultSet* r =
+                [db executeQuery:selectRows, collationKey(keyJSON, _collation, NULL), keyJSON];
+            if (!r ||
+                ![self storeReductionOfRows:r ofKey:keyJSON inTable:reduceTable inDatabase:db])
+                return NO;
+        }
+    }
+    return YES;
+}
+
+/** Answers a reduced or grouped query by rereducing the stored reductions of the keys in range.
+    Returns nil if the query can't be answered that way: if there are no stored reductions yet,
+    or the query gives specific keys, or skips or limits the rows to reduce. **/
+- (NSMutableArray*)storedReductionQuery:(const TDQueryOptions*)options
+                                  group:(BOOL)group
+                             groupLevel:(unsigned)groupLevel
+                               database:(FMDatabase*)db
+{
+    if (_viewID <= 0 || options->keys || options->skip > 0 ||
+        options->limit != kDefaultTDQueryOptions.limit)
+        return nil;
+    // (Checking the map table drops the stored reductions if the collation has changed.)
+    NSString* reduceTable = [TD_View reduceTableForViewID:_viewID];
+    if (![self mapTableInDatabase:db] || ![db tableExists:reduceTable]) return nil;
+
+    NSMutableString* sql = [NSMutableString
+        stringWithFormat:@"SELECT key, value FROM %@ WHERE key IS NOT NULL", reduceTable];
+    NSMutableArray* args = $marray();
+    [self appendRangeOfOptions:options toSql:sql args:args];
+    CDTLogInfo(CDTTD_VIEW_CONTEXT, @"Query %@: %@\n\tArguments: %@", _name, sql, args);
+    FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+    if (!r) return nil;
+
+    NSMutableArray* valuesToReduce = [[NSMutableArray alloc] initWithCapacity:100];
+    NSData* lastKeyData = nil;
+    NSMutableArray* rows = $marray();
+    while ([r next]) {
+        @autoreleasepool
+        {
+            NSData* keyData = [r dataForColumnIndex:0];
+            if (group && !groupTogether(keyData, lastKeyData, groupLevel)) {
+                if (lastKeyData) {
+                    // This key starts a new group, so rereduce & record the last one:
+                    [rows addObject:$dict({ @"key", groupKey(lastKeyData, groupLevel) },
+                                          { @"value", [self rereduce:valuesToReduce] })];
+                    [valuesToReduce removeAllObjects];
+                }
+                lastKeyData = [keyData copy];
+            }
+            [valuesToReduce addObject:[r dataForColumnIndex:1] ?: $null];
+        }
+    }
+    [r close];
+
+    if (valuesToReduce.count > 0) {
+        // Finish the last group (or the entire list, if no grouping):
+        id key = group ? groupKey(lastKeyData, groupLevel) : $null;
+        [rows addObject:$dict({ @"key", key }, { @"value", [self rereduce:valuesToReduce] })];
+    }
+    return rows;
+}
+
+// Combines stored reductions; a single one is already the answer.
+- (id)rereduce:(NSMutableArray*)values
+{
+    if (values.count == 1) {
+        id value = values[0];
+        return [value isKindOfClass:[NSData class]] ? (fromJSON(value) ?: $null) : value;
+    }
+    return [self reduceKeys:nil values:values rereduce:YES];
+}
+
 #pragma mark - OTHER:
 
 // This is really just for unit tests & debugging
@@ -635,9 +1184,11 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
     __block NSMutableArray* result;
     [_db.fmdbQueue inDatabase:^(FMDatabase* db) {
 
-        FMResultSet* r = [db executeQuery:@"SELECT sequence, key, value FROM maps "
-                                           "WHERE view_id=? ORDER BY key",
-                                          @(_viewID)];
+        NSString* table = [TD_View mapTableForViewID:_viewID];
+        if (![db tableExists:table]) return;
+        FMResultSet* r = [db executeQuery:$sprintf(@"SELECT sequence, key, value FROM %@ "
+                                                    "ORDER BY collation_key, key",
+                                                   table)];
         if (!r) {
             return;
         }
@@ -664,3 +1215,50 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
 + (id<TDViewCompiler>)compiler { return sCompiler; }
 
 @end
+
+@implementation TDMapPendingDocument
+
+- (void)decode
+{
+    _properties = [TD_Database documentPropertiesFromJSON:_json
+                                          extraProperties:_extra
+                                                    docID:_docID
+                                                    revID:_revID];
+    _json = nil;
+    if (!_properties) {
+        CDTLogWarn(CDTTD_VIEW_CONTEXT, @"Failed to parse JSON of doc %@ rev %@", _docID, _revID);
+        return;
+    }
+
+    if (_conflicts) {
+        // Add a "_conflicts" property if there were conflicting revisions:
+        NSMutableDictionary* mutableProps = [_properties mutableCopy];
+        mutableProps[@"_conflicts"] = _conflicts;
+        _properties = mutableProps;
+    }
+}
+
+- (void)mapWithBlock:(TDMapBlock)mapBlock collation:(TDViewCollation)collation
+{
+    _emitted = [NSMutableArray array];
+    if (!_properties) return;
+
+    // This is the emit() block, which gets called from within the user-defined map() block:
+    NSMutableArray* emitted = _emitted;
+    TDMapEmitBlock emit = ^(id key, id value) {
+        if (!key) key = $null;
+        NSString* keyJSON = toJSONString(key);
+        NSString* valueJSON = toJSONString(value);
+        CDTLogVerbose(CDTTD_VIEW_CONTEXT, @"    emit(%@, %@)", keyJSON, valueJSON);
+        [emitted addObject:keyJSON];
+        [emitted addObject:valueJSON ?: $null];
+        [emitted addObject:collationKey(keyJSON, collation, NULL)];
+    };
+
+    // Call the user-defined map() to emit new key/value pairs from this revision:
+    CDTLogVerbose(CDTTD_VIEW_CONTEXT, @"  call map for sequence=%lld...", _sequence);
+    mapBlock(_properties, emit);
+    _properties = nil;
+}
+
+@end
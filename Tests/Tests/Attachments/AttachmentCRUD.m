@@ -1199,6 +1199,53 @@
 }
 
 
+- (void)testRetrieveAttachmentsOfManyDocumentsViaAllDocuments
+{
+    NSError *error = nil;
+
+    // Documents with zero, one and two attachments, some sharing the same content
+    for (NSUInteger i = 0; i < 9; i++) {
+        CDTMutableDocumentRevision *document = [CDTMutableDocumentRevision revision];
+        document.docId = [NSString stringWithFormat:@"doc%lu", (unsigned long)i];
+        document.body = [@{ @"index" : @(i) } mutableCopy];
+
+        NSMutableDictionary *attachments = [NSMutableDictionary dictionary];
+        for (NSUInteger j = 0; j < i % 3; j++) {
+            NSString *content = [NSString stringWithFormat:@"content %lu", (unsigned long)j];
+            NSData *data = [content dataUsingEncoding:NSUTF8StringEncoding];
+            NSString *name = [NSString stringWithFormat:@"attachment%lu", (unsigned long)j];
+            attachments[name] = [[CDTUnsavedDataAttachment alloc] initWithData:data
+                                                                          name:name
+                                                                          type:@"text/plain"];
+        }
+        document.attachments = attachments;
+
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:document error:&error]);
+    }
+
+    NSArray *allDocuments = [self.datastore getAllDocuments];
+    XCTAssertEqual(allDocuments.count, (NSUInteger)9);
+
+    for (CDTDocumentRevision *revision in allDocuments) {
+        CDTDocumentRevision *single = [self.datastore getDocumentWithId:revision.docId
+                                                                  error:&error];
+        NSUInteger i = [revision.body[@"index"] unsignedIntegerValue];
+        XCTAssertEqual(revision.attachments.count, i % 3);
+        XCTAssertEqualObjects([NSSet setWithArray:revision.attachments.allKeys],
+                              [NSSet setWithArray:single.attachments.allKeys]);
+        for (NSString *name in revision.attachments) {
+            CDTSavedAttachment *attachment = revision.attachments[name];
+            XCTAssertEqualObjects([attachment dataFromAttachmentContent],
+                                  [single.attachments[name] dataFromAttachmentContent]);
+            // Attachments added in a document's first revision have revpos 1
+            XCTAssertEqual(attachment.revpos, (NSInteger)1);
+            XCTAssertEqual(((CDTSavedAttachment *)single.attachments[name]).revpos,
+                           (NSInteger)1);
+        }
+    }
+}
+
+
 #pragma mark - Utilities
 
 - (NSString*)tempFileName
@@ -0,0 +1,111 @@
+//
+//  CDTDatastoreStartupPerformanceTests.m
+//  Tests
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <CloudantSync.h>
+#import <CDTQIndexManager.h>
+#import <CDTQResultSet.h>
+#import "DBQueryUtils.h"
+
+#import <CocoaLumberjack.h>
+
+static const int kDatastoreCount = 20;
+
+SpecBegin(CDTDatastoreStartupPerformance)
+
+    xdescribe(@"Opening datastores at app startup", ^{
+
+        __block NSString *factoryPath;
+
+        beforeAll(^{
+            [DDLog addLogger:[DDTTYLogger sharedInstance]];
+
+            // Create a new CDTDatastoreFactory at a temp path
+
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            // Datastores with a few documents and an index each, closed again when the
+            // factory is released at the end of the pool
+            @autoreleasepool
+            {
+                CDTDatastoreManager *factory =
+                    [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+                for (int i = 0; i < kDatastoreCount; i++) {
+                    CDTDatastore *ds =
+                        [factory datastoreNamed:[NSString stringWithFormat:@"startup%d", i]
+                                          error:nil];
+                    CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                    for (int j = 0; j < 100; j++) {
+                        rev.docId = [NSString stringWithFormat:@"doc-%d", j];
+                        rev.body = @{ @"name" : (j % 2) ? @"mike" : @"fred", @"age" : @(j) };
+                        [ds createDocumentFromRevision:rev error:nil];
+                    }
+                    CDTQIndexManager *im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                    expect([im ensureIndexed:@[ @"name", @"age" ] withName:@"basic"])
+                        .toNot.beNil();
+                }
+            }
+        });
+
+        afterAll(^{
+            // Delete the databases we used
+            NSError *error;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+        });
+
+        it([NSString stringWithFormat:@"opens %d datastores and their indexes", kDatastoreCount], ^{
+            NSDate *start = [NSDate date];
+            CDTDatastoreManager *factory =
+                [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            NSMutableArray *datastores = [NSMutableArray array];
+            for (int i = 0; i < kDatastoreCount; i++) {
+                CDTDatastore *ds =
+                    [factory datastoreNamed:[NSString stringWithFormat:@"startup%d", i] error:nil];
+                expect(ds).toNot.beNil();
+                [datastores addObject:ds];
+            }
+            NSTimeInterval openTime = -[start timeIntervalSinceNow];
+
+            start = [NSDate date];
+            NSMutableArray *managers = [NSMutableArray array];
+            for (CDTDatastore *ds in datastores) {
+                [managers addObject:[CDTQIndexManager lazyManagerUsingDatastore:ds]];
+            }
+            NSTimeInterval lazyManagerTime = -[start timeIntervalSinceNow];
+
+            start = [NSDate date];
+            for (CDTQIndexManager *im in managers) {
+                CDTQResultSet *result = [im find:@{ @"name" : @"mike", @"age" : @{@"$lt" : @10} }];
+                expect(result.documentIds.count).to.equal(5);
+            }
+            NSTimeInterval firstQueryTime = -[start timeIntervalSinceNow];
+
+            start = [NSDate date];
+            for (CDTDatastore *ds in datastores) {
+                expect([CDTQIndexManager managerUsingDatastore:ds error:nil]).toNot.beNil();
+            }
+            NSTimeInterval eagerManagerTime = -[start timeIntervalSinceNow];
+
+            NSLog(@"Opening %d datastores took %.3fs", kDatastoreCount, openTime);
+            NSLog(@"Creating %d lazy index managers took %.3fs", kDatastoreCount,
+                  lazyManagerTime);
+            NSLog(@"First query on each, opening its index database, took %.3fs",
+                  firstQueryTime);
+            NSLog(@"Creating %d index managers opening their database took %.3fs",
+                  kDatastoreCount, eagerManagerTime);
+        });
+
+    });
+
+SpecEnd
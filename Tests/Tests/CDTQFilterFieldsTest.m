@@ -15,6 +15,7 @@
 #import <CDTQIndexCreator.h>
 #import <CDTQResultSet.h>
 #import <CDTQQueryExecutor.h>
+#import <CDTQProjectedDocumentRevision.h>
 
 SpecBegin(CDTQFilterFieldsTest)
 
@@ -215,6 +216,153 @@ SpecBegin(CDTQFilterFieldsTest)
 
         });
 
+        context(@"projecting from indexes", ^{
+
+            beforeEach(^{ im.indexOnlyProjection = YES; });
+
+            it(@"builds revisions from the index rows", ^{
+                NSDictionary *query = @{ @"age" : @34 };
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"name", @"age" ] sort:nil];
+                expect(result.documentIds).to.beSupersetOf(@[ @"mike34", @"mike72", @"fred34" ]);
+                expect(result.documentIds.count).to.equal(3);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        CDTDocumentRevision *stored = [ds getDocumentWithId:rev.docId error:nil];
+                        expect(rev).to.beKindOf([CDTQProjectedDocumentRevision class]);
+                        expect(rev.revId).to.equal(stored.revId);
+                        expect(rev.body).to.equal(
+                            (@{ @"name" : stored.body[@"name"], @"age" : @34 }));
+                        // Sequences aren't in the index, so a real one means a document was loaded
+                        expect(rev.sequence).to.equal(0);
+
+                        CDTMutableDocumentRevision *mutable = [rev mutableCopy];
+                        expect(mutable.body.count).to.equal(3);
+                    }];
+            });
+
+            // The bodies a query returns with indexOnlyProjection off, keyed by document ID
+            NSDictionary *(^loadedBodies)(NSDictionary *, NSArray *) =
+                ^NSDictionary *(NSDictionary *query, NSArray *fields) {
+                    im.indexOnlyProjection = NO;
+                    NSMutableDictionary *bodies = [NSMutableDictionary dictionary];
+                    CDTQResultSet *result =
+                        [im find:query skip:0 limit:NSUIntegerMax fields:fields sort:nil];
+                    [result enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev,
+                                                         NSUInteger i, BOOL *s) {
+                        bodies[rev.docId] = rev.body;
+                    }];
+                    im.indexOnlyProjection = YES;
+                    return bodies;
+                };
+
+            it(@"loads documents with a projected field missing", ^{
+                NSDictionary *query = @{ @"name" : @"fred", @"age" : @12 };
+                NSDictionary *expected = loadedBodies(query, @[ @"pet" ]);
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"pet" ] sort:nil];
+                expect(result.documentIds).to.equal(@[ @"fred12" ]);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal(expected[rev.docId]);
+                        expect(rev.sequence).to.beGreaterThan(0);
+                    }];
+            });
+
+            it(@"loads documents whose projected field is an object or an empty array", ^{
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = @"bill34";
+                rev.body = @{ @"name" : @"bill", @"age" : @34, @"pet" : @{ @"cat" : @"tom" } };
+                [ds createDocumentFromRevision:rev error:nil];
+                rev.docId = @"bill12";
+                rev.body = @{ @"name" : @"bill", @"age" : @12, @"pet" : @[] };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                NSDictionary *query = @{ @"name" : @"bill" };
+                NSDictionary *expected = loadedBodies(query, @[ @"pet" ]);
+                expect(expected[@"bill34"]).to.equal((@{ @"pet" : @{ @"cat" : @"tom" } }));
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"pet" ] sort:nil];
+                expect(result.documentIds.count).to.equal(2);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal(expected[rev.docId]);
+                        expect(rev.sequence).to.beGreaterThan(0);
+                    }];
+            });
+
+            it(@"loads documents whose projected field is an array", ^{
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = @"bill34";
+                rev.body = @{ @"name" : @"bill", @"age" : @34, @"pet" : @[ @"cat", @"dog" ] };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                NSDictionary *query = @{ @"name" : @"bill" };
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"pet" ] sort:nil];
+                expect(result.documentIds).to.equal(@[ @"bill34" ]);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal((@{ @"pet" : @[ @"cat", @"dog" ] }));
+                        expect(rev.sequence).to.beGreaterThan(0);
+                    }];
+            });
+
+            it(@"loads documents whose array field has a single value", ^{
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = @"bill34";
+                rev.body = @{ @"name" : @"bill", @"age" : @34, @"pet" : @[ @"cat" ] };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                NSDictionary *query = @{ @"name" : @"bill" };
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"pet" ] sort:nil];
+                expect(result.documentIds).to.equal(@[ @"bill34" ]);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal((@{ @"pet" : @[ @"cat" ] }));
+                        expect(rev.sequence).to.beGreaterThan(0);
+                    }];
+            });
+
+            it(@"projects strings which look like objects from the index", ^{
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = @"bill34";
+                rev.body = @{ @"name" : @"bill", @"age" : @34, @"pet" : @"{cat}" };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                NSDictionary *query = @{ @"name" : @"bill" };
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"pet" ] sort:nil];
+                expect(result.documentIds).to.equal(@[ @"bill34" ]);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal((@{ @"pet" : @"{cat}" }));
+                        expect(rev.sequence).to.equal(0);
+                    }];
+            });
+
+            it(@"loads documents when no index has all the fields", ^{
+                NSDictionary *query = @{ @"name" : @"mike", @"age" : @12 };
+                CDTQResultSet *result =
+                    [im find:query skip:0 limit:NSUIntegerMax fields:@[ @"age", @"pet" ] sort:nil];
+                expect(result.documentIds).to.equal(@[ @"mike12" ]);
+
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal((@{ @"age" : @12, @"pet" : @"cat" }));
+                        expect(rev.sequence).to.beGreaterThan(0);
+                    }];
+            });
+
+        });
+
     });
 
 SpecEnd
\ No newline at end of file
@@ -12,6 +12,9 @@
 #import <CDTQIndexCreator.h>
 #import <CDTQResultSet.h>
 #import <CDTQQueryExecutor.h>
+#import <CDTQQuerySqlTranslator.h>
+#import <CDTQQueryValidator.h>
+#import <FMDB/FMDB.h>
 #import "Matchers/CDTQContainsInAnyOrderMatcher.h"
 
 SpecBegin(CDTQIndexCreator)
@@ -471,7 +474,7 @@ SpecBegin(CDTQIndexCreator)
                                                                  fieldNames:fieldNames];
                 expect(parts.sqlWithPlaceholders)
                     .to.equal(@"CREATE TABLE _t_cloudant_sync_query_index_anIndex"
-                               " ( \"_id\" NONE, \"name\" NONE );");
+                               " ( \"_id\" NONE, \"name\" NONE, \"_projectable\" NONE );");
                 expect(parts.placeholderValues).to.equal(@[]);
             });
 
@@ -482,7 +485,8 @@ SpecBegin(CDTQIndexCreator)
                                                                  fieldNames:fieldNames];
                 expect(parts.sqlWithPlaceholders)
                     .to.equal(@"CREATE TABLE _t_cloudant_sync_query_index_anIndex"
-                               " ( \"_id\" NONE, \"name\" NONE, \"age\" NONE, \"pet\" NONE );");
+                               " ( \"_id\" NONE, \"name\" NONE, \"age\" NONE, \"pet\" NONE, "
+                               "\"_projectable\" NONE );");
                 expect(parts.placeholderValues).to.equal(@[]);
             });
 
@@ -504,7 +508,7 @@ SpecBegin(CDTQIndexCreator)
                 expect(parts.sqlWithPlaceholders)
                     .to.equal(@"CREATE INDEX _t_cloudant_sync_query_index_anIndex_index "
                                "ON _t_cloudant_sync_query_index_anIndex"
-                               " ( \"_id\", \"name\" );");
+                               " ( \"name\", \"_id\" );");
                 expect(parts.placeholderValues).to.equal(@[]);
             });
 
@@ -516,9 +520,284 @@ SpecBegin(CDTQIndexCreator)
                 expect(parts.sqlWithPlaceholders)
                     .to.equal(@"CREATE INDEX _t_cloudant_sync_query_index_anIndex_index "
                                "ON _t_cloudant_sync_query_index_anIndex"
-                               " ( \"_id\", \"name\", \"age\", \"pet\" );");
+                               " ( \"name\", \"age\", \"pet\", \"_id\" );");
                 expect(parts.placeholderValues).to.equal(@[]);
             });
+
+            it(@"puts _id and _rev after the indexed fields", ^{
+                NSArray *fieldNames = @[ @"_id", @"_rev", @"name", @"age" ];
+                CDTQSqlParts *parts =
+                    [CDTQIndexCreator createIndexIndexStatementForIndexName:@"anIndex"
+                                                                 fieldNames:fieldNames];
+                expect(parts.sqlWithPlaceholders)
+                    .to.equal(@"CREATE INDEX _t_cloudant_sync_query_index_anIndex_index "
+                               "ON _t_cloudant_sync_query_index_anIndex"
+                               " ( \"name\", \"age\", \"_id\", \"_rev\" );");
+            });
+
+            it(@"can create the _id index statement", ^{
+                CDTQSqlParts *parts = [CDTQIndexCreator createIdIndexStatementForIndexName:@"anIndex"];
+                expect(parts.sqlWithPlaceholders)
+                    .to.equal(@"CREATE INDEX _t_cloudant_sync_query_index_anIndex_id_index "
+                               "ON _t_cloudant_sync_query_index_anIndex ( \"_id\" );");
+                expect(parts.placeholderValues).to.equal(@[]);
+            });
+        });
+
+        describe(@"when planning queries", ^{
+
+            __block CDTDatastore *ds;
+            __block CDTQIndexManager *im;
+
+            // Returns the EXPLAIN QUERY PLAN details of the statement, joined by newlines.
+            NSString * (^queryPlan)(CDTQSqlParts *) = ^NSString *(CDTQSqlParts *parts) {
+                NSMutableArray *details = [NSMutableArray array];
+                [im.database inDatabase:^(FMDatabase *db) {
+                    NSString *sql = [@"EXPLAIN QUERY PLAN "
+                        stringByAppendingString:parts.sqlWithPlaceholders];
+                    FMResultSet *rs =
+                        [db executeQuery:sql withArgumentsInArray:parts.placeholderValues];
+                    while ([rs next]) {
+                        [details addObject:[rs stringForColumn:@"detail"]];
+                    }
+                    [rs close];
+                }];
+                return [details componentsJoinedByString:@"\n"];
+            };
+
+            beforeEach(^{
+                ds = [factory datastoreNamed:@"test" error:nil];
+                expect(ds).toNot.beNil();
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                expect([im ensureIndexed:@[ @"age", @"name" ] withName:@"basic"]).to.equal(@"basic");
+            });
+
+            it(@"seeks on the leading field for a range query", ^{
+                NSArray *clause = @[ @{ @"age" : @{ @"$gt" : @30 } } ];
+                CDTQSqlParts *parts =
+                    [CDTQQuerySqlTranslator selectStatementForAndClause:clause usingIndex:@"basic"];
+                NSString *plan = queryPlan(parts);
+                expect(plan).to.contain(@"SEARCH");
+                expect(plan).to.contain(@"_t_cloudant_sync_query_index_basic_index");
+            });
+
+            it(@"reads rows in index order when sorting", ^{
+                NSMutableSet *docIds = [NSMutableSet set];
+                for (int i = 0; i < 501; i++) {
+                    [docIds addObject:[NSString stringWithFormat:@"doc-%d", i]];
+                }
+                CDTQSqlParts *parts =
+                    [CDTQQueryExecutor sqlToSortIds:docIds
+                                         usingOrder:@[ @{ @"age" : @"asc" } ]
+                                            indexes:[im listIndexes]];
+                NSString *plan = queryPlan(parts);
+                expect(plan).to.contain(@"_t_cloudant_sync_query_index_basic_index");
+                expect(plan).toNot.contain(@"TEMP B-TREE FOR ORDER BY");
+            });
+
+            it(@"seeks on _id when removing a document's rows", ^{
+                NSString *sql =
+                    @"DELETE FROM _t_cloudant_sync_query_index_basic WHERE _id = ?;";
+                NSString *plan = queryPlan([CDTQSqlParts partsForSql:sql parameters:@[ @"a" ]]);
+                expect(plan).to.contain(@"SEARCH");
+                expect(plan).to.contain(@"_t_cloudant_sync_query_index_basic_id_index");
+            });
+
+            it(@"migrates indexes led by _id", ^{
+                // Put back the index created by version 2 of the schema
+                [im.database inDatabase:^(FMDatabase *db) {
+                    [db executeUpdate:@"DROP INDEX _t_cloudant_sync_query_index_basic_index;"];
+                    [db executeUpdate:@"DROP INDEX _t_cloudant_sync_query_index_basic_id_index;"];
+                    [db executeUpdate:@"CREATE INDEX _t_cloudant_sync_query_index_basic_index "
+                                      @"ON _t_cloudant_sync_query_index_basic "
+                                      @"( \"_id\", \"_rev\", \"age\", \"name\" );"];
+                    [db executeUpdate:@"pragma user_version = 2;"];
+                }];
+                [im.database close];
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+
+                __block NSArray *columns;
+                [im.database inDatabase:^(FMDatabase *db) {
+                    NSMutableArray *names = [NSMutableArray array];
+                    FMResultSet *rs = [db executeQuery:
+                        @"PRAGMA index_info(_t_cloudant_sync_query_index_basic_index);"];
+                    while ([rs next]) {
+                        [names addObject:[rs stringForColumn:@"name"]];
+                    }
+                    [rs close];
+                    columns = names;
+                }];
+                expect(columns).to.equal(@[ @"age", @"name", @"_id", @"_rev" ]);
+
+                NSArray *clause = @[ @{ @"age" : @{ @"$lt" : @30 } } ];
+                NSString *plan = queryPlan(
+                    [CDTQQuerySqlTranslator selectStatementForAndClause:clause usingIndex:@"basic"]);
+                expect(plan).to.contain(@"SEARCH");
+            });
+
+            it(@"migrates indexes without the projectable column", ^{
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = @"mike12";
+                rev.body = @{ @"name" : @"mike", @"age" : @12 };
+                [ds createDocumentFromRevision:rev error:nil];
+                expect([im updateAllIndexes]).to.beTruthy();
+
+                // Put back the table created by version 3 of the schema
+                [im.database inDatabase:^(FMDatabase *db) {
+                    [db executeUpdate:@"CREATE TABLE old_basic AS "
+                                      @"SELECT \"_id\", \"_rev\", \"age\", \"name\" "
+                                      @"FROM _t_cloudant_sync_query_index_basic;"];
+                    [db executeUpdate:@"DROP TABLE _t_cloudant_sync_query_index_basic;"];
+                    [db executeUpdate:@"ALTER TABLE old_basic "
+                                      @"RENAME TO _t_cloudant_sync_query_index_basic;"];
+                    [db executeUpdate:@"pragma user_version = 3;"];
+                }];
+                [im.database close];
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                [im.database inDatabase:^(FMDatabase *db) {
+                    expect([db columnExists:@"_projectable"
+                            inTableWithName:@"_t_cloudant_sync_query_index_basic"])
+                        .to.beTruthy();
+                }];
+
+                // Rows indexed before the column was added aren't marked, so the documents
+                // are loaded:
+                im.indexOnlyProjection = YES;
+                CDTQResultSet *result = [im find:@{ @"age" : @{ @"$lt" : @30 } }
+                                            skip:0
+                                           limit:NSUIntegerMax
+                                          fields:@[ @"name" ]
+                                            sort:nil];
+                expect(result.documentIds).to.equal(@[ @"mike12" ]);
+                [result
+                    enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger i, BOOL *s) {
+                        expect(rev.body).to.equal(@{ @"name" : @"mike" });
+                        expect(rev.sequence).to.beGreaterThan(0);
+                    }];
+            });
+        });
+
+        describe(@"when using partial indexes", ^{
+
+            __block CDTDatastore *ds;
+            __block CDTQIndexManager *im;
+
+            NSArray * (^indexedIds)(void) = ^NSArray *(void) {
+                NSMutableArray *ids = [NSMutableArray array];
+                [im.database inDatabase:^(FMDatabase *db) {
+                    FMResultSet *rs = [db executeQuery:@"SELECT _id FROM "
+                                                       @"_t_cloudant_sync_query_index_people "
+                                                       @"ORDER BY _id;"];
+                    while ([rs next]) {
+                        [ids addObject:[rs stringForColumn:@"_id"]];
+                    }
+                    [rs close];
+                }];
+                return ids;
+            };
+
+            beforeEach(^{
+                ds = [factory datastoreNamed:@"test" error:nil];
+                expect(ds).toNot.beNil();
+
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+
+                rev.docId = @"mike";
+                rev.body = @{ @"type" : @"person", @"name" : @"mike" };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                rev.docId = @"fred";
+                rev.body = @{ @"type" : @"person", @"name" : @"fred" };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                rev.docId = @"rover";
+                rev.body = @{ @"type" : @"dog", @"name" : @"mike" };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                expect([im ensureIndexed:@[ @"name" ]
+                                withName:@"people"
+                                    type:@"json"
+                                settings:@{
+                                    @"partial_filter_selector" : @{ @"type" : @"person" }
+                                }]).to.equal(@"people");
+            });
+
+            it(@"indexes only matching documents", ^{
+                expect(indexedIds()).to.equal(@[ @"fred", @"mike" ]);
+            });
+
+            it(@"stores the filter with the index", ^{
+                NSDictionary *index = [im listIndexes][@"people"];
+                expect(index[@"settings"])
+                    .to.equal(@"{\"partial_filter_selector\":{\"type\":\"person\"}}");
+            });
+
+            it(@"adds and removes documents as they start and stop matching", ^{
+                CDTMutableDocumentRevision *rev =
+                    [[ds getDocumentWithId:@"rover" error:nil] mutableCopy];
+                rev.body = @{ @"type" : @"person", @"name" : @"rover" };
+                [ds updateDocumentFromRevision:rev error:nil];
+
+                rev = [[ds getDocumentWithId:@"fred" error:nil] mutableCopy];
+                rev.body = @{ @"type" : @"cat", @"name" : @"fred" };
+                [ds updateDocumentFromRevision:rev error:nil];
+
+                expect([im updateAllIndexes]).to.beTruthy();
+                expect(indexedIds()).to.equal(@[ @"mike", @"rover" ]);
+            });
+
+            it(@"is only used by queries implying the filter", ^{
+                NSDictionary *indexes = [im listIndexes];
+
+                NSDictionary *selector = [CDTQQueryValidator
+                    normaliseAndValidateQuery:@{ @"type" : @"person", @"name" : @"mike" }];
+                expect([CDTQQueryExecutor indexes:indexes usableForSelector:selector])
+                    .to.haveCountOf(1);
+
+                selector = [CDTQQueryValidator normaliseAndValidateQuery:@{
+                    @"$or" : @[
+                        @{ @"type" : @"person", @"name" : @"mike" },
+                        @{ @"type" : @"person", @"name" : @"fred" }
+                    ]
+                }];
+                expect([CDTQQueryExecutor indexes:indexes usableForSelector:selector])
+                    .to.haveCountOf(1);
+
+                selector = [CDTQQueryValidator normaliseAndValidateQuery:@{ @"name" : @"mike" }];
+                expect([CDTQQueryExecutor indexes:indexes usableForSelector:selector])
+                    .to.haveCountOf(0);
+
+                selector = [CDTQQueryValidator normaliseAndValidateQuery:@{
+                    @"$or" : @[ @{ @"type" : @"person" }, @{ @"name" : @"mike" } ]
+                }];
+                expect([CDTQQueryExecutor indexes:indexes usableForSelector:selector])
+                    .to.haveCountOf(0);
+            });
+
+            it(@"answers queries correctly with and without the index", ^{
+                CDTQResultSet *result = [im find:@{ @"type" : @"person", @"name" : @"mike" }];
+                expect(result.documentIds).to.equal(@[ @"mike" ]);
+
+                // Can't use the partial index, so every document is matched
+                result = [im find:@{ @"name" : @"mike" }];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"mike", @"rover" ]);
+            });
+
+            it(@"rejects a different filter for an existing index", ^{
+                expect([im ensureIndexed:@[ @"name" ]
+                                withName:@"people"
+                                    type:@"json"
+                                settings:@{
+                                    @"partial_filter_selector" : @{ @"type" : @"dog" }
+                                }]).to.beNil();
+            });
         });
     });
 
@@ -13,6 +13,8 @@
 #import <CDTQResultSet.h>
 #import <CDTQQueryExecutor.h>
 #import "DBQueryUtils.h"
+#import "TD_Database.h"
+#import <FMDB/FMDB.h>
 
 SpecBegin(CDTQIndexManager)
 
@@ -257,4 +259,339 @@ SpecBegin(CDTQIndexManager)
         
     });
 
+    describe(@"when opening the index database lazily", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+
+        beforeEach(^{
+            // Create a new CDTDatastoreFactory at a temp path
+
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            NSError *error;
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:&error];
+
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+        });
+
+        afterEach(^{
+            // Delete the databases we used
+
+            factory = nil;
+            NSError *error;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+        });
+
+        it(@"doesn't create the index database until it's used", ^{
+            NSString *path = [[ds extensionDataFolder:@"com.cloudant.sync.query"]
+                stringByAppendingPathComponent:@"indexes.sqlite"];
+
+            CDTQIndexManager *im = [CDTQIndexManager lazyManagerUsingDatastore:ds];
+            expect(im).toNot.beNil();
+            expect([[NSFileManager defaultManager] fileExistsAtPath:path]).to.beFalsy();
+
+            expect([im ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+            expect([[NSFileManager defaultManager] fileExistsAtPath:path]).to.beTruthy();
+            expect([im listIndexes][@"basic"]).toNot.beNil();
+        });
+
+        it(@"sees indexes made by a manager which opened the database eagerly", ^{
+            CDTQIndexManager *eager = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect([eager ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+
+            CDTQIndexManager *im = [CDTQIndexManager lazyManagerUsingDatastore:ds];
+            expect([im listIndexes][@"basic"]).toNot.beNil();
+        });
+    });
+
+    describe(@"when colocating indexes with the datastore", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+
+        beforeEach(^{
+            // Create a new CDTDatastoreFactory at a temp path
+
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            NSError *error;
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:&error];
+
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSArray *docs = @[ @[ @"mike", @"cat" ], @[ @"mike", @"dog" ], @[ @"fred", @"cat" ] ];
+            for (NSArray *doc in docs) {
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.body = @{ @"name" : doc[0], @"pet" : doc[1] };
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+        });
+
+        afterEach(^{
+            // Delete the databases we used
+
+            factory = nil;
+            NSError *error;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+        });
+
+        it(@"keeps indexes in the datastore's database", ^{
+            NSString *path = [[ds extensionDataFolder:@"com.cloudant.sync.query"]
+                stringByAppendingPathComponent:@"indexes.sqlite"];
+            __block int datastoreVersion;
+            [ds.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+                datastoreVersion = [db intForQuery:@"pragma user_version;"];
+            }];
+
+            CDTQIndexManager *im = [CDTQIndexManager managerColocatedWithDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect(im.isColocated).to.beTruthy();
+            expect(im.database).to.beIdenticalTo(ds.database.fmdbQueue);
+            expect([im ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+            expect([im find:@{ @"name" : @"mike" }].documentIds.count).to.equal(2);
+
+            expect([[NSFileManager defaultManager] fileExistsAtPath:path]).to.beFalsy();
+            [ds.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+                expect([db intForQuery:@"pragma user_version;"]).to.equal(datastoreVersion);
+            }];
+        });
+
+        it(@"keeps its indexes apart from those in the index database", ^{
+            CDTQIndexManager *separate = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect([separate ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+
+            CDTQIndexManager *im = [CDTQIndexManager managerColocatedWithDatastore:ds error:nil];
+            expect([im listIndexes]).to.haveCountOf(0);
+        });
+
+        it(@"sees indexes made by another colocated manager", ^{
+            CDTQIndexManager *first = [CDTQIndexManager managerColocatedWithDatastore:ds error:nil];
+            expect([first ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+
+            CDTQIndexManager *im = [CDTQIndexManager managerColocatedWithDatastore:ds error:nil];
+            expect([im listIndexes][@"basic"]).toNot.beNil();
+            expect([im find:@{ @"name" : @"fred" }].documentIds.count).to.equal(1);
+        });
+
+        it(@"finds documents when there are no indexes", ^{
+            // Reads every document ID from the datastore, on the queue the index uses
+            CDTQIndexManager *im = [CDTQIndexManager managerColocatedWithDatastore:ds error:nil];
+            expect([im find:@{ @"pet" : @"cat" }].documentIds.count).to.equal(2);
+        });
+
+        it(@"joins index rows with documents in one statement", ^{
+            CDTQIndexManager *im = [CDTQIndexManager managerColocatedWithDatastore:ds error:nil];
+            expect([im ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+            expect([im updateAllIndexes]).to.beTruthy();
+
+            NSString *sql = [NSString
+                stringWithFormat:@"SELECT COUNT(*) FROM %@ AS i, docs, revs "
+                                 @"WHERE i.name = ? AND docs.docid = i._id "
+                                 @"AND revs.doc_id = docs.doc_id AND revs.revid = i._rev;",
+                                 [CDTQIndexManager tableNameForIndex:@"basic"]];
+            [im.database inDatabase:^(FMDatabase *db) {
+                expect([db intForQuery:sql, @"mike"]).to.equal(2);
+            }];
+        });
+    });
+
+    describe(@"when indexing in the background", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        // Number of documents a query allowing stale results finds for `name`.
+        NSUInteger (^staleCount)(NSString *) = ^NSUInteger(NSString *name) {
+            CDTQResultSet *result =
+                [im find:@{ @"name" : name } skip:0 limit:0 fields:nil sort:nil allowStale:YES];
+            return result.documentIds.count;
+        };
+
+        void (^createDocuments)(NSString *, int) = ^(NSString *name, int count) {
+            for (int i = 0; i < count; i++) {
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.body = @{ @"name" : name, @"i" : @(i) };
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+        };
+
+        beforeEach(^{
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+        });
+
+        afterEach(^{
+            im.backgroundIndexingEnabled = NO;
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"doesn't update indexes for stale queries by default", ^{
+            createDocuments(@"mike", 3);
+            expect(staleCount(@"mike")).to.equal(0);
+            expect([im find:@{ @"name" : @"mike" }].documentIds).to.haveCountOf(3);
+            expect(staleCount(@"mike")).to.equal(3);
+        });
+
+        it(@"catches up with existing changes when enabled", ^{
+            createDocuments(@"mike", 3);
+            im.backgroundIndexingEnabled = YES;
+
+            NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:10];
+            while (staleCount(@"mike") < 3 && [timeout timeIntervalSinceNow] > 0) {
+                [NSThread sleepForTimeInterval:0.05];
+            }
+            expect(staleCount(@"mike")).to.equal(3);
+        });
+
+        it(@"updates indexes as the datastore changes", ^{
+            im.backgroundIndexingEnabled = YES;
+            createDocuments(@"fred", 250);
+
+            NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:10];
+            while (staleCount(@"fred") < 250 && [timeout timeIntervalSinceNow] > 0) {
+                [NSThread sleepForTimeInterval:0.05];
+            }
+            expect(staleCount(@"fred")).to.equal(250);
+        });
+
+        it(@"catches up when enabled again after being disabled", ^{
+            im.backgroundIndexingEnabled = YES;
+            im.backgroundIndexingEnabled = NO;
+            createDocuments(@"mike", 3);
+            im.backgroundIndexingEnabled = YES;
+
+            NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:10];
+            while (staleCount(@"mike") < 3 && [timeout timeIntervalSinceNow] > 0) {
+                [NSThread sleepForTimeInterval:0.05];
+            }
+            expect(staleCount(@"mike")).to.equal(3);
+        });
+
+        it(@"waits for up to date indexes unless stale results are allowed", ^{
+            im.backgroundIndexingEnabled = YES;
+            createDocuments(@"john", 100);
+            expect([im find:@{ @"name" : @"john" }].documentIds).to.haveCountOf(100);
+        });
+    });
+
+    describe(@"when caching query results", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        void (^createDocuments)(NSString *, int) = ^(NSString *name, int count) {
+            for (int i = 0; i < count; i++) {
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.body = @{ @"name" : name, @"i" : @(i) };
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+        };
+
+        beforeEach(^{
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name" ] withName:@"basic"]).to.equal(@"basic");
+            createDocuments(@"mike", 3);
+            createDocuments(@"fred", 2);
+            im.queryCacheLimit = 100;
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"is disabled by default", ^{
+            CDTQIndexManager *other = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(other.queryCacheLimit).to.equal(0);
+            [other find:@{ @"name" : @"mike" }];
+            [other find:@{ @"name" : @"mike" }];
+            expect(other.queryCacheHits).to.equal(0);
+            expect(other.queryCacheMisses).to.equal(0);
+        });
+
+        it(@"answers a repeated query from the cache", ^{
+            CDTQResultSet *first = [im find:@{ @"name" : @"mike" }];
+            CDTQResultSet *second = [im find:@{ @"name" : @"mike" }];
+            expect(second).toNot.beIdenticalTo(first);  // callers don't share result sets
+            expect(second.documentIds).to.haveCountOf(3);
+            expect(second.documentIds).to.equal(first.documentIds);
+            expect(im.queryCacheMisses).to.equal(1);
+            expect(im.queryCacheHits).to.equal(1);
+        });
+
+        it(@"keys results by the normalised query and options", ^{
+            [im find:@{ @"name" : @"mike" }];
+            [im find:@{ @"name" : @{ @"$eq" : @"mike" } }];
+            expect(im.queryCacheHits).to.equal(1);
+            [im find:@{ @"name" : @"mike" } skip:1 limit:0 fields:nil sort:nil];
+            [im find:@{ @"name" : @"fred" }];
+            expect(im.queryCacheHits).to.equal(1);
+            expect(im.queryCacheMisses).to.equal(3);
+        });
+
+        it(@"misses once the datastore changes", ^{
+            [im find:@{ @"name" : @"mike" }];
+            createDocuments(@"mike", 1);
+            expect([im find:@{ @"name" : @"mike" }].documentIds).to.haveCountOf(4);
+            expect(im.queryCacheHits).to.equal(0);
+        });
+
+        it(@"misses once an index changes", ^{
+            [im find:@{ @"name" : @"mike" }];
+            expect([im ensureIndexed:@[ @"i" ] withName:@"other"]).to.equal(@"other");
+            [im find:@{ @"name" : @"mike" }];
+            expect(im.queryCacheHits).to.equal(0);
+        });
+
+        it(@"doesn't answer up to date queries with stale results", ^{
+            [im find:@{ @"name" : @"mike" } skip:0 limit:0 fields:nil sort:nil allowStale:YES];
+            expect([im find:@{ @"name" : @"mike" }].documentIds).to.haveCountOf(3);
+            expect(im.queryCacheHits).to.equal(0);
+            [im find:@{ @"name" : @"mike" } skip:0 limit:0 fields:nil sort:nil allowStale:YES];
+            expect(im.queryCacheHits).to.equal(1);
+        });
+
+        it(@"evicts the least recently used results", ^{
+            im.queryCacheLimit = 5;
+            [im find:@{ @"name" : @"mike" }];  // 3 IDs
+            [im find:@{ @"name" : @"fred" }];  // 2 IDs
+            [im find:@{ @"name" : @"mike" }];
+            expect(im.queryCacheHits).to.equal(1);
+            [im find:@{ @"name" : @"john" }];  // no IDs, fits without eviction
+            [im find:@{ @"name" : @"fred" } skip:0 limit:1 fields:nil sort:nil];  // evicts fred
+            [im find:@{ @"name" : @"mike" }];
+            expect(im.queryCacheHits).to.equal(2);
+            [im find:@{ @"name" : @"fred" }];
+            expect(im.queryCacheHits).to.equal(2);
+        });
+    });
+
 SpecEnd
@@ -90,6 +90,32 @@ describe(@"When creating an instance of index", ^{
         expect(index.indexSettings).to.beNil();
     });
     
+    it(@"constructs a json index instance with a partial filter selector", ^{
+        NSDictionary *filter = @{ @"type" : @"person" };
+        CDTQIndex *index = [CDTQIndex index:indexName
+                                 withFields:fieldNames
+                                     ofType:@"json"
+                               withSettings:@{ @"partial_filter_selector" : filter,
+                                               @"tokenize" : @"porter" }];
+
+        expect(index.indexType).to.equal(@"json");
+        expect(index.indexSettings).to.equal(@{ @"partial_filter_selector" : filter });
+        expect([CDTQIndex partialFilterSelectorFromSettings:[index settingsAsJSON]])
+            .to.equal(@{ @"$and" : @[ @{ @"type" : @{ @"$eq" : @"person" } } ] });
+    });
+
+    it(@"returns nil when the partial filter selector is invalid", ^{
+        expect([CDTQIndex index:indexName
+                     withFields:fieldNames
+                         ofType:@"json"
+                   withSettings:@{ @"partial_filter_selector" : @"person" }]).to.beNil();
+        NSDictionary *textSearch = @{ @"$text" : @{ @"$search" : @"person" } };
+        expect([CDTQIndex index:indexName
+                     withFields:fieldNames
+                         ofType:@"json"
+                   withSettings:@{ @"partial_filter_selector" : textSearch }]).to.beNil();
+    });
+
     it(@"constructs index instance and sets index settings when appropriate", ^{
         // text indexes support the tokenize setting.
         CDTQIndex *index = [CDTQIndex index:indexName
@@ -102,6 +128,31 @@ describe(@"When creating an instance of index", ^{
         expect(index.indexType).to.equal(@"text");
         expect(index.indexSettings[ @"tokenize" ]).to.equal(@"porter");
     });
+
+    it(@"constructs a text index instance with fts and prefix settings", ^{
+        CDTQIndex *index = [CDTQIndex index:indexName
+                                 withFields:fieldNames
+                                     ofType:@"text"
+                               withSettings:@{ @"fts" : @"fts5", @"prefix" : @[ @2, @3 ] }];
+
+        expect(index.indexSettings).to.equal(@{ @"fts" : @"fts5", @"prefix" : @[ @2, @3 ] });
+        expect([CDTQIndex isFTS5TextIndexWithSettings:[index settingsAsJSON]]).to.beTruthy();
+    });
+
+    it(@"returns nil when the fts or prefix settings are invalid", ^{
+        expect([CDTQIndex index:indexName
+                     withFields:fieldNames
+                         ofType:@"text"
+                   withSettings:@{ @"fts" : @"fts3" }]).to.beNil();
+        expect([CDTQIndex index:indexName
+                     withFields:fieldNames
+                         ofType:@"text"
+                   withSettings:@{ @"prefix" : @"2" }]).to.beNil();
+        expect([CDTQIndex index:indexName
+                     withFields:fieldNames
+                         ofType:@"text"
+                   withSettings:@{ @"prefix" : @[ @0 ] }]).to.beNil();
+    });
     
 });
 
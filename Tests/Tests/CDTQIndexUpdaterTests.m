@@ -12,6 +12,7 @@
 #import <CDTQIndexCreator.h>
 #import <CDTQResultSet.h>
 #import <CDTQQueryExecutor.h>
+#import <FMDB/FMDB.h>
 
 SpecBegin(CDTQIndexUpdater)
 
@@ -416,6 +417,245 @@ SpecBegin(CDTQIndexUpdater)
             });
 
         });
+
+        describe(@"when updating changed documents", ^{
+
+            __block CDTQIndexManager *im;
+
+            // Returns "rowid|_rev|pet" for each of the document's rows, ordered by pet.
+            NSArray * (^indexRows)(NSString *) = ^NSArray *(NSString *docId) {
+                NSMutableArray *rows = [NSMutableArray array];
+                [im.database inDatabase:^(FMDatabase *db) {
+                    FMResultSet *rs = [db executeQuery:@"SELECT rowid, _rev, pet FROM "
+                                                       @"_t_cloudant_sync_query_index_basic "
+                                                       @"WHERE _id = ? ORDER BY pet;",
+                                                       docId];
+                    while ([rs next]) {
+                        [rows addObject:[NSString
+                                            stringWithFormat:@"%lld|%@|%@",
+                                                             [rs longLongIntForColumn:@"rowid"],
+                                                             [rs stringForColumn:@"_rev"],
+                                                             [rs stringForColumn:@"pet"]]];
+                    }
+                    [rs close];
+                }];
+                return rows;
+            };
+
+            beforeEach(^{
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = @"mike";
+                rev.body = @{ @"name" : @"mike", @"pet" : @[ @"cat", @"dog" ], @"age" : @12 };
+                [ds createDocumentFromRevision:rev error:nil];
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                expect([im ensureIndexed:@[ @"name", @"pet" ] withName:@"basic"]).toNot.beNil();
+            });
+
+            it(@"only updates _rev when indexed fields are unchanged", ^{
+                NSArray *before = indexRows(@"mike");
+                expect(before).to.haveCountOf(2);
+
+                CDTMutableDocumentRevision *rev =
+                    [[ds getDocumentWithId:@"mike" error:nil] mutableCopy];
+                rev.body = @{ @"name" : @"mike", @"pet" : @[ @"cat", @"dog" ], @"age" : @13 };
+                CDTDocumentRevision *saved = [ds updateDocumentFromRevision:rev error:nil];
+                expect([im updateAllIndexes]).to.beTruthy();
+
+                NSArray *after = indexRows(@"mike");
+                expect(after).to.haveCountOf(2);
+                for (NSUInteger i = 0; i < 2; i++) {
+                    NSArray *beforeParts = [before[i] componentsSeparatedByString:@"|"];
+                    NSArray *afterParts = [after[i] componentsSeparatedByString:@"|"];
+                    expect(afterParts[0]).to.equal(beforeParts[0]);  // same row
+                    expect(afterParts[1]).to.equal(saved.revId);
+                    expect(afterParts[2]).to.equal(beforeParts[2]);
+                }
+            });
+
+            it(@"only writes the rows which changed", ^{
+                NSArray *before = indexRows(@"mike");
+
+                CDTMutableDocumentRevision *rev =
+                    [[ds getDocumentWithId:@"mike" error:nil] mutableCopy];
+                rev.body = @{ @"name" : @"mike", @"pet" : @[ @"cat", @"fish" ] };
+                [ds updateDocumentFromRevision:rev error:nil];
+                expect([im updateAllIndexes]).to.beTruthy();
+
+                NSArray *after = indexRows(@"mike");
+                expect(after).to.haveCountOf(2);
+                expect([after[0] componentsSeparatedByString:@"|"][0])
+                    .to.equal([before[0] componentsSeparatedByString:@"|"][0]);  // cat kept
+                expect([after[1] hasSuffix:@"|fish"]).to.beTruthy();
+            });
+
+            it(@"indexes many documents in one batch", ^{
+                for (int i = 0; i < 600; i++) {
+                    CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                    rev.docId = [NSString stringWithFormat:@"doc-%d", i];
+                    rev.body = @{ @"name" : rev.docId, @"pet" : @[ @"cat", @"dog", @"fish" ] };
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+                expect([im updateAllIndexes]).to.beTruthy();
+
+                __block int count = 0;
+                [im.database inDatabase:^(FMDatabase *db) {
+                    count = [db intForQuery:@"SELECT COUNT(*) FROM "
+                                            @"_t_cloudant_sync_query_index_basic;"];
+                }];
+                expect(count).to.equal(600 * 3 + 2);
+            });
+
+            it(@"removes the rows of deleted documents", ^{
+                [ds deleteDocumentWithId:@"mike" error:nil];
+                expect([im updateAllIndexes]).to.beTruthy();
+                expect(indexRows(@"mike")).to.haveCountOf(0);
+            });
+        });
+
+        describe(@"when building a new index", ^{
+
+            __block CDTQIndexManager *im;
+
+            // Returns "_id|_rev|name|pet" for every row of the index, in order.
+            NSArray * (^allRows)(void) = ^NSArray *(void) {
+                NSMutableArray *rows = [NSMutableArray array];
+                [im.database inDatabase:^(FMDatabase *db) {
+                    FMResultSet *rs = [db executeQuery:@"SELECT _id, _rev, name, pet FROM "
+                                                       @"_t_cloudant_sync_query_index_basic "
+                                                       @"ORDER BY _id, pet;"];
+                    while ([rs next]) {
+                        [rows addObject:[NSString stringWithFormat:@"%@|%@|%@|%@",
+                                                                   [rs stringForColumn:@"_id"],
+                                                                   [rs stringForColumn:@"_rev"],
+                                                                   [rs stringForColumn:@"name"],
+                                                                   [rs stringForColumn:@"pet"]]];
+                    }
+                    [rs close];
+                }];
+                return rows;
+            };
+
+            void (^resetIndex)(void) = ^{
+                [im.database inDatabase:^(FMDatabase *db) {
+                    [db executeUpdate:@"DELETE FROM _t_cloudant_sync_query_index_basic;"];
+                    [db executeUpdate:@"UPDATE _t_cloudant_sync_query_metadata "
+                                      @"SET last_sequence = 0;"];
+                }];
+            };
+
+            beforeEach(^{
+                for (int i = 0; i < 300; i++) {
+                    CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                    rev.docId = [NSString stringWithFormat:@"doc-%03d", i];
+                    if (i % 5 == 0) {
+                        rev.body = @{ @"age" : @(i) };
+                    } else {
+                        rev.body = @{ @"name" : rev.docId, @"pet" : @[ @"cat", @"dog" ] };
+                    }
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+                for (int i = 0; i < 300; i += 3) {
+                    NSString *docId = [NSString stringWithFormat:@"doc-%03d", i];
+                    if (i % 2 == 0) {
+                        [ds deleteDocumentWithId:docId error:nil];
+                    } else {
+                        CDTMutableDocumentRevision *rev =
+                            [[ds getDocumentWithId:docId error:nil] mutableCopy];
+                        rev.body = @{ @"name" : @"updated", @"pet" : @"fish" };
+                        [ds updateDocumentFromRevision:rev error:nil];
+                    }
+                }
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                expect([im ensureIndexed:@[ @"name", @"pet" ] withName:@"basic"]).toNot.beNil();
+            });
+
+            it(@"indexes the same rows as a serial update", ^{
+                NSArray *built = allRows();
+                expect(built.count).to.beGreaterThan(300);
+
+                resetIndex();
+                expect([CDTQIndexUpdater updateIndex:@"basic"
+                                          withFields:@[ @"_id", @"_rev", @"name", @"pet" ]
+                                          inDatabase:im.database
+                                       fromDatastore:ds
+                                               error:nil]).to.beTruthy();
+                expect(allRows()).to.equal(built);
+            });
+
+            it(@"records the sequence it was built to", ^{
+                CDTQIndexUpdater *updater =
+                    [[CDTQIndexUpdater alloc] initWithDatabase:im.database datastore:ds];
+                expect([updater sequenceNumberForIndex:@"basic"])
+                    .to.equal(ds.database.lastSequence);
+            });
+
+            it(@"reports the sequence it was built to, leaving the metadata alone", ^{
+                resetIndex();
+                SequenceNumber lastSequence = 0;
+                expect([CDTQIndexUpdater buildIndex:@"basic"
+                                         withFields:@[ @"_id", @"_rev", @"name", @"pet" ]
+                                         inDatabase:im.database
+                                      fromDatastore:ds
+                                       upToSequence:&lastSequence
+                                              error:nil]).to.beTruthy();
+                expect(lastSequence).to.equal(ds.database.lastSequence);
+
+                CDTQIndexUpdater *updater =
+                    [[CDTQIndexUpdater alloc] initWithDatabase:im.database datastore:ds];
+                expect([updater sequenceNumberForIndex:@"basic"]).to.equal(0);
+            });
+
+            it(@"replaces a table left by a build which didn't finish", ^{
+                [im.database inDatabase:^(FMDatabase *db) {
+                    [db executeUpdate:@"CREATE TABLE _t_cloudant_sync_query_index_other "
+                                      @"( \"_id\" NONE, \"_rev\" NONE, \"name\" NONE );"];
+                    [db executeUpdate:@"INSERT INTO _t_cloudant_sync_query_index_other "
+                                      @"VALUES ('doc-001', '1-x', 'doc-001');"];
+                }];
+
+                expect([im ensureIndexed:@[ @"name" ] withName:@"other"]).to.equal(@"other");
+
+                [im.database inDatabase:^(FMDatabase *db) {
+                    expect([db intForQuery:@"SELECT COUNT(*) FROM sqlite_master "
+                                           @"WHERE type = 'index' AND tbl_name = "
+                                           @"'_t_cloudant_sync_query_index_other';"])
+                        .to.equal(2);
+                }];
+                CDTQResultSet *result = [im find:@{ @"name" : @"doc-001" }];
+                expect(result.documentIds).to.equal(@[ @"doc-001" ]);
+            });
+
+            it(@"builds an index once when two managers create it at the same time", ^{
+                CDTQIndexManager *other = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                __block NSString *first = nil;
+                __block NSString *second = nil;
+                dispatch_queue_t queue =
+                    dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+                dispatch_group_t group = dispatch_group_create();
+                dispatch_group_async(group, queue, ^{
+                    first = [im ensureIndexed:@[ @"name" ] withName:@"both"];
+                });
+                dispatch_group_async(group, queue, ^{
+                    second = [other ensureIndexed:@[ @"name" ] withName:@"both"];
+                });
+                dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+                expect(first).to.equal(@"both");
+                expect(second).to.equal(@"both");
+
+                [im.database inDatabase:^(FMDatabase *db) {
+                    int rows = [db intForQuery:@"SELECT COUNT(*) FROM "
+                                               @"_t_cloudant_sync_query_index_both;"];
+                    int docs = [db intForQuery:@"SELECT COUNT(DISTINCT _id) FROM "
+                                               @"_t_cloudant_sync_query_index_both;"];
+                    expect(rows).to.beGreaterThan(0);
+                    expect(rows).to.equal(docs);
+                }];
+            });
+        });
     });
 
 SpecEnd
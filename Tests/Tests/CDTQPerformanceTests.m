@@ -12,6 +12,8 @@
 #import <CDTQIndexCreator.h>
 #import <CDTQResultSet.h>
 #import <CDTQQueryExecutor.h>
+#import <CDTQQueryValidator.h>
+#import <CDTQUnindexedMatcher.h>
 
 #import <CocoaLumberjack.h>
 
@@ -168,4 +170,65 @@ SpecBegin(CDTQPerformance)
 
     });
 
+    xdescribe(@"CDTQ post-hoc matching performance", ^{
+
+        __block NSMutableArray *revs;
+
+        beforeAll(^{
+            [DDLog addLogger:[DDTTYLogger sharedInstance]];
+
+            revs = [NSMutableArray arrayWithCapacity:100000];
+            NSArray *pets = @[ @"cat", @"dog", @"parrot" ];
+            for (int i = 0; i < 100000; i++) {
+                NSDictionary *body = @{
+                    @"name" : (i % 2) ? @"mike" : @"fred",
+                    @"age" : @(i % 100),
+                    @"docNumber" : @(i),
+                    @"pet" : pets[i % pets.count],
+                    @"address" : @{ @"town" : (i % 10) ? @"bristol" : @"bath" }
+                };
+                [revs addObject:[[CDTDocumentRevision alloc]
+                                    initWithDocId:[NSString stringWithFormat:@"doc-%d", i]
+                                       revisionId:@"1-a"
+                                             body:body
+                                          deleted:NO
+                                      attachments:@{}
+                                         sequence:i]];
+            }
+        });
+
+        NSDictionary *selectors = @{
+            @"equality" : @{ @"name" : @"mike", @"pet" : @"cat" },
+            @"range and dotted" :
+                @{ @"age" : @{ @"$gt" : @50 }, @"address.town" : @{ @"$eq" : @"bath" } },
+            @"$in and $mod" : @{
+                @"pet" : @{ @"$in" : @[ @"dog", @"parrot" ] },
+                @"docNumber" : @{ @"$mod" : @[ @7, @3 ] }
+            },
+            @"$or" : @{ @"$or" : @[ @{ @"name" : @"fred" }, @{ @"age" : @{ @"$lt" : @10 } } ] },
+        };
+
+        for (NSString *name in selectors) {
+            it([NSString stringWithFormat:@"matches 100k docs: %@", name], ^{
+                NSDictionary *selector =
+                    [CDTQQueryValidator normaliseAndValidateQuery:selectors[name]];
+                CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+                expect(matcher).toNot.beNil();
+
+                NSUInteger matched = 0;
+                NSDate *start = [NSDate date];
+                for (CDTDocumentRevision *rev in revs) {
+                    if ([matcher matches:rev]) {
+                        matched++;
+                    }
+                }
+                NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+                NSLog(@"Post-hoc matching %@ over %lu docs: %lu matched in %.3fs", name,
+                      (unsigned long)revs.count, (unsigned long)matched, elapsed);
+                expect(matched).to.beGreaterThan(0);
+            });
+        }
+
+    });
+
 SpecEnd
@@ -0,0 +1,207 @@
+//
+//  CDTQQueryPlanCacheTests.m
+//
+//  Copyright (c) 2015 Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <CloudantSync.h>
+#import <CDTQIndexManager.h>
+#import <CDTQResultSet.h>
+#import <CDTQQueryExecutor.h>
+#import <CDTQQueryPlanCache.h>
+#import <CDTQQuerySqlTranslator.h>
+#import "DBQueryUtils.h"
+
+SpecBegin(CDTQQueryPlanCache)
+
+    describe(@"shapeOfSelector", ^{
+
+        it(@"gives the same shape to selectors differing only in values", ^{
+            CDTQQueryShape *a = [CDTQQueryShape shapeOfSelector:@{
+                @"name" : @"mike",
+                @"age" : @{@"$gt" : @12}
+            }];
+            CDTQQueryShape *b = [CDTQQueryShape shapeOfSelector:@{
+                @"name" : @"fred",
+                @"age" : @{@"$gt" : @34}
+            }];
+            expect(a).toNot.beNil();
+            expect(a.selector).to.equal(b.selector);
+            expect(a.values).toNot.equal(b.values);
+        });
+
+        it(@"gives different shapes to different operators", ^{
+            CDTQQueryShape *a = [CDTQQueryShape shapeOfSelector:@{ @"age" : @{@"$gt" : @12} }];
+            CDTQQueryShape *b = [CDTQQueryShape shapeOfSelector:@{ @"age" : @{@"$lt" : @12} }];
+            expect(a.selector).toNot.equal(b.selector);
+        });
+
+        it(@"parameterises each element of $in", ^{
+            CDTQQueryShape *shape = [CDTQQueryShape shapeOfSelector:@{
+                @"$or" : @[ @{@"pet" : @{@"$in" : @[ @"cat", @"dog" ]}}, @{@"name" : @"mike"} ]
+            }];
+            expect(shape.values).to.equal(@[ @"cat", @"dog", @"mike" ]);
+        });
+
+        it(@"keeps booleans and the arguments of other operators", ^{
+            NSDictionary *selector = @{
+                @"pet" : @{@"$exists" : @YES},
+                @"age" : @{@"$mod" : @[ @2, @0 ]}
+            };
+            CDTQQueryShape *shape = [CDTQQueryShape shapeOfSelector:selector];
+            expect(shape.selector).to.equal(selector);
+            expect(shape.values).to.haveCountOf(0);
+        });
+
+        it(@"returns nil when a literal looks like a parameter", ^{
+            CDTQQueryShape *shape = [CDTQQueryShape shapeOfSelector:@{
+                @"age" : @{@"$mod" : @[ @(-1.0e300), @0 ]}
+            }];
+            expect(shape).to.beNil();
+        });
+    });
+
+    describe(@"bind", ^{
+
+        it(@"restores the original selector", ^{
+            NSDictionary *selector = @{
+                @"$and" : @[ @{@"name" : @"mike"}, @{@"age" : @{@"$not" : @{@"$lte" : @12}}} ]
+            };
+            CDTQQueryShape *shape = [CDTQQueryShape shapeOfSelector:selector];
+            expect([shape bind:shape.selector]).to.equal(selector);
+        });
+
+        it(@"binds the values in a query tree's SQL", ^{
+            CDTQQueryShape *shape = [CDTQQueryShape shapeOfSelector:@{ @"name" : @"mike" }];
+            CDTQSqlQueryNode *sqlNode = [[CDTQSqlQueryNode alloc] init];
+            sqlNode.sql = [CDTQSqlParts partsForSql:@"SELECT _id FROM t WHERE name = ?"
+                                         parameters:@[ shape.selector[@"name"] ]];
+            CDTQAndQueryNode *root = [[CDTQAndQueryNode alloc] init];
+            [root.children addObject:sqlNode];
+
+            CDTQChildrenQueryNode *bound = [shape bindQueryTree:root];
+            CDTQSqlQueryNode *boundSqlNode = bound.children[0];
+            expect(bound).to.beKindOf([CDTQAndQueryNode class]);
+            expect(boundSqlNode.sql.sqlWithPlaceholders).to.equal(sqlNode.sql.sqlWithPlaceholders);
+            expect(boundSqlNode.sql.placeholderValues).to.equal(@[ @"mike" ]);
+        });
+    });
+
+    describe(@"the cache", ^{
+
+        it(@"evicts the least recently used plan", ^{
+            CDTQQueryPlanCache *cache = [[CDTQQueryPlanCache alloc] initWithCapacity:2];
+            CDTQQueryShape *a = [CDTQQueryShape shapeOfSelector:@{ @"a" : @1 }];
+            CDTQQueryShape *b = [CDTQQueryShape shapeOfSelector:@{ @"b" : @1 }];
+            CDTQQueryShape *c = [CDTQQueryShape shapeOfSelector:@{ @"c" : @1 }];
+            CDTQQueryPlan *plan = [[CDTQQueryPlan alloc] init];
+
+            [cache addPlan:plan forShape:a indexGeneration:1];
+            [cache addPlan:plan forShape:b indexGeneration:1];
+            expect([cache planForShape:a indexGeneration:1]).to.equal(plan);
+            [cache addPlan:plan forShape:c indexGeneration:1];
+
+            expect([cache planForShape:a indexGeneration:1]).to.equal(plan);
+            expect([cache planForShape:b indexGeneration:1]).to.beNil();
+            expect([cache planForShape:c indexGeneration:1]).to.equal(plan);
+        });
+
+        it(@"keeps plans for different generations of indexes apart", ^{
+            CDTQQueryPlanCache *cache = [[CDTQQueryPlanCache alloc] initWithCapacity:2];
+            CDTQQueryShape *a = [CDTQQueryShape shapeOfSelector:@{ @"a" : @1 }];
+            [cache addPlan:[[CDTQQueryPlan alloc] init] forShape:a indexGeneration:1];
+            expect([cache planForShape:a indexGeneration:2]).to.beNil();
+        });
+
+        it(@"finds plans by the shape's content", ^{
+            CDTQQueryPlanCache *cache = [[CDTQQueryPlanCache alloc] initWithCapacity:2];
+            CDTQQueryPlan *plan = [[CDTQQueryPlan alloc] init];
+            [cache addPlan:plan
+                       forShape:[CDTQQueryShape shapeOfSelector:@{ @"a" : @{ @"$gt" : @1 } }]
+                indexGeneration:1];
+            CDTQQueryShape *same = [CDTQQueryShape shapeOfSelector:@{ @"a" : @{ @"$gt" : @2 } }];
+            expect([cache planForShape:same indexGeneration:1]).to.equal(plan);
+        });
+    });
+
+    describe(@"when executing queries with a plan cache", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            // Create a new CDTDatastoreFactory at a temp path
+
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            NSError *error;
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:&error];
+            ds = [factory datastoreNamed:@"test" error:nil];
+
+            NSArray *docs = @[
+                @[ @"mike12", @"mike", @12, @"cat" ],
+                @[ @"mike34", @"mike", @34, @"dog" ],
+                @[ @"fred34", @"fred", @34, @"cat" ],
+                @[ @"fred12", @"fred", @12, @"fish" ]
+            ];
+            for (NSArray *doc in docs) {
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = doc[0];
+                rev.body = @{ @"name" : doc[1], @"age" : doc[2], @"pet" : doc[3] };
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect([im ensureIndexed:@[ @"name", @"age" ] withName:@"basic"]).toNot.beNil();
+        });
+
+        afterEach(^{
+            // Delete the databases we used
+
+            factory = nil;
+            NSError *error;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+        });
+
+        it(@"binds each query's values to the shared plan", ^{
+            NSArray *names = @[ @"mike", @"fred", @"mike", @"bill" ];
+            NSArray *expected = @[ @[ @"mike34" ], @[ @"fred34" ], @[ @"mike34" ], @[] ];
+            for (NSUInteger i = 0; i < names.count; i++) {
+                CDTQResultSet *result =
+                    [im find:@{ @"name" : names[i], @"age" : @{@"$gt" : @20} }];
+                expect(result.documentIds).to.equal(expected[i]);
+            }
+        });
+
+        it(@"binds values used by the matcher when indexes don't cover the query", ^{
+            NSArray *pets = @[ @"cat", @"dog", @"fish" ];
+            NSArray *expected = @[ @[ @"mike12" ], @[ @"mike34" ], @[] ];
+            for (NSUInteger i = 0; i < pets.count; i++) {
+                CDTQResultSet *result = [im find:@{ @"name" : @"mike", @"pet" : pets[i] }];
+                expect(result.documentIds).to.equal(expected[i]);
+            }
+        });
+
+        it(@"plans again once the indexes change", ^{
+            NSDictionary *query = @{ @"name" : @"fred", @"age" : @{@"$gt" : @20} };
+            expect([im find:query].documentIds).to.equal(@[ @"fred34" ]);
+
+            expect([im deleteIndexNamed:@"basic"]).to.beTruthy();
+            expect([im find:query].documentIds).to.equal(@[ @"fred34" ]);
+
+            expect([im ensureIndexed:@[ @"age", @"name" ] withName:@"other"]).toNot.beNil();
+            expect([im find:query].documentIds).to.equal(@[ @"fred34" ]);
+        });
+    });
+
+SpecEnd
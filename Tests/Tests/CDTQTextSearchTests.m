@@ -397,6 +397,151 @@ SpecBegin(CDTQQueryExecutorTextSearch) describe(@"cdtq", ^{
             expect(result.documentIds.count).to.equal(0);
         });
 
+        it(@"can perform prefix searches using a prefix index", ^{
+            expect([im ensureIndexed:@[ @"comment" ]
+                            withName:@"basic_text"
+                                type:@"text"
+                            settings:@{ @"prefix" : @[ @2, @3 ] }]).toNot.beNil();
+
+            NSDictionary* query = @{ @"$text" : @{@"$search" : @"liv* riv*" } };
+            CDTQResultSet* result = [im find:query];
+            expect(result.documentIds).to.containsInAnyOrder(@[ @"mike34" ]);
+        });
+
+        it(@"applies the limit to a search consisting of a single text clause", ^{
+            expect([im ensureIndexed:@[ @"comment" ]
+                            withName:@"basic_text"
+                                type:@"text"]).toNot.beNil();
+
+            NSDictionary* query = @{ @"$text" : @{@"$search" : @"lives in Bristol"} };
+            CDTQResultSet* result = [im find:query skip:1 limit:1 fields:nil sort:nil];
+            expect(result.documentIds.count).to.equal(1);
+            expect(@[ @"mike12", @"mike34", @"fred12" ]).to.contain(result.documentIds[0]);
+        });
+
+        it(@"sorts every hit before applying the limit to a sorted text search", ^{
+            expect([im ensureIndexed:@[ @"name", @"comment" ]
+                            withName:@"basic_text"
+                                type:@"text"]).toNot.beNil();
+
+            NSDictionary* query = @{ @"$text" : @{@"$search" : @"lives in Bristol"} };
+            NSArray *order = @[ @{ @"name" : @"asc" } ];
+            CDTQResultSet* result = [im find:query skip:0 limit:1 fields:nil sort:order];
+            expect(result.documentIds).to.equal(@[ @"fred12" ]);
+        });
+
+        it(@"doesn't sort by rank using an FTS4 index", ^{
+            expect([im ensureIndexed:@[ @"comment" ]
+                            withName:@"basic_text"
+                                type:@"text"]).toNot.beNil();
+
+            NSDictionary* query = @{ @"$text" : @{@"$search" : @"Remus"} };
+            expect([im find:query skip:0 limit:0 fields:nil sort:@[ @{ @"$text" : @"desc" } ]])
+                .to.beNil();
+        });
+
+        it(@"can optimize a text index and set its automerge", ^{
+            expect([im ensureIndexed:@[ @"comment" ]
+                            withName:@"basic_text"
+                                type:@"text"]).toNot.beNil();
+
+            expect([im setAutomergeSegments:2 forTextIndexNamed:@"basic_text"]).to.beTruthy();
+            expect([im optimizeTextIndexNamed:@"basic_text"]).to.beTruthy();
+            expect([im setAutomergeSegments:17 forTextIndexNamed:@"basic_text"]).to.beFalsy();
+            expect([im optimizeTextIndexNamed:@"missing"]).to.beFalsy();
+
+            NSDictionary* query = @{ @"$text" : @{@"$search" : @"Remus"} };
+            CDTQResultSet* result = [im find:query];
+            expect(result.documentIds).to.containsInAnyOrder(@[ @"mike72", @"fred34" ]);
+        });
+
+        describe(@"using an FTS5 index", ^{
+
+            __block BOOL fts5Available;
+
+            beforeEach(^{
+                fts5Available = [CDTQIndexManager fts5AvailableInDatabase:im.database];
+                if (!fts5Available) {
+                    NSLog(@"FTS5 isn't compiled into SQLite, skipping FTS5 text search tests");
+                    return;
+                }
+                expect([im ensureIndexed:@[ @"name", @"comment" ]
+                                withName:@"basic_text"
+                                    type:@"text"
+                                settings:@{ @"fts" : @"fts5", @"prefix" : @[ @3 ] }])
+                    .toNot.beNil();
+            });
+
+            it(@"can perform a text search", ^{
+                if (!fts5Available) {
+                    return;
+                }
+                NSDictionary* query = @{ @"$text" : @{@"$search" : @"lives in Bristol"} };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds)
+                    .to.containsInAnyOrder(@[ @"mike12", @"mike34", @"fred12" ]);
+            });
+
+            it(@"can sort the results by rank", ^{
+                if (!fts5Available) {
+                    return;
+                }
+                // fred34 mentions both names, mike72 only Remus
+                NSDictionary* query = @{ @"$text" : @{@"$search" : @"Remus OR Romulus"} };
+                CDTQResultSet* result = [im find:query
+                                            skip:0
+                                           limit:0
+                                          fields:nil
+                                            sort:@[ @{ @"$text" : @"desc" } ]];
+                expect(result.documentIds).to.equal(@[ @"fred34", @"mike72" ]);
+            });
+
+            it(@"can return the top ranked results", ^{
+                if (!fts5Available) {
+                    return;
+                }
+                NSDictionary* query = @{ @"$text" : @{@"$search" : @"Remus OR Romulus"} };
+                CDTQResultSet* result = [im find:query
+                                            skip:0
+                                           limit:1
+                                          fields:nil
+                                            sort:@[ @{ @"$text" : @"desc" } ]];
+                expect(result.documentIds).to.equal(@[ @"fred34" ]);
+            });
+
+            it(@"can sort by rank when the text clause is combined with others", ^{
+                if (!fts5Available) {
+                    return;
+                }
+                NSDictionary* query = @{ @"pet" : @"cat",
+                                         @"$text" : @{@"$search" : @"Remus OR Romulus"} };
+                CDTQResultSet* result = [im find:query
+                                            skip:0
+                                           limit:1
+                                          fields:nil
+                                            sort:@[ @{ @"$text" : @"asc" } ]];
+                expect(result.documentIds).to.equal(@[ @"mike72" ]);
+            });
+
+            it(@"can perform prefix searches", ^{
+                if (!fts5Available) {
+                    return;
+                }
+                NSDictionary* query = @{ @"$text" : @{@"$search" : @"liv* riv*" } };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"mike34" ]);
+            });
+
+            it(@"can optimize the index and set its automerge", ^{
+                if (!fts5Available) {
+                    return;
+                }
+                expect([im setAutomergeSegments:8 forTextIndexNamed:@"basic_text"]).to.beTruthy();
+                expect([im optimizeTextIndexNamed:@"basic_text"]).to.beTruthy();
+            });
+
+        });
+
     });
     
 });
@@ -14,6 +14,9 @@
 #import <CDTQQueryExecutor.h>
 #import <CDTQUnindexedMatcher.h>
 #import <CDTQQueryValidator.h>
+#import "DBQueryUtils.h"
+#import "TD_Database.h"
+#import <FMDB/FMDB.h>
 
 SpecBegin(CDTQUnindexedMatcher) describe(@"matcherWithSelector", ^{
 
@@ -819,4 +822,128 @@ describe(@"matches", ^{
     });
 });
 
+describe(@"documentIdsMatching:inDatastore:", ^{
+
+    __block NSString *factoryPath;
+    __block CDTDatastoreManager *factory;
+    __block CDTDatastore *ds;
+    __block NSArray *docIds;
+
+    beforeEach(^{
+        factoryPath = [DBQueryUtils createTemporaryDirectory];
+        expect(factoryPath).toNot.beNil();
+
+        factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+        ds = [factory datastoreNamed:@"test" error:nil];
+        expect(ds).toNot.beNil();
+
+        NSArray *bodies = @[
+            @{ @"name" : @"mike", @"age" : @31, @"pets" : @[ @"cat", @"dog" ] },
+            @{ @"name" : @"fred", @"age" : @"unknown", @"pets" : @[] },
+            @{ @"name" : @"john", @"age" : @12.5, @"pets" : @"cat" },
+            @{ @"name" : @"bill", @"age" : [NSNull null], @"address" : @{ @"town" : @"bristol" } },
+            @{ @"name" : @"o'neil", @"age" : @45, @"pets" : @[ @[ @"cat" ], @{ @"a" : @1 } ] },
+            @{ @"name" : @"alf", @"pets" : @[ [NSNull null], @3 ], @"address" : @"bristol" },
+        ];
+        NSMutableArray *ids = [NSMutableArray array];
+        for (NSDictionary *body in bodies) {
+            CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+            rev.docId = body[@"name"];
+            rev.body = body;
+            [ds createDocumentFromRevision:rev error:nil];
+            [ids addObject:rev.docId];
+        }
+        [ids addObject:@"missing"];
+        docIds = ids;
+    });
+
+    afterEach(^{
+        ds = nil;
+        factory = nil;
+        [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+    });
+
+    it(@"matches the same documents as -matches:", ^{
+        NSArray *selectors = @[
+            @{ @"name" : @"mike" },
+            @{ @"name" : @"o'neil" },
+            @{ @"pets" : @"cat" },
+            @{ @"age" : @{ @"$gt" : @20 } },
+            @{ @"age" : @{ @"$lt" : @"b" } },
+            @{ @"age" : @{ @"$lte" : @12.5 } },
+            @{ @"age" : @{ @"$exists" : @YES } },
+            @{ @"age" : @{ @"$exists" : @NO } },
+            @{ @"pets" : @{ @"$exists" : @YES } },
+            @{ @"pets" : @{ @"$in" : @[ @"dog", @3 ] } },
+            @{ @"pets" : @{ @"$size" : @2 } },
+            @{ @"pets" : @{ @"$size" : @0 } },
+            @{ @"age" : @{ @"$mod" : @[ @5, @1 ] } },
+            @{ @"age" : @{ @"$ne" : @31 } },
+            @{ @"pets" : @{ @"$nin" : @[ @"cat" ] } },
+            @{ @"address.town" : @"bristol" },
+            @{ @"address" : @"bristol" },
+            @{ @"_id" : @{ @"$gt" : @"fred" } },
+            @{ @"$or" : @[ @{ @"name" : @"mike" }, @{ @"age" : @{ @"$lt" : @20 } } ] },
+            @{ @"$and" : @[ @{ @"age" : @{ @"$gt" : @10 } }, @{ @"pets" : @"cat" } ] },
+        ];
+
+        NSArray *revs = [ds getDocumentsWithIds:docIds];
+        for (NSDictionary *query in selectors) {
+            NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:query];
+            CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+
+            NSMutableSet *expected = [NSMutableSet set];
+            for (CDTDocumentRevision *rev in revs) {
+                if ([matcher matches:rev]) {
+                    [expected addObject:rev.docId];
+                }
+            }
+
+            NSSet *actual = [matcher documentIdsMatching:docIds inDatastore:ds];
+            expect(actual).toNot.beNil();
+            expect(actual).to.equal(expected);
+        }
+    });
+
+    it(@"matches the current revision", ^{
+        CDTDocumentRevision *rev = [ds getDocumentWithId:@"mike" error:nil];
+        CDTMutableDocumentRevision *update = [rev mutableCopy];
+        update.body = @{ @"name" : @"michael" };
+        [ds updateDocumentFromRevision:update error:nil];
+
+        NSDictionary *selector =
+            [CDTQQueryValidator normaliseAndValidateQuery:@{ @"name" : @"mike" }];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        expect([matcher documentIdsMatching:docIds inDatastore:ds]).to.haveCountOf(0);
+
+        [ds deleteDocumentWithId:@"fred" error:nil];
+        selector = [CDTQQueryValidator normaliseAndValidateQuery:@{ @"name" : @"fred" }];
+        matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        expect([matcher documentIdsMatching:docIds inDatastore:ds]).to.haveCountOf(0);
+    });
+
+    it(@"returns nil when a body isn't valid JSON", ^{
+        // Every document has to be matched one by one, rather than those matched in SQL
+        // before reaching the bad body being taken for all of them
+        [ds.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+            NSString *sql = @"UPDATE revs SET json = ? "
+                            @"WHERE doc_id = (SELECT doc_id FROM docs WHERE docid = ?);";
+            NSData *json = [@"not json" dataUsingEncoding:NSUTF8StringEncoding];
+            expect([db executeUpdate:sql, json, @"john"]).to.beTruthy();
+        }];
+
+        NSDictionary *selector =
+            [CDTQQueryValidator normaliseAndValidateQuery:@{ @"age" : @{ @"$exists" : @YES } }];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        expect([matcher documentIdsMatching:docIds inDatastore:ds]).to.beNil();
+    });
+
+    it(@"returns nil for $text", ^{
+        NSDictionary *selector = [CDTQQueryValidator
+            normaliseAndValidateQuery:@{ @"$text" : @{ @"$search" : @"mike" } }];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        expect([matcher documentIdsMatching:docIds inDatastore:ds]).to.beNil();
+    });
+});
+
 SpecEnd
@@ -34,4 +34,8 @@
                modifiedBy:(NSDictionary *)modifiedRowCount;
 +(NSSet *) compileOptions:(FMDatabaseQueue *)queue;
 
+/** Creates a new, empty directory under NSTemporaryDirectory() for a test's datastores.
+    Returns its path, or nil if it couldn't be created. */
++(NSString *) createTemporaryDirectory;
+
 @end
@@ -200,5 +200,20 @@ NSString* const DBQueryUtilsErrorDomain = @"DBQueryUtilsErrorDomain";
     return [NSSet setWithArray:compileOptions];
 }
 
++(NSString *) createTemporaryDirectory
+{
+    NSString *template = [NSTemporaryDirectory()
+        stringByAppendingPathComponent:@"cloudant_sync_ios_tests.XXXXXX"];
+    char *path = strdup([template fileSystemRepresentation]);
+    NSString *directory = nil;
+    if (mkdtemp(path)) {
+        directory = [[NSFileManager defaultManager]
+            stringWithFileSystemRepresentation:path
+                                        length:strlen(path)];
+    }
+    free(path);
+    return directory;
+}
+
 
 @end
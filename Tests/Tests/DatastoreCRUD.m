@@ -836,6 +836,52 @@
     
 }
 
+-(void)testEnumerateAllDocumentsReadsEveryPage
+{
+    NSError *error;
+    // More than one page of documents
+    int objectCount = 2500;
+    NSArray *bodies = [self generateDocuments:objectCount];
+    for (int i = 0; i < objectCount; i++) {
+        error = nil;
+        CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+        rev.docId = [NSString stringWithFormat:@"hello-%04d", i];
+        rev.body = bodies[i];
+        [self.datastore createDocumentFromRevision:rev error:&error];
+        XCTAssertNil(error, @"Error creating document");
+    }
+
+    __block int i = 0;
+    [self.datastore enumerateAllDocumentsUsingBlock:^(CDTDocumentRevision *revision, BOOL *stop) {
+        NSString *expected = [NSString stringWithFormat:@"hello-%04d", i];
+        XCTAssertEqualObjects(revision.docId, expected);
+        XCTAssertEqualObjects(revision.body, bodies[i]);
+        i++;
+    }];
+    XCTAssertEqual(i, objectCount);
+
+    XCTAssertEqual([self.datastore getAllDocuments].count, (NSUInteger)objectCount);
+    XCTAssertEqual([self.datastore getAllDocumentIds].count, (NSUInteger)objectCount);
+}
+
+-(void)testEnumerateAllDocumentsStops
+{
+    NSError *error;
+    for (int i = 0; i < 10; i++) {
+        CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+        rev.docId = [NSString stringWithFormat:@"hello-%04d", i];
+        rev.body = [@{ @"index" : @(i) } mutableCopy];
+        [self.datastore createDocumentFromRevision:rev error:&error];
+    }
+
+    __block int count = 0;
+    [self.datastore enumerateAllDocumentsUsingBlock:^(CDTDocumentRevision *revision, BOOL *stop) {
+        count++;
+        *stop = (count == 3);
+    }];
+    XCTAssertEqual(count, 3);
+}
+
 -(void)assertIdAndRevisionAndShallowContentExpected:(CDTDocumentRevision *)expected actual:(CDTDocumentRevision *)actual
 {
     XCTAssertEqualObjects([actual docId], [expected docId], @"docIDs don't match");
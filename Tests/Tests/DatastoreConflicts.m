@@ -940,4 +940,19 @@
                    (unsigned long)(oddNumberOfConflictingDocuments + 1));
 }
 
+- (void)testGetAllDocumentIdsReturnsEachConflictedDocumentOnce
+{
+    NSUInteger numberOfConflictingDocuments = 21;
+
+    for (NSUInteger i = 0; i < numberOfConflictingDocuments; i++) {
+        [self addConflictingDocumentWithId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]
+                               toDatastore:self.datastore];
+    }
+
+    NSArray *docIds = [self.datastore getAllDocumentIds];
+
+    XCTAssertEqual(docIds.count, numberOfConflictingDocuments);
+    XCTAssertEqual([NSSet setWithArray:docIds].count, numberOfConflictingDocuments);
+}
+
 @end
@@ -0,0 +1,91 @@
+//
+//  TDBatcherTests.m
+//  Tests
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "TDBatcher.h"
+#import "CloudantTests.h"
+
+@interface TDBatcherTests : CloudantTests
+
+@end
+
+@implementation TDBatcherTests
+
+- (void)testFlushProcessesInBatchesOfCapacity
+{
+    NSMutableArray* batches = [NSMutableArray array];
+    TDBatcher* batcher = [[TDBatcher alloc] initWithCapacity:3
+                                                       delay:60.0
+                                                   processor:^(NSArray* objects) {
+                                                       [batches addObject:objects];
+                                                   }];
+    [batcher queueObjects:@[ @1, @2 ]];
+    XCTAssertEqual(batcher.count, (NSUInteger)2);
+    XCTAssertEqual(batches.count, (NSUInteger)0);
+
+    // Reaching the capacity processes a batch straight away:
+    [batcher queueObjects:@[ @3, @4 ]];
+    XCTAssertEqualObjects(batches, (@[ @[ @1, @2, @3 ] ]));
+    XCTAssertEqual(batcher.count, (NSUInteger)1);
+
+    [batcher flushAll];
+    XCTAssertEqualObjects(batches, (@[ @[ @1, @2, @3 ], @[ @4 ] ]));
+    XCTAssertEqual(batcher.count, (NSUInteger)0);
+}
+
+- (void)testBackpressure
+{
+    NSMutableArray* signals = [NSMutableArray array];
+    TDBatcher* batcher =
+        [[TDBatcher alloc] initWithCapacity:100 delay:60.0 processor:^(NSArray* objects) {}];
+    batcher.highWaterMark = 10;
+    batcher.backpressureHandler = ^(BOOL backedUp) { [signals addObject:@(backedUp)]; };
+
+    for (int i = 0; i < 9; i++) [batcher queueObject:@(i)];
+    XCTAssertFalse(batcher.backedUp);
+    [batcher queueObject:@9];
+    XCTAssertTrue(batcher.backedUp);
+    [batcher queueObject:@10];
+    XCTAssertEqualObjects(signals, (@[ @YES ]));
+
+    [batcher flush];
+    XCTAssertFalse(batcher.backedUp);
+    XCTAssertEqualObjects(signals, (@[ @YES, @NO ]));
+}
+
+- (void)testQueueFromOtherThreads
+{
+    const NSUInteger kProducers = 4, kPerProducer = 500;
+    __block NSUInteger processed = 0;
+    TDBatcher* batcher = [[TDBatcher alloc] initWithCapacity:100
+                                                       delay:0.01
+                                                   processor:^(NSArray* objects) {
+                                                       XCTAssertTrue([NSThread isMainThread]);
+                                                       processed += objects.count;
+                                                   }];
+    dispatch_apply(kProducers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                   ^(size_t producer) {
+                       for (NSUInteger i = 0; i < kPerProducer; i++)
+                           [batcher queueObject:@(producer * kPerProducer + i)];
+                   });
+
+    NSDate* timeout = [NSDate dateWithTimeIntervalSinceNow:10.0];
+    while (processed < kProducers * kPerProducer && [timeout timeIntervalSinceNow] > 0)
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    XCTAssertEqual(processed, kProducers * kPerProducer);
+    XCTAssertEqual(batcher.count, (NSUInteger)0);
+}
+
+@end
@@ -184,5 +184,57 @@ extern char convertEscape(const char**);
     [self scalarTest:mode str1:"[5,\"wow\"]" str2:"[5,\"MOM\"]" retVal:1 arrayLimit:2];
 }
 
+- (int)compareCollationKeys:(void *)mode str1:(const char *)str1 str2:(const char *)str2
+                      exact:(BOOL *)exact
+{
+    BOOL exact1, exact2;
+    NSData *key1 = TDCollationKeyForJSON(mode, (int)strlen(str1), str1, &exact1);
+    NSData *key2 = TDCollationKeyForJSON(mode, (int)strlen(str2), str2, &exact2);
+    *exact = exact1 && exact2;
+    int diff = memcmp(key1.bytes, key2.bytes, MIN(key1.length, key2.length));
+    if (diff == 0) diff = (int)key1.length - (int)key2.length;
+    return diff > 0 ? 1 : (diff < 0 ? -1 : 0);
+}
+
+- (void)collationKeyTest:(void *)mode values:(NSArray *)values
+{
+    // Every pair of keys must order the same way as their JSON. Inexact keys must either agree
+    // or be equal, leaving the JSON to decide.
+    for (NSString *value1 in values) {
+        for (NSString *value2 in values) {
+            const char *str1 = value1.UTF8String, *str2 = value2.UTF8String;
+            int expected = TDCollateJSON(mode, (int)strlen(str1), str1, (int)strlen(str2), str2);
+            BOOL exact;
+            int actual = [self compareCollationKeys:mode str1:str1 str2:str2 exact:&exact];
+            if (exact || actual != 0) {
+                XCTAssertEqual(actual, expected, @"keys for %s and %s in mode %d", str1, str2,
+                               (int)(intptr_t)mode);
+            }
+        }
+    }
+}
+
+- (void)testCollationKeys
+{
+    NSArray *values = @[
+        @"null", @"false", @"true", @"-1e10", @"-2.5", @"-1", @"-0.0", @"0", @"0.5", @"1",
+        @"123", @"1e300", @"\"\"", @"\"A\"", @"\"B\"", @"\"a\"", @"\"aa\"", @"\"a\\u0001\"",
+        @"\"a\\u0000b\"", @"\"\\t\"", @"\"12\\/34\"", @"\"12/34\"", @"[]", @"[null]",
+        @"[false]", @"[123]", @"[45,67]", @"[123.4,\"wow\"]", @"[123.40,789]", @"[[]]",
+        @"[1,[2,3],4]", @"[1,[2,3.1],4,5,6]", @"{}", @"{\"a\":1}", @"{\"a\":2}", @"{\"b\":1}"
+    ];
+    [self collationKeyTest:kTDCollateJSON_ASCII values:values];
+    [self collationKeyTest:kTDCollateJSON_Raw values:values];
+    [self collationKeyTest:kTDCollateJSON_Unicode values:values];
+
+    BOOL exact;
+    TDCollationKeyForJSON(kTDCollateJSON_ASCII, 8, "[\"a\",1]", &exact);
+    XCTAssertTrue(exact);
+    TDCollationKeyForJSON(kTDCollateJSON_Unicode, 3, "[1]", &exact);
+    XCTAssertTrue(exact);
+    TDCollationKeyForJSON(kTDCollateJSON_Unicode, 8, "[\"a\",1]", &exact);
+    XCTAssertFalse(exact);
+}
+
 
 @end
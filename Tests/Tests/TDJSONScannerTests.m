@@ -0,0 +1,130 @@
+//
+//  TDJSONScannerTests.m
+//  Tests
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "CollectionUtils.h"
+#import "TDJSONScanner.h"
+#import "TDCanonicalJSON.h"
+#import "CloudantTests.h"
+
+@interface TDJSONScannerTests : CloudantTests
+
+@end
+
+@implementation TDJSONScannerTests
+
+- (TDJSONScanner*)scan:(NSString*)json
+{
+    TDJSONScanner* scanner =
+        [[TDJSONScanner alloc] initWithData:[json dataUsingEncoding:NSUTF8StringEncoding]];
+    return [scanner scan] ? scanner : nil;
+}
+
+- (void)testSpecialProperties
+{
+    TDJSONScanner* scanner = [self scan:@"{\"_id\":\"doc1\", \"_rev\":\"3-cc\", \"_deleted\":true,"
+                                        @" \"_revisions\":{\"start\":3,\"ids\":[\"cc\",\"bb\",\"aa\"]},"
+                                        @" \"_conflicts\":[\"3-dd\"], \"name\":\"fred\"}"];
+    XCTAssertNotNil(scanner);
+    XCTAssertEqualObjects(scanner.docID, @"doc1");
+    XCTAssertEqualObjects(scanner.revID, @"3-cc");
+    XCTAssertTrue(scanner.deleted);
+    XCTAssertFalse(scanner.hasAttachments);
+    XCTAssertEqualObjects(scanner.revisionHistory, (@[ @"3-cc", @"2-bb", @"1-aa" ]));
+    XCTAssertEqualObjects([scanner.canonicalBody my_UTF8ToString], @"{\"name\":\"fred\"}");
+}
+
+- (void)testMissingRevisionHistory
+{
+    TDJSONScanner* scanner = [self scan:@"{\"_id\":\"doc1\",\"_rev\":\"1-aa\"}"];
+    XCTAssertNotNil(scanner);
+    XCTAssertNil(scanner.revisionHistory);
+    XCTAssertFalse(scanner.deleted);
+    XCTAssertEqualObjects([scanner.canonicalBody my_UTF8ToString], @"{}");
+}
+
+- (void)testAttachments
+{
+    TDJSONScanner* scanner = [self
+        scan:@"{\"_id\":\"a\",\"_rev\":\"1-aa\",\"_attachments\":{\"f.txt\":{\"stub\":true}}}"];
+    XCTAssertTrue(scanner.hasAttachments);
+
+    scanner = [self scan:@"{\"_id\":\"a\",\"_rev\":\"1-aa\",\"_attachments\":{ }}"];
+    XCTAssertFalse(scanner.hasAttachments);
+}
+
+- (void)testReplicationKeysAreKept
+{
+    TDJSONScanner* scanner = [self scan:@"{\"_id\":\"a\",\"_replication_id\":\"r\"}"];
+    XCTAssertEqualObjects([scanner.canonicalBody my_UTF8ToString], @"{\"_replication_id\":\"r\"}");
+}
+
+- (void)testInvalidDocuments
+{
+    XCTAssertNil([self scan:@"{\"_id\":\"a\",\"_foo\":1}"], @"Unknown special key accepted");
+    XCTAssertNil([self scan:@"{\"a\":1,\"a\":2}"], @"Duplicate key accepted");
+    XCTAssertNil([self scan:@"{\"a\":\"\\ud800\"}"], @"Lone surrogate accepted");
+    XCTAssertNil([self scan:@"{\"a\":1"], @"Truncated JSON accepted");
+    XCTAssertNil([self scan:@"{\"a\":1} x"], @"Trailing garbage accepted");
+    XCTAssertNil([self scan:@"[1,2]"], @"Non-object accepted");
+}
+
+- (void)testCanonicalBodyMatchesTDCanonicalJSON
+{
+    NSArray* bodies = @[
+        @"{\"b\" : 1, \"a\" : [true, false, null, \"x\"]}",
+        @"{\"nested\":{\"z\":{\"y\":[{\"b\":2,\"a\":1}]},\"a\":\"\"}}",
+        @"{\"esc\":\"tab\\there \\\"quoted\\\" back\\\\slash\\/ \\r\\n \\u0001\"}",
+        @"{\"unicode\":\"\\u00e9t\\u00e9 \\ud83d\\ude00 \xe2\x82\xac\"}",
+        @"{\"\\uff21\":1,\"\\ud83d\\ude00\":2,\"B\":3,\"a\":4}",
+        @"{\"n\":-12,\"big\":9007199254740993}",
+    ];
+    for (NSString* body in bodies) {
+        TDJSONScanner* scanner = [self scan:body];
+        XCTAssertNotNil(scanner, @"Couldn't scan %@", body);
+        id parsed = [NSJSONSerialization JSONObjectWithData:[body dataUsingEncoding:NSUTF8StringEncoding]
+                                                    options:0
+                                                      error:NULL];
+        XCTAssertEqualObjects([scanner.canonicalBody my_UTF8ToString],
+                              [TDCanonicalJSON canonicalString:parsed]);
+    }
+}
+
+- (void)testNumbersKeptAsReceived
+{
+    TDJSONScanner* scanner = [self scan:@"{\"f\":2.50,\"e\":1E+3}"];
+    XCTAssertEqualObjects([scanner.canonicalBody my_UTF8ToString], @"{\"e\":1E+3,\"f\":2.50}");
+}
+
+- (void)testDocumentsInAllDocsResponse
+{
+    NSString* response = @"{\"total_rows\":3,\"offset\":0,\"rows\":["
+                         @"{\"id\":\"a\",\"key\":\"a\",\"value\":{\"rev\":\"1-aa\"},"
+                         @"\"doc\":{\"_id\":\"a\",\"_rev\":\"1-aa\",\"x\":1}},"
+                         @"{\"key\":\"b\",\"error\":\"not_found\"},"
+                         @"{\"id\":\"c\",\"key\":\"c\",\"value\":{\"rev\":\"1-cc\",\"deleted\":true},"
+                         @"\"doc\":null}"
+                         @"]}";
+    NSArray* docs =
+        [TDJSONScanner documentsInAllDocsResponse:[response dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqual(docs.count, (NSUInteger)3);
+    XCTAssertEqualObjects([docs[0] my_UTF8ToString], @"{\"_id\":\"a\",\"_rev\":\"1-aa\",\"x\":1}");
+    XCTAssertEqualObjects(docs[1], [NSNull null]);
+    XCTAssertEqualObjects(docs[2], [NSNull null]);
+
+    XCTAssertNil([TDJSONScanner
+        documentsInAllDocsResponse:[@"{\"rows\":[" dataUsingEncoding:NSUTF8StringEncoding]]);
+}
+
+@end
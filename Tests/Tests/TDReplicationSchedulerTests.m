@@ -0,0 +1,143 @@
+//
+//  TDReplicationSchedulerTests.m
+//  Tests
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "CDTDatastoreManager.h"
+#import "CDTDatastore.h"
+#import "TDReplicator.h"
+#import "TDReplicationScheduler.h"
+
+@interface TDReplicationSchedulerTests : CloudantSyncTests
+
+@property (nonatomic, strong) TDReplicationScheduler *scheduler;
+@property (nonatomic, strong) NSMutableArray *grants;
+
+@end
+
+@implementation TDReplicationSchedulerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.scheduler = [[TDReplicationScheduler alloc] initWithThreadCount:2];
+    self.grants = [NSMutableArray array];
+}
+
+- (TDReplicator *)replicatorWithPriority:(NSInteger)priority
+{
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test" error:nil];
+    TDReplicator *replicator =
+        [[TDReplicator alloc] initWithDB:datastore.database
+                                  remote:[NSURL URLWithString:@"http://localhost:5984/db"]
+                                    push:NO
+                              continuous:NO
+                            interceptors:@[]];
+    replicator.priority = priority;
+    return replicator;
+}
+
+- (void)acquireConnectionFor:(TDReplicator *)replicator name:(NSString *)name
+{
+    [self.scheduler acquireResource:kTDReplicationResourceConnection
+                      forReplicator:replicator
+                            onGrant:^{ [self.grants addObject:name]; }];
+}
+
+- (void)waitForGrants:(NSUInteger)count
+{
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (self.grants.count < count && [timeout timeIntervalSinceNow] > 0)
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    // Give any grant that shouldn't have happened a chance to show up:
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                             beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+}
+
+- (void)testHigherPriorityIsGrantedFirst
+{
+    self.scheduler.maxConnections = 1;
+    TDReplicator *first = [self replicatorWithPriority:0];
+    TDReplicator *low = [self replicatorWithPriority:0];
+    TDReplicator *high = [self replicatorWithPriority:5];
+
+    [self acquireConnectionFor:first name:@"first"];
+    [self waitForGrants:1];
+    [self acquireConnectionFor:low name:@"low"];
+    [self acquireConnectionFor:high name:@"high"];
+    [self waitForGrants:2];
+    XCTAssertEqualObjects(self.grants, (@[ @"first" ]));
+
+    [self.scheduler releaseResource:kTDReplicationResourceConnection forReplicator:first];
+    [self waitForGrants:2];
+    XCTAssertEqualObjects(self.grants, (@[ @"first", @"high" ]));
+
+    [self.scheduler releaseResource:kTDReplicationResourceConnection forReplicator:high];
+    [self waitForGrants:3];
+    XCTAssertEqualObjects(self.grants, (@[ @"first", @"high", @"low" ]));
+}
+
+- (void)testReplicatorHoldingFewestGoesFirst
+{
+    self.scheduler.maxConnections = 2;
+    TDReplicator *greedy = [self replicatorWithPriority:0];
+    TDReplicator *other = [self replicatorWithPriority:0];
+
+    [self acquireConnectionFor:greedy name:@"greedy1"];
+    [self acquireConnectionFor:greedy name:@"greedy2"];
+    [self acquireConnectionFor:greedy name:@"greedy3"];
+    [self acquireConnectionFor:other name:@"other"];
+    [self waitForGrants:2];
+    XCTAssertEqualObjects(self.grants, (@[ @"greedy1", @"greedy2" ]));
+
+    // greedy3 has waited longer, but greedy already holds a connection and other holds none:
+    [self.scheduler releaseResource:kTDReplicationResourceConnection forReplicator:greedy];
+    [self waitForGrants:3];
+    XCTAssertEqualObjects(self.grants, (@[ @"greedy1", @"greedy2", @"other" ]));
+}
+
+- (void)testFinishedReplicatorFreesItsResources
+{
+    self.scheduler.maxConnections = 1;
+    TDReplicator *finishing = [self replicatorWithPriority:0];
+    TDReplicator *waiting = [self replicatorWithPriority:0];
+
+    [self acquireConnectionFor:finishing name:@"finishing"];
+    [self acquireConnectionFor:finishing name:@"dropped"];
+    [self acquireConnectionFor:waiting name:@"waiting"];
+    [self waitForGrants:1];
+    XCTAssertEqualObjects(self.grants, (@[ @"finishing" ]));
+
+    [self.scheduler replicatorFinished:finishing];
+    [self waitForGrants:2];
+    XCTAssertEqualObjects(self.grants, (@[ @"finishing", @"waiting" ]));
+
+    // A late release from the finished replicator mustn't free someone else's connection:
+    [self.scheduler releaseResource:kTDReplicationResourceConnection forReplicator:finishing];
+    [self acquireConnectionFor:waiting name:@"again"];
+    [self waitForGrants:3];
+    XCTAssertEqualObjects(self.grants, (@[ @"finishing", @"waiting" ]));
+}
+
+- (void)testThreadsAreShared
+{
+    NSMutableSet *threads = [NSMutableSet set];
+    for (int i = 0; i < 5; i++) {
+        [threads addObject:[self.scheduler threadForReplicator:[self replicatorWithPriority:0]]];
+    }
+    XCTAssertEqual(threads.count, (NSUInteger)2);
+}
+
+@end
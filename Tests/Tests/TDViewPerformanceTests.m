@@ -0,0 +1,96 @@
+//
+//  TDViewPerformanceTests.m
+//  Tests
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <CloudantSync.h>
+#import "TD_Database.h"
+#import "TD_View.h"
+#import "DBQueryUtils.h"
+
+#import <CocoaLumberjack.h>
+
+SpecBegin(TDViewPerformance)
+
+    xdescribe(@"TD_View reindexing performance", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+
+        beforeAll(^{
+            [DDLog addLogger:[DDTTYLogger sharedInstance]];
+
+            // Create a new CDTDatastoreFactory at a temp path
+
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+
+            NSError *error;
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:&error];
+            ds = [factory datastoreNamed:@"test50k" error:nil];
+
+            CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+            NSArray *pets = @[ @"cat", @"dog", @"parrot" ];
+            for (int i = 0; i < 50000; i++) {
+                @autoreleasepool
+                {
+                    rev.docId = [NSString stringWithFormat:@"doc-%d", i];
+                    rev.body = @{
+                        @"name" : (i % 2) ? @"mike" : @"fred",
+                        @"age" : @(i % 100),
+                        @"docNumber" : @(i),
+                        @"pet" : pets[i % pets.count]
+                    };
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+            }
+        });
+
+        afterAll(^{
+            // Delete the databases we used
+            factory = nil;
+            NSError *error;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+        });
+
+        NSDictionary *mapBlocks = @{
+            @"string keys" : ^(NSDictionary *doc, TDMapEmitBlock emit) {
+                emit(doc[@"name"], nil);
+            },
+            @"array keys" : ^(NSDictionary *doc, TDMapEmitBlock emit) {
+                emit(@[ doc[@"pet"], doc[@"age"] ], doc[@"docNumber"]);
+            },
+            @"three rows per doc" : ^(NSDictionary *doc, TDMapEmitBlock emit) {
+                emit(doc[@"name"], nil);
+                emit(doc[@"age"], nil);
+                emit(doc[@"pet"], doc[@"docNumber"]);
+            },
+        };
+
+        for (NSString *name in mapBlocks) {
+            it([NSString stringWithFormat:@"reindexes 50k docs: %@", name], ^{
+                TD_View *view = [ds.database viewNamed:name];
+                [view setMapBlock:mapBlocks[name] reduceBlock:nil version:@"1"];
+                [view removeIndex];
+
+                NSDate *start = [NSDate date];
+                expect([view updateIndex]).to.equal(kTDStatusOK);
+                NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+                NSLog(@"Reindexing view %@ over 50000 docs took %.3fs (%.0f docs/s)", name,
+                      elapsed, 50000 / elapsed);
+            });
+        }
+
+    });
+
+SpecEnd
@@ -0,0 +1,331 @@
+//
+//  TDViewReduceTests.m
+//  Tests
+//
+//  Copyright (c) 2015 IBM Cloudant. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <CloudantSync.h>
+#import "TD_Database.h"
+#import "TD_View.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "DBQueryUtils.h"
+#import <FMDB/FMDB.h>
+
+SpecBegin(TDViewReduce)
+
+    describe(@"TD_View stored reductions", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block TD_View *view;
+
+        NSArray *pets = @[ @"cat", @"Cat", @"dog", @"parrot" ];
+
+        TDMapBlock mapBlock = ^(NSDictionary *doc, TDMapEmitBlock emit) {
+            emit(@[ doc[@"pet"], doc[@"age"] ], doc[@"age"]);
+        };
+
+        // Counts rows, so it gives the wrong answer if called with rereduce:NO on reductions.
+        TDReduceBlock countBlock = ^id(NSArray *keys, NSArray *values, BOOL rereduce) {
+            return rereduce ? [TD_View totalValues:values] : @(values.count);
+        };
+
+        void (^createDocuments)(int, int) = ^(int first, int count) {
+            for (int i = first; i < first + count; i++) {
+                CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+                rev.docId = [NSString stringWithFormat:@"doc-%03d", i];
+                rev.body = @{ @"pet" : pets[i % pets.count], @"age" : @(i % 5) };
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+        };
+
+        NSArray * (^query)(TD_View *, TDQueryOptions) =
+            ^NSArray *(TD_View *v, TDQueryOptions options) {
+            TDStatus status = kTDStatusDBError;
+            NSArray *rows = [v queryWithOptions:&options status:&status];
+            expect(status).to.equal(kTDStatusOK);
+            return rows;
+        };
+
+        // Any limit other than the default keeps the query from using the stored reductions,
+        // so it reduces every row of the map table instead.
+        NSArray * (^reduceMapRows)(TD_View *, TDQueryOptions) =
+            ^NSArray *(TD_View *v, TDQueryOptions options) {
+            options.limit = UINT_MAX - 1;
+            return query(v, options);
+        };
+
+        BOOL (^hasStoredReductions)(TD_View *) = ^BOOL(TD_View *v) {
+            __block BOOL exists = NO;
+            [ds.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+                exists = [db tableExists:[NSString stringWithFormat:@"reduces_%d", v.viewID]];
+            }];
+            return exists;
+        };
+
+        // Reduced and grouped queries of `v`, each answered from the stored reductions.
+        NSArray * (^reducedQueries)(TD_View *) = ^NSArray *(TD_View *v) {
+            expect(hasStoredReductions(v)).to.beTruthy();
+            NSMutableArray *results = [NSMutableArray array];
+            NSArray *catStart = @[ @"cat" ], *catEnd = @[ @"cat", @{} ];
+
+            TDQueryOptions options = kDefaultTDQueryOptions;
+            options.reduce = YES;
+            [results addObject:query(v, options)];
+            expect(reduceMapRows(v, options)).to.equal(results.lastObject);
+
+            options.group = YES;
+            [results addObject:query(v, options)];
+            expect(reduceMapRows(v, options)).to.equal(results.lastObject);
+
+            options.groupLevel = 1;
+            [results addObject:query(v, options)];
+            expect(reduceMapRows(v, options)).to.equal(results.lastObject);
+
+            options.descending = YES;
+            [results addObject:query(v, options)];
+            expect(reduceMapRows(v, options)).to.equal(results.lastObject);
+
+            options.descending = NO;
+            options.groupLevel = 0;
+            options.startKey = catStart;
+            options.endKey = catEnd;
+            [results addObject:query(v, options)];
+            expect(reduceMapRows(v, options)).to.equal(results.lastObject);
+
+            return results;
+        };
+
+        beforeEach(^{
+            factoryPath = [DBQueryUtils createTemporaryDirectory];
+            expect(factoryPath).toNot.beNil();
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            createDocuments(0, 40);
+            view = [ds.database viewNamed:@"pets"];
+            [view setMapBlock:mapBlock reduceBlock:countBlock version:@"1"];
+            expect([view updateIndex]).to.equal(kTDStatusOK);
+        });
+
+        afterEach(^{
+            view = nil;
+            ds = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"match reducing the map rows once built", ^{
+            NSArray *results = reducedQueries(view);
+            expect(results[0]).to.equal(@[ @{ @"key" : [NSNull null], @"value" : @40 } ]);
+            expect(results[2]).to.haveCountOf(pets.count);
+        });
+
+        it(@"match reducing the map rows after keys are added", ^{
+            createDocuments(40, 23);  // more rows for existing keys, then a new key
+            CDTMutableDocumentRevision *rev = [CDTMutableDocumentRevision revision];
+            rev.body = @{ @"pet" : @"hamster", @"age" : @7 };
+            [ds createDocumentFromRevision:rev error:nil];
+            expect([view updateIndex]).to.equal(kTDStatusOK);
+
+            NSArray *results = reducedQueries(view);
+            expect(results[0]).to.equal(@[ @{ @"key" : [NSNull null], @"value" : @64 } ]);
+            expect(results[2]).to.haveCountOf(pets.count + 1);
+        });
+
+        it(@"match reducing the map rows after keys are removed", ^{
+            // Every parrot leaves, so its keys lose all their rows; other keys lose some.
+            for (int i = 0; i < 40; i++) {
+                NSString *docId = [NSString stringWithFormat:@"doc-%03d", i];
+                if ([pets[i % pets.count] isEqualToString:@"parrot"]) {
+                    [ds deleteDocumentWithId:docId error:nil];
+                } else if (i % 3 == 0) {
+                    CDTMutableDocumentRevision *rev =
+                        [[ds getDocumentWithId:docId error:nil] mutableCopy];
+                    rev.body = @{ @"pet" : @"dog", @"age" : @9 };
+                    [ds updateDocumentFromRevision:rev error:nil];
+                }
+            }
+            expect([view updateIndex]).to.equal(kTDStatusOK);
+
+            NSArray *results = reducedQueries(view);
+            expect(results[0]).to.equal(@[ @{ @"key" : [NSNull null], @"value" : @30 } ]);
+            expect(results[2]).to.haveCountOf(pets.count - 1);
+        });
+
+        it(@"match reducing the map rows after the index is rebuilt", ^{
+            NSArray *before = reducedQueries(view);
+            [view removeIndex];
+            expect([view updateIndex]).to.equal(kTDStatusOK);
+            expect(reducedQueries(view)).to.equal(before);
+
+            // A new version of the view resets its index too:
+            [view setMapBlock:mapBlock reduceBlock:countBlock version:@"2"];
+            expect([view updateIndex]).to.equal(kTDStatusOK);
+            expect(reducedQueries(view)).to.equal(before);
+        });
+
+        it(@"answer grouped queries from the stored rows", ^{
+            TDQueryOptions options = kDefaultTDQueryOptions;
+            options.group = YES;
+            NSArray *rows = query(view, options);
+
+            // Two rows for every pet and age, in the view's collation:
+            expect(rows).to.haveCountOf(20);
+            expect(rows[0]).to.equal((@{ @"key" : @[ @"cat", @0 ], @"value" : @2 }));
+            expect(rows[5]).to.equal((@{ @"key" : @[ @"Cat", @0 ], @"value" : @2 }));
+            expect(rows).to.equal(reduceMapRows(view, options));
+        });
+
+        it(@"are rebuilt when the collation changes", ^{
+            view.collation = kTDViewCollationASCII;
+            expect([view updateIndex]).to.equal(kTDStatusOK);
+            NSArray *results = reducedQueries(view);
+
+            // ASCII collation puts upper case before lower case:
+            expect(results[2][0]).to.equal((@{ @"key" : @[ @"Cat" ], @"value" : @10 }));
+            expect(results[2][1]).to.equal((@{ @"key" : @[ @"cat" ], @"value" : @10 }));
+        });
+
+        describe(@"when migrating from the shared maps table", ^{
+
+            // Returns the database to schema version 201, where the rows of every view were
+            // kept in one maps table and views had no collation column, then reopens it. If
+            // `keepMapTable` is set the view's own map table is left in place, so the migration
+            // fails part way through.
+            BOOL (^downgradeDatabase)(BOOL) = ^BOOL(BOOL keepMapTable) {
+                int viewID = view.viewID;
+                NSString *path = ds.database.path;
+                expect([ds.database close]).to.beTruthy();
+
+                DBQueryUtils *utils = [[DBQueryUtils alloc] initWithDbPath:path];
+                [utils.queue inDatabase:^(FMDatabase *db) {
+                    NSString *dropMapTable =
+                        [NSString stringWithFormat:@"DROP TABLE maps_%d", viewID];
+                    NSMutableArray *statements = [@[
+                        @"CREATE TABLE maps ( "
+                        @"view_id INTEGER NOT NULL REFERENCES views(view_id) ON DELETE CASCADE, "
+                        @"sequence INTEGER NOT NULL REFERENCES revs(sequence) ON DELETE CASCADE, "
+                        @"key TEXT NOT NULL COLLATE JSON, value TEXT, collation_key BLOB)",
+                        @"CREATE INDEX maps_keys on maps(view_id, key COLLATE JSON)",
+                        @"CREATE INDEX maps_collation_keys "
+                        @"ON maps(view_id, collation_key, key COLLATE JSON)",
+                        [NSString stringWithFormat:@"INSERT INTO maps SELECT %d, sequence, key, "
+                                                   @"value, collation_key FROM maps_%d",
+                                                   viewID, viewID],
+                        dropMapTable,
+                        [NSString stringWithFormat:@"DROP TABLE reduces_%d", viewID],
+                        @"CREATE TABLE views_201 (view_id INTEGER PRIMARY KEY, "
+                        @"name TEXT UNIQUE NOT NULL, version TEXT, "
+                        @"lastsequence INTEGER DEFAULT 0)",
+                        @"INSERT INTO views_201 SELECT view_id, name, version, lastsequence "
+                        @"FROM views",
+                        @"DROP TABLE views",
+                        @"ALTER TABLE views_201 RENAME TO views",
+                        @"CREATE INDEX views_by_name ON views(name)",
+                        @"PRAGMA user_version = 201"
+                    ] mutableCopy];
+                    if (keepMapTable) {
+                        [statements removeObject:dropMapTable];
+                    }
+                    for (NSString *sql in statements) {
+                        expect([db executeUpdate:sql]).to.beTruthy();
+                    }
+                }];
+                [utils.queue close];
+
+                return [ds.database
+                    openWithEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+            };
+
+            it(@"keeps each view's rows in a table of its own", ^{
+                NSArray *before = reducedQueries(view);
+                SequenceNumber lastSequence = view.lastSequenceIndexed;
+                expect(downgradeDatabase(NO)).to.beTruthy();
+
+                view = [ds.database viewNamed:@"pets"];
+                [view setMapBlock:mapBlock reduceBlock:countBlock version:@"1"];
+                expect(view.lastSequenceIndexed).to.equal(lastSequence);
+                expect(hasStoredReductions(view)).to.beFalsy();
+
+                // Until the next update, queries reduce the migrated map rows:
+                TDQueryOptions options = kDefaultTDQueryOptions;
+                options.group = YES;
+                expect(query(view, options)).to.equal(before[1]);
+
+                createDocuments(40, 4);
+                expect([view updateIndex]).to.equal(kTDStatusOK);
+                NSArray *after = reducedQueries(view);
+                expect(after[0]).to.equal(@[ @{ @"key" : [NSNull null], @"value" : @44 } ]);
+            });
+
+            it(@"re-indexes views whose collation isn't Unicode", ^{
+                view.collation = kTDViewCollationASCII;
+                expect([view updateIndex]).to.equal(kTDStatusOK);
+                NSArray *before = reducedQueries(view);
+                expect(downgradeDatabase(NO)).to.beTruthy();
+
+                view = [ds.database viewNamed:@"pets"];
+                [view setMapBlock:mapBlock reduceBlock:countBlock version:@"1"];
+                view.collation = kTDViewCollationASCII;
+                expect([view updateIndex]).to.equal(kTDStatusOK);
+                expect(reducedQueries(view)).to.equal(before);
+            });
+
+            it(@"doesn't create the shared maps table in new databases", ^{
+                [ds.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+                    expect([db intForQuery:@"PRAGMA user_version"]).to.equal(202);
+                    expect([db tableExists:@"maps"]).to.beFalsy();
+                }];
+            });
+
+            it(@"leaves the database at version 201 when the migration fails", ^{
+                NSString *path = ds.database.path;
+                expect(downgradeDatabase(YES)).to.beFalsy();
+
+                DBQueryUtils *utils = [[DBQueryUtils alloc] initWithDbPath:path];
+                [utils.queue inDatabase:^(FMDatabase *db) {
+                    expect([db intForQuery:@"PRAGMA user_version"]).to.equal(201);
+                    expect([db tableExists:@"maps"]).to.beTruthy();
+                    expect([db columnExists:@"collation" inTableWithName:@"views"]).to.beFalsy();
+                }];
+                [utils.queue close];
+            });
+        });
+
+        describe(@"when mapping concurrently", ^{
+
+            it(@"indexes and reduces the same rows as mapping serially", ^{
+                createDocuments(40, 300);
+                expect([view updateIndex]).to.equal(kTDStatusOK);
+
+                TD_View *concurrent = [ds.database viewNamed:@"pets-concurrently"];
+                [concurrent setMapBlock:mapBlock reduceBlock:countBlock version:@"1"];
+                concurrent.mapsConcurrently = YES;
+                expect([concurrent updateIndex]).to.equal(kTDStatusOK);
+
+                expect(query(concurrent, kDefaultTDQueryOptions))
+                    .to.equal(query(view, kDefaultTDQueryOptions));
+                expect(reducedQueries(concurrent)).to.equal(reducedQueries(view));
+
+                // And keeps them up to date the same way:
+                createDocuments(340, 70);
+                [ds deleteDocumentWithId:@"doc-001" error:nil];
+                expect([view updateIndex]).to.equal(kTDStatusOK);
+                expect([concurrent updateIndex]).to.equal(kTDStatusOK);
+                expect(reducedQueries(concurrent)).to.equal(reducedQueries(view));
+            });
+        });
+    });
+
+SpecEnd
@@ -146,7 +146,7 @@
       dbVersion = [db intForQuery:@"PRAGMA user_version"];
     }];
 
-    XCTAssertEqual(dbVersion, 200, @"Database version should be 101");
+    XCTAssertEqual(dbVersion, 202, @"Database version should be 202");
 }
 
 - (void)testReopenSucceedsAfterUpdatingDBVersion